@@ -12,6 +12,8 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
+
 #include "src/serialize/serialize.h"
 #include "src/cfg/cfg.h"
 
@@ -247,16 +249,25 @@ void Cfg::recompute_defs_gen_kill() {
 
   // No sense in checking the entry; we'll consider the exit, but it'll be a nop.
   for (auto i = ++reachable_begin(), ie = reachable_end(); i != ie; ++i) {
-    for (auto j = instr_begin(*i), je = instr_end(*i); j != je; ++j) {
-      gen_[*i] |= must_write_set(*j);
-      gen_[*i] -= maybe_undef_set(*j);
+    recompute_defs_gen_kill(*i);
+  }
+}
 
-      kill_[*i] |= maybe_undef_set(*j);
-      kill_[*i] -= maybe_write_set(*j);
-    }
+void Cfg::recompute_defs_gen_kill(id_type id) {
+  gen_[id] = RegSet::empty();
+  kill_[id] = RegSet::empty();
+
+  for (auto j = instr_begin(id), je = instr_end(id); j != je; ++j) {
+    gen_[id] |= must_write_set(*j);
+    gen_[id] -= maybe_undef_set(*j);
+
+    kill_[id] |= maybe_undef_set(*j);
+    kill_[id] -= maybe_write_set(*j);
   }
 }
+
 void Cfg::recompute_defs() {
+  defs_logged_ = false;
   recompute_defs_gen_kill();
 
   // Need a little extra room for def_ins_[get_exit()]
@@ -308,6 +319,102 @@ void Cfg::recompute_defs() {
   }
 }
 
+void Cfg::recompute_defs(initializer_list<size_t> indices) {
+  assert(def_ins_.size() == get_code().size() + 1);
+  assert(def_outs_.size() == num_blocks());
+
+  def_ins_log_.clear();
+  def_outs_log_.clear();
+  gen_kill_log_.clear();
+  defs_logged_ = true;
+
+  // Only the blocks that a changed block can reach may see different values.  The entry
+  // block never changes, since it holds no instructions.
+  defs_region_.resize_for_bits(num_blocks());
+  defs_region_.reset();
+  for (auto idx : indices) {
+    const auto id = get_loc(idx).first;
+    if (!is_reachable(id) || defs_region_[id]) {
+      continue;
+    }
+
+    gen_kill_log_.push_back({id, {gen_[id], kill_[id]}});
+    recompute_defs_gen_kill(id);
+
+    defs_region_[id] = true;
+    block_stack_.push(id);
+  }
+  while (!block_stack_.empty()) {
+    const auto id = block_stack_.top();
+    block_stack_.pop();
+    for (auto s = succ_begin(id), se = succ_end(id); s != se; ++s) {
+      if (is_reachable(*s) && !defs_region_[*s]) {
+        defs_region_[*s] = true;
+        block_stack_.push(*s);
+      }
+    }
+  }
+
+  // Start the region over from the top, so we find the same fixed point recompute_defs() would
+  for (auto i = defs_region_.set_bit_index_begin(), ie = defs_region_.set_bit_index_end(); i != ie; ++i) {
+    def_outs_log_.push_back({*i, def_outs_[*i]});
+    def_outs_[*i] = RegSet::universe();
+
+    // The exit block has no instructions, but its def-ins are still stored
+    for (size_t j = 0, je = std::max(num_instrs(*i), (size_t)1); j < je; ++j) {
+      def_ins_log_.push_back({blocks_[*i] + j, def_ins_[blocks_[*i] + j]});
+    }
+  }
+
+  // Iterate until fixed point; blocks outside the region keep their values
+  for (auto changed = true; changed;) {
+    changed = false;
+
+    for (auto i = defs_region_.set_bit_index_begin(), ie = defs_region_.set_bit_index_end(); i != ie; ++i) {
+      def_ins_[blocks_[*i]] = RegSet::universe();
+      for (auto p = pred_begin(*i), pe = pred_end(*i); p != pe; ++p) {
+        if (is_reachable(*p)) {
+          def_ins_[blocks_[*i]] &= def_outs_[*p];
+        }
+      }
+      const auto new_out = (def_ins_[blocks_[*i]] - kill_[*i]) | gen_[*i];
+
+      changed |= def_outs_[*i] != new_out;
+      def_outs_[*i] = new_out;
+    }
+  }
+
+  for (auto i = defs_region_.set_bit_index_begin(), ie = defs_region_.set_bit_index_end(); i != ie; ++i) {
+    for (size_t j = 1, je = num_instrs(*i); j < je; ++j) {
+      const auto idx = blocks_[*i] + j;
+      def_ins_[idx] = def_ins_[idx - 1];
+
+      const auto& instr = get_code()[idx - 1];
+      def_ins_[idx] |= must_write_set(instr);
+      def_ins_[idx] -= maybe_undef_set(instr);
+    }
+  }
+}
+
+void Cfg::undo_defs() {
+  if (!defs_logged_) {
+    recompute_defs();
+    return;
+  }
+
+  for (const auto& l : def_ins_log_) {
+    def_ins_[l.first] = l.second;
+  }
+  for (const auto& l : def_outs_log_) {
+    def_outs_[l.first] = l.second;
+  }
+  for (const auto& l : gen_kill_log_) {
+    gen_[l.first] = l.second.first;
+    kill_[l.first] = l.second.second;
+  }
+  defs_logged_ = false;
+}
+
 void Cfg::recompute_liveness() {
   recompute_liveness_use_kill();
 
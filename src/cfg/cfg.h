@@ -18,6 +18,7 @@
 #include <cassert>
 #include <stdint.h>
 
+#include <initializer_list>
 #include <map>
 #include <stack>
 #include <sstream>
@@ -80,6 +81,7 @@ public:
   /** Recompute graph structure; modifying control flow will invalidate this state, calling this
     method will restore it. */
   void recompute_structure() {
+    defs_logged_ = false;
     recompute_blocks();
     recompute_labels();
     recompute_succs();
@@ -90,6 +92,14 @@ public:
     this relation, calling this method will restore it. Undefined if graph structure is not up to
     date. */
   void recompute_defs();
+  /** Recomputes the defined-in relation after the instructions at these code indices changed,
+    without changing the graph structure.  Only the blocks that they can reach are revisited, and
+    the values that are overwritten are logged so that undo_defs() can put them back. */
+  void recompute_defs(std::initializer_list<size_t> indices);
+  /** Puts back the values overwritten by the last call to recompute_defs(indices); call it after
+    putting back the instructions.  Falls back on recompute_defs() if anything else has been
+    recomputed since. */
+  void undo_defs();
 
   /** Return a reference to the function underlying this graph. */
   TUnit& get_function() {
@@ -468,6 +478,15 @@ private:
   /** The kill set for each block. */
   std::vector<x64asm::RegSet> kill_;
 
+  /** The blocks revisited by recompute_defs(indices). */
+  cpputil::BitVector defs_region_;
+  /** Values overwritten by the last call to recompute_defs(indices), by index. */
+  std::vector<std::pair<size_t, x64asm::RegSet>> def_ins_log_;
+  std::vector<std::pair<id_type, x64asm::RegSet>> def_outs_log_;
+  std::vector<std::pair<id_type, std::pair<x64asm::RegSet, x64asm::RegSet>>> gen_kill_log_;
+  /** Can undo_defs() use these logs? */
+  bool defs_logged_ = false;
+
   /** The set of registers live out for every instruction. The final element refers to the exit block. */
   std::vector<x64asm::RegSet> live_outs_;
   /** The set of registers live in at each instruction */
@@ -491,6 +510,8 @@ private:
 
   /** Recomputes the gen and kill sets used by recompute_defs(). */
   void recompute_defs_gen_kill();
+  /** Recomputes the gen and kill sets for one block. */
+  void recompute_defs_gen_kill(id_type id);
   /** Recomputes the use and defs set used for liveness */
   void recompute_liveness_use_kill();
   /** Recomputes live_outs_ using the generic LFP dataflow algorithm */
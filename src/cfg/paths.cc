@@ -125,38 +125,42 @@ bool CfgPaths::learn_path(CfgPath& path, const Cfg& cfg, const CpuState& tc, Lab
   sandbox_->insert_function(cfg);
   sandbox_->set_entrypoint(label);
 
-  /** Insert code either before or after the first instruction in a block to
-   * record the path took */
-  vector<pair<CfgPaths*, Cfg::id_type>*> to_delete;
-  for (size_t i = 0; i < code.size(); ++i) {
-    // figure out if we're at the beginning of a block
-    auto loc = cfg.get_loc(i);
-    auto steps = loc.second;
-    if (steps > 0)
-      continue;
-
-    // build a pair with a pointer to our object and the basic block of this
-    // instruction
-    auto pair = new std::pair<CfgPaths*, Cfg::id_type>(this, loc.first);
-    to_delete.push_back(pair);
-
-    // insert callback after labels (so jumps don't skip them), but before
-    // returns and everything else (so if segfault or exit we still get
-    // called).
-    auto instr = code[i];
-    if (instr.is_label_defn()) {
-      sandbox_->insert_after(label, i, learn_path_callback, pair);
-    } else {
-      sandbox_->insert_before(label, i, learn_path_callback, pair);
+  /** Record the block id either before or after the first instruction in a
+   * block.  Paths through loops can be long; if the trace buffer wraps, grow
+   * it and run again. */
+  size_t capacity = 1024;
+  while (true) {
+    TraceBuffer trace(RegSet::empty(), capacity);
+    for (size_t i = 0; i < code.size(); ++i) {
+      // figure out if we're at the beginning of a block
+      auto loc = cfg.get_loc(i);
+      auto steps = loc.second;
+      if (steps > 0)
+        continue;
+
+      // insert trace point after labels (so jumps don't skip them), but before
+      // returns and everything else (so if segfault or exit we still get
+      // called).
+      auto instr = code[i];
+      if (instr.is_label_defn()) {
+        sandbox_->insert_trace_after(label, i, &trace, loc.first);
+      } else {
+        sandbox_->insert_trace_before(label, i, &trace, loc.first);
+      }
     }
-  }
 
-  // Now learn the path!
-  current_path_ = &path;
-  sandbox_->run();
+    // Now learn the path!
+    sandbox_->run();
+    sandbox_->clear_callbacks();
 
-  for (auto it : to_delete)
-    delete it;
+    if (trace.dropped() == 0) {
+      for (size_t i = 0, ie = trace.size(); i < ie; ++i) {
+        path.push_back(trace.get_tag(i));
+      }
+      break;
+    }
+    capacity *= 2;
+  }
 
   auto err = sandbox_->get_output(0)->code;
 
@@ -178,17 +182,6 @@ bool CfgPaths::is_prefix(const CfgPath& p, const CfgPath& q) {
   return true;
 }
 
-/** Callback used for learning a path. */
-void CfgPaths::learn_path_callback(const StateCallbackData&, void* arg) {
-
-  auto pair = (std::pair<CfgPaths*, Cfg::id_type>*)arg;
-
-  auto bb = pair->second;
-  pair->first->current_path_->push_back(bb);
-
-
-}
-
 namespace std {
 
 ostream& operator<<(ostream& os, const stoke::CfgPath& path) {
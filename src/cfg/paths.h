@@ -64,9 +64,6 @@ public:
     passed in the 'path' variable. */
   bool learn_path(CfgPath& path, const Cfg& cfg, const CpuState& tc, x64asm::Label* lbl = NULL);
 
-  /** Callback used for learning a path. */
-  static void learn_path_callback(const StateCallbackData&, void*);
-
   // Remove all blocks with zero instructions
   static void removeZeroInstrs(Cfg& cfg, CfgPath& path) {
     for (auto iter = path.begin(); iter != path.end(); ) {
@@ -84,7 +81,6 @@ private:
 
   /** Used for path learning. */
   Sandbox* sandbox_;
-  CfgPath* current_path_;
 
   static void cleanup_path(CfgPath& p);
 
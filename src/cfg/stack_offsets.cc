@@ -0,0 +1,152 @@
+// Copyright 2013-2019 Stanford University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "src/cfg/stack_offsets.h"
+
+using namespace std;
+using namespace stoke;
+using namespace x64asm;
+
+void CfgStackOffsets::recompute() {
+
+  // Start clean
+  const auto& code = cfg_.get_code();
+  known_.assign(code.size(), false);
+  offsets_.assign(code.size(), 0);
+
+  // Each block is either unvisited, entered with a single known offset, or
+  // entered with an offset that can't be determined.  Blocks only ever move
+  // up that order, so each one is visited at most three times.
+  enum { UNSEEN, KNOWN, UNKNOWN };
+  vector<int> state(cfg_.num_blocks(), UNSEEN);
+  vector<int64_t> in(cfg_.num_blocks(), 0);
+
+  const auto entry = cfg_.get_entry();
+  state[entry] = KNOWN;
+  vector<Cfg::id_type> work = {entry};
+
+  while (!work.empty()) {
+    const auto b = work.back();
+    work.pop_back();
+
+    auto known = state[b] == KNOWN;
+    auto offset = in[b];
+
+    const auto size = cfg_.num_instrs(b);
+    const auto begin = size == 0 ? 0 : cfg_.get_index(Cfg::loc_type(b, 0));
+    for (auto i = begin, ie = begin + size; i < ie; ++i) {
+      known_[i] = known;
+      offsets_[i] = offset;
+      if (known) {
+        known = transfer(code[i], offset);
+      }
+    }
+
+    for (auto s = cfg_.succ_begin(b), se = cfg_.succ_end(b); s != se; ++s) {
+      const auto old = state[*s];
+      if (old == UNSEEN) {
+        state[*s] = known ? KNOWN : UNKNOWN;
+        in[*s] = offset;
+      } else if (old == KNOWN && (!known || in[*s] != offset)) {
+        state[*s] = UNKNOWN;
+      }
+      if (state[*s] != old) {
+        work.push_back(*s);
+      }
+    }
+  }
+}
+
+bool CfgStackOffsets::transfer(const Instruction& instr, int64_t& offset) {
+
+  switch (instr.get_opcode()) {
+  case PUSH_R64:
+  case PUSH_R64_1:
+  case PUSH_M64:
+  case PUSHQ_IMM8:
+  case PUSHQ_IMM16:
+  case PUSHQ_IMM32:
+  case PUSHFQ:
+    offset -= 8;
+    return true;
+  case PUSH_R16:
+  case PUSH_R16_1:
+  case PUSH_M16:
+  case PUSHW_IMM8:
+  case PUSHW_IMM16:
+  case PUSHF:
+    offset -= 2;
+    return true;
+
+  case POP_R64:
+  case POP_R64_1:
+    if (instr.get_operand<R64>(0) == rsp) {
+      return false;
+    }
+    offset += 8;
+    return true;
+  case POP_R16:
+  case POP_R16_1:
+    if (instr.get_operand<R16>(0) == sp) {
+      return false;
+    }
+    offset += 2;
+    return true;
+  case POP_M64:
+  case POPFQ:
+    offset += 8;
+    return true;
+  case POP_M16:
+  case POPF:
+    offset += 2;
+    return true;
+
+  case ADD_R64_IMM8:
+  case ADD_R64_IMM32:
+  case SUB_R64_IMM8:
+  case SUB_R64_IMM32:
+    if (instr.get_operand<R64>(0) == rsp) {
+      // Both immediate forms are sign extended
+      const auto op = instr.get_opcode();
+      const auto raw = (uint64_t)instr.get_operand<Imm>(1);
+      const auto imm = (op == ADD_R64_IMM8 || op == SUB_R64_IMM8) ? (int64_t)(int8_t)raw : (int64_t)(int32_t)raw;
+      const auto add = op == ADD_R64_IMM8 || op == ADD_R64_IMM32;
+      offset += add ? imm : -imm;
+      return true;
+    }
+    break;
+
+  case LEA_R64_M64:
+    if (instr.get_operand<R64>(0) == rsp) {
+      const auto mem = instr.get_operand<M64>(1);
+      if (mem.contains_base() && mem.get_base() == rsp && !mem.contains_index() &&
+          !mem.contains_seg() && !mem.rip_offset() && !mem.addr_or()) {
+        offset += (int32_t)mem.get_disp();
+        return true;
+      }
+      return false;
+    }
+    break;
+
+  default:
+    break;
+  }
+
+  // Control leaves this function, or %rsp is clobbered in some other way
+  if (instr.is_any_call() || instr.is_any_return()) {
+    return false;
+  }
+  return !instr.maybe_write_set().contains(spl);
+}
@@ -0,0 +1,72 @@
+// Copyright 2013-2019 Stanford University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef STOKE_SRC_CFG_STACK_OFFSETS_H
+#define STOKE_SRC_CFG_STACK_OFFSETS_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "src/ext/x64asm/include/x64asm.h"
+
+#include "src/cfg/cfg.h"
+
+namespace stoke {
+
+/** A view over CFGs for tracking the value of %rsp relative to its value on
+  entry to the function.  An offset is known before an instruction only if
+  every path from the entry agrees on it.  Pushes, pops and adjustments of
+  %rsp by a constant are tracked; calls, returns and any other write to %rsp
+  make the offset unknown. */
+class CfgStackOffsets {
+public:
+
+  CfgStackOffsets(const Cfg& cfg) : cfg_(cfg) {
+    recompute();
+  }
+
+  /** Recompute the offsets.  Useful if you update the CFG. */
+  void recompute();
+
+  /** Is the offset of %rsp known before the instruction at this index? */
+  bool is_known(size_t idx) const {
+    assert(idx < known_.size());
+    return known_[idx];
+  }
+  /** Returns the offset of %rsp before the instruction at this index. */
+  int64_t get_offset(size_t idx) const {
+    assert(is_known(idx));
+    return offsets_[idx];
+  }
+
+  /** Updates offset to account for the effect of instr on %rsp.  Returns
+    false if the offset after instr can't be determined. */
+  static bool transfer(const x64asm::Instruction& instr, int64_t& offset);
+
+private:
+
+  /** Whether the offset is known before each instruction */
+  std::vector<bool> known_;
+  /** The offset before each instruction */
+  std::vector<int64_t> offsets_;
+
+  /** The CFG */
+  const Cfg& cfg_;
+
+};
+
+} // namespace stoke
+
+#endif
@@ -25,6 +25,57 @@ using namespace cpputil;
 using namespace std;
 using namespace x64asm;
 
+namespace {
+
+/** Where a general purpose register lives in a CpuState. */
+void gp_slot(const R& r, size_t& idx, size_t& width, size_t& start) {
+  idx = r;
+  width = r.size();
+  start = 0;
+  if (r.type() == Type::RH) {
+    idx -= 4;
+    start = 8;
+  }
+}
+
+/** Reads the ith lane of an sse register. */
+uint64_t get_lane(const BitVector& bv, size_t width, size_t i) {
+  switch (width) {
+  case 1:
+    return bv.get_fixed_byte(i);
+  case 2:
+    return bv.get_fixed_word(i);
+  case 4:
+    return bv.get_fixed_double(i);
+  case 8:
+    return bv.get_fixed_quad(i);
+  default:
+    assert(false);
+    return 0;
+  }
+}
+
+/** Builds a table that expands 8 valid bits into a mask of 8 valid bytes. */
+array<uint64_t, 256> build_byte_masks() {
+  array<uint64_t, 256> table;
+  for (size_t i = 0; i < 256; ++i) {
+    table[i] = 0;
+    for (size_t b = 0; b < 8; ++b) {
+      if (i & (1 << b)) {
+        table[i] |= (uint64_t)0xff << (8*b);
+      }
+    }
+  }
+  return table;
+}
+
+/** Expands 8 valid bits into a mask of 8 valid bytes. */
+uint64_t byte_mask(uint8_t valid) {
+  static const auto table = build_byte_masks();
+  return table[valid];
+}
+
+} // namespace
 
 namespace stoke {
 
@@ -44,6 +95,12 @@ CorrectnessCost& CorrectnessCost::set_target(const Cfg& target, bool stack_out,
   for (auto i = test_sandbox_->result_begin(), ie = test_sandbox_->result_end(); i != ie; ++i) {
     reference_out_.push_back(*i);
   }
+
+  order_.clear();
+  for (size_t i = 0, ie = reference_out_.size(); i < ie; ++i) {
+    order_.push_back(i);
+  }
+  limit_ = order_.size();
   return *this;
 }
 
@@ -70,11 +127,98 @@ void CorrectnessCost::recompute_target_defs(const RegSet& rs) {
   }
 }
 
+void CorrectnessCost::recompute_rewrite_layout(const RegSet& defs) {
+
+  gp_targets_.clear();
+  gp_candidates_.clear();
+  for (const auto& r_t : target_gp_out_) {
+    auto size = r_t.size();
+    auto is_t_rh = (r_t).type() == Type::RH;
+
+    GpTarget gt;
+    gp_slot(r_t, gt.slot.idx, gt.slot.width, gt.slot.start);
+    gt.undef = undef_default(size/8);
+    gt.begin = gp_candidates_.size();
+
+    for (auto r_r = defs.gp_begin(), r_re = defs.gp_end(); r_r != r_re; ++r_r) {
+      if (r_t != *r_r && !relax_reg_) {
+        continue;
+      }
+      if ((*r_r).size() < size) {
+        continue;
+      }
+
+      GpCandidate c;
+      bool is_same = false;
+      auto is_r_rh = (*r_r).type() == Type::RH;
+      if (!is_t_rh && !is_r_rh) {
+        // normal case, we are looking at two non-rh registers
+        c.slot = {(size_t)*r_r, size, 0};
+        is_same = ((uint64_t)r_t) == ((uint64_t)*r_r);
+      } else if (is_t_rh && is_r_rh) {
+        // we are comparing two rh registers, also simple
+        gp_slot(*r_r, c.slot.idx, c.slot.width, c.slot.start);
+        is_same = r_t == *r_r;
+      } else if (is_t_rh) {
+        // t is an rh register, but r is not:
+
+        // make sure that there is a corresponding rh register, and that it's defined
+        if ((*r_r).size() < 16 || *r_r >= 4) {
+          continue;
+        }
+        // get rh register that corresponds to r
+        auto rh = Constants::rhs()[*r_r];
+        is_same = rh == r_t;
+        gp_slot(rh, c.slot.idx, c.slot.width, c.slot.start);
+      } else {
+        // r is an rh register, but t is not, so no match
+        assert(is_r_rh);
+        continue;
+      }
+      c.penalty = is_same ? 0 : misalign_penalty_;
+
+      // Try the same register first; it's the one most likely to match exactly
+      gp_candidates_.push_back(c);
+      if (is_same) {
+        std::swap(gp_candidates_[gt.begin], gp_candidates_.back());
+      }
+    }
+
+    gt.end = gp_candidates_.size();
+    gp_targets_.push_back(gt);
+  }
+
+  sse_begin_.clear();
+  sse_candidates_.clear();
+  for (const auto& s_t : target_sse_out_) {
+    const auto begin = sse_candidates_.size();
+    sse_begin_.push_back(begin);
+
+    for (auto s_r = defs.any_sub_sse_begin(), s_re = defs.any_sub_sse_end(); s_r != s_re; ++s_r) {
+      if (s_t != *s_r && !relax_reg_) {
+        continue;
+      }
+      const auto is_same = s_t == *s_r;
+      sse_candidates_.push_back({(size_t)*s_r, is_same ? 0 : misalign_penalty_});
+      if (is_same) {
+        std::swap(sse_candidates_[begin], sse_candidates_.back());
+      }
+    }
+  }
+  sse_begin_.push_back(sse_candidates_.size());
+}
+
 /** Evaluate a rewrite. This method may shortcircuit and return max as soon as its
   result would equal or exceed that value. */
 CorrectnessCost::result_type CorrectnessCost::operator()(const Cfg& cfg, const Cost max) {
 
-  run_test_sandbox(cfg);
+  // When fused, testcases are run as they're needed
+  if (fuses_test_sandbox()) {
+    test_sandbox_->insert_function(cfg);
+    test_sandbox_->set_entrypoint(cfg.get_code()[0].get_operand<x64asm::Label>(0));
+  } else {
+    run_test_sandbox(cfg);
+  }
 
   auto cost = evaluate_correctness(cfg, max);
   bool correct = cost == 0;
@@ -83,24 +227,49 @@ CorrectnessCost::result_type CorrectnessCost::operator()(const Cfg& cfg, const C
 
 Cost CorrectnessCost::evaluate_correctness(const Cfg& cfg, const Cost max) {
 
+  // Which registers to compare only depends on the rewrite, not the testcase
+  const auto defs = cfg.def_outs();
+  recompute_rewrite_layout(defs);
+
+  Cost res = 0;
   switch (reduction_) {
   case Reduction::MAX:
-    return max_correctness(cfg, max);
+    res = max_correctness(defs, max);
+    break;
   case Reduction::SUM:
-    return sum_correctness(cfg, max);
+    res = sum_correctness(defs, max);
+    break;
   default:
     assert(false);
-    return 0;
+    break;
+  }
+
+  // The next rewrite is most likely to fail where this one did
+  if (fused_ && counter_example_testcase_ >= 0) {
+    const auto itr = find(order_.begin(), order_.end(), (size_t)counter_example_testcase_);
+    assert(itr != order_.end());
+    rotate(order_.begin(), itr, itr + 1);
+  }
+
+  return res;
+}
+
+size_t CorrectnessCost::run_testcase(size_t i) {
+  assert(i < limit_);
+  const auto idx = order_[i];
+  if (fuses_test_sandbox()) {
+    test_sandbox_->run(idx);
   }
+  return idx;
 }
 
-Cost CorrectnessCost::max_correctness(const Cfg& cfg, const Cost max) {
+Cost CorrectnessCost::max_correctness(const RegSet& defs, const Cost max) {
   Cost res = 0;
   counter_example_testcase_ = -1;
 
-  size_t i = 0;
-  for (size_t ie = test_sandbox_->size(); res < max && i < ie; ++i) {
-    const auto err = evaluate_error(reference_out_[i], *(test_sandbox_->get_result(i)), cfg.def_outs());
+  for (size_t j = 0; res < max && j < limit_; ++j) {
+    const auto i = run_testcase(j);
+    const auto err = evaluate_error(reference_out_[i], *(test_sandbox_->get_result(i)), defs, max);
     assert(err <= max_testcase_cost);
     if (err != 0 && counter_example_testcase_ < 0) {
       counter_example_testcase_ = i;
@@ -113,13 +282,13 @@ Cost CorrectnessCost::max_correctness(const Cfg& cfg, const Cost max) {
   return res;
 }
 
-Cost CorrectnessCost::sum_correctness(const Cfg& cfg, const Cost max) {
+Cost CorrectnessCost::sum_correctness(const RegSet& defs, const Cost max) {
   Cost res = 0;
   counter_example_testcase_ = -1;
 
-  size_t i = 0;
-  for (size_t ie = test_sandbox_->size(); res < max && i < ie; ++i) {
-    const auto err = evaluate_error(reference_out_[i], *(test_sandbox_->get_result(i)), cfg.def_outs());
+  for (size_t j = 0; res < max && j < limit_; ++j) {
+    const auto i = run_testcase(j);
+    const auto err = evaluate_error(reference_out_[i], *(test_sandbox_->get_result(i)), defs, max - res);
     assert(err <= max_testcase_cost);
     if (err != 0 && counter_example_testcase_ < 0) {
       counter_example_testcase_ = i;
@@ -132,7 +301,7 @@ Cost CorrectnessCost::sum_correctness(const Cfg& cfg, const Cost max) {
   return res;
 }
 
-Cost CorrectnessCost::evaluate_error(const CpuState& t, const CpuState& r, const RegSet& defs) const {
+Cost CorrectnessCost::evaluate_error(const CpuState& t, const CpuState& r, const RegSet& defs, Cost budget) const {
   // Only assess a signal penalty if target and rewrite disagree
   if (t.code != r.code) {
     return sig_penalty_;
@@ -144,16 +313,20 @@ Cost CorrectnessCost::evaluate_error(const CpuState& t, const CpuState& r, const
     return 0;
   }
 
-  // Otherwise, we can do the usual thing and check results register by register
-  Cost cost = 0;
-  cost += gp_error(t, r, defs);
-  cost += sse_error(t.sse, r.sse, defs);
-  cost += rflags_error(t.rf, r.rf, defs);
-  if (stack_out_) {
-    cost += mem_error(t.stack, r.stack);
+  // Otherwise, we can do the usual thing and check results register by register;
+  // cheap checks go first so that we can stop as soon as we're over budget
+  Cost cost = rflags_error(t.rf, r.rf, defs);
+  if (cost < budget) {
+    cost += gp_error(t, r, budget - cost);
   }
-  if (heap_out_) {
-    cost += block_heap_ ? block_mem_error(t.heap, r.heap, r.sse, defs) : mem_error(t.heap, r.heap);
+  if (cost < budget) {
+    cost += sse_error(t.sse, r.sse, budget - cost);
+  }
+  if (stack_out_ && cost < budget) {
+    cost += mem_error(t.stack, r.stack, budget - cost);
+  }
+  if (heap_out_ && cost < budget) {
+    cost += block_heap_ ? block_mem_error(t.heap, r.heap, r.sse, defs, budget - cost) : mem_error(t.heap, r.heap, budget - cost);
   }
 
   return cost;
@@ -161,144 +334,108 @@ Cost CorrectnessCost::evaluate_error(const CpuState& t, const CpuState& r, const
 
 
 
-Cost CorrectnessCost::gp_error(const CpuState& t, const CpuState& r, const RegSet& defs) const {
+Cost CorrectnessCost::gp_error(const CpuState& t, const CpuState& r, Cost budget) const {
   Cost cost = 0;
 
-  for (const auto& r_t : target_gp_out_) {
-    auto size = r_t.size();
-    auto bytes = size/8;
-    auto delta = undef_default(bytes);
-    const auto val_t = t[r_t];
-    auto is_t_rh = (r_t).type() == Type::RH;
-
-    for (auto r_r = defs.gp_begin(), r_re = defs.gp_end(); r_r != r_re; ++r_r) {
-      if (r_t != *r_r && !relax_reg_) {
-        continue;
-      }
-      if ((*r_r).size() < size) {
-        continue;
-      }
-
-      uint64_t val_r;
-      bool is_same = false;
-      auto is_r_rh = (*r_r).type() == Type::RH;
-      if (!is_t_rh && !is_r_rh) {
-        // normal case, we are looking at two non-rh registers
-        val_r = r.read_gp(*r_r, size, 0);
-        is_same = ((uint64_t)r_t) == ((uint64_t)*r_r);
-      } else if (is_t_rh && is_r_rh) {
-        // we are comparing two rh registers, also simple
-        val_r = r[*r_r];
-        is_same = r_t == *r_r;
-      } else if (is_t_rh) {
-        // t is an rh register, but r is not:
-
-        // make sure that there is a corresponding rh register, and that it's defined
-        if ((*r_r).size() < 16 || *r_r >= 4) {
-          continue;
-        }
-        // get rh register that corresponds to r
-        auto rh = Constants::rhs()[*r_r];
-        is_same = rh == r_t;
-        val_r = r[rh];
-      } else {
-        // r is an rh register, but t is not, so no match
-        assert(is_r_rh);
-        continue;
-      }
-
-      const auto eval = evaluate_distance(val_t, val_r) + (is_same ? 0 : misalign_penalty_);
+  for (const auto& gt : gp_targets_) {
+    const auto val_t = t.read_gp(gt.slot.idx, gt.slot.width, gt.slot.start);
 
+    auto delta = gt.undef;
+    for (size_t i = gt.begin; i < gt.end && delta > 0; ++i) {
+      const auto& c = gp_candidates_[i];
+      const auto val_r = r.read_gp(c.slot.idx, c.slot.width, c.slot.start);
+      const auto eval = evaluate_distance(val_t, val_r) + c.penalty;
       delta = min(delta, eval);
     }
+
     cost += delta;
+    if (cost >= budget) {
+      break;
+    }
   }
 
   return cost;
 }
 
-Cost CorrectnessCost::sse_error(const Regs& t, const Regs& r, const RegSet& defs) const {
+Cost CorrectnessCost::sse_error(const Regs& t, const Regs& r, Cost budget) const {
   Cost cost = 0;
+  const auto undef = undef_default(sse_width_);
 
   for (size_t i = 0; i < sse_count_; ++i) {
-    for (const auto& s_t : target_sse_out_) {
-      auto delta = undef_default(sse_width_);
-      uint64_t val_t = 0;
-      switch (sse_width_) {
-      case 1:
-        val_t = t[s_t].get_fixed_byte(i);
-        break;
-      case 2:
-        val_t = t[s_t].get_fixed_word(i);
-        break;
-      case 4:
-        val_t = t[s_t].get_fixed_double(i);
-        break;
-      case 8:
-        val_t = t[s_t].get_fixed_quad(i);
-        break;
-      default:
-        assert(false);
-        break;
-      }
-
-      for (auto s_r = defs.any_sub_sse_begin(), s_re = defs.any_sub_sse_end(); s_r != s_re; ++s_r) {
-        if (s_t != *s_r && !relax_reg_) {
-          continue;
-        }
-
-        uint64_t val_r = 0;
-        switch (sse_width_) {
-        case 1:
-          val_r = r[*s_r].get_fixed_byte(i);
-          break;
-        case 2:
-          val_r = r[*s_r].get_fixed_word(i);
-          break;
-        case 4:
-          val_r = r[*s_r].get_fixed_double(i);
-          break;
-        case 8:
-          val_r = r[*s_r].get_fixed_quad(i);
-          break;
-        default:
-          assert(false);
-          break;
-        }
-
-        const auto eval = evaluate_distance(val_t, val_r) + ((s_t == *s_r) ? 0 : misalign_penalty_);
+    for (size_t j = 0, je = target_sse_out_.size(); j < je; ++j) {
+      const auto val_t = get_lane(t[target_sse_out_[j]], sse_width_, i);
+
+      auto delta = undef;
+      for (size_t k = sse_begin_[j], ke = sse_begin_[j+1]; k < ke && delta > 0; ++k) {
+        const auto& c = sse_candidates_[k];
+        const auto val_r = get_lane(r[c.idx], sse_width_, i);
+        const auto eval = evaluate_distance(val_t, val_r) + c.penalty;
         delta = min(delta, eval);
       }
+
       cost += delta;
+      if (cost >= budget) {
+        return cost;
+      }
     }
   }
 
   return cost;
 }
 
-Cost CorrectnessCost::mem_error(const Memory& t, const Memory& r) const {
+Cost CorrectnessCost::mem_error(const Memory& t, const Memory& r, Cost budget) const {
   Cost cost = 0;
 
-  for (auto i = t.valid_begin(), ie = t.valid_end(); i != ie; ++i) {
-    if (relax_mem_) {
+  if (relax_mem_) {
+    for (auto i = t.valid_begin(), ie = t.valid_end(); i != ie && cost < budget; ++i) {
       Cost delta = undef_default(1);
       for (auto j = r.valid_begin(), je = r.valid_end(); j != je; ++j) {
         const auto eval = evaluate_distance(t[*i], r[*j]) + (*i == *j ? 0 : misalign_penalty_);
         delta = min(delta, eval);
       }
       cost += delta;
+    }
+    return cost;
+  }
+
+  // Target and rewrite ran on the same testcase, so their memories line up;
+  // compare a quad at a time, masking off invalid bytes
+  assert(t.lower_bound() == r.lower_bound());
+  assert(t.num_quads() == r.num_quads());
+
+  for (size_t q = 0, qe = t.num_quads(); q < qe; ++q) {
+    const auto valid = t.get_valid_byte(q);
+    if (valid == 0) {
+      continue;
+    }
+    const auto mask = byte_mask(valid);
+    const auto val_t = t.get_fixed_quad(q) & mask;
+    const auto val_r = r.get_fixed_quad(q) & mask;
+    if (val_t == val_r) {
+      continue;
+    }
+
+    if (distance_ == Distance::HAMMING) {
+      cost += hamming_distance(val_t, val_r);
     } else {
-      cost += evaluate_distance(t[*i], r[*i]);
+      for (size_t b = 0; b < 8; ++b) {
+        if (valid & (1 << b)) {
+          cost += evaluate_distance((val_t >> (8*b)) & 0xff, (val_r >> (8*b)) & 0xff);
+        }
+      }
+    }
+    if (cost >= budget) {
+      break;
     }
   }
 
   return cost;
 }
 
-Cost CorrectnessCost::block_mem_error(const Memory& t, const Memory& rmem, const Regs& rsse, const RegSet& defs) const {
+Cost CorrectnessCost::block_mem_error(const Memory& t, const Memory& rmem, const Regs& rsse, const RegSet& defs, Cost budget) const {
   Cost cost = 0;
 
-  for (size_t i = *t.valid_begin(), ie = t.upper_bound(); i < ie; i += 16) {
+  for (size_t i = *t.valid_begin(), ie = t.upper_bound(); i < ie && cost < budget; i += 16) {
     // Skip invalid blocks
     if (!t.is_valid(i)) {
       assert(!t.is_valid_quad(i));
@@ -18,6 +18,7 @@
 #include <cassert>
 #include <stdint.h>
 
+#include <algorithm>
 #include <vector>
 
 #include "src/ext/cpputil/include/bits/bit_manip.h"
@@ -58,6 +59,7 @@ public:
     set_penalty(0, 0);
     set_min_ulp(0);
     set_reduction(Reduction::SUM);
+    set_fused(false);
   }
 
   /** Reset target function; evaluates testcases and caches the results. */
@@ -96,6 +98,14 @@ public:
     reduction_ = r;
     return *this;
   }
+  /** Run the rewrite on one testcase at a time, comparing each result against
+    the target as soon as it's available.  Testcases that failed recently go
+    first, and evaluation stops once the cost reaches max, so most rejected
+    rewrites only ever run on a testcase or two. */
+  CorrectnessCost& set_fused(bool f) {
+    fused_ = f;
+    return *this;
+  }
 
   /** Evaluate a rewrite. This method may shortcircuit and return max as soon as its
     result would equal or exceed that value. */
@@ -105,6 +115,23 @@ public:
   size_t num_testcases() const {
     return test_sandbox_->size();
   }
+  /** Evaluate testcases in this order.  In fused mode, this is where the
+    latest counter-example is moved to the front. */
+  CorrectnessCost& set_testcase_order(const std::vector<size_t>& order) {
+    assert(order.size() == order_.size());
+    order_ = order;
+    return *this;
+  }
+  /** Evaluate only the first n testcases in order.  Those are run here, as
+    in fused mode, so the others don't have to be. */
+  CorrectnessCost& set_testcase_limit(size_t n) {
+    limit_ = std::min(n, order_.size());
+    return *this;
+  }
+  /** Returns the first testcase the last rewrite got wrong, or -1. */
+  long get_failing_testcase() const {
+    return counter_example_testcase_;
+  }
   /** Returns the ith testcase used in this function's correctness term. */
   const CpuState& get_testcase(size_t i) const {
     assert(i < num_testcases());
@@ -121,6 +148,10 @@ public:
   bool need_test_sandbox() {
     return true;
   }
+  /** In fused mode, or on a subset of testcases, we run it ourselves. */
+  bool fuses_test_sandbox() {
+    return fused_ || limit_ < order_.size();
+  }
 
   /** Just make sure our sandbox is the same as theirs...
       The constructor shouldn't ever be given a different sandbox than the one
@@ -163,12 +194,18 @@ private:
   Cost min_ulp_;
   /** Reduction method. */
   Reduction reduction_;
+  /** Run and compare testcases one at a time? */
+  bool fused_;
 
   /** The results produced by executing the target on testcases. */
   std::vector<CpuState> reference_out_;
 
   /** A test-case (index) that has non-zero cost (or -1). */
   long counter_example_testcase_;
+  /** The order to evaluate testcases in; when fused, the latest counter-example is moved to the front. */
+  std::vector<size_t> order_;
+  /** How many testcases in order_ to evaluate. */
+  size_t limit_;
 
   /** The set of general purpose registers live out for the target. */
   std::vector<x64asm::R> target_gp_out_;
@@ -177,26 +214,62 @@ private:
   /** The set of sse registers live out for the target. */
   std::vector<x64asm::Ymm> target_sse_out_;
 
+  /** Where to find a general purpose value in a CpuState; see CpuState::read_gp(). */
+  struct GpSlot {
+    size_t idx;
+    size_t width;
+    size_t start;
+  };
+  /** A live out register in the target and the range of candidates it's compared against. */
+  struct GpTarget {
+    GpSlot slot;
+    Cost undef;
+    size_t begin;
+    size_t end;
+  };
+  /** A location in the rewrite that a target value may be found in. */
+  struct GpCandidate {
+    GpSlot slot;
+    Cost penalty;
+  };
+  /** An sse register in the rewrite that a target value may be found in. */
+  struct SseCandidate {
+    size_t idx;
+    Cost penalty;
+  };
+
+  /** Target registers and their candidates for the current rewrite. */
+  std::vector<GpTarget> gp_targets_;
+  std::vector<GpCandidate> gp_candidates_;
+  /** Candidates for each sse register in target_sse_out_ are [sse_begin_[i], sse_begin_[i+1]). */
+  std::vector<size_t> sse_begin_;
+  std::vector<SseCandidate> sse_candidates_;
+
   /** Recompute the set of registers that are live out in the target. */
   void recompute_target_defs(const x64asm::RegSet& rs);
+  /** Recompute which rewrite registers each target register is compared against. */
+  void recompute_rewrite_layout(const x64asm::RegSet& defs);
 
   /** Evaluate the correctness term for a rewrite. */
   Cost evaluate_correctness(const Cfg& cfg, const Cost max);
   /** Evaluate correctness by returning the max cost over testcases. */
-  Cost max_correctness(const Cfg& cfg, const Cost max);
+  Cost max_correctness(const x64asm::RegSet& defs, const Cost max);
   /** Evaluate correctness by summing cost over testcases. */
-  Cost sum_correctness(const Cfg& cfg, const Cost max);
+  Cost sum_correctness(const x64asm::RegSet& defs, const Cost max);
+  /** Returns the index of the ith testcase to evaluate, running it first if need be. */
+  size_t run_testcase(size_t i);
 
-  /** Evaluate error between states. */
-  Cost evaluate_error(const CpuState& t, const CpuState& r, const x64asm::RegSet& defs) const;
+  /** Evaluate error between states.  These methods may stop early and return
+    any value at least as large as budget once they reach it. */
+  Cost evaluate_error(const CpuState& t, const CpuState& r, const x64asm::RegSet& defs, Cost budget) const;
   /** Evaluate error between general purpose registers. */
-  Cost gp_error(const CpuState& t, const CpuState& r, const x64asm::RegSet& defs) const;
+  Cost gp_error(const CpuState& t, const CpuState& r, Cost budget) const;
   /** Evaluate error between sse registers. */
-  Cost sse_error(const Regs& t, const Regs& r, const x64asm::RegSet& defs) const;
+  Cost sse_error(const Regs& t, const Regs& r, Cost budget) const;
   /** Evaluate error between memories. */
-  Cost mem_error(const Memory& t, const Memory& r) const;
+  Cost mem_error(const Memory& t, const Memory& r, Cost budget) const;
   /** Evaluate error between memories that are written in 128-bit blocks. */
-  Cost block_mem_error(const Memory& t, const Memory& rmem, const Regs& rsse, const x64asm::RegSet& defs) const;
+  Cost block_mem_error(const Memory& t, const Memory& rmem, const Regs& rsse, const x64asm::RegSet& defs, Cost budget) const;
   /** Evaluate error between rflags. */
   Cost rflags_error(const RFlags& t, const RFlags& r, const x64asm::RegSet& defs) const;
 
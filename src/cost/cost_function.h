@@ -18,6 +18,8 @@
 #include <cassert>
 #include <stdint.h>
 
+#include <vector>
+
 #include "src/cfg/cfg.h"
 #include "src/cost/cost.h"
 #include "src/sandbox/sandbox.h"
@@ -63,6 +65,34 @@ public:
     return false;
   }
 
+  /** Does this CostFunction run the test Sandbox itself, a testcase at a time?
+      Contract for clients:
+
+        If this function returns true, there's no need to run the test sandbox
+        before calling operator(); its outputs may be out of date afterwards.
+   */
+  virtual bool fuses_test_sandbox() {
+    return false;
+  }
+
+  /** The number of testcases this function evaluates; zero if it doesn't use any. */
+  virtual size_t num_testcases() const {
+    return 0;
+  }
+  /** Evaluate testcases in this order, given as a permutation of their indices (optional). */
+  virtual CostFunction& set_testcase_order(const std::vector<size_t>& order) {
+    return *this;
+  }
+  /** Evaluate only the first n testcases in order (optional).  The result is
+    then a lower bound on the cost over all of them. */
+  virtual CostFunction& set_testcase_limit(size_t n) {
+    return *this;
+  }
+  /** The first testcase that the last rewrite evaluated got wrong, or -1 (optional). */
+  virtual long get_failing_testcase() const {
+    return -1;
+  }
+
   /** Does this CostFunction require a performance Sandbox object?
       Contract for clients:
 
@@ -0,0 +1,132 @@
+// Copyright 2013-2019 Stanford University
+//
+// Licensed under the Apache License, Version 2.0 (the License);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an AS IS BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <algorithm>
+#include <cstdio>
+#include <sched.h>
+
+#include "src/cost/cycles.h"
+#include "src/cost/latency.h"
+
+using namespace std;
+
+namespace stoke {
+
+bool CyclesCost::pin() {
+  if (pin_cpu_ < 0 || pin_failed_) {
+    return false;
+  }
+
+  // Say so once, then measure wherever we happen to run
+  if (sched_getaffinity(0, sizeof(unpinned_), &unpinned_)) {
+    perror("cycles cost sched_getaffinity");
+    pin_failed_ = true;
+    return false;
+  }
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(pin_cpu_, &set);
+  if (sched_setaffinity(0, sizeof(set), &set)) {
+    perror("cycles cost sched_setaffinity");
+    pin_failed_ = true;
+    return false;
+  }
+  return true;
+}
+
+void CyclesCost::unpin() {
+  if (sched_setaffinity(0, sizeof(unpinned_), &unpinned_)) {
+    perror("cycles cost sched_setaffinity");
+  }
+}
+
+Cost CyclesCost::quantile(double q) const {
+  assert(!samples_.empty());
+  const auto idx = (size_t)(q * (samples_.size() - 1) + 0.5);
+  return samples_[idx];
+}
+
+CyclesCost::result_type CyclesCost::operator()(const Cfg& cfg, Cost max) {
+  // This also serves as the first warmup run
+  run_perf_sandbox(cfg);
+
+  const auto tc_count = perf_sandbox_->size();
+  if (tc_count == 0) {
+    LatencyCost lc;
+    return lc(cfg, max);
+  }
+
+  // A run that faults stops early; its cycles would make it look fastest of all
+  for (size_t i = 0; i < tc_count; ++i) {
+    if (perf_sandbox_->get_result(i)->code != ErrorCode::NORMAL) {
+      return result_type(true, max);
+    }
+  }
+
+  // Keep every sample on the same core so that caches and frequency stay put
+  const auto pinned = pin();
+  const auto res = measure(max);
+  if (pinned) {
+    unpin();
+  }
+  return res;
+}
+
+CyclesCost::result_type CyclesCost::measure(Cost max) {
+  const auto tc_count = perf_sandbox_->size();
+  const auto overhead = perf_sandbox_->get_cycle_overhead();
+  median_ = 0;
+  iqr_ = 0;
+
+  Cost total = 0;
+  for (size_t i = 0; i < tc_count; ++i) {
+    for (size_t j = 0; j < warmup_; ++j) {
+      perf_sandbox_->run(i);
+    }
+
+    perf_sandbox_->set_count_cycles(true);
+    samples_.clear();
+    for (size_t j = 0; j < runs_; ++j) {
+      perf_sandbox_->run(i);
+      const auto cycles = perf_sandbox_->get_cycles(i);
+      samples_.push_back(cycles > overhead ? cycles - overhead : 0);
+    }
+    perf_sandbox_->set_count_cycles(false);
+    sort(samples_.begin(), samples_.end());
+
+    // Drop samples outside of Tukey's fences (interrupts, migrations, page faults)
+    const auto q1 = quantile(0.25);
+    const auto q3 = quantile(0.75);
+    const auto iqr = q3 - q1;
+    const auto lo = q1 > 3*iqr/2 ? q1 - 3*iqr/2 : 0;
+    const auto hi = q3 + 3*iqr/2;
+    samples_.erase(upper_bound(samples_.begin(), samples_.end(), hi), samples_.end());
+    samples_.erase(samples_.begin(), lower_bound(samples_.begin(), samples_.end(), lo));
+
+    const auto median = quantile(0.5);
+    median_ += median;
+    iqr_ += iqr;
+    total += median;
+
+    // Every remaining testcase can only add to the mean
+    if (total / tc_count >= max) {
+      return result_type(true, max);
+    }
+  }
+
+  return result_type(true, total / tc_count);
+}
+
+} // namespace stoke
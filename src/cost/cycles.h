@@ -0,0 +1,110 @@
+// Copyright 2013-2019 Stanford University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef STOKE_SRC_COST_CYCLES_H
+#define STOKE_SRC_COST_CYCLES_H
+
+#include <sched.h>
+#include <vector>
+
+#include "src/cost/cost_function.h"
+
+namespace stoke {
+
+/** Measures wall-clock cycles by running the rewrite repeatedly in the perf
+  sandbox with fenced reads of the time stamp counter.  Each testcase is
+  warmed up, sampled several times, filtered for outliers and summarized by
+  its median; the cost is the mean of those medians.  Because the code runs
+  through the same JIT and testcase memory as testing, the numbers include
+  the sandbox's memory instrumentation (and any callbacks installed on the
+  perf sandbox), so they are best used to compare rewrites with each other. */
+class CyclesCost : public CostFunction {
+
+public:
+  CyclesCost() {
+    set_runs(15);
+    set_warmup(3);
+    set_pin_cpu(-1);
+    pin_failed_ = false;
+    median_ = 0;
+    iqr_ = 0;
+  }
+
+  /** Set the number of timed runs per testcase. */
+  CyclesCost& set_runs(size_t runs) {
+    assert(runs > 0);
+    runs_ = runs;
+    return *this;
+  }
+  /** Set the number of untimed runs per testcase before sampling begins. */
+  CyclesCost& set_warmup(size_t warmup) {
+    warmup_ = warmup;
+    return *this;
+  }
+  /** Set the cpu to pin this thread to while it takes samples; -1 to leave it alone. */
+  CyclesCost& set_pin_cpu(int cpu) {
+    pin_cpu_ = cpu;
+    return *this;
+  }
+
+  /** Yes, we need to use the sandbox */
+  bool need_perf_sandbox() {
+    return true;
+  }
+
+  /** Measures the mean over testcases of the median cycles per run. */
+  result_type operator()(const Cfg& cfg, Cost max = max_cost);
+
+  /** Returns the sum over testcases of the median cycles from the last evaluation. */
+  Cost get_median() const {
+    return median_;
+  }
+  /** Returns the sum over testcases of the interquartile range from the last evaluation. */
+  Cost get_iqr() const {
+    return iqr_;
+  }
+
+private:
+  /** Number of timed runs per testcase. */
+  size_t runs_;
+  /** Number of warmup runs per testcase. */
+  size_t warmup_;
+  /** Which cpu to pin to (or -1). */
+  int pin_cpu_;
+  /** Did pinning fail once already? */
+  bool pin_failed_;
+  /** The affinity this thread had before it was pinned. */
+  cpu_set_t unpinned_;
+
+  /** Statistics from the last evaluation. */
+  Cost median_;
+  Cost iqr_;
+
+  /** Scratch space for samples; reused between evaluations. */
+  std::vector<Cost> samples_;
+
+  /** Returns the value at quantile q of the sorted samples. */
+  Cost quantile(double q) const;
+
+  /** Pins this thread to pin_cpu_; returns false if it isn't pinned. */
+  bool pin();
+  /** Puts back the affinity this thread had before pin(). */
+  void unpin();
+  /** Takes samples for every testcase, once the rewrite is known to run. */
+  result_type measure(Cost max);
+};
+
+} // namespace stoke
+
+#endif
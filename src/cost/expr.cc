@@ -12,6 +12,9 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
+#include <limits>
+
 #include "src/cost/expr.h"
 
 using namespace stoke;
@@ -36,6 +39,37 @@ ExprCost& ExprCost::setup_perf_sandbox(Sandbox* sb) {
   return *this;
 }
 
+size_t ExprCost::num_testcases() const {
+
+  size_t n = 0;
+  for (auto cf : all_leaf_functions()) {
+    n = max(n, cf->num_testcases());
+  }
+  return n;
+}
+
+ExprCost& ExprCost::set_testcase_order(const vector<size_t>& order) {
+
+  if (!compiled_) {
+    compile();
+  }
+  for (auto cf : leaves_) {
+    cf->set_testcase_order(order);
+  }
+  return *this;
+}
+
+ExprCost& ExprCost::set_testcase_limit(size_t n) {
+
+  if (!compiled_) {
+    compile();
+  }
+  for (auto cf : leaves_) {
+    cf->set_testcase_limit(n);
+  }
+  return *this;
+}
+
 set<CostFunction*> ExprCost::all_leaf_functions() const {
 
   auto leaves = leaf_functions();
@@ -71,84 +105,283 @@ set<CostFunction*> ExprCost::leaf_functions() const {
 
 }
 
-ExprCost::result_type ExprCost::operator()(const Cfg& cfg, Cost max) {
-
-  // Get the full list of leaf functions
-  auto leaves = all_leaf_functions();
+void ExprCost::compile() {
+  // Leaves are numbered in the order they appear in the expression
+  leaves_.clear();
+  map<CostFunction*, size_t> index;
+  cost_prog_.clear();
+  compile(this, cost_prog_, index);
+  correctness_prog_.clear();
+  if (correctness_) {
+    compile(correctness_, correctness_prog_, index);
+  }
 
-  // run the sandbox, if needed
-  if (need_test_sandbox_)
-    run_test_sandbox(cfg);
-  if (need_perf_sandbox_)
-    run_perf_sandbox(cfg);
+  // Leaves that don't touch a sandbox are cheapest; those that read the test
+  // sandbox (i.e. correctness) are usually the most expensive, so they go last
+  const auto rank = [](CostFunction* cf) {
+    return cf->need_test_sandbox() ? 2 : cf->need_perf_sandbox() ? 1 : 0;
+  };
+  auto order = leaves_;
+  stable_sort(order.begin(), order.end(), [&rank](CostFunction* x, CostFunction* y) {
+    return rank(x) < rank(y);
+  });
 
-  // build the environment (i.e. run the actual cost functions)
-  std::map<CostFunction*, Cost> env;
-  for (auto it : leaves) {
-    env[it] = (*it)(cfg, max).second;
+  leaves_ = order;
+  leaf_needs_test_.clear();
+  leaf_needs_perf_.clear();
+  for (size_t i = 0; i < leaves_.size(); ++i) {
+    index[leaves_[i]] = i;
+    leaf_needs_test_.push_back(leaves_[i]->need_test_sandbox());
+    leaf_needs_perf_.push_back(leaves_[i]->need_perf_sandbox());
   }
+  leaf_values_.resize(leaves_.size());
 
-  // compute cost and correctness (i.e. combine the results together)
-  Cost cost = run(env);
-
-  bool correct = true;
+  // Renumber the leaves in the programs to match
+  cost_prog_.clear();
+  compile(this, cost_prog_, index);
+  correctness_prog_.clear();
   if (correctness_) {
-    correct = (correctness_->run(env) != 0);
+    compile(correctness_, correctness_prog_, index);
   }
 
-  return result_type(correct, cost);
+  compiled_ = true;
 }
 
-Cost ExprCost::run(const std::map<CostFunction*, Cost>& env) const {
+void ExprCost::compile(const ExprCost* e, Program& prog, map<CostFunction*, size_t>& index) {
+  if (e->arity_ == 0) {
+    prog.push_back({Instr::CONSTANT, NONE, e->constant_});
+    return;
+  } else if (e->arity_ == 1) {
+    if (!index.count(e->a1_)) {
+      index[e->a1_] = leaves_.size();
+      leaves_.push_back(e->a1_);
+    }
+    prog.push_back({Instr::LEAF, NONE, index[e->a1_]});
+    return;
+  }
 
-  if (arity_ == 0) {
-    return constant_;
-  } else if (arity_ == 1) {
-    assert(a1_);
-    assert(env.count(a1_) > 0);
-    return env.at(a1_);
-  } else if (arity_ == 2) {
-    assert(a1_);
-    assert(a2_);
-    auto c1 = static_cast<ExprCost*>(a1_)->run(env);
-    auto c2 = static_cast<ExprCost*>(a2_)->run(env);
-
-    switch (op_) {
-    case NONE:
-      assert(false);
-    case PLUS:
-      return c1+c2;
-    case MINUS:
-      return c1-c2;
-    case TIMES:
-      return c1*c2;
-    case DIV:
-      return c1/c2;
-    case MOD:
-      return c1%c2;
-    case AND:
-      return c1&c2;
-    case OR:
-      return c1|c2;
-    case SHL:
-      return c1 << c2;
-    case SHR:
-      return c1 >> c2;
-    case LT:
-      return c1 < c2;
-    case LTE:
-      return c1 <= c2;
-    case GT:
-      return c1 > c2;
-    case GTE:
-      return c1 >= c2;
-    case EQ:
-      return c1 == c2;
+  assert(e->arity_ == 2);
+  const auto lhs = prog.size();
+  compile(static_cast<ExprCost*>(e->a1_), prog, index);
+  const auto rhs = prog.size();
+  compile(static_cast<ExprCost*>(e->a2_), prog, index);
+
+  // Both operands are single constants, so we can evaluate this operation now
+  if (rhs == lhs + 1 && prog.size() == rhs + 1 &&
+      prog[lhs].kind == Instr::CONSTANT && prog[rhs].kind == Instr::CONSTANT &&
+      can_fold(e->op_, prog[lhs].value, prog[rhs].value)) {
+    const auto value = apply(e->op_, prog[lhs].value, prog[rhs].value);
+    prog.resize(lhs);
+    prog.push_back({Instr::CONSTANT, NONE, value});
+    return;
+  }
+
+  prog.push_back({Instr::BINOP, e->op_, 0});
+}
+
+ExprCost::Interval ExprCost::eval(const Program& prog) {
+  stack_.clear();
+  for (const auto& instr : prog) {
+    switch (instr.kind) {
+    case Instr::CONSTANT:
+      stack_.push_back(Interval(instr.value, instr.value));
+      break;
+    case Instr::LEAF:
+      stack_.push_back(leaf_values_[instr.value]);
+      break;
+    case Instr::BINOP: {
+      const auto rhs = stack_.back();
+      stack_.pop_back();
+      stack_.back() = apply(instr.op, stack_.back(), rhs);
+      break;
+    }
     default:
       assert(false);
     }
   }
-  assert(false);
+  assert(stack_.size() == 1);
+  return stack_.back();
+}
+
+ExprCost::result_type ExprCost::operator()(const Cfg& cfg, Cost max) {
+
+  if (!compiled_) {
+    compile();
+  }
+
+  // Nothing is known about any of the leaves yet
+  const auto unknown = Interval(0, numeric_limits<Cost>::max());
+  for (auto& v : leaf_values_) {
+    v = unknown;
+  }
+
+  ran_test_sandbox_ = false;
+  ran_perf_sandbox_ = false;
+  failing_testcase_ = -1;
+
+  for (size_t i = 0, ie = leaves_.size(); i < ie; ++i) {
+    // Stop as soon as the leaves evaluated so far guarantee we're over budget;
+    // only the cost saturates, correctness is still reported as it is
+    if (eval(cost_prog_).first >= max) {
+      return result_type(eval_correctness(cfg), max);
+    }
+
+    // A leaf may only stop early if any result it would cut short puts the
+    // whole expression over budget; otherwise it has to produce an exact value
+    leaf_values_[i] = Interval(max, unknown.second);
+    const auto bound = eval(cost_prog_).first >= max ? max : max_cost;
+    eval_leaf(cfg, i, bound);
+  }
+
+  // If a leaf was cut short, its lower bound is enough to put us over budget
+  const auto cost = eval(cost_prog_);
+  if (cost.first != cost.second) {
+    assert(cost.first >= max);
+    return result_type(eval_correctness(cfg), max);
+  }
+
+  return result_type(eval_correctness(cfg), cost.first);
+}
+
+void ExprCost::eval_leaf(const Cfg& cfg, size_t i, Cost bound) {
+  // run the sandbox, if needed (and only once); some leaves run their own
+  if (leaf_needs_test_[i] && !ran_test_sandbox_ && !leaves_[i]->fuses_test_sandbox()) {
+    run_test_sandbox(cfg);
+    ran_test_sandbox_ = true;
+  }
+  if (leaf_needs_perf_[i] && !ran_perf_sandbox_) {
+    run_perf_sandbox(cfg);
+    ran_perf_sandbox_ = true;
+  }
+
+  const auto c = (*leaves_[i])(cfg, bound).second;
+  if (failing_testcase_ < 0) {
+    failing_testcase_ = leaves_[i]->get_failing_testcase();
+  }
+  const auto cut_short = c >= bound && bound < max_cost;
+  leaf_values_[i] = cut_short ? Interval(c, numeric_limits<Cost>::max()) : Interval(c, c);
+}
+
+bool ExprCost::eval_correctness(const Cfg& cfg) {
+  if (!correctness_) {
+    return true;
+  }
+
+  // Leaves skipped because of the budget are first only asked whether they're
+  // zero, which is all "correctness == 0" needs; anything still undecided
+  // after that is evaluated exactly
+  for (auto bound : {(Cost)1, (Cost)max_cost}) {
+    const auto c = eval(correctness_prog_);
+    if (c.first != 0 || c.second == 0) {
+      return c.first != 0;
+    }
+    for (const auto& instr : correctness_prog_) {
+      if (instr.kind != Instr::LEAF) {
+        continue;
+      }
+      const auto& v = leaf_values_[instr.value];
+      if (v.first == v.second || v.first >= bound) {
+        continue;
+      }
+      eval_leaf(cfg, instr.value, bound);
+    }
+  }
+  return eval(correctness_prog_).first != 0;
+}
+
+bool ExprCost::can_fold(Operator op, Cost c1, Cost c2) {
+  switch (op) {
+  case DIV:
+  case MOD:
+    return c2 != 0;
+  case SHL:
+  case SHR:
+    return c2 < 64;
+  default:
+    return true;
+  }
+}
+
+Cost ExprCost::apply(Operator op, Cost c1, Cost c2) {
+  switch (op) {
+  case NONE:
+    assert(false);
+  case PLUS:
+    return c1+c2;
+  case MINUS:
+    return c1-c2;
+  case TIMES:
+    return c1*c2;
+  case DIV:
+    return c1/c2;
+  case MOD:
+    return c1%c2;
+  case AND:
+    return c1&c2;
+  case OR:
+    return c1|c2;
+  case SHL:
+    return c1 << c2;
+  case SHR:
+    return c1 >> c2;
+  case LT:
+    return c1 < c2;
+  case LTE:
+    return c1 <= c2;
+  case GT:
+    return c1 > c2;
+  case GTE:
+    return c1 >= c2;
+  case EQ:
+    return c1 == c2;
+  default:
+    assert(false);
+  }
   return 0;
 }
 
+ExprCost::Interval ExprCost::apply(Operator op, const Interval& i1, const Interval& i2) {
+  if (i1.first == i1.second && i2.first == i2.second) {
+    const auto c = apply(op, i1.first, i2.first);
+    return Interval(c, c);
+  }
+
+  // Costs stay far below the point of overflow; saturating keeps the bounds
+  // sound when an unbounded leaf is involved
+  const auto top = numeric_limits<Cost>::max();
+  const auto sat_add = [top](Cost a, Cost b) {
+    return a > top - b ? top : a + b;
+  };
+  const auto sat_mul = [top](Cost a, Cost b) {
+    return (a != 0 && b > top / a) ? top : a * b;
+  };
+
+  switch (op) {
+  case PLUS:
+    return Interval(sat_add(i1.first, i2.first), sat_add(i1.second, i2.second));
+  case MINUS:
+    if (i1.first >= i2.second) {
+      return Interval(i1.first - i2.second, i1.second - i2.first);
+    }
+    return Interval(0, top);
+  case TIMES:
+    return Interval(sat_mul(i1.first, i2.first), sat_mul(i1.second, i2.second));
+  case DIV:
+    if (i2.first != 0) {
+      return Interval(i1.first / i2.second, i1.second / i2.first);
+    }
+    return Interval(0, top);
+  case LT:
+    return i1.second < i2.first ? Interval(1, 1) : i1.first >= i2.second ? Interval(0, 0) : Interval(0, 1);
+  case LTE:
+    return i1.second <= i2.first ? Interval(1, 1) : i1.first > i2.second ? Interval(0, 0) : Interval(0, 1);
+  case GT:
+    return apply(LT, i2, i1);
+  case GTE:
+    return apply(LTE, i2, i1);
+  case EQ:
+    return (i1.second < i2.first || i2.second < i1.first) ? Interval(0, 0) : Interval(0, 1);
+  default:
+    return Interval(0, top);
+  }
+}
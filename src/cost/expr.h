@@ -18,7 +18,10 @@
 #include "src/cost/cost_function.h"
 #include "gtest/gtest_prod.h"
 
+#include <map>
 #include <set>
+#include <utility>
+#include <vector>
 
 namespace stoke {
 
@@ -31,6 +34,7 @@ class ExprCost : public CostFunction {
   FRIEND_TEST(CostParserTest, LeafFunctions);
   FRIEND_TEST(CostParserTest, NoLeafFunctions);
   FRIEND_TEST(CostParserTest, TwoLeafFunctions);
+  FRIEND_TEST(CostParserTest, ConstantsAreFolded);
 
 public:
 
@@ -79,6 +83,14 @@ public:
   ExprCost(Cost constant) : constant_(constant), arity_(0) {
     reset();
   }
+  /** Deletes subexpressions; leaf cost functions and the correctness term
+    belong to whoever created them. */
+  ~ExprCost() {
+    if (arity_ == 2) {
+      delete a1_;
+      delete a2_;
+    }
+  }
 
   /** Compute the cost of this expression. */
   result_type operator()(const Cfg& cfg, Cost max = max_cost);
@@ -86,6 +98,7 @@ public:
   /** Set the correctness term to another expression. */
   ExprCost& set_correctness(ExprCost* correctness) {
     correctness_ = correctness;
+    compiled_ = false;
     return *this;
   }
 
@@ -101,16 +114,61 @@ public:
   ExprCost& setup_test_sandbox(Sandbox* sb);
   ExprCost& setup_perf_sandbox(Sandbox* sb);
 
+  /** Leaves share a test sandbox, so these apply to all of them alike. */
+  size_t num_testcases() const;
+  ExprCost& set_testcase_order(const std::vector<size_t>& order);
+  ExprCost& set_testcase_limit(size_t n);
+  /** Returns the first failing testcase reported by a leaf evaluated last time, or -1. */
+  long get_failing_testcase() const {
+    return failing_testcase_;
+  }
+
 private:
   /** Called by all constructors. */
   void reset() {
     correctness_ = NULL;
     need_test_sandbox_ = false;
     need_perf_sandbox_ = false;
+    compiled_ = false;
+    failing_testcase_ = -1;
   }
 
-  /** Compute the cost associated with this node. */
-  Cost run(const std::map<CostFunction*, Cost>& environment) const;
+  /** A single step of a compiled expression; operands are taken from a stack. */
+  struct Instr {
+    enum Kind {
+      CONSTANT,
+      LEAF,
+      BINOP
+    } kind;
+    /** The operator (for BINOP). */
+    Operator op;
+    /** The value (for CONSTANT) or index into leaves_ (for LEAF). */
+    Cost value;
+  };
+  /** An expression compiled into postfix order. */
+  typedef std::vector<Instr> Program;
+  /** The range of values that a (partially evaluated) expression may take. */
+  typedef std::pair<Cost, Cost> Interval;
+
+  /** Flattens this expression and its correctness term into programs. */
+  void compile();
+  /** Appends the postfix form of an expression to a program, folding constants. */
+  void compile(const ExprCost* e, Program& prog, std::map<CostFunction*, size_t>& index);
+  /** Evaluates a program over the current leaf values. */
+  Interval eval(const Program& prog);
+  /** Evaluates one leaf with a bound, running sandboxes it needs first, and
+    records what that says about its value. */
+  void eval_leaf(const Cfg& cfg, size_t i, Cost bound);
+  /** Works out the correctness term, evaluating whatever leaves it still
+    needs; only as far as it takes to tell whether the term is zero. */
+  bool eval_correctness(const Cfg& cfg);
+
+  /** Apply an operator to two values. */
+  static Cost apply(Operator op, Cost c1, Cost c2);
+  /** Apply an operator to two ranges of values; the result contains every possible outcome. */
+  static Interval apply(Operator op, const Interval& i1, const Interval& i2);
+  /** Can an operator be applied to these values at compile time? */
+  static bool can_fold(Operator op, Cost c1, Cost c2);
 
   /** Do we need a sandbox? */
   bool need_test_sandbox_;
@@ -135,6 +193,29 @@ private:
   /** Set the correctness term */
   ExprCost* correctness_;
 
+  /** Have the programs below been built? */
+  bool compiled_;
+  /** Leaf functions of this expression and its correctness term, cheapest first. */
+  std::vector<CostFunction*> leaves_;
+  /** Does each leaf need the test or perf sandbox to have been run? */
+  std::vector<bool> leaf_needs_test_;
+  std::vector<bool> leaf_needs_perf_;
+  /** The first failing testcase reported by a leaf during the last evaluation. */
+  long failing_testcase_;
+  /** The compiled cost expression. */
+  Program cost_prog_;
+  /** The compiled correctness term (empty if there isn't one). */
+  Program correctness_prog_;
+
+  // This scratch state is maintained to reduce the overhead of repeated allocations
+
+  /** What is known about each leaf so far. */
+  std::vector<Interval> leaf_values_;
+  /** Operand stack for eval(). */
+  std::vector<Interval> stack_;
+  /** Have the sandboxes been run for the current evaluation? */
+  bool ran_test_sandbox_;
+  bool ran_perf_sandbox_;
 
 
 };
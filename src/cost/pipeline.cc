@@ -0,0 +1,296 @@
+// Copyright 2013-2019 Stanford University
+//
+// Licensed under the Apache License, Version 2.0 (the License);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an AS IS BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <algorithm>
+#include <array>
+#include <string>
+#include <vector>
+
+#include "src/cfg/sccs.h"
+#include "src/cost/pipeline.h"
+#include "src/ext/x64asm/include/x64asm.h"
+
+using namespace std;
+using namespace x64asm;
+
+namespace {
+
+/** The kind of execution unit that a uop needs. */
+enum UopClass {
+  NONE = 0,
+  ALU,
+  SHIFT,
+  MUL,
+  DIV,
+  BRANCH,
+  LEA,
+  LOAD,
+  STORE_ADDR,
+  STORE_DATA,
+  VEC_ALU,
+  VEC_MUL,
+  VEC_SHUF,
+  VEC_DIV,
+  NUM_CLASSES
+};
+
+/** How an opcode decomposes into uops. */
+struct UopInfo {
+  UopClass cls;
+  bool load;
+  bool store;
+};
+
+/** Port masks for each uop class, indexed by Uarch.  Bit i is set if the uop
+  can issue on port i. */
+const array<array<uint8_t, NUM_CLASSES>, 4> ports_ {{
+    // NATIVE (never used; resolved by PipelineCost::set_uarch())
+    {{0}},
+    // NEHALEM
+    {{0x00, 0x23, 0x21, 0x02, 0x01, 0x20, 0x02, 0x04, 0x08, 0x10, 0x23, 0x01, 0x20, 0x01}},
+    // SANDYBRIDGE
+    {{0x00, 0x23, 0x21, 0x02, 0x01, 0x20, 0x22, 0x0c, 0x0c, 0x10, 0x23, 0x01, 0x20, 0x01}},
+    // HASWELL
+    {{0x00, 0x63, 0x41, 0x02, 0x01, 0x41, 0x22, 0x0c, 0x8c, 0x10, 0x23, 0x03, 0x20, 0x01}}
+  }
+};
+
+/** Number of uops that the front end can issue per cycle. */
+constexpr size_t issue_width_ = 4;
+
+bool has_prefix(const string& s, const string& p) {
+  return s.compare(0, p.size(), p) == 0;
+}
+
+bool has_substr(const string& s, const string& p) {
+  return s.find(p) != string::npos;
+}
+
+/** Classify an opcode by its properties and mnemonic. */
+UopInfo classify(Opcode opc) {
+  const Instruction instr(opc);
+  UopInfo info {NONE, instr.maybe_read_memory(), instr.maybe_write_memory()};
+
+  if (instr.is_label_defn() || instr.is_nop()) {
+    info.load = info.store = false;
+    return info;
+  }
+  if (instr.is_any_jump() || instr.is_any_return() || instr.is_any_call()) {
+    info.cls = BRANCH;
+    return info;
+  }
+  if (instr.is_div() || instr.is_idiv()) {
+    info.cls = DIV;
+    return info;
+  }
+  if (instr.is_lea()) {
+    info.cls = LEA;
+    info.load = info.store = false;
+    return info;
+  }
+  // Pushes, pops and moves to or from memory only need load/store units
+  if (instr.is_push() || instr.is_pop()) {
+    return info;
+  }
+
+  const auto text = opcode_write_att(opc);
+  if ((has_prefix(text, "mov") || has_prefix(text, "vmov")) && instr.is_explicit_memory_dereference()) {
+    return info;
+  }
+
+  if (instr.is_sse() || instr.is_avx() || instr.is_avx2()) {
+    if (has_substr(text, "div") || has_substr(text, "sqrt")) {
+      info.cls = VEC_DIV;
+    } else if (has_substr(text, "mul") || has_substr(text, "fma") || has_substr(text, "madd")) {
+      info.cls = VEC_MUL;
+    } else if (has_substr(text, "shuf") || has_substr(text, "unpck") || has_substr(text, "perm") ||
+               has_substr(text, "pack") || has_substr(text, "insert") || has_substr(text, "extract") ||
+               has_substr(text, "broadcast") || has_substr(text, "palignr")) {
+      info.cls = VEC_SHUF;
+    } else {
+      info.cls = VEC_ALU;
+    }
+  } else if (has_prefix(text, "mul") || has_prefix(text, "imul")) {
+    info.cls = MUL;
+  } else if (has_prefix(text, "sa") || has_prefix(text, "shl") || has_prefix(text, "shr") ||
+             has_prefix(text, "ro") || has_prefix(text, "rc")) {
+    info.cls = SHIFT;
+  } else {
+    info.cls = ALU;
+  }
+  return info;
+}
+
+/** Builds the uop decomposition of every opcode. */
+vector<UopInfo> build_uop_table() {
+  vector<UopInfo> table;
+  table.reserve(X64ASM_NUM_OPCODES);
+  for (size_t i = 0; i < X64ASM_NUM_OPCODES; ++i) {
+    table.push_back(classify((Opcode)i));
+  }
+  return table;
+}
+
+/** Returns the uop decomposition of every opcode; built once on first use. */
+const vector<UopInfo>& uop_table() {
+  static const vector<UopInfo> table = build_uop_table();
+  return table;
+}
+
+} // namespace
+
+namespace stoke {
+
+Cost PipelineCost::schedule(const Cfg& cfg, Cfg::id_type b, size_t& uops) {
+  const auto& table = uop_table();
+  const auto& ports = ports_[(size_t)uarch_];
+
+  // Issues a single uop onto the least loaded port that can accept it
+  const auto issue = [this, &ports, &uops](UopClass c, Cost occupancy) {
+    const auto mask = ports[c];
+    size_t best = 0;
+    for (size_t p = 0; p < port_load_.size(); ++p) {
+      if ((mask & (1 << p)) && (!(mask & (1 << best)) || port_load_[p] < port_load_[best])) {
+        best = p;
+      }
+    }
+    port_load_[best] += occupancy;
+    uops++;
+  };
+
+  Cost critical = 0;
+  for (auto i = cfg.instr_begin(b), ie = cfg.instr_end(b); i != ie; ++i) {
+    const auto& info = table[(size_t)i->get_opcode()];
+    if (info.cls == NONE && !info.load && !info.store) {
+      continue;
+    }
+
+    // An instruction can begin once everything it reads is available
+    const auto rs = cfg.maybe_read_set(*i);
+    Cost start = 0;
+    for (size_t r = 0; r < 16; ++r) {
+      if (rs.contains(r8s[r])) {
+        start = std::max(start, gp_ready_[r]);
+      }
+      if (rs.contains(xmms[r])) {
+        start = std::max(start, sse_ready_[r]);
+      }
+    }
+    if (rs.contains(eflags_cf) || rs.contains(eflags_zf) || rs.contains(eflags_sf) ||
+        rs.contains(eflags_of)) {
+      start = std::max(start, flags_ready_);
+    }
+
+    const Cost latency = std::max((Cost)1, (Cost)i->haswell_latency());
+    const Cost done = start + latency;
+
+    const auto ws = cfg.maybe_write_set(*i);
+    for (size_t r = 0; r < 16; ++r) {
+      if (ws.contains(r8s[r])) {
+        gp_ready_[r] = done;
+      }
+      if (ws.contains(xmms[r])) {
+        sse_ready_[r] = done;
+      }
+    }
+    if (ws.contains(eflags_cf) || ws.contains(eflags_zf) || ws.contains(eflags_sf) ||
+        ws.contains(eflags_of)) {
+      flags_ready_ = done;
+    }
+    critical = std::max(critical, done);
+
+    // Dividers are not pipelined; they hold their port for the whole operation
+    if (info.cls != NONE) {
+      issue(info.cls, (info.cls == DIV || info.cls == VEC_DIV) ? latency : 1);
+    }
+    if (info.load) {
+      issue(LOAD, 1);
+    }
+    if (info.store) {
+      issue(STORE_ADDR, 1);
+      issue(STORE_DATA, 1);
+    }
+  }
+
+  return critical;
+}
+
+Cost PipelineCost::block_cost(const Cfg& cfg, Cfg::id_type b, bool in_loop) {
+  gp_ready_.fill(0);
+  sse_ready_.fill(0);
+  flags_ready_ = 0;
+  port_load_.fill(0);
+
+  size_t uops = 0;
+  const auto critical = schedule(cfg, b, uops);
+  const auto port_bound = *std::max_element(port_load_.begin(), port_load_.end());
+  const Cost issue_bound = (uops + issue_width_ - 1) / issue_width_;
+  const auto throughput = std::max(port_bound, issue_bound);
+
+  if (!in_loop) {
+    return std::max(critical, throughput);
+  }
+
+  // In a loop, independent chains overlap across iterations.  What remains is
+  // the latency carried from one iteration into the next, which we measure by
+  // scheduling the block a second time on top of its own results.
+  const auto gp_first = gp_ready_;
+  const auto sse_first = sse_ready_;
+  const auto flags_first = flags_ready_;
+  schedule(cfg, b, uops);
+
+  Cost carried = flags_ready_ - flags_first;
+  for (size_t r = 0; r < 16; ++r) {
+    carried = std::max(carried, gp_ready_[r] - gp_first[r]);
+    carried = std::max(carried, sse_ready_[r] - sse_first[r]);
+  }
+  return std::max(throughput, carried);
+}
+
+PipelineCost::result_type PipelineCost::operator()(const Cfg& cfg, Cost max) {
+  // Blocks are laid out in code order, so only a backwards edge can close a loop
+  bool has_loop = false;
+  for (auto b = cfg.reachable_begin(), be = cfg.reachable_end(); b != be && !has_loop; ++b) {
+    for (auto s = cfg.succ_begin(*b), se = cfg.succ_end(*b); s != se; ++s) {
+      if (*s <= *b) {
+        has_loop = true;
+        break;
+      }
+    }
+  }
+
+  CfgSccs* sccs = has_loop ? new CfgSccs(cfg) : NULL;
+
+  Cost cost = 0;
+  for (auto b = ++cfg.reachable_begin(), be = cfg.reachable_end(); b != be; ++b) {
+    if (cfg.is_exit(*b)) {
+      continue;
+    }
+
+    const auto in_loop = sccs != NULL && sccs->in_scc(*b);
+    const auto block = block_cost(cfg, *b, in_loop);
+    cost += in_loop ? block * nesting_penalty_ : block;
+
+    if (cost >= max) {
+      delete sccs;
+      return result_type(true, max);
+    }
+  }
+
+  delete sccs;
+  return result_type(true, cost);
+}
+
+} // namespace stoke
@@ -0,0 +1,82 @@
+// Copyright 2013-2019 Stanford University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef STOKE_SRC_COST_PIPELINE_H
+#define STOKE_SRC_COST_PIPELINE_H
+
+#include <array>
+
+#include "src/cost/cost_function.h"
+#include "src/target/cpu_info.h"
+
+namespace stoke {
+
+/** A static throughput model.  Each basic block is scheduled onto the
+  execution ports of a microarchitecture; its cost is the largest of its
+  dependency-chain critical path, its most heavily loaded port and its issue
+  bound.  Blocks inside loops are additionally charged for their loop-carried
+  latency and scaled by a nesting penalty. */
+class PipelineCost : public CostFunction {
+
+public:
+  PipelineCost() {
+    set_uarch(Uarch::NATIVE);
+    set_nesting_penalty(5);
+  }
+
+  /** Set the microarchitecture to model; NATIVE queries the host cpu. */
+  PipelineCost& set_uarch(Uarch u) {
+    uarch_ = u == Uarch::NATIVE ? CpuInfo::get_uarch() : u;
+    return *this;
+  }
+  /** Set the multiplier applied to blocks that appear inside of a loop. */
+  PipelineCost& set_nesting_penalty(Cost p) {
+    nesting_penalty_ = p;
+    return *this;
+  }
+
+  /** Returns the microarchitecture being modeled. */
+  Uarch get_uarch() const {
+    return uarch_;
+  }
+
+  result_type operator()(const Cfg& cfg, Cost max = max_cost);
+
+  /** Returns the estimated cycles for one execution of a basic block. */
+  Cost block_cost(const Cfg& cfg, Cfg::id_type b, bool in_loop);
+
+private:
+  /** The modeled microarchitecture. */
+  Uarch uarch_;
+  /** Multiplier for blocks inside of loops. */
+  Cost nesting_penalty_;
+
+  // This scratch state is maintained to reduce the overhead of repeated allocations
+
+  /** Cycle at which each general purpose register becomes available. */
+  std::array<Cost, 16> gp_ready_;
+  /** Cycle at which each sse register becomes available. */
+  std::array<Cost, 16> sse_ready_;
+  /** Cycle at which the status flags become available. */
+  Cost flags_ready_;
+  /** Accumulated occupancy of each execution port. */
+  std::array<Cost, 8> port_load_;
+
+  /** Schedules a block starting from the current ready times; returns the critical path. */
+  Cost schedule(const Cfg& cfg, Cfg::id_type b, size_t& uops);
+};
+
+} // namespace stoke
+
+#endif
@@ -15,12 +15,56 @@
 #ifndef STOKE_SRC_SANDBOX_IO_PAIR_H
 #define STOKE_SRC_SANDBOX_IO_PAIR_H
 
+#include <algorithm>
+#include <vector>
+
 #include "src/ext/x64asm/include/x64asm.h"
 
 #include "src/state/cpu_state.h"
 
 namespace stoke {
 
+/** The pages of one segment of an output state that runs wrote since it was
+  last restored.  The sandbox's address mapping code flags a page and appends
+  it to the list the first time it's written, so restoring costs as much as
+  the run wrote, whatever the size of the segment. */
+struct DirtyPages {
+  static constexpr size_t page_bits = 12;
+
+  /** One per page; nonzero if the page is in the list. */
+  std::vector<uint8_t> flags;
+  /** Pages in the order they were first written. */
+  std::vector<uint64_t> list;
+  /** How many pages are in the list. */
+  uint64_t count;
+  /** Was the segment changed without going through the mapping code? */
+  bool all;
+
+  /** Emitted code holds on to the vectors; they must never be resized. */
+  DirtyPages(const Memory& m) : count(0), all(false) {
+    const auto pages = ((m.num_quads() * 8) >> page_bits) + 1;
+    flags.resize(pages, 0);
+    list.resize(pages, 0);
+  }
+
+  /** Copies the dirty pages from in to out, and forgets them. */
+  void restore(Memory& out, const Memory& in) {
+    if (all) {
+      out.copy(in);
+      std::fill(flags.begin(), flags.end(), 0);
+    } else {
+      const size_t bytes = in.num_quads() * 8;
+      for (size_t i = 0; i < count; ++i) {
+        const size_t begin = list[i] << page_bits;
+        out.copy(in, begin, std::min(begin + ((size_t)1 << page_bits), bytes));
+        flags[list[i]] = 0;
+      }
+    }
+    count = 0;
+    all = false;
+  }
+};
+
 class IoPair {
   /** This class is for use by the sandbox only. */
   friend class Sandbox;
@@ -42,6 +86,21 @@ class IoPair {
   x64asm::Function cpu2out_;
   /** Sandboxes memory accesses for this output state. */
   x64asm::Function map_addr_;
+
+  /** Cycles spent by the most recent timed run (zero if it didn't exit normally). */
+  uint64_t cycles_ = 0;
+
+  /** Dirty pages of the heap, data and other segments of out_, in that order.
+    The stack is always copied in full, since accesses to it that were
+    checked at compile time bypass the mapping code. */
+  std::vector<DirtyPages> dirty_;
+
+  /** Marks every segment as dirty, after out_ changed wholesale. */
+  void set_all_dirty() {
+    for (auto& d : dirty_) {
+      d.all = true;
+    }
+  }
 };
 
 } // namespace stoke
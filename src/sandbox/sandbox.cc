@@ -12,16 +12,24 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
 #include <cassert>
+#include <cstring>
 #include <set>
+#include <sstream>
 #include <setjmp.h>
 #include <signal.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <unistd.h>
 
 #include "src/sandbox/dispatch_table.h"
 #include "src/sandbox/sandbox.h"
 #include "src/serialize/serialize.h"
+#include "src/telemetry/telemetry.h"
 
 #include "ext/stdio_filebuf.h"
 
@@ -38,7 +46,9 @@ set<Opcode> unsupported_ {{
   }
 };
 
-sigjmp_buf buf_;
+// SIGFPE is delivered to the thread that raised it, so sandboxes running on
+// different threads each need their own place to jump back to
+thread_local sigjmp_buf buf_;
 void sigfpe_handler(int signum, siginfo_t* si, void* data) {
   siglongjmp(buf_, 1);
 }
@@ -47,6 +57,93 @@ void callback_wrapper(StateCallback cb, Code* code, size_t line, CpuState* curre
   cb({*code, line, *current}, arg);
 }
 
+/** What the fork server is asked to do: run one input with these settings,
+  after catching up with any code recompiled since the last command. */
+struct ForkServerCommand {
+  uint64_t index;
+  uint64_t max_jumps;
+  bool abi_check;
+  bool count_cycles;
+  /** Functions to recompile first, and the size of their serialized Cfgs,
+    which follow the command on the socket */
+  uint64_t num_recompiled;
+  uint64_t recompiled_bytes;
+};
+
+/** Visits the raw bytes of everything in a state that running code can
+  change.  Runs in the fork server copy these out to shared memory, and the
+  parent copies them back in the same order. */
+template <typename F>
+void for_each_region(CpuState& cs, F f) {
+  f(&cs.code, sizeof(cs.code));
+  for (size_t i = 0, ie = cs.gp.size(); i < ie; ++i) {
+    f(cs.gp[i].data(), cs.gp[i].num_fixed_bytes());
+  }
+  for (size_t i = 0, ie = cs.sse.size(); i < ie; ++i) {
+    f(cs.sse[i].data(), cs.sse[i].num_fixed_bytes());
+  }
+  f(const_cast<void*>(cs.rf.data()), (cs.rf.size() + 7) / 8);
+
+  auto memory = [&f](Memory& m) {
+    f(m.data(), m.num_quads() * 8);
+    f(m.valid_mask(), m.num_quads());
+  };
+  memory(cs.stack);
+  memory(cs.heap);
+  memory(cs.data);
+  for (auto& segment : cs.segments) {
+    memory(segment);
+  }
+}
+
+bool send_fully(int fd, const void* data, size_t n) {
+  auto p = (const char*)data;
+  while (n > 0) {
+    auto sent = send(fd, p, n, MSG_NOSIGNAL);
+    if (sent <= 0) {
+      return false;
+    }
+    p += sent;
+    n -= sent;
+  }
+  return true;
+}
+
+bool recv_fully(int fd, void* data, size_t n) {
+  auto p = (char*)data;
+  while (n > 0) {
+    auto got = recv(fd, p, n, 0);
+    if (got <= 0) {
+      return false;
+    }
+    p += got;
+    n -= got;
+  }
+  return true;
+}
+
+/** Sent by the fork server in place of a wait status when fork() fails. */
+constexpr int fork_failed_status = -1;
+
+/** The error to report for a run that took down its process. */
+ErrorCode error_for_status(int status) {
+  if (!WIFSIGNALED(status)) {
+    return ErrorCode::SIGSEGV_;
+  }
+  switch (WTERMSIG(status)) {
+  case SIGILL:
+    return ErrorCode::SIGILL_;
+  case SIGFPE:
+    return ErrorCode::SIGFPE_;
+  case SIGKILL:
+    return ErrorCode::SIGKILL_;
+  case SIGBUS:
+    return ErrorCode::SIGBUS_;
+  default:
+    return ErrorCode::SIGSEGV_;
+  }
+}
+
 } // namespace
 
 namespace stoke {
@@ -108,14 +205,25 @@ bool Sandbox::is_supported(Opcode o) {
 }
 
 void Sandbox::init() {
+  fork_server_.pid = -1;
   set_abi_check(true);
   set_stack_check(true);
   set_use_child(false);
   set_max_jumps(16);
+  set_count_cycles(false);
   instr_offset_ = (uint64_t)(-1);
+  cycle_overhead_ = 0;
+  stack_offset_known_ = false;
+  stack_offset_ = 0;
+  stack_rebase_ = 0;
 
   harness_ = emit_harness();
+  timed_harness_ = emit_harness(true);
   signal_trap_ = emit_signal_trap();
+
+  assm_.start(empty_fxn_);
+  assm_.ret();
+  assm_.finish();
   reset();
 
   static bool once = false;
@@ -134,6 +242,7 @@ void Sandbox::init() {
 }
 
 Sandbox& Sandbox::insert_input(const CpuState& input) {
+  stop_fork_server();
   io_pairs_.push_back(new IoPair());
   auto io = io_pairs_.back();
 
@@ -143,16 +252,28 @@ Sandbox& Sandbox::insert_input(const CpuState& input) {
   io->in_ = input;
   io->out_ = input;
 
+  // Emitted code refers to these, so they're set up once and for all
+  io->dirty_.reserve(2 + io->out_.segments.size());
+  io->dirty_.emplace_back(io->out_.heap);
+  io->dirty_.emplace_back(io->out_.data);
+  for (const auto& segment : io->out_.segments) {
+    io->dirty_.emplace_back(segment);
+  }
+
   // Assemble helper functions for this io pair.
   io->in2cpu_ = emit_state2cpu(io->in_);
   io->out2cpu_ = emit_state2cpu(io->out_);
   io->cpu2out_ = emit_cpu2state(io->out_);
-  io->map_addr_ = emit_map_addr(io->out_);
+  io->map_addr_ = emit_map_addr(*io);
+
+  // Stack accesses that were compiled without checks must be safe for this input too
+  check_stack_accesses(io->in_);
 
   return *this;
 }
 
 Sandbox& Sandbox::clear_inputs() {
+  stop_fork_server();
   for (auto io : io_pairs_) {
     delete io;
   }
@@ -168,14 +289,25 @@ Sandbox& Sandbox::insert_function(const Cfg& cfg) {
   // If this is the first time we've seen this function, allocate state
   // Otherwise just replace what's there
   if (!contains_function(label)) {
+    stop_fork_server();
     fxns_[label] = new x64asm::Function(512 * cfg.get_code().size() + 8192);
     fxns_src_[label] = new Cfg(cfg);
+    // Know the main function before compiling, so it gets stack check elision
+    if (num_functions() == 1) {
+      main_fxn_ = label;
+      instr_offset_ = -1;
+    }
     recompile(cfg);
   } else {
     *fxns_src_[label] = cfg;
     recompile(cfg);
   }
 
+  // A new way into the main function means it can no longer assume its entry %rsp
+  if (label != main_fxn_ && stack_accesses_.count(main_fxn_) && !can_elide_stack_checks(main_fxn_)) {
+    recompile(*fxns_src_[main_fxn_]);
+  }
+
   // If this is the only function it becomes main by default
   if (num_functions() == 1) {
     set_entrypoint(label);
@@ -184,6 +316,7 @@ Sandbox& Sandbox::insert_function(const Cfg& cfg) {
 }
 
 Sandbox& Sandbox::clear_functions() {
+  stop_fork_server();
   for (auto fxn : fxns_) {
     delete fxn.second;
   }
@@ -193,11 +326,33 @@ Sandbox& Sandbox::clear_functions() {
     delete fxn.second;
   }
   fxns_src_.clear();
+  stack_accesses_.clear();
+
+  return *this;
+}
 
+Sandbox& Sandbox::set_entrypoint(const Label& l) {
+  assert(contains_function(l));
+  if (l != main_fxn_ || instr_offset_ != (uint64_t)(-1)) {
+    stop_fork_server();
+  }
+  const auto old = main_fxn_;
+  main_fxn_ = l;
+  entrypoint_ = fxns_[main_fxn_]->get_entrypoint();
+  instr_offset_ = -1;
+
+  // Stack check elision depends on which function is main
+  if (old != l) {
+    if (stack_accesses_.count(old)) {
+      recompile(*fxns_src_[old]);
+    }
+    recompile(*fxns_src_[l]);
+  }
   return *this;
 }
 
 Sandbox& Sandbox::insert_before(StateCallback cb, void* arg) {
+  stop_fork_server();
   global_before_ = {cb, arg};
   recompile();
   return *this;
@@ -205,12 +360,14 @@ Sandbox& Sandbox::insert_before(StateCallback cb, void* arg) {
 
 Sandbox& Sandbox::insert_before(const Label& l, size_t line, StateCallback cb, void* arg) {
   assert(contains_function(l));
+  stop_fork_server();
   before_[l][line] = {cb, arg};
   recompile(*get_function(l));
   return *this;
 }
 
 Sandbox& Sandbox::insert_after(StateCallback cb, void* arg) {
+  stop_fork_server();
   global_after_ = {cb, arg};
   recompile();
   return *this;
@@ -218,16 +375,38 @@ Sandbox& Sandbox::insert_after(StateCallback cb, void* arg) {
 
 Sandbox& Sandbox::insert_after(const Label& l, size_t line, StateCallback cb, void* arg) {
   assert(contains_function(l));
+  stop_fork_server();
   after_[l][line] = {cb, arg};
   recompile(*get_function(l));
   return *this;
 }
 
+Sandbox& Sandbox::insert_trace_before(const Label& l, size_t line, TraceBuffer* buf, uint64_t tag) {
+  assert(contains_function(l));
+  stop_fork_server();
+  assert(buf != nullptr);
+  trace_before_[l][line] = {buf, tag};
+  recompile(*get_function(l));
+  return *this;
+}
+
+Sandbox& Sandbox::insert_trace_after(const Label& l, size_t line, TraceBuffer* buf, uint64_t tag) {
+  assert(contains_function(l));
+  stop_fork_server();
+  assert(buf != nullptr);
+  trace_after_[l][line] = {buf, tag};
+  recompile(*get_function(l));
+  return *this;
+}
+
 Sandbox& Sandbox::clear_callbacks() {
+  stop_fork_server();
   global_before_ = {nullptr, nullptr};
   before_.clear();
   global_after_ = {nullptr, nullptr};
   after_.clear();
+  trace_before_.clear();
+  trace_after_.clear();
   recompile();
   return *this;
 }
@@ -272,14 +451,29 @@ void Sandbox::update_child_callback(pair<StateCallback, void*>& pair, ostream& o
 }
 
 void Sandbox::run_child(size_t index) {
+  // Trace buffers are written in place, so the child's entries would be lost
+  if (!trace_before_.empty() || !trace_after_.empty()) {
+    io_pairs_[index]->out_.code = ErrorCode::SIGCUSTOM_UNSUPPORTED_IN_CHILD;
+    return;
+  }
 
   int fds[2];
   int ok = pipe(fds);
   if (ok) {
     perror("sandbox pipe");
+    io_pairs_[index]->out_.code = ErrorCode::SIGCUSTOM_FORK_FAILED;
+    return;
   }
 
   pid_t pid = fork();
+  if (pid < 0) {
+    // Nowhere isolated to run the code; say so rather than blame the code
+    perror("sandbox fork");
+    close(fds[0]);
+    close(fds[1]);
+    io_pairs_[index]->out_.code = ErrorCode::SIGCUSTOM_FORK_FAILED;
+    return;
+  }
   if (pid) {
     // parent.
     close(fds[1]);
@@ -298,6 +492,7 @@ void Sandbox::run_child(size_t index) {
         // read the result and save it
         auto io = io_pairs_[index];
         io->out_ = stoke::deserialize<CpuState>(is);
+        io->set_all_dirty();
 
         // cleanup
         getline(is, line);
@@ -355,13 +550,199 @@ void Sandbox::run_child(size_t index) {
 
 }
 
+void Sandbox::run_fork_server(size_t index) {
+  auto io = io_pairs_[index];
+
+  // Don't bother executing testcases that are in error states
+  if (io->in_.code != ErrorCode::NORMAL) {
+    return;
+  }
+
+  // If the server went away, start another and try again
+  for (size_t attempt = 0; attempt < 2; ++attempt) {
+    if (!start_fork_server()) {
+      break;
+    }
+
+    string recompiled;
+    for (const auto& r : fork_server_.recompiled) {
+      recompiled += r.second;
+    }
+    ForkServerCommand command = {index, max_jumps_, abi_check_, count_cycles_,
+                                 fork_server_.recompiled.size(), recompiled.size()
+                                };
+    int status;
+    if (!send_fully(fork_server_.fd, &command, sizeof(command)) ||
+        !send_fully(fork_server_.fd, recompiled.data(), recompiled.size()) ||
+        !recv_fully(fork_server_.fd, &status, sizeof(status))) {
+      stop_fork_server();
+      continue;
+    }
+    fork_server_.recompiled.clear();
+
+    // The server couldn't fork; try a child of our own instead
+    if (status == fork_failed_status) {
+      break;
+    }
+
+    // A run that crashed its process escaped the sandbox; its output is garbage
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      io->out_.code = error_for_status(status);
+      io->cycles_ = 0;
+      return;
+    }
+
+    auto p = fork_server_.buffer;
+    memcpy(&io->cycles_, p, sizeof(io->cycles_));
+    p += sizeof(io->cycles_);
+    for_each_region(io->out_, [&p](void* data, size_t n) {
+      memcpy(data, p, n);
+      p += n;
+    });
+    io->set_all_dirty();
+    return;
+  }
+
+  run_child(index);
+}
+
+bool Sandbox::start_fork_server() {
+  if (fork_server_.pid > 0 && fork_server_.owner == getpid()) {
+    return true;
+  }
+  // A server inherited across fork() belongs to the process that started it
+  if (fork_server_.pid > 0) {
+    close(fork_server_.fd);
+    munmap(fork_server_.buffer, fork_server_.buffer_size);
+    fork_server_.pid = -1;
+  }
+  fork_server_.recompiled.clear();
+
+  // Room for the largest output state
+  size_t size = 0;
+  for (auto io : io_pairs_) {
+    size_t bytes = sizeof(io->cycles_);
+    for_each_region(io->out_, [&bytes](void* data, size_t n) {
+      bytes += n;
+    });
+    size = std::max(size, bytes);
+  }
+
+  auto buffer = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (buffer == MAP_FAILED) {
+    perror("sandbox fork server mmap");
+    return false;
+  }
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds)) {
+    perror("sandbox fork server socketpair");
+    munmap(buffer, size);
+    return false;
+  }
+
+  fork_server_.buffer = (uint8_t*)buffer;
+  fork_server_.buffer_size = size;
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    close(fds[0]);
+    serve_fork_server(fds[1]);
+  }
+  close(fds[1]);
+
+  if (pid < 0) {
+    perror("sandbox fork server fork");
+    close(fds[0]);
+    munmap(buffer, size);
+    return false;
+  }
+
+  fork_server_.pid = pid;
+  fork_server_.owner = getpid();
+  fork_server_.fd = fds[0];
+  return true;
+}
+
+void Sandbox::stop_fork_server() {
+  if (fork_server_.pid <= 0) {
+    return;
+  }
+
+  // Other servers may hold copies of our socket, so it never sees EOF
+  close(fork_server_.fd);
+  if (fork_server_.owner == getpid()) {
+    kill(fork_server_.pid, SIGKILL);
+    waitpid(fork_server_.pid, NULL, 0);
+  }
+  munmap(fork_server_.buffer, fork_server_.buffer_size);
+  fork_server_.pid = -1;
+  fork_server_.recompiled.clear();
+}
+
+void Sandbox::serve_fork_server(int fd) {
+  // Don't outlive the parent; nor run anything but the code already compiled
+  prctl(PR_SET_PDEATHSIG, SIGKILL);
+  Telemetry::after_fork();
+  use_child_ = false;
+  fork_server_.pid = -1;
+
+  ForkServerCommand command;
+  while (recv_fully(fd, &command, sizeof(command))) {
+    max_jumps_ = command.max_jumps;
+    abi_check_ = command.abi_check;
+    count_cycles_ = command.count_cycles;
+
+    // Compile what the parent has since it sent us its last command
+    if (command.num_recompiled > 0) {
+      string recompiled(command.recompiled_bytes, '\0');
+      if (!recv_fully(fd, &recompiled[0], recompiled.size())) {
+        break;
+      }
+      istringstream is(recompiled);
+      for (size_t i = 0; i < command.num_recompiled; ++i) {
+        insert_function(Cfg::deserialize(is));
+      }
+      entrypoint_ = fxns_[main_fxn_]->get_entrypoint();
+    }
+
+    int status = fork_failed_status;
+    pid_t pid = fork();
+    if (pid == 0) {
+      run(command.index);
+
+      auto io = io_pairs_[command.index];
+      auto p = fork_server_.buffer;
+      memcpy(p, &io->cycles_, sizeof(io->cycles_));
+      p += sizeof(io->cycles_);
+      for_each_region(io->out_, [&p](void* data, size_t n) {
+        memcpy(p, data, n);
+        p += n;
+      });
+      _exit(0);
+    } else if (pid > 0) {
+      waitpid(pid, &status, 0);
+    }
+
+    if (!send_fully(fd, &status, sizeof(status))) {
+      break;
+    }
+  }
+  _exit(0);
+}
+
 Sandbox& Sandbox::run(size_t index) {
 
   assert(num_functions() > 0);
   assert(index < num_inputs());
 
+  Telemetry::Timer timer(Telemetry::SANDBOX_RUN);
+
   if (use_child_) {
-    run_child(index);
+    if (has_callbacks()) {
+      run_child(index);
+    } else {
+      run_fork_server(index);
+    }
     return *this;
   }
 
@@ -372,12 +753,13 @@ Sandbox& Sandbox::run(size_t index) {
     return *this;
   }
 
+  // Put back what the last run changed
   io->out_.stack.copy(io->in_.stack);
-  io->out_.heap.copy(io->in_.heap);
-  io->out_.data.copy(io->in_.data);
-  io->out_.segments.resize(io->in_.segments.size());
+  io->dirty_[0].restore(io->out_.heap, io->in_.heap);
+  io->dirty_[1].restore(io->out_.data, io->in_.data);
+  assert(io->out_.segments.size() == io->in_.segments.size());
   for (size_t i = 0, ie=io->out_.segments.size(); i < ie; ++i) {
-    io->out_.segments[i].copy(io->in_.segments[i]);
+    io->dirty_[i+2].restore(io->out_.segments[i], io->in_.segments[i]);
   }
 
   // Reset error-related variables
@@ -390,6 +772,7 @@ Sandbox& Sandbox::run(size_t index) {
   out2cpu_ = io->out2cpu_.get_entrypoint();
   cpu2out_ = io->cpu2out_.get_entrypoint();
   map_addr_ = io->map_addr_.get_entrypoint();
+  stack_rebase_ = (uint64_t)io->out_.stack.data() - io->out_.stack.lower_bound();
 
   // Initialize state related to %rsp tracking
   user_rsp_ = io->in_.gp[rsp].get_fixed_quad(0);
@@ -400,11 +783,20 @@ Sandbox& Sandbox::run(size_t index) {
   if (!lnkr_.good()) {
     io->out_.code = ErrorCode::SIGCUSTOM_LINKER_ERROR;
   } else if (!sigsetjmp(buf_, 1)) {
-    io->out_.code = harness_.call<ErrorCode>();
+    if (count_cycles_) {
+      io->out_.code = timed_harness_.call<ErrorCode>();
+    } else {
+      io->out_.code = harness_.call<ErrorCode>();
+    }
   } else {
     io->out_.code = ErrorCode::SIGFPE_;
   }
 
+  // The time stamp reads are skipped when control leaves through the signal trap
+  if (count_cycles_) {
+    io->cycles_ = io->out_.code == ErrorCode::NORMAL ? tsc_end_ - tsc_start_ : 0;
+  }
+
   // Finalize output state
   if (abi_check_ && !check_abi(*io)) {
     io->out_.code = ErrorCode::SIGCUSTOM_ABI_VIOLATION;
@@ -420,6 +812,42 @@ Sandbox& Sandbox::run() {
   return *this;
 }
 
+uint64_t Sandbox::get_cycle_overhead() {
+  assert(num_inputs() > 0);
+  if (cycle_overhead_ > 0) {
+    return cycle_overhead_;
+  }
+
+  // Time the harness around a function that returns immediately.  The minimum
+  // over many runs filters out interrupts and cold caches.
+  auto io = io_pairs_[0];
+  out_ = &io->out_;
+  in2cpu_ = io->in2cpu_.get_entrypoint();
+  cpu2out_ = io->cpu2out_.get_entrypoint();
+  user_rsp_ = io->in_.gp[rsp].get_fixed_quad(0);
+
+  const auto entrypoint = entrypoint_;
+  entrypoint_ = empty_fxn_.get_entrypoint();
+
+  uint64_t best = (uint64_t)(-1);
+  for (size_t i = 0; i < 64; ++i) {
+    timed_harness_.call<ErrorCode>();
+    best = std::min(best, tsc_end_ - tsc_start_);
+  }
+  entrypoint_ = entrypoint;
+  cycle_overhead_ = best;
+
+  // The empty function left input register values in this output; recompute it
+  if (num_functions() > 0) {
+    const auto count = count_cycles_;
+    set_count_cycles(false);
+    run(0);
+    set_count_cycles(count);
+  }
+
+  return cycle_overhead_;
+}
+
 bool Sandbox::check_abi(const IoPair& iop) const {
   for (const auto& r : {
   rbx, rbp, rsp, r12, r13, r14, r15
@@ -444,10 +872,20 @@ size_t Sandbox::get_unused_reg(const Instruction& instr) const {
 }
 
 void Sandbox::recompile(const Cfg& cfg) {
+  Telemetry::Timer timer(Telemetry::SANDBOX_COMPILE);
+
   // Grab the name of this function
   assert(cfg.get_function().invariant_first_instr_is_label());
   const auto& label = cfg.get_function().get_leading_label();
 
+  // Only the code changed, so a running fork server can catch up with its
+  // next command; forking a new one for every rewrite would cost more
+  if (fork_server_.pid > 0 && fork_server_.owner == getpid()) {
+    ostringstream oss;
+    cfg.serialize(oss);
+    fork_server_.recompiled[label] = oss.str();
+  }
+
   // Compile the function and record its source
   assert(fxns_[label] != 0);
   emit_function(cfg, fxns_[label]);
@@ -486,7 +924,7 @@ void Sandbox::recompile() {
 // Returns:
 //   - Error code associated with execution
 
-Function Sandbox::emit_harness() {
+Function Sandbox::emit_harness(bool timed) {
   Function fxn;
   assm_.start(fxn);
 
@@ -499,6 +937,12 @@ Function Sandbox::emit_harness() {
   assm_.push_1(r14);
   assm_.push_1(r15);
 
+  // Start the clock before any user state is loaded; the cost of loading and
+  // saving that state is measured separately by get_cycle_overhead()
+  if (timed) {
+    emit_read_tsc(&tsc_start_, true);
+  }
+
   // Save the %rsp for this stack frame
   // If control ever traps an exception, we'll restore the %rsp here
   // and jump back out of this function
@@ -527,6 +971,11 @@ Function Sandbox::emit_harness() {
   assm_.call(M64(rsp));
   assm_.lea(rsp, M64(rsp, Imm32(8)));
 
+  // User state has been saved, so we're free to clobber rax, rcx and rdx
+  if (timed) {
+    emit_read_tsc(&tsc_end_, false);
+  }
+
   // Restore callee-save state
   assm_.pop_1(r15);
   assm_.pop_1(r14);
@@ -544,6 +993,30 @@ Function Sandbox::emit_harness() {
   return fxn;
 }
 
+// Reads the time stamp counter into a class variable.
+//
+// Calling Context:
+//   - emit_harness()
+// Requirements:
+//   - MAY clobber %rax, %rcx and %rdx
+//   - The start read MUST NOT begin before earlier instructions retire
+//   - The end read MUST NOT begin before the user's code retires, and later
+//     instructions MUST NOT begin before it completes
+
+void Sandbox::emit_read_tsc(uint64_t* dest, bool start) {
+  if (start) {
+    assm_.lfence();
+    assm_.rdtsc();
+  } else {
+    assm_.rdtscp();
+  }
+  assm_.lfence();
+
+  assm_.shl(rdx, Imm8(32));
+  assm_.or_(rax, rdx);
+  assm_.mov(Moffs64(dest), rax);
+}
+
 // Emits a function that sets the value of the error code and jumps control
 // back into stoke code
 //
@@ -706,10 +1179,18 @@ Function Sandbox::emit_cpu2state(CpuState& cs) {
 //   - %rcx = byte write mask
 // Return Vale:
 //   - %rax = physical address
-Function Sandbox::emit_map_addr(CpuState& cs) {
+Function Sandbox::emit_map_addr(IoPair& io) {
   Function fxn;
   assm_.start(fxn);
 
+  auto& cs = io.out_;
+  unordered_map<Memory*, DirtyPages*> dirty;
+  dirty[&cs.heap] = &io.dirty_[0];
+  dirty[&cs.data] = &io.dirty_[1];
+  for (size_t i = 0, ie = cs.segments.size(); i < ie; ++i) {
+    dirty[&cs.segments[i]] = &io.dirty_[i+2];
+  }
+
   // Populate a list of memory segments we need to emit code for
   vector<Memory*> segments;
   vector<Label> segment_cases;
@@ -728,19 +1209,37 @@ Function Sandbox::emit_map_addr(CpuState& cs) {
   auto done = get_label();
   auto fail = get_label();
 
-  if (segments.size()) {
-    for (size_t i = 0; i < segments.size() - 1; ++i)
-      segment_cases.push_back(get_label());
-  }
-  segment_cases.push_back(fail);
-
   // Check alignment: A well aligned address won't change
   // Following this check, rsi is free for use as scratch space
   assm_.and_(rsi, rdi);
   assm_.cmp(rsi, rdi);
   assm_.jne_1(fail);
 
-  // emit the code to figure out which segment we're writing to.
+  // If no two segments overlap (or touch), the order we check them in doesn't
+  // matter and we can binary search them by address
+  auto sorted = segments;
+  sort(sorted.begin(), sorted.end(), [](Memory* m, Memory* n) {
+    return m->lower_bound() < n->lower_bound();
+  });
+  auto disjoint = true;
+  for (size_t i = 1; i < sorted.size(); ++i) {
+    const auto prev = sorted[i-1];
+    if (prev->upper_bound() == 0 || prev->upper_bound() >= sorted[i]->lower_bound()) {
+      disjoint = false;
+    }
+  }
+  if (disjoint) {
+    emit_map_addr_search(sorted, 0, sorted.size(), fail, done, dirty);
+    segments.clear();
+  }
+
+  if (segments.size()) {
+    for (size_t i = 0; i < segments.size() - 1; ++i)
+      segment_cases.push_back(get_label());
+  }
+  segment_cases.push_back(fail);
+
+  // Otherwise emit the code to figure out which segment we're writing to, in priority order.
   for (size_t i = 0; i < segments.size(); ++i) {
     Memory* segment = segments[i];
 
@@ -767,7 +1266,7 @@ Function Sandbox::emit_map_addr(CpuState& cs) {
     assm_.sub(rdi, rax);
 
     // emit the memory access
-    emit_map_addr_cases(fail, done, segment);
+    emit_map_addr_cases(fail, done, segment, dirty.count(segment) ? dirty[segment] : nullptr);
 
   }
 
@@ -784,12 +1283,51 @@ Function Sandbox::emit_map_addr(CpuState& cs) {
   return fxn;
 }
 
+void Sandbox::emit_map_addr_search(const vector<Memory*>& segments, size_t begin, size_t end,
+                                   const Label& fail, const Label& done,
+                                   const unordered_map<Memory*, DirtyPages*>& dirty) {
+  if (begin == end) {
+    assm_.jmp_1(fail);
+    return;
+  }
+
+  const auto mid = begin + (end - begin) / 2;
+  const auto segment = segments[mid];
+  const auto above = mid + 1 == end ? fail : get_label();
+  const auto below = mid == begin ? fail : get_label();
+
+  // Same bounds checks as the linear search; addresses past the upper bound
+  // belong to a later segment, and addresses before the lower bound to an
+  // earlier one
+  if (segment->upper_bound()) {
+    assm_.mov((R64)rax, Imm64(segment->upper_bound()));
+    assm_.cmp(rdi, rax);
+    assm_.ja_1(above);
+  }
+  assm_.mov((R64)rax, Imm64(segment->lower_bound()));
+  assm_.cmp(rdi, rax);
+  assm_.jb_1(below);
+  assm_.sub(rdi, rax);
+  const auto d = dirty.find(segment);
+  emit_map_addr_cases(fail, done, segment, d == dirty.end() ? nullptr : d->second);
+
+  if (mid != begin) {
+    assm_.bind(below);
+    emit_map_addr_search(segments, begin, mid, fail, done, dirty);
+  }
+  if (mid + 1 != end) {
+    assm_.bind(above);
+    emit_map_addr_search(segments, mid + 1, end, fail, done, dirty);
+  }
+}
+
 /** Back in the day, this function did a switch() statement to choose between
  * the stack/heap/data segments, rather than receiving a Memory*.
  * Hence "cases" in the name.  It could, probably, be
  * renamed/removed/refactored.  And we can do that.  But for now, as a tribute
  * to Eric's work on the Sandbox, it's gonna stick around here. -- BRC */
-void Sandbox::emit_map_addr_cases(const Label& fail, const Label& done, Memory* mem) {
+void Sandbox::emit_map_addr_cases(const Label& fail, const Label& done, Memory* mem,
+                                  DirtyPages* dirty) {
   // Save rcx (we need to use it for the shift instruction below)
   assm_.mov(rax, rcx);
   // We have a valid address, divide by to find the corresponding address in the mask array
@@ -817,6 +1355,42 @@ void Sandbox::emit_map_addr_cases(const Label& fail, const Label& done, Memory*
   assm_.cmp(rax, rcx);
   assm_.jne_1(fail);
 
+  // Writes flag the first and last page they touch (no access is wider than
+  // 32 bytes), and list each page the first time it's flagged.  rdx and rsi
+  // are free by now, and the caller saved the flags.
+  if (dirty != nullptr) {
+    const auto skip = get_label();
+    const auto mark = get_label();
+    const auto marked = get_label();
+
+    assm_.test(rcx, rcx);
+    assm_.je_1(skip);
+    assm_.mov(rsi, rdi);
+    assm_.shr(rsi, Imm8(DirtyPages::page_bits));
+    assm_.call(mark);
+    assm_.lea(rsi, M64(rdi, Imm32(31)));
+    assm_.shr(rsi, Imm8(DirtyPages::page_bits));
+    assm_.call(mark);
+    assm_.jmp_1(skip);
+
+    // Flags page rsi and lists it, if it isn't already
+    assm_.bind(mark);
+    assm_.mov((R64)rax, Imm64(dirty->flags.data()));
+    assm_.cmp(M8(rax, rsi, Scale::TIMES_1), Imm8(0));
+    assm_.jne_1(marked);
+    assm_.mov(M8(rax, rsi, Scale::TIMES_1), Imm8(1));
+    assm_.mov((R64)rax, Imm64(&dirty->count));
+    assm_.mov(rdx, M64(rax));
+    assm_.mov((R64)rax, Imm64(dirty->list.data()));
+    assm_.mov(M64(rax, rdx, Scale::TIMES_8), rsi);
+    assm_.mov((R64)rax, Imm64(&dirty->count));
+    assm_.add(M64(rax), Imm8(1));
+    assm_.bind(marked);
+    assm_.ret();
+
+    assm_.bind(skip);
+  }
+
   // Do final remapping
   assm_.mov((R64)rax, Imm64(mem->data()));
   assm_.add(rax, rdi);
@@ -868,6 +1442,11 @@ bool Sandbox::emit_function(const Cfg& cfg, Function* fxn) {
     assm_.jmp_1(middle);
   }
 
+  // Stack accesses whose bounds are known at compile time don't need checks
+  stack_accesses_.erase(label);
+  const auto elide = can_elide_stack_checks(label);
+  CfgStackOffsets offsets(cfg);
+
   // Assemble instructions and add instrumentation for reachable blocks
   for (Cfg::id_type b = 0, be = cfg.num_blocks(); b < be; ++b) {
     if (!cfg.is_reachable(b)) {
@@ -891,15 +1470,18 @@ bool Sandbox::emit_function(const Cfg& cfg, Function* fxn) {
       }
 
       // Emit callbacks and instruction
-      if (global_before_.first != nullptr || !before_.empty()) {
+      if (global_before_.first != nullptr || !before_.empty() || !trace_before_.empty()) {
         emit_before(cfg.get_function().get_leading_label(), i);
       }
       if (label == main_fxn_ && i == instr_offset_) {
         assm_.bind(middle);
       }
       DEBUG_SANDBOX(cout << "[sandbox] emitting " << instr << " at " << (fxn->data() + fxn->size()) << endl;)
+      stack_offset_known_ = elide && offsets.is_known(i);
+      stack_offset_ = stack_offset_known_ ? offsets.get_offset(i) : 0;
       emit_instruction(instr, label, hex_offset, entry, exit);
-      if (global_after_.first != nullptr || !after_.empty()) {
+      stack_offset_known_ = false;
+      if (global_after_.first != nullptr || !after_.empty() || !trace_after_.empty()) {
         emit_after(cfg.get_function().get_leading_label(), i);
       }
     }
@@ -959,10 +1541,65 @@ void Sandbox::emit_callback(const pair<StateCallback, void*>& cb, const Label& f
   emit_load_user_rsp();
 }
 
+void Sandbox::emit_trace(const pair<TraceBuffer*, uint64_t>& tp) {
+  const auto buf = tp.first;
+  auto buffer = assm_.get_fxn();
+  DEBUG_SANDBOX(cout << "[sandbox] emitting trace at " << (buffer->data() + buffer->size()) << endl;)
+  (void) buffer;
+
+  // Park user %rax, %rbx and flags on the STOKE stack
+  emit_load_stoke_rsp();
+  assm_.pushfq();
+  assm_.push_1(rax);
+  assm_.push_1(rbx);
+
+  // %rbx = &data_[(head_++ & mask_) * stride_]; moffs only moves through %rax
+  assm_.mov(rax, Moffs64(&buf->head_));
+  assm_.mov(rbx, rax);
+  assm_.lea(rax, M64(rax, Imm32(1)));
+  assm_.mov(Moffs64(&buf->head_), rax);
+  assm_.mov(rax, rbx);
+  assm_.and_(rax, Imm32(buf->mask_));
+  assm_.imul(rax, rax, Imm32(buf->stride_ * 8));
+  assm_.mov(rbx, Imm64(buf->data_.data()));
+  assm_.add(rbx, rax);
+
+  assm_.mov(rax, Imm64(tp.second));
+  assm_.mov(M64(rbx), rax);
+  for (size_t k = 0, ke = buf->regs_.size(); k < ke; ++k) {
+    const auto r = buf->regs_[k];
+    const auto slot = M64(rbx, Imm32(8 * (k + 1)));
+    if (r == rax) {
+      assm_.mov(rax, M64(rsp, Imm32(8)));
+      assm_.mov(slot, rax);
+    } else if (r == rbx) {
+      assm_.mov(rax, M64(rsp));
+      assm_.mov(slot, rax);
+    } else if (r == rsp) {
+      assm_.mov(rax, Moffs64(&user_rsp_));
+      assm_.mov(slot, rax);
+    } else {
+      assm_.mov(slot, r);
+    }
+  }
+
+  assm_.pop_1(rbx);
+  assm_.pop_1(rax);
+  assm_.popfq();
+  emit_load_user_rsp();
+}
+
 void Sandbox::emit_before(const Label& label, size_t line) {
   if (global_before_.first != nullptr) {
     emit_callback(global_before_, label, line);
   }
+  const auto t = trace_before_.find(label);
+  if (t != trace_before_.end()) {
+    const auto u = t->second.find(line);
+    if (u != t->second.end()) {
+      emit_trace(u->second);
+    }
+  }
   const auto i = before_.find(label);
   if (i == before_.end()) {
     return;
@@ -978,6 +1615,13 @@ void Sandbox::emit_after(const Label& label, size_t line) {
   if (global_after_.first != nullptr) {
     emit_callback(global_after_, label, line);
   }
+  const auto t = trace_after_.find(label);
+  if (t != trace_after_.end()) {
+    const auto u = t->second.find(line);
+    if (u != t->second.end()) {
+      emit_trace(u->second);
+    }
+  }
   const auto i = after_.find(label);
   if (i == after_.end()) {
     return;
@@ -1069,6 +1713,56 @@ void Sandbox::emit_memory_instruction(const Instruction& instr, uint64_t hex_off
   const auto old_op = temp->get_operand<M64>(mi);
   auto fxn = assm_.get_fxn();
 
+  // Work out the alignment mask and which bytes are touched
+  uint64_t align = 0xffffffffffffffff;
+  uint64_t bytes = 0;
+  switch (instr.type(mi)) {
+  case Type::M_256:
+    // Berkeley says that 256-bit values DON'T have to be aligned? Is this true?
+    align = 0xffffffffffffffe0;
+    bytes = 0x00000000ffffffff;
+    break;
+  case Type::M_128:
+    align = 0xfffffffffffffff0;
+    bytes = 0x000000000000ffff;
+    break;
+  case Type::M_80_BCD:
+  case Type::M_80_FP:
+    // I'm not sure whether 128-bit alignment is required for 80-bit types or just preferred
+    align = 0xfffffffffffffff0;
+    bytes = 0x00000000000003ff;
+    break;
+  case Type::M_64:
+  case Type::M_64_FP:
+  case Type::M_64_INT:
+    bytes = 0x00000000000000ff;
+    break;
+  case Type::M_32:
+  case Type::M_32_FP:
+  case Type::M_32_INT:
+    bytes = 0x000000000000000f;
+    break;
+  case Type::M_16:
+  case Type::M_16_INT:
+    bytes = 0x0000000000000003;
+    break;
+  case Type::M_8:
+    bytes = 0x0000000000000001;
+    break;
+  default:
+    assert(false);
+    break;
+  }
+  // Some special instructions get a bye for alignment
+  if (instr.is_unaligned()) {
+    align = 0xffffffffffffffff;
+  }
+
+  // Stack accesses that are safe for every input don't need the rest of this
+  if (emit_stack_access(instr, align, bytes)) {
+    return;
+  }
+
   // We'll be doing some function calls, and need some scratch, so load STOKE's rsp
   emit_load_stoke_rsp();
   // Backup some scratch values and the rflags register
@@ -1109,51 +1803,8 @@ void Sandbox::emit_memory_instruction(const Instruction& instr, uint64_t hex_off
 
   // Load the alignment mask into rsi, and the read/write mask into rdx/rcx
   DEBUG_SANDBOX(cout << "[sandbox][emit_memory_instruction] loading masks at " << (fxn->data() + fxn->size()) << endl;)
-  switch (instr.type(mi)) {
-  case Type::M_256:
-    // Berkeley says that 256-bit values DON'T have to be aligned? Is this true?
-    assm_.mov(rsi, Imm64(0xffffffffffffffe0));
-    assm_.mov(rdx, Imm64(0x00000000ffffffff));
-    break;
-  case Type::M_128:
-    assm_.mov(rsi, Imm64(0xfffffffffffffff0));
-    assm_.mov(rdx, Imm64(0x000000000000ffff));
-    break;
-  case Type::M_80_BCD:
-  case Type::M_80_FP:
-    // I'm not sure whether 128-bit alignment is required for 80-bit types or just preferred
-    assm_.mov(rsi, Imm64(0xfffffffffffffff0));
-    assm_.mov(rdx, Imm64(0x00000000000003ff));
-    break;
-  case Type::M_64:
-  case Type::M_64_FP:
-  case Type::M_64_INT:
-    assm_.mov(rsi, Imm64(0xffffffffffffffff));
-    assm_.mov(rdx, Imm64(0x00000000000000ff));
-    break;
-  case Type::M_32:
-  case Type::M_32_FP:
-  case Type::M_32_INT:
-    assm_.mov(rsi, Imm64(0xffffffffffffffff));
-    assm_.mov(rdx, Imm64(0x000000000000000f));
-    break;
-  case Type::M_16:
-  case Type::M_16_INT:
-    assm_.mov(rsi, Imm64(0xffffffffffffffff));
-    assm_.mov(rdx, Imm64(0x0000000000000003));
-    break;
-  case Type::M_8:
-    assm_.mov(rsi, Imm64(0xffffffffffffffff));
-    assm_.mov(rdx, Imm64(0x0000000000000001));
-    break;
-  default:
-    assert(false);
-    break;
-  }
-  // Some special instructions get a bye for alignment
-  if (instr.is_unaligned()) {
-    assm_.mov(rsi, Imm64(0xffffffffffffffff));
-  }
+  assm_.mov(rsi, Imm64(align));
+  assm_.mov(rdx, Imm64(bytes));
   // Finish up setting the read/write masks
   if (instr.maybe_write(mi)) {
     assm_.mov(rcx, rdx);
@@ -1206,6 +1857,103 @@ void Sandbox::emit_memory_instruction(const Instruction& instr, uint64_t hex_off
   assm_.mov(rx, M64(rx));
 }
 
+bool Sandbox::can_elide_stack_checks(const Label& fxn) const {
+  if (fxn != main_fxn_ || instr_offset_ != (uint64_t)(-1)) {
+    return false;
+  }
+  // Any call into this function, or jump into it from elsewhere, would enter with a different %rsp
+  for (const auto& f : fxns_src_) {
+    for (const auto& instr : f.second->get_code()) {
+      const auto into = instr.get_opcode() == CALL_LABEL || (instr.is_any_jump() && f.first != fxn);
+      if (into && instr.type(0) == Type::LABEL && instr.get_operand<Label>(0) == fxn) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool Sandbox::stack_access_ok(const CpuState& cs, const StackAccess& sa) const {
+  // Inputs in error states are never run
+  if (cs.code != ErrorCode::NORMAL) {
+    return true;
+  }
+  const auto addr = cs.gp[rsp].get_fixed_quad(0) + sa.offset;
+  if ((addr & sa.align) != addr) {
+    return false;
+  }
+  for (size_t i = 0; i < sa.size; ++i) {
+    if (!cs.stack.in_range(addr + i) || !cs.stack.is_valid(addr + i)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void Sandbox::check_stack_accesses(const CpuState& cs) {
+  // Recompiling updates stack_accesses_, so find everything first
+  vector<Label> stale;
+  for (const auto& f : stack_accesses_) {
+    for (const auto& sa : f.second) {
+      if (!stack_access_ok(cs, sa)) {
+        stale.push_back(f.first);
+        break;
+      }
+    }
+  }
+  for (const auto& l : stale) {
+    recompile(*fxns_src_[l]);
+  }
+}
+
+bool Sandbox::emit_stack_access(const Instruction& instr, uint64_t align, uint64_t bytes) {
+  if (!stack_offset_known_) {
+    return false;
+  }
+  const auto mi = instr.mem_index();
+  const auto op = instr.get_operand<M64>(mi);
+  if (!op.contains_base() || op.get_base() != rsp || op.contains_index() ||
+      op.contains_seg() || op.rip_offset() || op.addr_or()) {
+    return false;
+  }
+
+  const int32_t disp = op.get_disp();
+  const StackAccess sa {stack_offset_ + disp, (size_t)__builtin_popcountll(bytes), align};
+  for (auto io : io_pairs_) {
+    if (!stack_access_ok(io->in_, sa)) {
+      return false;
+    }
+  }
+  stack_accesses_[main_fxn_].push_back(sa);
+
+  auto fxn = assm_.get_fxn();
+  DEBUG_SANDBOX(cout << "[sandbox][emit_stack_access] rebasing address at " << (fxn->data() + fxn->size()) << endl;)
+  (void) fxn;
+
+  // Backup rx and load it with the rebased address.  Neither xchg nor lea
+  // touch rflags, and nothing here needs the STOKE stack.
+  const auto rx = uses_rh(instr) ? rbp : get_unused_quad(instr);
+  assm_.xchg(rax, rx);
+  assm_.mov(Moffs64(&scratch_[rx]), rax);
+  assm_.mov(rax, Moffs64(&stack_rebase_));
+  assm_.xchg(rax, rx);
+  assm_.lea(rx, M64(rsp, rx, Scale::TIMES_1, Imm32(disp)));
+
+  // Assemble the instruction using the rebased operand instead
+  auto* temp = const_cast<Instruction*>(&instr);
+  temp->set_operand(mi, M8(rx));
+  assert(temp->check());
+  assm_.assemble(*temp);
+  temp->set_operand(mi, op);
+
+  // Restore rx
+  assm_.xchg(rax, rx);
+  assm_.mov(rax, Moffs64(&scratch_[rx]));
+  assm_.xchg(rax, rx);
+
+  return true;
+}
+
 void Sandbox::emit_jump(const Instruction& instr) {
   // Load the STOKE %rsp, we'll need to do some pushing here
   emit_load_stoke_rsp();
@@ -1252,6 +2000,8 @@ void Sandbox::emit_call(const Instruction& instr, uint64_t hex_offset) {
   emit_load_stoke_rsp();
   assm_.assemble(instr);
   emit_load_user_rsp();
+  // The callee decides where %rsp ends up
+  stack_offset_known_ = false;
 
   // This pop doesn't actually have to go anywhere.
   // We just want to be able to catch an rsp that was left in a bad location
@@ -1274,6 +2024,8 @@ void Sandbox::emit_call_with_stack_check(const Instruction& instr, uint64_t hex_
   // Restore the STOKE %rsp before the call
   emit_load_stoke_rsp();
   assm_.assemble(instr);
+  // The callee decides where %rsp ends up
+  stack_offset_known_ = false;
 
   // Backup some regs while we still have the stoke rsp
   assm_.push_1(rax);
@@ -1308,6 +2060,7 @@ void Sandbox::emit_ret(const Instruction& instr, const Label& exit) {
 
 void Sandbox::emit_leave(const Instruction& instr) {
   assm_.mov(rsp, rbp);
+  stack_offset_known_ = false;
   emit_pop({POP_R64_1, {rbp}});
 }
 
@@ -1507,11 +2260,13 @@ void Sandbox::emit_pop(const Instruction& instr) {
   case POP_R16:
   case POP_R16_1:
     assm_.lea(rsp, M64(rsp, Imm32(2)));
+    stack_offset_ += 2;
     emit_memory_instruction({MOV_R16_M16, {instr.get_operand<R16>(0), M16(rsp, Imm32(-2))}});
     break;
   case POP_R64:
   case POP_R64_1:
     assm_.lea(rsp, M64(rsp, Imm32(8)));
+    stack_offset_ += 8;
     emit_memory_instruction({MOV_R64_M64, {instr.get_operand<R64>(0), M64(rsp, Imm32(-8))}});
     break;
 
@@ -15,17 +15,20 @@
 #ifndef STOKE_SRC_SANDBOX_SANDBOX_H
 #define STOKE_SRC_SANDBOX_SANDBOX_H
 
+#include <sys/types.h>
 #include <unordered_map>
 #include <vector>
 
 #include "src/ext/x64asm/include/x64asm.h"
 
 #include "src/cfg/cfg.h"
+#include "src/cfg/stack_offsets.h"
 #include "src/sandbox/io_pair.h"
 #include "src/sandbox/function_iterator.h"
 #include "src/sandbox/input_iterator.h"
 #include "src/sandbox/output_iterator.h"
 #include "src/sandbox/state_callback.h"
+#include "src/sandbox/trace_buffer.h"
 #include "src/state/cpu_state.h"
 #include "src/validator/line_info.h"
 
@@ -53,6 +56,7 @@ public:
     set_stack_check(sb.stack_check_);
     set_max_jumps(sb.max_jumps_);
     set_use_child(sb.use_child_);
+    set_count_cycles(sb.count_cycles_);
 
     // Inputs
     for (size_t i = 0; i < sb.size(); ++i) {
@@ -83,10 +87,15 @@ public:
   }
   /** Sets whether the sandbox should report sigsegv for stack smashing violations. */
   Sandbox& set_stack_check(bool check) {
+    stop_fork_server();
     stack_check_ = check;
     return *this;
   }
-  /** Sets whether the sandbox uses a child process for the heavy lifting. */
+  /** Sets whether the sandbox uses a child process for the heavy lifting.
+    Unless there are callbacks to invoke, runs are forked from a server that
+    is started once per set of inputs, and results come back through shared
+    memory.  Recompiled functions are sent to the server rather than starting
+    a new one. */
   Sandbox& set_use_child(bool use) {
     use_child_ = use;
     return *this;
@@ -96,9 +105,15 @@ public:
     max_jumps_ = jumps;
     return *this;
   }
+  /** Sets whether runs are bracketed by fenced reads of the time stamp counter. */
+  Sandbox& set_count_cycles(bool count) {
+    count_cycles_ = count;
+    return *this;
+  }
   /** Sets a mapping from line number to RIP offset for cases where the
     default computation doesn't work. */
   Sandbox& set_linemap(const LineMap& m) {
+    stop_fork_server();
     rip_map_.clear();
     for (auto pair : m) {
       rip_map_[pair.first] = pair.second.rip_offset;
@@ -187,19 +202,21 @@ public:
   Sandbox& insert_after(StateCallback cb, void* arg);
   /** Insert a callback after this line */
   Sandbox& insert_after(const x64asm::Label& l, size_t line, StateCallback cb, void* arg);
-  /** Clears the set of callbacks to invoke during execution. */
+  /** Record a trace entry before this line.  Unlike a callback, this doesn't
+    leave JITted code or copy out the cpu state; only the tag and the registers
+    that buf was created with are written to buf.  buf must outlive the sandbox's
+    use of it.  Not supported when forking to run code. */
+  Sandbox& insert_trace_before(const x64asm::Label& l, size_t line, TraceBuffer* buf, uint64_t tag);
+  /** Record a trace entry after this line. */
+  Sandbox& insert_trace_after(const x64asm::Label& l, size_t line, TraceBuffer* buf, uint64_t tag);
+  /** Clears the set of callbacks and trace points to invoke during execution. */
   Sandbox& clear_callbacks();
 
   /** Designates a function as the entrypoint. */
-  Sandbox& set_entrypoint(const x64asm::Label& l) {
-    assert(contains_function(l));
-    main_fxn_ = l;
-    entrypoint_ = fxns_[main_fxn_]->get_entrypoint();
-    instr_offset_ = -1;
-    return *this;
-  }
+  Sandbox& set_entrypoint(const x64asm::Label& l);
   /** Designates a function and offset as the entrypoint. */
   Sandbox& set_entrypoint(const x64asm::Label& l, size_t instr_offset) {
+    stop_fork_server();
     set_entrypoint(l);
     instr_offset_ = instr_offset;
     recompile();
@@ -210,6 +227,14 @@ public:
   /** Run a main function for all inputs. */
   Sandbox& run();
 
+  /** Returns the cycles spent by the most recent timed run of an input. */
+  uint64_t get_cycles(size_t index) const {
+    assert(index < size());
+    return io_pairs_[index]->cycles_;
+  }
+  /** Returns the cycles that a timed run spends outside of user code; measured once. */
+  uint64_t get_cycle_overhead();
+
   /** @deprecated */
   size_t size() const {
     return num_inputs();
@@ -279,6 +304,8 @@ private:
   bool use_child_;
   /** The maximum number of jumps to take before raising SIGINT. */
   size_t max_jumps_;
+  /** Should runs read the time stamp counter? */
+  bool count_cycles_;
 
   /** Assembler, no sense in always creating these. */
   x64asm::Assembler assm_;
@@ -296,6 +323,10 @@ private:
   std::pair<StateCallback, void*> global_after_;
   /** After callbacks on a per-line basis */
   std::unordered_map<x64asm::Label, std::unordered_map<size_t, std::pair<StateCallback, void*>>> after_;
+  /** Trace points to record before a line */
+  std::unordered_map<x64asm::Label, std::unordered_map<size_t, std::pair<TraceBuffer*, uint64_t>>> trace_before_;
+  /** Trace points to record after a line */
+  std::unordered_map<x64asm::Label, std::unordered_map<size_t, std::pair<TraceBuffer*, uint64_t>>> trace_after_;
 
   /** Each function gets a pool of anonymous labels to use. */
   std::unordered_map<x64asm::Label, std::vector<x64asm::Label>*> label_pools_;
@@ -328,6 +359,13 @@ private:
   uint64_t user_rsp_;
   /** The harness's %rsp */
   uint64_t harness_rsp_;
+
+  /** Time stamp counter on entry to the timed harness */
+  uint64_t tsc_start_;
+  /** Time stamp counter on exit from the timed harness */
+  uint64_t tsc_end_;
+  /** Cached result of get_cycle_overhead(); zero until measured */
+  uint64_t cycle_overhead_;
   /** STOKE's %rsp */
   uint64_t stoke_rsp_;
 
@@ -340,6 +378,10 @@ private:
   x64asm::Function* fxn_;
   /** Pointer to the harness function */
   x64asm::Function harness_;
+  /** Pointer to the harness function that reads the time stamp counter */
+  x64asm::Function timed_harness_;
+  /** A function that returns immediately; used to measure timed harness overhead */
+  x64asm::Function empty_fxn_;
   /** Pointer to the signal trap function */
   x64asm::Function signal_trap_;
   /** Functions that the code may invoke at runtime. Pointers to simplify reallocation. */
@@ -347,12 +389,49 @@ private:
   /** Pointer to the current main function */
   x64asm::Label main_fxn_;
 
+  /** An access to the user's stack at a fixed offset from %rsp on entry to
+    the main function, which was emitted without bounds or alignment checks. */
+  struct StackAccess {
+    /** Offset of the first byte from %rsp on entry */
+    int64_t offset;
+    /** Number of bytes */
+    size_t size;
+    /** Alignment mask; a well aligned address won't change when and'ed with it */
+    uint64_t align;
+  };
+  /** The unchecked stack accesses in each function; only ever the main function. */
+  std::unordered_map<x64asm::Label, std::vector<StackAccess>> stack_accesses_;
+  /** Is the offset of the user's %rsp from its value on entry known for the instruction being emitted? */
+  bool stack_offset_known_;
+  /** If so, the offset */
+  int64_t stack_offset_;
+  /** Difference between physical and virtual stack addresses for the current input */
+  uint64_t stack_rebase_;
+
   /** Auxiliary function source (saved in case recompilation is necessary). */
   std::unordered_map<x64asm::Label, Cfg*> fxns_src_;
 
   /** RIP offset map to override default computation. */
   std::map<size_t, uint64_t> rip_map_;
 
+  /** A copy of this process forked once the code and inputs are in place.  It
+    forks again for each run, so every run starts from the same snapshot. */
+  struct ForkServer {
+    /** The server's process id; -1 if there is no server */
+    pid_t pid;
+    /** The process that started the server; forked copies of it start their own */
+    pid_t owner;
+    /** Our end of a socket to the server */
+    int fd;
+    /** Shared memory that runs write their output states into */
+    uint8_t* buffer;
+    /** Size of the shared memory */
+    size_t buffer_size;
+    /** Functions recompiled since the server last heard from us, serialized */
+    std::unordered_map<x64asm::Label, std::string> recompiled;
+  };
+  ForkServer fork_server_;
+
   /** Do setup in constructor. */
   void init();
 
@@ -412,23 +491,43 @@ private:
   /** Recompiles every function */
   void recompile();
 
-  /** Assembles the harness function */
-  x64asm::Function emit_harness();
+  /** Assembles the harness function; optionally brackets the call with time stamp reads */
+  x64asm::Function emit_harness(bool timed = false);
+  /** Emits a fenced read of the time stamp counter into a variable */
+  void emit_read_tsc(uint64_t* dest, bool start);
   /** Assembles a signal handler trap */
   x64asm::Function emit_signal_trap();
   /** Assembles a function for writing user state (modulo rsp) to the cpu */
   x64asm::Function emit_state2cpu(const CpuState& cs);
   /** Assembles a function for reading user state from the cpu */
   x64asm::Function emit_cpu2state(CpuState& cs);
-  /** Returns a function that maps virtual addresses to physical addresses. */
-  x64asm::Function emit_map_addr(CpuState& cs);
-  /** Returns code to check memory for validity and then toggle def bits. */
-  void emit_map_addr_cases(const x64asm::Label& fail, const x64asm::Label& done, Memory* mem);
+  /** Returns a function that maps virtual addresses to physical addresses in
+    an output state, noting which pages get written. */
+  x64asm::Function emit_map_addr(IoPair& io);
+  /** Emits a binary search over segments [begin, end), sorted by address and
+    non-overlapping, that jumps to the mapping code for the segment holding %rdi. */
+  void emit_map_addr_search(const std::vector<Memory*>& segments, size_t begin, size_t end,
+                            const x64asm::Label& fail, const x64asm::Label& done,
+                            const std::unordered_map<Memory*, DirtyPages*>& dirty);
+  /** Returns code to check memory for validity and then toggle def bits.
+    Writes flag their pages in dirty, unless it's null. */
+  void emit_map_addr_cases(const x64asm::Label& fail, const x64asm::Label& done, Memory* mem,
+                           DirtyPages* dirty);
+
+  /** Can stack accesses in this function be checked at compile time?  This
+    requires that every run enters it with the input's %rsp. */
+  bool can_elide_stack_checks(const x64asm::Label& fxn) const;
+  /** Is this access in bounds, valid and aligned for an input? */
+  bool stack_access_ok(const CpuState& cs, const StackAccess& sa) const;
+  /** Recompiles any function whose unchecked stack accesses aren't safe for an input. */
+  void check_stack_accesses(const CpuState& cs);
 
   /** Assembles the user's function into a buffer.  Returns if successful. */
   bool emit_function(const Cfg& cfg, x64asm::Function* fxn);
   /** Emit a single callback for this line. */
   void emit_callback(const std::pair<StateCallback, void*>& cb, const x64asm::Label& fxn, size_t line);
+  /** Emit code that appends an entry to a trace buffer. */
+  void emit_trace(const std::pair<TraceBuffer*, uint64_t>& tp);
   /** Emit all before callbacks */
   void emit_before(const x64asm::Label& fxn, size_t line);
   /** Emit all after callbacks */
@@ -437,6 +536,9 @@ private:
   void emit_instruction(const x64asm::Instruction& instr, const x64asm::Label& fxn, uint64_t hex_offset, const x64asm::Label& entry, const x64asm::Label& exit);
   /** Emit a memory instruction. */
   void emit_memory_instruction(const x64asm::Instruction& instr, uint64_t hex_offset = 0);
+  /** Emit a memory instruction without checks if it provably touches valid stack
+    memory for every input.  Returns false (and emits nothing) otherwise. */
+  bool emit_stack_access(const x64asm::Instruction& instr, uint64_t align, uint64_t bytes);
   /** Emit a jump instruction */
   void emit_jump(const x64asm::Instruction& instr);
   /** Emit the CALL LABEL instruction with no special stack smashing check. */
@@ -478,6 +580,19 @@ private:
 
   /** Runs sandbox in a child process. */
   void run_child(size_t index);
+  /** Runs sandbox in a child of the fork server. */
+  void run_fork_server(size_t index);
+  /** Starts the fork server if it isn't running.  Returns false on failure. */
+  bool start_fork_server();
+  /** Stops the fork server; it's out of date whenever code or inputs change. */
+  void stop_fork_server();
+  /** What the fork server does; never returns. */
+  void serve_fork_server(int fd);
+  /** Are there callbacks that have to run in this process? */
+  bool has_callbacks() const {
+    return global_before_.first != nullptr || global_after_.first != nullptr ||
+           !before_.empty() || !after_.empty();
+  }
   /** Updates the callbacks for the child */
   void update_child_callback(std::pair<StateCallback, void*>& pair, std::ostream& os);
   void update_child_callback(std::unordered_map<x64asm::Label,
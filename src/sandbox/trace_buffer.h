@@ -0,0 +1,109 @@
+// Copyright 2013-2019 Stanford University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef STOKE_SRC_SANDBOX_TRACE_BUFFER_H
+#define STOKE_SRC_SANDBOX_TRACE_BUFFER_H
+
+#include <cassert>
+#include <stdint.h>
+#include <vector>
+
+#include "src/ext/x64asm/include/x64asm.h"
+
+namespace stoke {
+
+class Sandbox;
+
+/** A ring buffer that the sandbox writes trace points into directly from
+  JITted code.  Each entry holds the tag of the trace point that produced it
+  followed by the values of a fixed set of 64-bit general purpose registers.
+  When the buffer is full, new entries overwrite the oldest ones. */
+class TraceBuffer {
+  friend class Sandbox;
+
+public:
+  /** Creates a buffer that records the 64-bit general purpose registers in
+    regs (which may be empty).  Capacity is rounded up to a power of two. */
+  TraceBuffer(const x64asm::RegSet& regs, size_t capacity = 1024) {
+    for (size_t i = 0; i < 16; ++i) {
+      if (regs.contains(x64asm::r64s[i])) {
+        regs_.push_back(x64asm::r64s[i]);
+      }
+    }
+    size_t cap = 1;
+    while (cap < capacity) {
+      cap <<= 1;
+    }
+    stride_ = 1 + regs_.size();
+    mask_ = cap - 1;
+    data_.resize(cap * stride_);
+    head_ = 0;
+  }
+
+  /** Returns the maximum number of entries held at once. */
+  size_t capacity() const {
+    return mask_ + 1;
+  }
+  /** Returns the registers recorded in each entry, in order. */
+  const std::vector<x64asm::R64>& get_regs() const {
+    return regs_;
+  }
+
+  /** Returns the number of entries held. */
+  size_t size() const {
+    return head_ < capacity() ? head_ : capacity();
+  }
+  /** Returns the number of entries that were overwritten since the last clear. */
+  size_t dropped() const {
+    return head_ - size();
+  }
+  /** Returns the tag of the ith entry, oldest first. */
+  uint64_t get_tag(size_t i) const {
+    return entry(i)[0];
+  }
+  /** Returns the value of the kth register in get_regs() for the ith entry, oldest first. */
+  uint64_t get_reg(size_t i, size_t k) const {
+    assert(k < regs_.size());
+    return entry(i)[1 + k];
+  }
+
+  /** Discards all entries. */
+  TraceBuffer& clear() {
+    head_ = 0;
+    return *this;
+  }
+
+private:
+  /** The registers to record. */
+  std::vector<x64asm::R64> regs_;
+  /** Number of quads per entry. */
+  size_t stride_;
+  /** Capacity minus one, used to wrap entry indices. */
+  size_t mask_;
+  /** Entry storage. */
+  std::vector<uint64_t> data_;
+  /** Total number of entries written since the last clear; updated by JITted code. */
+  uint64_t head_;
+
+  /** Returns a pointer to the ith entry, oldest first. */
+  const uint64_t* entry(size_t i) const {
+    assert(i < size());
+    const auto idx = (head_ - size() + i) & mask_;
+    return data_.data() + idx * stride_;
+  }
+};
+
+} // namespace stoke
+
+#endif
@@ -0,0 +1,120 @@
+// Copyright 2013-2019 Stanford University
+//
+// Licensed under the Apache License, Version 2.0 (the License);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an AS IS BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <cassert>
+
+#include "src/search/candidate_board.h"
+
+using namespace std;
+
+namespace stoke {
+
+CandidateBoard::CandidateBoard(size_t num_searchers) :
+  slots_(num_searchers), cursors_(num_searchers, 0) {
+  assert(num_searchers > 0);
+  for (auto& s : slots_) {
+    s.store(nullptr);
+  }
+  next_slot_.store(0);
+  pending_.store(0);
+  verified_.store(nullptr);
+  counterexamples_.store(nullptr);
+  closed_.store(false);
+}
+
+CandidateBoard::~CandidateBoard() {
+  for (auto& s : slots_) {
+    delete s.load();
+  }
+  delete verified_.load();
+  for (auto c = counterexamples_.load(); c != nullptr;) {
+    const auto next = c->next;
+    delete c;
+    c = next;
+  }
+}
+
+void CandidateBoard::publish(size_t searcher, const Cfg& rewrite, Cost cost) {
+  assert(searcher < slots_.size());
+
+  // Count the candidate before it becomes visible, so that pending() can't
+  // momentarily underflow if a verifier takes and finishes it right away
+  pending_++;
+  const auto old = slots_[searcher].exchange(new Candidate {rewrite, cost, searcher});
+  if (old != nullptr) {
+    delete old;
+    pending_--;
+  }
+}
+
+CandidateBoard::Candidate* CandidateBoard::take() {
+  const auto start = next_slot_++;
+  for (size_t i = 0, ie = slots_.size(); i < ie; ++i) {
+    const auto c = slots_[(start + i) % ie].exchange(nullptr);
+    if (c != nullptr) {
+      return c;
+    }
+  }
+  return nullptr;
+}
+
+void CandidateBoard::finish(Candidate* c) {
+  assert(c != nullptr);
+  delete c;
+  pending_--;
+}
+
+void CandidateBoard::set_verified(const Candidate& c) {
+  const auto v = new Candidate(c);
+  Candidate* expected = nullptr;
+  if (!verified_.compare_exchange_strong(expected, v)) {
+    delete v;
+  }
+}
+
+void CandidateBoard::add_counterexample(const CpuState& cs) {
+  auto node = new Counterexample {cs, 0, counterexamples_.load()};
+  do {
+    node->seq = node->next == nullptr ? 1 : node->next->seq + 1;
+  } while (!counterexamples_.compare_exchange_weak(node->next, node));
+}
+
+size_t CandidateBoard::drain_counterexamples(size_t searcher, vector<CpuState>& out) {
+  assert(searcher < cursors_.size());
+
+  const auto head = counterexamples_.load();
+  if (head == nullptr || head->seq == cursors_[searcher]) {
+    return 0;
+  }
+
+  // The list is newest-first; hand back the unseen suffix in the order it was added
+  const auto n = head->seq - cursors_[searcher];
+  const auto begin = out.size();
+  out.resize(begin + n);
+  auto c = head;
+  for (size_t i = n; i > 0; --i, c = c->next) {
+    out[begin + i - 1] = c->cs;
+  }
+
+  cursors_[searcher] = head->seq;
+  return n;
+}
+
+size_t CandidateBoard::num_counterexamples() const {
+  const auto head = counterexamples_.load();
+  return head == nullptr ? 0 : head->seq;
+}
+
+} // namespace stoke
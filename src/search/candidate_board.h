@@ -0,0 +1,132 @@
+// Copyright 2013-2019 Stanford University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef STOKE_SRC_SEARCH_CANDIDATE_BOARD_H
+#define STOKE_SRC_SEARCH_CANDIDATE_BOARD_H
+
+#include <atomic>
+#include <vector>
+
+#include "src/cfg/cfg.h"
+#include "src/cost/cost.h"
+#include "src/state/cpu_state.h"
+
+namespace stoke {
+
+/** A lock-free meeting point between searchers and verifiers.
+
+  Each searcher owns a slot on the board.  Publishing a candidate replaces
+  whatever is sitting in that slot; a searcher's newer best correct rewrite
+  always supersedes one that nobody has started verifying yet.  Verifiers take
+  candidates from any slot, and report back with either a verified rewrite or
+  a counterexample.  Counterexamples are appended to a shared list that every
+  searcher reads at its own pace, so each searcher's testcase set grows without
+  its chain having to stop.
+
+  Nothing here blocks; every operation is a single atomic exchange or
+  compare-and-swap.  Candidates and counterexamples are heap allocated and
+  owned by whoever most recently removed them from the board. */
+class CandidateBoard {
+public:
+  /** A rewrite waiting for verification. */
+  struct Candidate {
+    /** The rewrite to verify. */
+    Cfg rewrite;
+    /** Its cost under the searcher's cost function. */
+    Cost cost;
+    /** Which searcher published it. */
+    size_t searcher;
+  };
+
+  /** Creates a board with one slot per searcher. */
+  CandidateBoard(size_t num_searchers);
+  /** Frees anything that is still on the board. */
+  ~CandidateBoard();
+
+  CandidateBoard(const CandidateBoard&) = delete;
+  CandidateBoard& operator=(const CandidateBoard&) = delete;
+
+  /** Returns the number of searcher slots. */
+  size_t num_searchers() const {
+    return slots_.size();
+  }
+
+  /** Called by a searcher; publishes a candidate, replacing any that has not been taken yet. */
+  void publish(size_t searcher, const Cfg& rewrite, Cost cost);
+  /** Called by a verifier; takes the next candidate, or returns nullptr if there is none.
+    The caller must hand the candidate back with finish(). */
+  Candidate* take();
+  /** Called by a verifier once it is done with a candidate. */
+  void finish(Candidate* c);
+  /** Returns the number of candidates that are published or being verified. */
+  size_t pending() const {
+    return pending_.load();
+  }
+
+  /** Called by a verifier; records a rewrite that verified.  The first one wins. */
+  void set_verified(const Candidate& c);
+  /** Returns the first verified rewrite, or nullptr if there is none yet. */
+  const Candidate* get_verified() const {
+    return verified_.load();
+  }
+
+  /** Called by a verifier; shares a counterexample with every searcher. */
+  void add_counterexample(const CpuState& cs);
+  /** Called by a searcher; appends every counterexample that it has not yet
+    seen to out.  Returns the number of new counterexamples. */
+  size_t drain_counterexamples(size_t searcher, std::vector<CpuState>& out);
+  /** Returns the total number of counterexamples added to the board. */
+  size_t num_counterexamples() const;
+
+  /** Asks verifiers to stop once they are done with their current candidate. */
+  void close() {
+    closed_.store(true);
+  }
+  /** Has the board been closed? */
+  bool is_closed() const {
+    return closed_.load();
+  }
+
+private:
+  /** A counterexample in the shared list; newest first. */
+  struct Counterexample {
+    CpuState cs;
+    /** Number of counterexamples up to and including this one. */
+    size_t seq;
+    Counterexample* next;
+  };
+
+  /** One slot per searcher. */
+  std::vector<std::atomic<Candidate*>> slots_;
+  /** Where the next call to take() begins scanning, so no slot starves. */
+  std::atomic<size_t> next_slot_;
+  /** Published candidates that have not yet been finished. */
+  std::atomic<size_t> pending_;
+
+  /** The first rewrite to verify. */
+  std::atomic<Candidate*> verified_;
+
+  /** Head of the counterexample list.  Nodes are never removed while the board exists. */
+  std::atomic<Counterexample*> counterexamples_;
+  /** The sequence number of the last counterexample each searcher has seen.
+    Each entry is only touched by the searcher that owns it. */
+  std::vector<size_t> cursors_;
+
+  /** Set once verifiers should wind down. */
+  std::atomic<bool> closed_;
+};
+
+} // namespace stoke
+
+#endif
@@ -12,6 +12,7 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
 #include <cassert>
 #include <cmath>
 #include <csignal>
@@ -46,6 +47,10 @@ Search::Search(Transform* transform) : transform_(transform) {
   set_progress_callback(nullptr, nullptr);
   set_statistics_callback(nullptr, nullptr);
   set_statistics_interval(100000);
+  set_refresh_callback(nullptr, nullptr, 1000);
+  set_adapt_interval(0);
+  set_reorder_interval(0);
+  set_testcase_subset(0);
 
   static bool once = false;
   if (!once) {
@@ -73,7 +78,11 @@ void Search::run(const Cfg& target, CostFunction& fxn, Init init, SearchState& s
   // Statistics callback variables
   // FIXME: Search only works with 'WeightedTransform', because it needs
   // statistics.
-  move_statistics = vector<Statistics>(static_cast<WeightedTransform*>(transform_)->size());
+  auto weighted = static_cast<WeightedTransform*>(transform_);
+  move_statistics = vector<Statistics>(weighted->size());
+  if (adapt_interval_ > 0) {
+    weighted->reset_weights();
+  }
   num_iterations = 0;
   const auto start = chrono::steady_clock::now();
 
@@ -85,6 +94,7 @@ void Search::run(const Cfg& target, CostFunction& fxn, Init init, SearchState& s
     return;
   }
 
+  reset_testcases(fxn);
   TransformInfo ti;
 
   give_up_now = false;
@@ -96,6 +106,20 @@ void Search::run(const Cfg& target, CostFunction& fxn, Init init, SearchState& s
       num_iterations = iterations;
       statistics_cb_(get_statistics(), statistics_cb_arg_);
     }
+    // Give the client a chance to change the cost function without stopping the chain
+    if ((refresh_cb_ != nullptr) && refresh_interval_ > 0 && (iterations % refresh_interval_ == 0) &&
+        iterations > 0 && refresh_cb_({state}, refresh_cb_arg_)) {
+      // The testcases may have changed too
+      fxn.set_testcase_limit(-1);
+      refresh(target, fxn, state);
+      reset_testcases(fxn);
+    }
+    if (reorder_interval_ > 0 && iterations % reorder_interval_ == 0 && iterations > 0) {
+      reorder_testcases(fxn);
+    }
+    if (adapt_interval_ > 0 && iterations % adapt_interval_ == 0 && iterations > 0) {
+      weighted->adapt(move_statistics);
+    }
 
     // This is just here to clean up the for loop; check early exit conditions
     if (timeout_itr_ > 0 && iterations >= timeout_itr_) {
@@ -116,7 +140,7 @@ void Search::run(const Cfg& target, CostFunction& fxn, Init init, SearchState& s
     const auto p = prob_(gen_);
     const auto max = state.current_cost - (log(p) / beta_);
 
-    const auto new_res = fxn(state.current, max + 1);
+    const auto new_res = evaluate(fxn, state.current, max + 1);
     const auto is_correct = new_res.first;
     const auto new_cost = new_res.second;
 
@@ -147,6 +171,9 @@ void Search::run(const Cfg& target, CostFunction& fxn, Init init, SearchState& s
     }
   }
 
+  // Leave the cost function evaluating everything
+  fxn.set_testcase_limit(-1);
+
   // update values for statistics
   elapsed = duration_cast<duration<double>>(steady_clock::now() - start);
   num_iterations = iterations;
@@ -170,6 +197,58 @@ void Search::stop() {
   give_up_now = true;
 }
 
+void Search::reset_testcases(CostFunction& fxn) {
+  const auto n = fxn.num_testcases();
+  testcase_rejections_.assign(n, 0);
+  testcase_order_.clear();
+  for (size_t i = 0; i < n; ++i) {
+    testcase_order_.push_back(i);
+  }
+  subset_ = (subset_size_ > 0 && subset_size_ < n) ? subset_size_ : n;
+
+  if (n > 0) {
+    fxn.set_testcase_order(testcase_order_);
+    fxn.set_testcase_limit(n);
+  }
+}
+
+void Search::reorder_testcases(CostFunction& fxn) {
+  if (testcase_order_.empty()) {
+    return;
+  }
+
+  stable_sort(testcase_order_.begin(), testcase_order_.end(), [this](size_t x, size_t y) {
+    return testcase_rejections_[x] > testcase_rejections_[y];
+  });
+  fxn.set_testcase_order(testcase_order_);
+
+  // Halve the counts so that the order follows the search as it moves on
+  for (auto& r : testcase_rejections_) {
+    r /= 2;
+  }
+}
+
+CostFunction::result_type Search::evaluate(CostFunction& fxn, const Cfg& cfg, Cost max) {
+  // A proposal that's over budget on the subset is over budget on everything
+  auto res = CostFunction::result_type(false, 0);
+  if (subset_ < testcase_order_.size()) {
+    fxn.set_testcase_limit(subset_);
+    res = fxn(cfg, max);
+    fxn.set_testcase_limit(testcase_order_.size());
+  }
+  if (res.second < max) {
+    res = fxn(cfg, max);
+  }
+
+  if (res.second >= max) {
+    const auto t = fxn.get_failing_testcase();
+    if (t >= 0 && (size_t)t < testcase_rejections_.size()) {
+      testcase_rejections_[t]++;
+    }
+  }
+  return res;
+}
+
 void Search::configure(const Cfg& target, CostFunction& fxn, SearchState& state, vector<TUnit>& aux_fxn) const {
   state.current.recompute();
   state.best_yet.recompute();
@@ -204,6 +283,24 @@ void Search::configure(const Cfg& target, CostFunction& fxn, SearchState& state,
   assert(state.best_yet_cost <= state.current_cost);
 }
 
+void Search::refresh(const Cfg& target, CostFunction& fxn, SearchState& state) const {
+  state.current_cost = fxn(state.current).second;
+  state.best_yet_cost = fxn(state.best_yet).second;
+  if (state.current_cost < state.best_yet_cost) {
+    state.best_yet = state.current;
+    state.best_yet_cost = state.current_cost;
+  }
 
+  // A new testcase may show that our best correct rewrite isn't; fall back on
+  // the target, which is correct by definition
+  const auto res = fxn(state.best_correct);
+  if (res.first) {
+    state.best_correct_cost = res.second;
+  } else {
+    state.best_correct = target;
+    state.best_correct_cost = fxn(state.best_correct).second;
+    state.success = false;
+  }
+}
 
 } // namespace stoke
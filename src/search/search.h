@@ -22,6 +22,7 @@
 #include "src/search/init.h"
 #include "src/search/progress_callback.h"
 #include "src/search/new_best_correct_callback.h"
+#include "src/search/refresh_callback.h"
 #include "src/search/search_state.h"
 #include "src/search/statistics.h"
 #include "src/search/statistics_callback.h"
@@ -73,11 +74,37 @@ public:
     statistics_cb_arg_ = arg;
     return *this;
   }
+  /** Set refresh callback function and the number of proposals to perform between calls (0 to never call it). */
+  Search& set_refresh_callback(RefreshCallback cb, void* arg, size_t interval) {
+    refresh_cb_ = cb;
+    refresh_cb_arg_ = arg;
+    refresh_interval_ = interval;
+    return *this;
+  }
   /** Set the number of proposals to perform between statistics updates. */
   Search& set_statistics_interval(size_t si) {
     interval_ = si;
     return *this;
   }
+  /** Set the number of proposals between adapting transform weights to how
+    often each kind of move is accepted (0 to keep the weights fixed). */
+  Search& set_adapt_interval(size_t ai) {
+    adapt_interval_ = ai;
+    return *this;
+  }
+  /** Set the number of proposals between reordering testcases so that those
+    that reject the most proposals go first (0 to keep them as they are). */
+  Search& set_reorder_interval(size_t ri) {
+    reorder_interval_ = ri;
+    return *this;
+  }
+  /** Evaluate proposals on the first n testcases, and only on the rest if they
+    aren't rejected there (0 to always use all of them).  Rejections are exact
+    as long as the cost never goes down when more testcases fail. */
+  Search& set_testcase_subset(size_t n) {
+    subset_size_ = n;
+    return *this;
+  }
 
   /** Run search beginning from a search state using a user-supplied cost function. */
   void run(const Cfg& target, CostFunction& fxn, Init init, SearchState& state, std::vector<stoke::TUnit>& aux_fxn);
@@ -116,14 +143,42 @@ private:
   void* statistics_cb_arg_;
   /** How often are statistics printed? */
   size_t interval_;
+  /** Refresh callback. */
+  RefreshCallback refresh_cb_;
+  void* refresh_cb_arg_;
+  /** How often is the refresh callback invoked? */
+  size_t refresh_interval_;
+
+  /** How often are transform weights adapted? */
+  size_t adapt_interval_;
+  /** How often are testcases reordered? */
+  size_t reorder_interval_;
+  /** How many testcases to try proposals on first? */
+  size_t subset_size_;
 
   /** Statistics so far. */
   std::vector<Statistics> move_statistics;
   size_t num_iterations;
   std::chrono::duration<double> elapsed;
 
+  /** How many proposals each testcase was the first to reject (decays on reordering). */
+  std::vector<size_t> testcase_rejections_;
+  /** The order testcases are evaluated in, most rejections first. */
+  std::vector<size_t> testcase_order_;
+  /** How many of them make up the subset? */
+  size_t subset_;
+
   /** Configures a search state. */
   void configure(const Cfg& target, CostFunction& fxn, SearchState& state, std::vector<stoke::TUnit>& aux_fxn) const;
+  /** Recomputes the costs in a search state after the cost function has changed. */
+  void refresh(const Cfg& target, CostFunction& fxn, SearchState& state) const;
+
+  /** Forgets testcase statistics and goes back to evaluating every testcase in order. */
+  void reset_testcases(CostFunction& fxn);
+  /** Sorts testcases by how many proposals they've rejected lately. */
+  void reorder_testcases(CostFunction& fxn);
+  /** Evaluates a proposal, on the subset first if there is one, and records which testcase rejected it. */
+  CostFunction::result_type evaluate(CostFunction& fxn, const Cfg& cfg, Cost max);
 };
 
 } // namespace stoke
@@ -0,0 +1,95 @@
+// Copyright 2013-2019 Stanford University
+//
+// Licensed under the Apache License, Version 2.0 (the License);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an AS IS BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef STOKE_SRC_SERIALIZE_HASH64_H
+#define STOKE_SRC_SERIALIZE_HASH64_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+namespace stoke {
+
+/** A fast, non-cryptographic 64-bit hash of a byte range (MurmurHash64A).
+  Good for naming content, not for resisting anyone trying to collide it. */
+inline uint64_t hash64(const void* data, size_t size, uint64_t seed = 0) {
+  const uint64_t m = 0xc6a4a7935bd1e995ull;
+  const int r = 47;
+
+  uint64_t h = seed ^ (size * m);
+
+  const auto bytes = static_cast<const uint8_t*>(data);
+  const auto end = bytes + (size & ~(size_t)7);
+  for (auto p = bytes; p != end; p += 8) {
+    uint64_t k;
+    memcpy(&k, p, 8);
+
+    k *= m;
+    k ^= k >> r;
+    k *= m;
+
+    h ^= k;
+    h *= m;
+  }
+
+  switch (size & 7) {
+  case 7:
+    h ^= uint64_t(end[6]) << 48;
+    // fall through
+  case 6:
+    h ^= uint64_t(end[5]) << 40;
+    // fall through
+  case 5:
+    h ^= uint64_t(end[4]) << 32;
+    // fall through
+  case 4:
+    h ^= uint64_t(end[3]) << 24;
+    // fall through
+  case 3:
+    h ^= uint64_t(end[2]) << 16;
+    // fall through
+  case 2:
+    h ^= uint64_t(end[1]) << 8;
+    // fall through
+  case 1:
+    h ^= uint64_t(end[0]);
+    h *= m;
+  }
+
+  h ^= h >> r;
+  h *= m;
+  h ^= h >> r;
+
+  return h;
+}
+
+/** Hashes a string. */
+inline uint64_t hash64(const std::string& s, uint64_t seed = 0) {
+  return hash64(s.data(), s.size(), seed);
+}
+
+/** Formats a hash as 16 hex digits. */
+inline std::string hash64_hex(uint64_t h) {
+  const char* digits = "0123456789abcdef";
+  std::string s(16, '0');
+  for (size_t i = 0; i < 16; ++i) {
+    s[15-i] = digits[h & 0xf];
+    h >>= 4;
+  }
+  return s;
+}
+
+} // namespace stoke
+
+#endif
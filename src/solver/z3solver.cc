@@ -15,7 +15,6 @@
 
 #include <iostream>
 #include <fstream>
-#include <chrono>
 
 #include "src/solver/z3solver.h"
 #include "src/symstate/axiom_visitor.h"
@@ -23,24 +22,16 @@
 #include "src/symstate/typecheck_visitor.h"
 #include "src/symstate/memo_visitor.h"
 #include "src/symstate/visitor.h"
+#include "src/telemetry/telemetry.h"
 #include "src/validator/md5.h"
 
 using namespace stoke;
 using namespace z3;
 using namespace std;
-using namespace std::chrono;
 
 //#define STOKE_Z3_DEBUG_LAST_HASH YESPLEASE
-//#define DEBUG_Z3_PERFORMANCE 1
 #define DEBUG_Z3(X) { if(0) { X } }
 
-#ifdef DEBUG_Z3_INTERFACE_PERFORMANCE
-uint64_t Z3Solver::number_queries_ = 0;
-uint64_t Z3Solver::typecheck_time_ = 0;
-uint64_t Z3Solver::convert_time_ = 0;
-uint64_t Z3Solver::solver_time_ = 0;
-#endif
-
 vector<SymBool> split_constraints(const vector<SymBool>& constraints) {
   vector<SymBool> split;
   for (auto it : constraints) {
@@ -62,10 +53,6 @@ vector<SymBool> split_constraints(const vector<SymBool>& constraints) {
 
 bool Z3Solver::is_sat(const vector<SymBool>& constraints) {
 
-#ifdef DEBUG_Z3_INTERFACE_PERFORMANCE
-  number_queries_++;
-#endif
-
   /* Reset state. */
   error_ = "";
   model_ = 0;
@@ -86,6 +73,8 @@ bool Z3Solver::is_sat(const vector<SymBool>& constraints) {
   const vector<SymBool>* current = &split;
   vector<SymBool>* new_constraints = 0;
   bool free_it = false;
+  uint64_t typecheck_time = 0;
+  uint64_t convert_time = 0;
 
   auto check_abort = [&]() -> bool {
     if (stop_now_) {
@@ -105,10 +94,7 @@ bool Z3Solver::is_sat(const vector<SymBool>& constraints) {
     for (auto it : *current) {
       if (check_abort()) return false;
 
-#ifdef DEBUG_Z3_INTERFACE_PERFORMANCE
-      number_queries_++;
-      microseconds typecheck_start = duration_cast<microseconds>(system_clock::now().time_since_epoch());
-#endif
+      auto typecheck_start = Telemetry::now();
       if (tc(it) != 1) {
         stringstream ss;
         ss << "Typechecking failed for constraint: " << it << endl;
@@ -119,10 +105,8 @@ bool Z3Solver::is_sat(const vector<SymBool>& constraints) {
         error_ = ss.str();
         return false;
       }
-#ifdef DEBUG_Z3_INTERFACE_PERFORMANCE
-      microseconds typecheck_end = duration_cast<microseconds>(system_clock::now().time_since_epoch());
-      typecheck_time_ += (typecheck_end - typecheck_start).count();
-#endif
+      auto typecheck_end = Telemetry::now();
+      typecheck_time += typecheck_end - typecheck_start;
 
       auto constraint = ec(it);
       if (ec.has_error()) {
@@ -130,10 +114,7 @@ bool Z3Solver::is_sat(const vector<SymBool>& constraints) {
         return false;
       }
 
-#ifdef DEBUG_Z3_INTERFACE_PERFORMANCE
-      microseconds convert_end = duration_cast<microseconds>(system_clock::now().time_since_epoch());
-      convert_time_ += (convert_end - typecheck_end).count();
-#endif
+      convert_time += Telemetry::now() - typecheck_end;
       DEBUG_Z3(
         cout << it << endl;
         cout << constraint << endl;)
@@ -148,11 +129,11 @@ bool Z3Solver::is_sat(const vector<SymBool>& constraints) {
   }
   delete current;
 
+  Telemetry::record(Telemetry::SOLVER_TYPECHECK, typecheck_time);
+  Telemetry::record(Telemetry::SOLVER_CONVERT, convert_time);
+
   /* Run the solver and see */
   try {
-#if defined(DEBUG_Z3_INTERFACE_PERFORMANCE) || defined(DEBUG_Z3_PERFORMANCE)
-    microseconds solver_start = duration_cast<microseconds>(system_clock::now().time_since_epoch());
-#endif
     if (check_abort()) return false;
 
     DEBUG_Z3(
@@ -170,16 +151,9 @@ bool Z3Solver::is_sat(const vector<SymBool>& constraints) {
     last_text_ = smt;
 #endif
 
+    Telemetry::Timer check_timer(Telemetry::SOLVER_CHECK);
     auto result = solver_.check();
-#if defined(DEBUG_Z3_INTERFACE_PERFORMANCE) || defined(DEBUG_Z3_PERFORMANCE)
-    microseconds solver_end = duration_cast<microseconds>(system_clock::now().time_since_epoch());
-#endif
-#ifdef DEBUG_Z3_PERFORMANCE
-    cout << "[z3perf] " << (solver_end-solver_start).count()/1000 << "ms" << endl;
-#endif
-#ifdef DEBUG_Z3_INTERFACE_PERFORMANCE
-    solver_time_ += (solver_end - solver_start).count();
-#endif
+    check_timer.stop();
 
     switch (result) {
     case unsat: {
@@ -23,8 +23,6 @@
 #include "src/symstate/bitvector.h"
 #include "src/symstate/memo_visitor.h"
 
-//#define DEBUG_Z3_INTERFACE_PERFORMANCE
-
 //#define STOKE_Z3_DEBUG_LAST_HASH YESPLEASE
 
 namespace stoke {
@@ -95,17 +93,6 @@ public:
   /** Get the satisfying assignment for an array (i.e. memory) */
   std::pair<std::map<uint64_t, cpputil::BitVector>, uint8_t>  get_model_array(const std::string& var, uint16_t key_bits, uint16_t value_bits);
 
-#ifdef DEBUG_Z3_INTERFACE_PERFORMANCE
-  static void print_performance() {
-    std::cout << "====== Z3 Interface Performance Report ======" << std::endl;
-    std::cout << "Number queries: " << number_queries_ << std::endl;
-    std::cout << "Typecheck time (ms): " << (typecheck_time_/1000) << std::endl;
-    std::cout << "Convert time (ms): " << (convert_time_/1000) << std::endl;
-    std::cout << "Z3 time (ms): " << (solver_time_/1000) << std::endl;
-    std::cout << "Total accounted: " << (typecheck_time_ + convert_time_ + solver_time_)/1000 << std::endl;
-  }
-#endif
-
   virtual void interrupt() {
     stop_now_.store(true);
     context_.interrupt();
@@ -309,14 +296,6 @@ private:
 
     std::string error_;
   };
-
-#ifdef DEBUG_Z3_INTERFACE_PERFORMANCE
-  static uint64_t number_queries_;
-  static uint64_t typecheck_time_;
-  static uint64_t convert_time_;
-  static uint64_t solver_time_;
-
-#endif
 };
 
 } //namespace stoke
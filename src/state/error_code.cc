@@ -48,6 +48,10 @@ string stoke::readable_error_code(ErrorCode ec) {
     return "SIGCUSTOM (corrupted return address on stack)";
   case ErrorCode::SIGCUSTOM_ASSEMBLER_ERROR:
     return "SIGCUSTOM (assembler error)";
+  case ErrorCode::SIGCUSTOM_FORK_FAILED:
+    return "SIGCUSTOM (couldn't fork a process to run in)";
+  case ErrorCode::SIGCUSTOM_UNSUPPORTED_IN_CHILD:
+    return "SIGCUSTOM (configuration can't run in a child process)";
   default:
     assert(false);
     return "STOKE_BUG";
@@ -35,6 +35,8 @@ enum class ErrorCode {
   SIGCUSTOM_NO_RETURN = 260,
   SIGCUSTOM_STACK_SMASH = 261,
   SIGCUSTOM_ASSEMBLER_ERROR = 262,
+  SIGCUSTOM_FORK_FAILED = 263,
+  SIGCUSTOM_UNSUPPORTED_IN_CHILD = 264,
 };
 
 std::string readable_error_code(ErrorCode ec);
@@ -16,6 +16,7 @@
 #define STOKE_SRC_STATE_MEMORY_H
 
 #include <cassert>
+#include <cstring>
 #include <iostream>
 #include <stdint.h>
 
@@ -69,6 +70,13 @@ public:
     valid_.copy(rhs.valid_);
   }
 
+  /** Copy bytes [begin, end) from another memory, counting from lower_bound(); leaves valid bits alone. */
+  void copy(const Memory& rhs, size_t begin, size_t end) {
+    assert(base_ == rhs.base_);
+    assert(end <= contents_.num_fixed_bytes() && end <= rhs.contents_.num_fixed_bytes());
+    memcpy((uint8_t*)contents_.data() + begin, (const uint8_t*)rhs.contents_.data() + begin, end - begin);
+  }
+
   /** Logical memory size; doesn't include headroom. */
   size_t size() const {
     return contents_.num_fixed_bytes() - 32;
@@ -106,6 +114,19 @@ public:
     return contents_.get_fixed_quad((addr - base_)/8);
   }
 
+  /** Number of aligned quads in this memory, including headroom. */
+  size_t num_quads() const {
+    return contents_.num_fixed_bytes() / 8;
+  }
+  /** Contents of the ith aligned quad, counting from lower_bound(); undefined for invalid bytes. */
+  uint64_t get_fixed_quad(size_t i) const {
+    return contents_.get_fixed_quad(i);
+  }
+  /** Valid bits of the ith aligned quad, counting from lower_bound(); bit j is set if byte j is valid. */
+  uint8_t get_valid_byte(size_t i) const {
+    return valid_.get_fixed_byte(i);
+  }
+
   /** Pointer to underlying data. */
   void* data() {
     return contents_.data();
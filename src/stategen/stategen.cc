@@ -14,9 +14,13 @@
 
 #include "src/stategen/stategen.h"
 
+#include <algorithm>
 #include <cstdlib>
+#include <memory>
 #include <string>
+#include <thread>
 
+#include "src/cfg/dominators.h"
 #include "src/sandbox/sandbox.h"
 #include "src/sandbox/state_callback.h"
 #include "src/state/regs.h"
@@ -33,6 +37,12 @@ void callback(const StateCallbackData& data, void* arg) {
   last_line = data.line;
 }
 
+/** Returns true if writing these registers might change the value of r. */
+bool may_change(const RegSet& ws, const R64& r) {
+  static const Rh highs[] = {ah, ch, dh, bh};
+  return ws.contains(r8s[r]) || (r < 4 && ws.contains(highs[r]));
+}
+
 } // namespace
 
 namespace stoke {
@@ -92,6 +102,12 @@ bool StateGen::get(CpuState& cs, const Cfg& cfg, bool no_randomize) {
   if (!no_randomize)
     get(cs);
 
+  // Allocate whatever we can without running anything
+  if (static_layout_) {
+    recompute_written_before(cfg);
+    layout_static_accesses(cfg, cs);
+  }
+
   // now try to patch in the gaps
   tried_to_fix_misalign_ = false;
   for (int i = 0; i < (int)max_attempts_; ++i) {
@@ -123,6 +139,9 @@ bool StateGen::get(CpuState& cs, const Cfg& cfg, bool no_randomize) {
     // Otherwise, generate a new state and call this attempt failed
     else {
       get(cs);
+      if (static_layout_) {
+        layout_static_accesses(cfg, cs);
+      }
       tried_to_fix_misalign_ = false;
     }
   }
@@ -132,6 +151,141 @@ bool StateGen::get(CpuState& cs, const Cfg& cfg, bool no_randomize) {
   return false;
 }
 
+size_t StateGen::get(vector<CpuState>& css, size_t n, const Cfg& cfg, size_t threads) {
+  threads = max(min(threads, n), (size_t)1);
+
+  // Each state gets its own seed, drawn in order, so that the states don't
+  // depend on how many threads there are
+  vector<default_random_engine::result_type> seeds;
+  for (size_t i = 0; i < n; ++i) {
+    seeds.push_back(gen_());
+  }
+
+  // Each thread works with its own copy of this generator and the sandbox
+  vector<unique_ptr<Sandbox>> sandboxes;
+  vector<StateGen> gens;
+  gens.reserve(threads);
+  for (size_t t = 0; t < threads; ++t) {
+    sandboxes.emplace_back(new Sandbox(*sb_));
+    gens.push_back(*this);
+    gens.back().sb_ = sandboxes.back().get();
+  }
+
+  vector<CpuState> states(n);
+  vector<char> ok(n, false);
+  vector<string> errors(n);
+  auto work = [&](size_t t) {
+    for (size_t i = t; i < n; i += threads) {
+      gens[t].set_seed(seeds[i]);
+      ok[i] = gens[t].get(states[i], cfg);
+      errors[i] = gens[t].get_error();
+    }
+  };
+
+  vector<thread> workers;
+  for (size_t t = 1; t < threads; ++t) {
+    workers.emplace_back(work, t);
+  }
+  work(0);
+  for (auto& w : workers) {
+    w.join();
+  }
+
+  size_t found = 0;
+  for (size_t i = 0; i < n; ++i) {
+    if (ok[i]) {
+      css.push_back(states[i]);
+      found++;
+    }
+  }
+  if (n > 0) {
+    error_message_ = errors[n-1];
+  }
+  return found;
+}
+
+void StateGen::recompute_written_before(const Cfg& cfg) {
+  const auto& code = cfg.get_code();
+  written_before_.assign(code.size(), RegSet::empty());
+
+  // Whatever any predecessor might have written, iterated to a fixed point
+  // for loops; the union only grows, so this terminates
+  vector<RegSet> outs(cfg.num_blocks(), RegSet::empty());
+  for (auto changed = true; changed;) {
+    changed = false;
+
+    for (auto b = ++cfg.reachable_begin(), be = cfg.reachable_end(); b != be; ++b) {
+      auto written = RegSet::empty();
+      for (auto p = cfg.pred_begin(*b), pe = cfg.pred_end(*b); p != pe; ++p) {
+        if (cfg.is_reachable(*p)) {
+          written |= outs[*p];
+        }
+      }
+      for (size_t j = 0, je = cfg.num_instrs(*b); j < je; ++j) {
+        const auto idx = cfg.get_index({*b, j});
+        written_before_[idx] = written;
+        written |= cfg.maybe_write_set(code[idx]);
+      }
+
+      changed |= outs[*b] != written;
+      outs[*b] = written;
+    }
+  }
+}
+
+void StateGen::layout_static_accesses(const Cfg& cfg, CpuState& cs) {
+  const auto& code = cfg.get_code();
+
+  // Only blocks that dominate the exit run on every path; an access behind a
+  // guard may never happen, and allocating for it would hide that
+  if (!cfg.is_reachable(cfg.get_exit())) {
+    return;
+  }
+  const auto always = CfgDominators(cfg).get_dominators(cfg.get_exit());
+
+  for (auto b = ++cfg.reachable_begin(), be = cfg.reachable_end(); b != be; ++b) {
+    if (always.find(*b) == always.end()) {
+      continue;
+    }
+    for (size_t j = 0, je = cfg.num_instrs(*b); j < je; ++j) {
+      const auto idx = cfg.get_index({*b, j});
+      const auto& instr = code[idx];
+
+      // Stack accesses through push/pop/call/ret are left to the sandbox runs
+      if (instr.is_push() || instr.is_pop() || instr.is_any_return() || instr.is_call()) {
+        continue;
+      }
+      if (!instr.is_explicit_memory_dereference() || instr.is_implicit_memory_dereference()) {
+        continue;
+      }
+
+      const auto mem = instr.get_operand<Mem>(instr.mem_index());
+      if (mem.contains_seg()) {
+        continue;
+      }
+
+      // The address is known if nothing it's built from has been written yet
+      uint64_t addr = 0;
+      if (mem.rip_offset()) {
+        addr = get_rip_addr(cfg, idx, mem);
+      } else {
+        const auto& written = written_before_[idx];
+        if ((mem.contains_base() && may_change(written, mem.get_base())) ||
+            (mem.contains_index() && may_change(written, mem.get_index()))) {
+          continue;
+        }
+        addr = cs.get_addr(instr);
+      }
+
+      const auto size = get_size(instr);
+      if (is_misaligned(addr, size) && !allow_unaligned_) {
+        continue;
+      }
+      allocate(cs, addr, size);
+    }
+  }
+}
+
 bool StateGen::is_ok(const Instruction& line) {
   if (sb_->get_result(0)->code == ErrorCode::NORMAL) {
     return true;
@@ -333,23 +487,7 @@ bool StateGen::fix(const CpuState& cs, CpuState& fixed, const Cfg& cfg, size_t l
   if (instr.mem_index() != -1) {
     auto mem = instr.get_operand<Mem>(instr.mem_index());
     if (mem.rip_offset()) {
-      auto& fxn = cfg.get_function();
-      uint64_t disp = mem.get_disp();
-
-      if (disp & 0x80000000)
-        disp |= 0xffffffff00000000;
-      else
-        disp &= 0x00000000ffffffff;
-
-      if (linemap_.size() && linemap_.count(line)) {
-        DEBUG_STATEGEN(
-          cout << "[fix] have rip offset of " << linemap_[line].rip_offset << endl;
-          cout << "[fix] (uint64_t)mem.get_disp() = " << (uint64_t)mem.get_disp() << endl;
-          cout << "[fix] disp = " << disp << endl;)
-        addr = linemap_[line].rip_offset + disp;
-      } else {
-        addr = disp + fxn.get_rip_offset() + fxn.hex_offset(line) + fxn.hex_size(line);
-      }
+      addr = get_rip_addr(cfg, line, mem);
     }
   }
 
@@ -362,15 +500,42 @@ bool StateGen::fix(const CpuState& cs, CpuState& fixed, const Cfg& cfg, size_t l
     return fix_misalignment(cs, fixed, instr);
   }
 
+  if (!allocate(fixed, addr, size)) {
+    tried_to_fix_misalign_ = false;
+    error_message_ = "Memory was already allocated in segment.";
+    return false;
+  }
+  return true;
+}
+
+uint64_t StateGen::get_rip_addr(const Cfg& cfg, size_t line, const Mem& mem) {
+  auto& fxn = cfg.get_function();
+  uint64_t disp = mem.get_disp();
+
+  if (disp & 0x80000000)
+    disp |= 0xffffffff00000000;
+  else
+    disp &= 0x00000000ffffffff;
+
+  if (linemap_.size() && linemap_.count(line)) {
+    DEBUG_STATEGEN(
+      cout << "[fix] have rip offset of " << linemap_[line].rip_offset << endl;
+      cout << "[fix] (uint64_t)mem.get_disp() = " << (uint64_t)mem.get_disp() << endl;
+      cout << "[fix] disp = " << disp << endl;)
+    return linemap_[line].rip_offset + disp;
+  } else {
+    return disp + fxn.get_rip_offset() + fxn.hex_offset(line) + fxn.hex_size(line);
+  }
+}
+
+bool StateGen::allocate(CpuState& fixed, uint64_t addr, size_t size) {
   vector<Memory> segments;
   segments.push_back(fixed.stack);
   segments.push_back(fixed.heap);
-  segments.insert(segments.begin(), fixed.segments.begin(), fixed.segments.end());
+  segments.insert(segments.end(), fixed.segments.begin(), fixed.segments.end());
 
   for (auto& segment : segments) {
     if (already_allocated(segment, addr, size)) {
-      tried_to_fix_misalign_ = false;
-      error_message_ = "Memory was already allocated in segment.";
       return false;
     }
   }
@@ -380,14 +545,16 @@ bool StateGen::fix(const CpuState& cs, CpuState& fixed, const Cfg& cfg, size_t l
     cout << endl << endl;
   })
 
-  /** See if we can resize one of the segments. */
-  for (auto& segment : segments) {
-    if (resize_mem(segment, addr, size)) {
-      fixed.stack = segments[0];
-      fixed.heap = segments[1];
-      segments.erase(segments.begin());
-      segments.erase(segments.begin());
-      fixed.segments = segments;
+  /** See if we can resize one of the segments; the stack and heap come first. */
+  for (size_t i = 0; i < segments.size(); ++i) {
+    if (resize_mem(segments[i], addr, size)) {
+      if (i == 0) {
+        fixed.stack = segments[0];
+      } else if (i == 1) {
+        fixed.heap = segments[1];
+      } else {
+        fixed.segments[i-2] = segments[i];
+      }
       return true;
     }
   }
@@ -396,8 +563,7 @@ bool StateGen::fix(const CpuState& cs, CpuState& fixed, const Cfg& cfg, size_t l
   Memory m;
   bool b = resize_mem(m, addr, size);
   assert(b);
-  segments.push_back(m);
-  fixed.segments = segments;
+  fixed.segments.push_back(m);
   DEBUG_STATEGEN(cout << "[fix] Adding segment" << endl;)
   DEBUG_STATEGEN(m.write_text(cout);)
   DEBUG_STATEGEN(cout << endl;)
@@ -19,6 +19,7 @@
 #include <random>
 #include <stdint.h>
 #include <string>
+#include <vector>
 
 #include "src/ext/x64asm/include/x64asm.h"
 
@@ -35,6 +36,7 @@ public:
     set_max_attempts(16);
     set_max_memory(1024);
     set_allow_unaligned(false);
+    set_static_layout(true);
 
     // use the time for a seed; can be manually specified with set_seed()
     const auto time = std::chrono::system_clock::now().time_since_epoch().count();
@@ -56,6 +58,13 @@ public:
     allow_unaligned_ = b;
     return *this;
   }
+  /** Sets whether memory is allocated before the first run for accesses whose
+    address only depends on registers that haven't been written yet.  Only
+    accesses in blocks that run on every path (ie dominate the exit) count. */
+  StateGen& set_static_layout(bool b) {
+    static_layout_ = b;
+    return *this;
+  }
   /** Set maximum value for register */
   StateGen& set_max_value(x64asm::R64 r, uint64_t value) {
     max_register_values_[r] = value;
@@ -81,6 +90,9 @@ public:
   bool get(CpuState& cs);
   /** Tries to generate a state in which cfg can execute without signaling. */
   bool get(CpuState& cs, const Cfg& cfg, bool no_randomize = false);
+  /** Tries to generate n states in which cfg can execute, spread over this many
+    threads; appends the ones that succeed and returns how many there were. */
+  size_t get(std::vector<CpuState>& css, size_t n, const Cfg& cfg, size_t threads = 1);
 
   /** Returns the reason the last attempt to fix a dereference failed. */
   std::string get_error() const {
@@ -121,8 +133,19 @@ private:
   void randomize_mem(Memory& mem);
   /** Returns true if a memory can be resized to accommadate an access. */
   bool resize_mem(Memory& mem, uint64_t addr, size_t size);
+  /** Returns the address of a rip-relative access on this line. */
+  uint64_t get_rip_addr(const Cfg& cfg, size_t line, const x64asm::Mem& mem);
+  /** Returns true if memory could be allocated for an access. */
+  bool allocate(CpuState& fixed, uint64_t addr, size_t size);
   /** Returns true if the memory access on this line was fixable. */
   bool fix(const CpuState& cs, CpuState& fixed, const Cfg& cfg, size_t line);
+
+  /** Computes which registers may have been written before each line. */
+  void recompute_written_before(const Cfg& cfg);
+  /** Allocates memory for every access on every path whose address is already known. */
+  void layout_static_accesses(const Cfg& cfg, CpuState& cs);
+  /** The registers that may have been written before each line. */
+  std::vector<x64asm::RegSet> written_before_;
   /** Returns true if we think we've adjusted registers to make memory align. */
   bool fix_misalignment(const CpuState& cs, CpuState& fixed, const x64asm::Instruction& instr);
   /** If we've already tried to fix misalignment.  We can go into an infinite loop
@@ -137,6 +160,8 @@ private:
   size_t max_jumps_;
   /** If unaligned memory accesses are OK? */
   bool allow_unaligned_;
+  /** If memory is laid out before the first run. */
+  bool static_layout_;
 
   /** Used to reset the sandbox to a default state */
   void cleanup();
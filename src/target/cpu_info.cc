@@ -178,4 +178,16 @@ FlagSet CpuInfo::get_flags() {
   return result;
 }
 
+Uarch CpuInfo::get_uarch() {
+  // get_flags() already masks out features that the build target lacks
+  const auto flags = get_flags();
+  if (flags.contains(Flag::AVX2)) {
+    return Uarch::HASWELL;
+  } else if (flags.contains(Flag::AVX)) {
+    return Uarch::SANDYBRIDGE;
+  } else {
+    return Uarch::NEHALEM;
+  }
+}
+
 } // namespace stoke
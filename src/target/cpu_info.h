@@ -19,9 +19,19 @@
 
 namespace stoke {
 
+/** Microarchitectures that we have static pipeline models for. */
+enum class Uarch {
+  NATIVE,
+  NEHALEM,
+  SANDYBRIDGE,
+  HASWELL
+};
+
 class CpuInfo {
 public:
   static x64asm::FlagSet get_flags();
+  /** Returns the closest modeled microarchitecture to the one we're running on. */
+  static Uarch get_uarch();
 };
 
 } // namespace stoke
@@ -0,0 +1,373 @@
+// Copyright 2013-2019 Stanford University
+//
+// Licensed under the Apache License, Version 2.0 (the License);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an AS IS BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <mutex>
+#include <new>
+#include <unistd.h>
+
+#include "src/telemetry/telemetry.h"
+
+using namespace std;
+using namespace stoke;
+
+namespace {
+
+/** The most spans a thread will keep for traces. */
+const size_t max_events = 1 << 16;
+
+struct AtomicStats {
+  atomic<uint64_t> count;
+  atomic<uint64_t> total;
+  atomic<uint64_t> min;
+  atomic<uint64_t> max;
+  array<atomic<uint64_t>, Telemetry::num_buckets> buckets;
+};
+
+/** What one thread has recorded.  Only the owning thread writes the stats, so
+  plain loads and stores will do; they're atomic so that readers never see
+  half of a value.  Spans are rarer and take a lock. */
+struct Slab {
+  uint64_t tid;
+  array<AtomicStats, Telemetry::NUM_METRICS> stats;
+  mutex events_mutex;
+  vector<Telemetry::Event> events;
+
+  Slab(uint64_t t) : tid(t) {
+    zero();
+  }
+
+  void zero() {
+    for (auto& s : stats) {
+      s.count.store(0);
+      s.total.store(0);
+      s.min.store(0);
+      s.max.store(0);
+      for (auto& b : s.buckets)
+        b.store(0);
+    }
+    lock_guard<mutex> guard(events_mutex);
+    events.clear();
+  }
+};
+
+struct Registry {
+  /** Guards everything below.  A pointer, so that after_fork() can replace
+    one that some other thread held at the time of the fork. */
+  mutex* lock;
+  vector<Slab*> slabs;
+  /** What other processes sent us. */
+  Telemetry::Snapshot merged;
+  uint64_t next_tid;
+  atomic<bool> tracing;
+
+  Registry() : lock(new mutex()), next_tid(0) {
+    tracing.store(false);
+  }
+};
+
+/** Never destroyed, so that threads still running at exit can record safely. */
+Registry& registry() {
+  static Registry* r = new Registry();
+  return *r;
+}
+
+thread_local Slab* local_slab = nullptr;
+
+Slab* get_slab() {
+  if (local_slab != nullptr)
+    return local_slab;
+
+  auto& r = registry();
+  lock_guard<mutex> guard(*r.lock);
+  local_slab = new Slab(r.next_tid++);
+  r.slabs.push_back(local_slab);
+  return local_slab;
+}
+
+inline void bump(atomic<uint64_t>& x, uint64_t n) {
+  x.store(x.load(memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+inline size_t bucket(uint64_t value) {
+  if (value == 0)
+    return 0;
+  return min((size_t)(64 - __builtin_clzll(value)), Telemetry::num_buckets - 1);
+}
+
+const char* names[] = {
+  "obligation_check",
+  "obligation_aliasing",
+  "obligation_constraints",
+  "obligation_solve",
+  "obligation_ceg_check",
+  "obligation_refutation",
+  "solver_typecheck",
+  "solver_convert",
+  "solver_check",
+  "sandbox_compile",
+  "sandbox_run",
+  "learner_learn",
+  "ddec_verify",
+  "ddec_fixpoint"
+};
+static_assert(sizeof(names)/sizeof(names[0]) == Telemetry::NUM_METRICS, "every metric needs a name");
+
+bool metric_from_name(const string& s, Telemetry::Metric& m) {
+  for (size_t i = 0; i < Telemetry::NUM_METRICS; ++i) {
+    if (s == names[i]) {
+      m = (Telemetry::Metric)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+/** Nanoseconds as fractional microseconds, which is what traces want. */
+void write_micros(ostream& os, uint64_t ns) {
+  os << ns / 1000 << "." << setw(3) << setfill('0') << ns % 1000 << setfill(' ');
+}
+
+} // namespace
+
+namespace stoke {
+
+void Telemetry::Stats::merge(const Stats& other) {
+  if (other.count == 0)
+    return;
+
+  min = count == 0 ? other.min : std::min(min, other.min);
+  max = std::max(max, other.max);
+  count += other.count;
+  total += other.total;
+  for (size_t i = 0; i < num_buckets; ++i)
+    buckets[i] += other.buckets[i];
+}
+
+uint64_t Telemetry::Stats::quantile(double q) const {
+  if (count == 0)
+    return 0;
+
+  uint64_t target = (uint64_t)ceil(q * count);
+  uint64_t seen = 0;
+  for (size_t i = 0; i < num_buckets; ++i) {
+    seen += buckets[i];
+    if (seen >= target && seen > 0) {
+      uint64_t upper = i == 0 ? 0 : (i >= 63 ? max : ((uint64_t)1 << i) - 1);
+      return std::min(upper, max);
+    }
+  }
+  return max;
+}
+
+void Telemetry::Snapshot::merge(const Snapshot& other) {
+  for (size_t i = 0; i < NUM_METRICS; ++i)
+    stats[i].merge(other.stats[i]);
+  events.insert(events.end(), other.events.begin(), other.events.end());
+}
+
+void Telemetry::Snapshot::write(ostream& os) const {
+  size_t used = 0;
+  for (const auto& s : stats)
+    if (s.count > 0)
+      used++;
+
+  os << "telemetry " << used << endl;
+  for (size_t i = 0; i < NUM_METRICS; ++i) {
+    const auto& s = stats[i];
+    if (s.count == 0)
+      continue;
+    os << names[i] << " " << s.count << " " << s.total << " " << s.min << " " << s.max;
+    for (auto b : s.buckets)
+      os << " " << b;
+    os << endl;
+  }
+
+  os << "events " << events.size() << endl;
+  for (const auto& e : events)
+    os << e.pid << " " << e.tid << " " << names[e.metric] << " " << e.start << " " << e.duration << endl;
+}
+
+bool Telemetry::Snapshot::read(istream& is) {
+  string word;
+  size_t n;
+  if (!(is >> word) || word != "telemetry" || !(is >> n))
+    return false;
+
+  for (size_t i = 0; i < n; ++i) {
+    string metric_name;
+    Stats s;
+    is >> metric_name >> s.count >> s.total >> s.min >> s.max;
+    for (auto& b : s.buckets)
+      is >> b;
+    if (!is)
+      return false;
+
+    Metric m;
+    if (metric_from_name(metric_name, m))
+      stats[m].merge(s);
+  }
+
+  if (!(is >> word) || word != "events" || !(is >> n))
+    return false;
+  for (size_t i = 0; i < n; ++i) {
+    Event e;
+    string metric_name;
+    is >> e.pid >> e.tid >> metric_name >> e.start >> e.duration;
+    if (!is)
+      return false;
+    if (metric_from_name(metric_name, e.metric))
+      events.push_back(e);
+  }
+
+  return true;
+}
+
+void Telemetry::Snapshot::write_json(ostream& os) const {
+  os << "{" << endl;
+  os << "  \"pid\": " << getpid() << "," << endl;
+  os << "  \"metrics\": {";
+
+  bool first = true;
+  for (size_t i = 0; i < NUM_METRICS; ++i) {
+    const auto& s = stats[i];
+    if (s.count == 0)
+      continue;
+
+    os << (first ? "" : ",") << endl;
+    first = false;
+    os << "    \"" << names[i] << "\": {"
+       << "\"count\": " << s.count
+       << ", \"total_ns\": " << s.total
+       << ", \"mean_ns\": " << s.total / s.count
+       << ", \"min_ns\": " << s.min
+       << ", \"max_ns\": " << s.max
+       << ", \"p50_ns\": " << s.quantile(0.5)
+       << ", \"p90_ns\": " << s.quantile(0.9)
+       << ", \"p99_ns\": " << s.quantile(0.99)
+       << "}";
+  }
+
+  os << endl << "  }" << endl;
+  os << "}" << endl;
+}
+
+void Telemetry::Snapshot::write_chrome_trace(ostream& os) const {
+  os << "{\"traceEvents\": [";
+  for (size_t i = 0; i < events.size(); ++i) {
+    const auto& e = events[i];
+    os << (i ? "," : "") << endl;
+    os << "  {\"name\": \"" << names[e.metric] << "\", \"cat\": \"stoke\", \"ph\": \"X\", \"ts\": ";
+    write_micros(os, e.start);
+    os << ", \"dur\": ";
+    write_micros(os, e.duration);
+    os << ", \"pid\": " << e.pid << ", \"tid\": " << e.tid << "}";
+  }
+  os << endl << "]}" << endl;
+}
+
+const char* Telemetry::name(Metric m) {
+  return names[m];
+}
+
+void Telemetry::record(Metric m, uint64_t value, uint64_t start) {
+  auto slab = get_slab();
+  auto& s = slab->stats[m];
+
+  auto count = s.count.load(memory_order_relaxed);
+  if (count == 0 || value < s.min.load(memory_order_relaxed))
+    s.min.store(value, memory_order_relaxed);
+  if (value > s.max.load(memory_order_relaxed))
+    s.max.store(value, memory_order_relaxed);
+  bump(s.total, value);
+  bump(s.buckets[bucket(value)], 1);
+  s.count.store(count + 1, memory_order_relaxed);
+
+  if (start != 0 && registry().tracing.load(memory_order_relaxed)) {
+    lock_guard<mutex> guard(slab->events_mutex);
+    if (slab->events.size() < max_events)
+      slab->events.push_back({0, slab->tid, m, start, value});
+  }
+}
+
+void Telemetry::set_tracing(bool b) {
+  registry().tracing.store(b);
+}
+
+bool Telemetry::get_tracing() {
+  return registry().tracing.load();
+}
+
+Telemetry::Snapshot Telemetry::snapshot() {
+  auto& r = registry();
+  uint64_t pid = getpid();
+
+  Snapshot result;
+  lock_guard<mutex> guard(*r.lock);
+  for (auto slab : r.slabs) {
+    for (size_t i = 0; i < NUM_METRICS; ++i) {
+      const auto& as = slab->stats[i];
+      Stats s;
+      s.count = as.count.load(memory_order_relaxed);
+      s.total = as.total.load(memory_order_relaxed);
+      s.min = as.min.load(memory_order_relaxed);
+      s.max = as.max.load(memory_order_relaxed);
+      for (size_t j = 0; j < num_buckets; ++j)
+        s.buckets[j] = as.buckets[j].load(memory_order_relaxed);
+      result.stats[i].merge(s);
+    }
+
+    lock_guard<mutex> events_guard(slab->events_mutex);
+    for (auto e : slab->events) {
+      e.pid = pid;
+      result.events.push_back(e);
+    }
+  }
+  result.merge(r.merged);
+
+  return result;
+}
+
+void Telemetry::merge(const Snapshot& s) {
+  auto& r = registry();
+  lock_guard<mutex> guard(*r.lock);
+  r.merged.merge(s);
+}
+
+void Telemetry::reset() {
+  auto& r = registry();
+  lock_guard<mutex> guard(*r.lock);
+  for (auto slab : r.slabs)
+    slab->zero();
+  r.merged = Snapshot();
+}
+
+void Telemetry::after_fork() {
+  auto& r = registry();
+
+  // Whatever the other threads held, they aren't here to release it.  Their
+  // slabs leak, which is fine; there's only ever a handful.
+  r.lock = new mutex();
+  r.slabs.clear();
+  r.merged = Snapshot();
+  if (local_slab != nullptr) {
+    new (&local_slab->events_mutex) mutex();
+    local_slab->zero();
+    r.slabs.push_back(local_slab);
+  }
+}
+
+} // namespace stoke
@@ -0,0 +1,160 @@
+// Copyright 2013-2019 Stanford University
+//
+// Licensed under the Apache License, Version 2.0 (the License);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an AS IS BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef STOKE_SRC_TELEMETRY_TELEMETRY_H
+#define STOKE_SRC_TELEMETRY_TELEMETRY_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace stoke {
+
+/** Counters and timers for the hot paths, compiled in all the time.  Every
+  thread records into a slab of its own, so recording never takes a lock;
+  reading adds up all the slabs.  Forked workers send a snapshot of what they
+  recorded back to the parent, which merges it in. */
+class Telemetry {
+
+public:
+
+  /** Everything we measure.  Timers record nanoseconds. */
+  enum Metric {
+    OBLIGATION_CHECK,
+    OBLIGATION_ALIASING,
+    OBLIGATION_CONSTRAINTS,
+    OBLIGATION_SOLVE,
+    OBLIGATION_CEG_CHECK,
+    OBLIGATION_REFUTATION,
+    SOLVER_TYPECHECK,
+    SOLVER_CONVERT,
+    SOLVER_CHECK,
+    SANDBOX_COMPILE,
+    SANDBOX_RUN,
+    LEARNER_LEARN,
+    DDEC_VERIFY,
+    DDEC_FIXPOINT,
+    NUM_METRICS
+  };
+
+  /** Histograms have one bucket per power of two. */
+  static constexpr size_t num_buckets = 64;
+
+  /** What we know about one metric. */
+  struct Stats {
+    uint64_t count;
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+    std::array<uint64_t, num_buckets> buckets;
+
+    Stats() : count(0), total(0), min(0), max(0) {
+      buckets.fill(0);
+    }
+
+    /** Folds in another set of observations. */
+    void merge(const Stats& other);
+    /** An upper bound on the given quantile (between 0 and 1). */
+    uint64_t quantile(double q) const;
+  };
+
+  /** One timed span, for traces. */
+  struct Event {
+    uint64_t pid;
+    uint64_t tid;
+    Metric metric;
+    uint64_t start;
+    uint64_t duration;
+  };
+
+  /** Everything recorded, summed over threads and merged-in workers. */
+  struct Snapshot {
+    std::array<Stats, NUM_METRICS> stats;
+    std::vector<Event> events;
+
+    void merge(const Snapshot& other);
+
+    /** Text format used to send snapshots between processes. */
+    void write(std::ostream& os) const;
+    /** Returns false if there's no snapshot to read. */
+    bool read(std::istream& is);
+
+    /** Summary of every metric that saw any use. */
+    void write_json(std::ostream& os) const;
+    /** Events in the Chrome trace format (chrome://tracing, Perfetto). */
+    void write_chrome_trace(std::ostream& os) const;
+  };
+
+  /** Times a scope. */
+  class Timer {
+  public:
+    Timer(Metric m) : metric_(m), start_(now()), running_(true) { }
+
+    ~Timer() {
+      stop();
+    }
+
+    /** Records the time so far, once.  Returns it in nanoseconds. */
+    uint64_t stop() {
+      if (!running_)
+        return 0;
+      running_ = false;
+      auto duration = now() - start_;
+      record(metric_, duration, start_);
+      return duration;
+    }
+
+  private:
+    Metric metric_;
+    uint64_t start_;
+    bool running_;
+  };
+
+  /** The name of a metric, as it appears in output. */
+  static const char* name(Metric m);
+
+  /** Nanoseconds on a clock that all processes on this machine share. */
+  static uint64_t now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  /** Records an observation.  If tracing, and given a start time, also
+    records a span. */
+  static void record(Metric m, uint64_t value, uint64_t start = 0);
+
+  /** Keep spans for traces?  Off by default; spans cost more than stats. */
+  static void set_tracing(bool b);
+  static bool get_tracing();
+
+  /** Adds up everything recorded so far. */
+  static Snapshot snapshot();
+  /** Merges in what some other process recorded. */
+  static void merge(const Snapshot& s);
+  /** Forgets everything. */
+  static void reset();
+
+  /** Call in the child right after fork().  Other threads didn't come along,
+    and what the parent recorded stays with the parent. */
+  static void after_fork();
+
+};
+
+} // namespace stoke
+
+#endif
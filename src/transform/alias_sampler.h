@@ -0,0 +1,105 @@
+// Copyright 2013-2019 Stanford University
+//
+// Licensed under the Apache License, Version 2.0 (the License);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an AS IS BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef STOKE_SRC_TRANSFORM_ALIAS_SAMPLER_H
+#define STOKE_SRC_TRANSFORM_ALIAS_SAMPLER_H
+
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+namespace stoke {
+
+/** Samples indices in proportion to real-valued weights in constant time,
+  using Walker's alias method. */
+class AliasSampler {
+public:
+  /** Rebuilds the table.  Weights must be non-negative; if they sum to zero,
+    the sampler is left empty. */
+  void reset(const std::vector<double>& weights) {
+    prob_.clear();
+    alias_.clear();
+
+    double sum = 0;
+    for (auto w : weights) {
+      assert(w >= 0);
+      sum += w;
+    }
+    if (sum <= 0) {
+      return;
+    }
+
+    // Scale so that the average weight is 1, then pair each small entry with a
+    // large one that makes up the rest of its slot
+    const auto n = weights.size();
+    prob_.resize(n);
+    alias_.resize(n);
+    std::vector<size_t> small;
+    std::vector<size_t> large;
+    for (size_t i = 0; i < n; ++i) {
+      prob_[i] = weights[i] * n / sum;
+      alias_[i] = i;
+      (prob_[i] < 1 ? small : large).push_back(i);
+    }
+    while (!small.empty() && !large.empty()) {
+      const auto s = small.back();
+      small.pop_back();
+      const auto l = large.back();
+
+      alias_[s] = l;
+      prob_[l] -= 1 - prob_[s];
+      if (prob_[l] < 1) {
+        large.pop_back();
+        small.push_back(l);
+      }
+    }
+    // Whatever is left is 1, up to rounding
+    for (auto i : small) {
+      prob_[i] = 1;
+    }
+    for (auto i : large) {
+      prob_[i] = 1;
+    }
+  }
+
+  /** Returns a random index; undefined if the sampler is empty.  Takes a
+    single draw from gen: the remainder picks a slot and the quotient decides
+    between it and its alias.  With equal weights this is gen() % n, so
+    seeded runs see the same sequence as a plain modulo would. */
+  template <typename G>
+  size_t operator()(G& gen) const {
+    assert(!empty());
+    const uint64_t n = prob_.size();
+    const uint64_t r = gen();
+
+    const auto i = r % n;
+    const auto u = double(r / n) / double(uint64_t(G::max()) / n + 1);
+    return u < prob_[i] ? i : alias_[i];
+  }
+
+  /** Are there no weights to sample from? */
+  bool empty() const {
+    return prob_.empty();
+  }
+
+private:
+  /** The chance of keeping each slot's own index. */
+  std::vector<double> prob_;
+  /** The index each slot gives otherwise. */
+  std::vector<size_t> alias_;
+};
+
+} // namespace stoke
+
+#endif
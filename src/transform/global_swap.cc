@@ -45,7 +45,7 @@ TransformInfo GlobalSwapTransform::operator()(Cfg& cfg) {
   }
 
   cfg.get_function().swap(ti.undo_index[0], ti.undo_index[1]);
-  cfg.recompute_defs();
+  cfg.recompute_defs({ti.undo_index[0], ti.undo_index[1]});
   if (!cfg.check_invariants()) {
     undo(cfg, ti);
     return ti;
@@ -62,7 +62,7 @@ TransformInfo GlobalSwapTransform::operator()(Cfg& cfg) {
 
 void GlobalSwapTransform::undo(Cfg& cfg, const TransformInfo& ti) const {
   cfg.get_function().swap(ti.undo_index[0], ti.undo_index[1]);
-  cfg.recompute_defs();
+  cfg.undo_defs();
 
   assert(cfg.invariant_no_undef_reads());
   assert(cfg.get_function().check_invariants());
@@ -68,7 +68,7 @@ TransformInfo InstructionTransform::operator()(Cfg& cfg) {
   // Success: Any failure beyond here will require undoing the move
   // Operands come from the global pool so this rip will need rescaling
   cfg.get_function().replace(ti.undo_index[0], instr, false, true);
-  cfg.recompute_defs();
+  cfg.recompute_defs({ti.undo_index[0]});
   if (!cfg.check_invariants()) {
     undo(cfg, ti);
     return ti;
@@ -84,7 +84,7 @@ TransformInfo InstructionTransform::operator()(Cfg& cfg) {
 void InstructionTransform::undo(Cfg& cfg, const TransformInfo& ti) const {
 
   cfg.get_function().replace(ti.undo_index[0], ti.undo_instr, true);
-  cfg.recompute_defs();
+  cfg.undo_defs();
 
 
   assert(cfg.invariant_no_undef_reads());
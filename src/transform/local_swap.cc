@@ -54,7 +54,7 @@ TransformInfo LocalSwapTransform::operator()(Cfg& cfg) {
   }
 
   cfg.get_function().swap(ti.undo_index[0], ti.undo_index[1]);
-  cfg.recompute_defs();
+  cfg.recompute_defs({ti.undo_index[0], ti.undo_index[1]});
   if (!cfg.check_invariants()) {
     undo(cfg, ti);
     return ti;
@@ -71,7 +71,7 @@ TransformInfo LocalSwapTransform::operator()(Cfg& cfg) {
 
 void LocalSwapTransform::undo(Cfg& cfg, const TransformInfo& ti) const {
   cfg.get_function().swap(ti.undo_index[0], ti.undo_index[1]);
-  cfg.recompute_defs();
+  cfg.undo_defs();
 
   assert(cfg.invariant_no_undef_reads());
   assert(cfg.get_function().check_invariants());
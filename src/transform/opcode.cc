@@ -50,7 +50,7 @@ TransformInfo OpcodeTransform::operator()(Cfg& cfg) {
   // Success: Any failure beyond here will require undoing the move
   // This operand hasn't changed, so the rip only needs local rescaling
   cfg.get_function().replace(ti.undo_index[0], instr, false, false);
-  cfg.recompute_defs();
+  cfg.recompute_defs({ti.undo_index[0]});
   if (!cfg.check_invariants()) {
     undo(cfg, ti);
     return ti;
@@ -66,7 +66,7 @@ TransformInfo OpcodeTransform::operator()(Cfg& cfg) {
 
 void OpcodeTransform::undo(Cfg& cfg, const TransformInfo& ti) const {
   cfg.get_function().replace(ti.undo_index[0], ti.undo_instr, true);
-  cfg.recompute_defs();
+  cfg.undo_defs();
 
   assert(cfg.invariant_no_undef_reads());
   assert(cfg.get_function().check_invariants());
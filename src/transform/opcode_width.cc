@@ -49,7 +49,7 @@ TransformInfo OpcodeWidthTransform::operator()(Cfg& cfg) {
 
   // Success: Any failure beyond here will require undoing the move
   cfg.get_function().replace(ti.undo_index[0], instr, false, true);
-  cfg.recompute_defs();
+  cfg.recompute_defs({ti.undo_index[0]});
   if (!cfg.check_invariants()) {
     undo(cfg, ti);
     return ti;
@@ -65,7 +65,7 @@ TransformInfo OpcodeWidthTransform::operator()(Cfg& cfg) {
 
 void OpcodeWidthTransform::undo(Cfg& cfg, const TransformInfo& ti) const {
   cfg.get_function().replace(ti.undo_index[0], ti.undo_instr, true);
-  cfg.recompute_defs();
+  cfg.undo_defs();
 
   assert(cfg.invariant_no_undef_reads());
   assert(cfg.get_function().check_invariants());
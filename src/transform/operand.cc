@@ -73,7 +73,7 @@ TransformInfo OperandTransform::operator()(Cfg& cfg) {
 
   // Success: Any failure beyond here will require undoing the move
   cfg.get_function().replace(ti.undo_index[0], instr, false, is_rip);
-  cfg.recompute_defs();
+  cfg.recompute_defs({ti.undo_index[0]});
   if (!cfg.check_invariants()) {
     undo(cfg, ti);
     return ti;
@@ -89,7 +89,7 @@ TransformInfo OperandTransform::operator()(Cfg& cfg) {
 
 void OperandTransform::undo(Cfg& cfg, const TransformInfo& ti) const {
   cfg.get_function().replace(ti.undo_index[0], ti.undo_instr, true);
-  cfg.recompute_defs();
+  cfg.undo_defs();
 
   assert(cfg.invariant_no_undef_reads());
   assert(cfg.get_function().check_invariants());
@@ -89,17 +89,14 @@ bool is_enabled(Opcode o, const FlagSet& fs) {
   return Instruction(o).enabled(fs);
 }
 
-/** Do these two instructions take operands of the same arity and type? */
-bool is_type_equiv(Opcode o1, Opcode o2) {
-  if (arity(o1) != arity(o2)) {
-    return false;
-  }
-  for (size_t i = 0, ie = arity(o1); i < ie; ++i) {
-    if (type(o1, i) != type(o2, i)) {
-      return false;
-    }
+/** The operand types an instruction takes; two instructions are type equivalent if these match. */
+vector<Type> signature(Opcode o) {
+  const Instruction instr(o);
+  vector<Type> sig;
+  for (size_t i = 0, ie = instr.arity(); i < ie; ++i) {
+    sig.push_back(instr.type(i));
   }
-  return true;
+  return sig;
 }
 
 /** Fills a reg pool */
@@ -136,17 +133,20 @@ bool get(const vector<T>& pool, const T& val, Operand& o) {
 /** Set o to a random element in a register set. Returns true on success. */
 template <typename T>
 bool get(default_random_engine& gen, const vector<T>& pool, const RegSet& rs, Operand& o) {
-  vector<T> ts;
+  // Count the candidates and then pick one, rather than collecting them
+  size_t count = 0;
   for (const auto& t : pool) {
-    if (rs.contains(t)) {
-      ts.push_back(t);
-    }
+    count += rs.contains(t);
   }
-  if (ts.empty()) {
+  if (count == 0) {
     return false;
   }
-  o = ts[gen() % ts.size()];
-  return true;
+  for (size_t i = 0, n = gen() % count; ; ++i) {
+    if (rs.contains(pool[i]) && n-- == 0) {
+      o = pool[i];
+      return true;
+    }
+  }
 }
 
 /** Replaces base register using an element of a reg set. Returns true on success. */
@@ -385,19 +385,24 @@ no:
     }
   }
 
-  // Build type_equivalent pool
-  opcodes_type_equiv_.clear();
-  opcodes_type_equiv_.resize(X64ASM_NUM_OPCODES);
+  // Build type_equivalent pools; opcodes with the same operand types share one,
+  // and class 0 is left empty for opcodes that aren't in use
+  type_classes_.assign(1, vector<Opcode>());
+  type_class_.assign(X64ASM_NUM_OPCODES, 0);
 
-  for (auto i = 0; i < X64ASM_NUM_OPCODES; ++i)
+  map<vector<Type>, size_t> classes;
+  for (auto i = 0; i < X64ASM_NUM_OPCODES; ++i) {
     if (opcode_weights_[i]) {
-      for (size_t j = 0; j < X64ASM_NUM_OPCODES; ++j)
-        if (is_type_equiv((Opcode)i, (Opcode)j))
-          for (size_t k = 0; k < opcode_weights_[j]; ++k)
-            opcodes_type_equiv_[i].push_back((Opcode)j);
-    } else {
-      opcodes_type_equiv_[i].clear();
+      const auto itr = classes.insert({signature((Opcode)i), type_classes_.size()}).first;
+      if (itr->second == type_classes_.size()) {
+        type_classes_.emplace_back();
+      }
+      type_class_[i] = itr->second;
+      for (size_t k = 0; k < opcode_weights_[i]; ++k) {
+        type_classes_[itr->second].push_back((Opcode)i);
+      }
     }
+  }
 }
 
 
@@ -133,8 +133,8 @@ public:
 
   /** Sets o to a random opcode of equivalent type; returns true on success */
   bool get_control_free_type_equiv(x64asm::Opcode& o) {
-    assert(!opcodes_type_equiv_.empty());
-    const auto& equiv = opcodes_type_equiv_[o];
+    assert(!type_class_.empty());
+    const auto& equiv = type_classes_[type_class_[o]];
     if (equiv.empty()) {
       return false;
     }
@@ -223,8 +223,10 @@ protected:
   /** Pool with same raw memonic. */
   std::vector<std::vector<x64asm::Opcode>> raw_memonic_pool_;
 
-  /** Weighted pool of opcodes categorized by type */
-  std::vector<std::vector<x64asm::Opcode>> opcodes_type_equiv_;
+  /** Weighted pools of opcodes that take the same operand types. */
+  std::vector<std::vector<x64asm::Opcode>> type_classes_;
+  /** The index into type_classes_ for each opcode; 0 (an empty pool) if it isn't in use. */
+  std::vector<size_t> type_class_;
 
   /** Operand pool. */
   std::vector<x64asm::Rh> rh_pool_;
@@ -21,6 +21,8 @@
 #include <set>
 #include <vector>
 
+#include "src/search/statistics.h"
+#include "src/transform/alias_sampler.h"
 #include "src/transform/transform.h"
 
 namespace stoke {
@@ -36,8 +38,7 @@ public:
   }
 
   TransformInfo operator()(Cfg& cfg) {
-    size_t pool_index = gen_() % transform_pool_.size();
-    size_t tform_index = transform_pool_[pool_index];
+    size_t tform_index = sampler_(gen_);
     Transform* tr = transforms_[tform_index];
     auto ti = (*tr)(cfg);
     ti.move_type = tform_index;
@@ -49,11 +50,38 @@ public:
   }
 
   /** Add a transform to the set. */
-  void insert_transform(Transform* tr, size_t weight = 1) {
-    size_t label = transforms_.size();
+  void insert_transform(Transform* tr, double weight = 1) {
     transforms_.push_back(tr);
-    for (size_t i = 0; i < weight; ++i)
-      transform_pool_.push_back(label);
+    base_weights_.push_back(weight);
+    weights_.push_back(weight);
+    sampler_.reset(weights_);
+  }
+
+  /** Scales each transform's weight by how often its proposals have been
+    accepted, so that productive moves are proposed more often.  No transform
+    falls below a tenth of the average acceptance rate, so none of them stop
+    being proposed altogether. */
+  void adapt(const std::vector<Statistics>& stats) {
+    assert(stats.size() == transforms_.size());
+
+    size_t proposed = 0;
+    size_t accepted = 0;
+    for (const auto& s : stats) {
+      proposed += s.num_proposed;
+      accepted += s.num_accepted;
+    }
+    const auto floor = 0.1 * (accepted + 1) / (proposed + 2);
+
+    for (size_t i = 0, ie = transforms_.size(); i < ie; ++i) {
+      const auto rate = (stats[i].num_accepted + 1.0) / (stats[i].num_proposed + 2.0);
+      weights_[i] = base_weights_[i] * std::max(rate, floor);
+    }
+    sampler_.reset(weights_);
+  }
+  /** Goes back to the weights the transforms were inserted with. */
+  void reset_weights() {
+    weights_ = base_weights_;
+    sampler_.reset(weights_);
   }
 
   /** Get a pointer to a transform at a given index.  This is
@@ -64,6 +92,12 @@ public:
     return transforms_[index];
   }
 
+  /** Returns the current weight of a transform. */
+  double get_weight(size_t index) const {
+    assert(index < weights_.size());
+    return weights_[index];
+  }
+
   /** Returns the number of transforms available to choose from. */
   size_t size() const {
     return transforms_.size();
@@ -81,9 +115,12 @@ protected:
   /** Transforms that we have available to use. */
   std::vector<Transform*> transforms_;
 
-  /** Members are indexes into transforms_ vector.  The indexes are
-    repeated based on the given weight of the transform. */
-  std::vector<size_t> transform_pool_;
+  /** The weights transforms were inserted with. */
+  std::vector<double> base_weights_;
+  /** The weights transforms are currently chosen with. */
+  std::vector<double> weights_;
+  /** Chooses indexes into transforms_ in proportion to weights_. */
+  AliasSampler sampler_;
 };
 
 } // namespace stoke
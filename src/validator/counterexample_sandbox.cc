@@ -0,0 +1,167 @@
+// Copyright 2013-2019 Stanford University
+//
+// Licensed under the Apache License, Version 2.0 (the License);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an AS IS BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <sstream>
+
+#include "src/validator/counterexample_sandbox.h"
+#include "src/validator/handlers/conditional_handler.h"
+#include "src/validator/obligation_checker.h"
+
+using namespace std;
+using namespace stoke;
+using namespace x64asm;
+
+void CounterexampleSandbox::clear() {
+  for (auto it : paths_)
+    delete it.second;
+  paths_.clear();
+}
+
+string CounterexampleSandbox::key(const Cfg& program, const Code& unroll, const LineMap& linemap) {
+  stringstream ss;
+  ss << program.def_ins() << ";" << program.live_outs() << ";";
+  for (auto entry : linemap)
+    ss << entry.first << ":" << entry.second.block_number << ":" << entry.second.rip_offset << ",";
+  ss << ";" << unroll;
+  return ss.str();
+}
+
+void CounterexampleSandbox::callback(const StateCallbackData& data, void* arg) {
+  auto path = static_cast<Path*>(arg);
+  path->last = data.state;
+  path->traced = true;
+
+  auto it = path->guards->find(data.line);
+  if (it != path->guards->end() &&
+      ConditionalHandler::condition_satisfied(it->second.condition, data.state) != it->second.taken)
+    path->on_path = false;
+}
+
+CounterexampleSandbox::Guards CounterexampleSandbox::get_guards(const Cfg& program, Cfg::id_type end_block, const CfgPath& path) {
+  Guards guards;
+  const auto& code = program.get_code();
+
+  // Count lines the same way PathUnroller::generate_linemap() lays them out
+  size_t line = 0;
+  bool first = true;
+  for (size_t i = 0; i < path.size(); ++i) {
+    auto n = program.num_instrs(path[i]);
+    if (n == 0)
+      continue;
+
+    auto start = program.get_index(Cfg::loc_type(path[i], 0));
+    if (first && !code[start].is_label_defn())
+      line++;
+    first = false;
+    line += n;
+
+    const auto& last = code[start + n - 1];
+    if (i + 1 == path.size() || !last.is_jcc())
+      continue;
+
+    auto jump = ObligationChecker::is_jump(program, end_block, path, i);
+    if (jump == ObligationChecker::JumpType::NONE)
+      continue;
+
+    Guard g;
+    g.condition = opcode_write_att(last.get_opcode()).substr(1);
+    g.taken = jump == ObligationChecker::JumpType::JUMP;
+    guards[line - 1] = g;
+  }
+
+  return guards;
+}
+
+CounterexampleSandbox::Path* CounterexampleSandbox::get_path(const Cfg& program, const Code& unroll, const LineMap& linemap) {
+
+  clock_++;
+
+  auto k = key(program, unroll, linemap);
+  auto it = paths_.find(k);
+  if (it != paths_.end()) {
+    it->second->last_used = clock_;
+    return it->second;
+  }
+
+  // Make room
+  if (paths_.size() >= capacity_ && paths_.size() > 0) {
+    auto oldest = paths_.begin();
+    for (auto jt = paths_.begin(); jt != paths_.end(); ++jt)
+      if (jt->second->last_used < oldest->second->last_used)
+        oldest = jt;
+    delete oldest->second;
+    paths_.erase(oldest);
+  }
+
+  auto path = new Path();
+  path->last_used = clock_;
+  path->traced = false;
+  path->guards = NULL;
+  path->on_path = true;
+  paths_[k] = path;
+  compilations_++;
+
+  Cfg cfg(unroll, program.def_ins(), program.live_outs());
+  auto label = cfg.get_function().get_leading_label();
+
+  auto& sb = path->sandbox;
+  sb.set_abi_check(false);
+  sb.set_stack_check(false);
+  sb.set_linemap(linemap);
+  sb.insert_function(cfg);
+  sb.set_entrypoint(label);
+
+  // Same instrumentation as DataCollector::get_detailed_traces(), except that
+  // we only keep the latest state rather than the whole trace.
+  const auto& code = cfg.get_code();
+  for (size_t i = 0; i + 1 < code.size(); ++i) {
+    if (code[i].is_any_jump())
+      sb.insert_before(label, i, callback, path);
+    else
+      sb.insert_after(label, i, callback, path);
+  }
+
+  return path;
+}
+
+vector<CounterexampleSandbox::Run> CounterexampleSandbox::run(const Cfg& program, const Code& unroll,
+    const LineMap& linemap, const vector<CpuState>& starts, const Guards& guards) {
+
+  vector<Run> runs(starts.size());
+  if (starts.empty())
+    return runs;
+
+  auto path = get_path(program, unroll, linemap);
+  auto& sb = path->sandbox;
+  path->guards = &guards;
+
+  sb.clear_inputs();
+  for (const auto& start : starts)
+    sb.insert_input(start);
+
+  for (size_t i = 0; i < starts.size(); ++i) {
+    path->traced = false;
+    path->on_path = true;
+    sb.run(i);
+
+    const auto& output = *sb.get_output(i);
+    runs[i].code = output.code;
+    runs[i].output = path->traced ? path->last : output;
+    runs[i].on_path = path->on_path;
+  }
+
+  sb.clear_inputs();
+  path->guards = NULL;
+  return runs;
+}
@@ -0,0 +1,134 @@
+// Copyright 2013-2019 Stanford University
+//
+// Licensed under the Apache License, Version 2.0 (the License);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an AS IS BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef STOKE_SRC_VALIDATOR_COUNTEREXAMPLE_SANDBOX_H
+#define STOKE_SRC_VALIDATOR_COUNTEREXAMPLE_SANDBOX_H
+
+#include "src/cfg/cfg.h"
+#include "src/cfg/paths.h"
+#include "src/sandbox/sandbox.h"
+#include "src/state/cpu_state.h"
+#include "src/state/error_code.h"
+#include "src/validator/line_info.h"
+#include "src/ext/x64asm/include/x64asm.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace stoke {
+
+/** Runs candidate counterexamples down unrolled paths.  Each unrolled path is
+  compiled and instrumented once, then kept around (up to a fixed number of
+  paths) so that later batches along the same path skip straight to running. */
+class CounterexampleSandbox {
+
+public:
+
+  /** What happened to one start state. */
+  struct Run {
+    /** Anything other than NORMAL means the run failed. */
+    ErrorCode code;
+    /** The state after the last instrumented instruction. */
+    CpuState output;
+    /** False if a conditional jump went the other way from the path. */
+    bool on_path;
+  };
+
+  /** A conditional jump along the path, which the path expects to go one way. */
+  struct Guard {
+    /** The condition code, e.g. "ne". */
+    std::string condition;
+    bool taken;
+  };
+  /** Guards, by the line of the unrolled code where the jump used to be. */
+  typedef std::map<size_t, Guard> Guards;
+
+  CounterexampleSandbox(size_t capacity = 32) :
+    capacity_(capacity), clock_(0), compilations_(0) {
+  }
+
+  /** Compiled paths aren't shared; a copy starts out empty. */
+  CounterexampleSandbox(const CounterexampleSandbox& other) :
+    CounterexampleSandbox(other.capacity_) {
+  }
+
+  CounterexampleSandbox& operator=(const CounterexampleSandbox&) = delete;
+
+  ~CounterexampleSandbox() {
+    clear();
+  }
+
+  /** Runs every start state through an unrolled path of program, in order.
+    Returns one result per start state.  Unrolling turns jumps into nops, so
+    a start state may not really follow the path; the guards catch those that
+    don't. */
+  std::vector<Run> run(const Cfg& program, const x64asm::Code& unroll,
+                       const LineMap& linemap, const std::vector<CpuState>& starts,
+                       const Guards& guards = Guards());
+
+  /** The guards for an unrolled path (as built by PathUnroller), with the last
+    block's jump left out. */
+  static Guards get_guards(const Cfg& program, Cfg::id_type end_block, const CfgPath& path);
+
+  /** The number of paths compiled so far. */
+  size_t get_compilations() const {
+    return compilations_;
+  }
+
+  /** The number of paths currently compiled. */
+  size_t size() const {
+    return paths_.size();
+  }
+
+  /** Throws away every compiled path. */
+  void clear();
+
+  /** Identifies an unrolled path of a program. */
+  static std::string key(const Cfg& program, const x64asm::Code& unroll, const LineMap& linemap);
+
+private:
+
+  struct Path {
+    Sandbox sandbox;
+    /** Filled in by the callbacks as the path runs. */
+    CpuState last;
+    bool traced;
+    /** The guards for the current run, and whether they've held. */
+    const Guards* guards;
+    bool on_path;
+    /** For evicting the least recently used path. */
+    uint64_t last_used;
+  };
+
+  /** The most paths we'll keep compiled at once. */
+  size_t capacity_;
+  /** Ticks once per lookup. */
+  uint64_t clock_;
+  /** Paths compiled over our lifetime. */
+  size_t compilations_;
+
+  std::map<std::string, Path*> paths_;
+
+  /** Finds the compiled path, compiling it if needed. */
+  Path* get_path(const Cfg& program, const x64asm::Code& unroll, const LineMap& linemap);
+
+  /** Records the state at each instrumented line. */
+  static void callback(const StateCallbackData& data, void* arg);
+
+};
+
+} // namespace stoke
+
+#endif
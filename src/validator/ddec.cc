@@ -15,6 +15,7 @@
 #include "src/cfg/paths.h"
 #include "src/cfg/sccs.h"
 #include "src/serialize/serialize.h"
+#include "src/telemetry/telemetry.h"
 #include "src/validator/bounded.h"
 #include "src/validator/data_collector.h"
 #include "src/validator/paa.h"
@@ -349,6 +350,8 @@ bool DdecValidator::build_paa_for_alignment_predicate(std::shared_ptr<Invariant>
 
 bool DdecValidator::verify_paa(ProgramAlignmentAutomata& paa) {
 
+  Telemetry::Timer timer(Telemetry::DDEC_FIXPOINT);
+
   // check if there are any cycles with only edges in target / only edges in rewrite
   auto edge_reachable = paa.get_edge_reachable_states();
   cout << "Checking for cycle in paa" << endl;
@@ -542,6 +545,12 @@ bool DdecValidator::verify_paa(ProgramAlignmentAutomata& paa) {
   auto states = paa.get_topological_sort();
   update_needed[start_state] = true;
 
+  // Obligations are prioritized along the topological order, so that what we
+  // learn about early states can propagate before later states are checked
+  map<ProgramAlignmentAutomata::State, int> topological_rank;
+  for (size_t i = 0; i < states.size(); ++i)
+    topological_rank[states[i]] = (int)(states.size() - i);
+
   for (size_t round = 0; round < 2; round++) {
 
     fixpoint = false;
@@ -587,6 +596,26 @@ bool DdecValidator::verify_paa(ProgramAlignmentAutomata& paa) {
             testcases.push_back(make_pair(target_testcases[i], rewrite_testcases[i]));
           }
 
+          // construct source invariant
+          shared_ptr<ConjunctionInvariant> new_source_invariant =
+            dynamic_pointer_cast<ConjunctionInvariant>(source_inv->clone());
+
+          // we don't want to just remove these conjuncts because they may imply others which do hold
+          // (we can however, remove them, if we add in the others also)
+          //const auto& conjuncts_to_ignore = conjuncts_to_delete[state];
+          //for(size_t i = 0; i < source_inv->size(); ++i) {
+          //if(!conjuncts_to_ignore.count(i))
+          //  new_source_invariant.add_invariant((*source_inv)[i]);
+          //}
+          for (auto inv : assume_always_) {
+            new_source_invariant->add_invariant(inv);
+          }
+
+          // All the conjuncts along this edge share the same paths and assumption, so
+          // they're dispatched together.  Those whose failure ends the search outright
+          // go in their own batch, so that we hear about them first.
+          vector<shared_ptr<Invariant>> proves[2];
+          vector<void*> params[2];
           for (size_t i = 0; i < target_inv->size(); ++i) {
             if (conjuncts_to_delete[target].count(i))
               continue;
@@ -599,25 +628,24 @@ bool DdecValidator::verify_paa(ProgramAlignmentAutomata& paa) {
             pointers_to_delete.push_back(cbp);
             auto conjunct = (*target_inv)[i];
 
-            // construct source invariant
-            shared_ptr<ConjunctionInvariant> new_source_invariant =
-              dynamic_pointer_cast<ConjunctionInvariant>(source_inv->clone());
-
-            // we don't want to just remove these conjuncts because they may imply others which do hold
-            // (we can however, remove them, if we add in the others also)
-            //const auto& conjuncts_to_ignore = conjuncts_to_delete[state];
-            //for(size_t i = 0; i < source_inv->size(); ++i) {
-            //if(!conjuncts_to_ignore.count(i))
-            //  new_source_invariant.add_invariant((*source_inv)[i]);
-            //}
-            for (auto inv : assume_always_) {
-              new_source_invariant->add_invariant(inv);
-            }
-
-            // dispatch the check
+            bool urgent = conjunct->is_critical() || target == fail_state || target == end_state;
             cout << "[verify_paa]      dispatching conjunct " << i << ": " << *conjunct << endl;
-            checker_.check(target_, rewrite_, e.to.ts, e.to.rs, e.te, e.re,
-                           new_source_invariant, conjunct, testcases, callback, true, (void*)cbp);
+            proves[urgent].push_back(conjunct);
+            params[urgent].push_back((void*)cbp);
+          }
+
+          for (int urgent = 1; urgent >= 0; --urgent) {
+            if (proves[urgent].empty())
+              continue;
+
+            auto priority = topological_rank[state];
+            if (urgent)
+              priority += (int)states.size();
+            checker_.set_priority(priority);
+
+            // dispatch the checks
+            checker_.check_all(target_, rewrite_, e.to.ts, e.to.rs, e.te, e.re,
+                               new_source_invariant->clone(), proves[urgent], testcases, callback, true, params[urgent]);
 
             // see if we've received any callbacks that end it all
             if (failure) {
@@ -639,6 +667,7 @@ bool DdecValidator::verify_paa(ProgramAlignmentAutomata& paa) {
         }
       }
 
+      checker_.set_priority(0);
       checker_.block_until_complete();
       if (failure) {
         checker_.delete_all();
@@ -773,6 +802,7 @@ bool DdecValidator::test_alignment_predicate(shared_ptr<Invariant> invariant) {
 
 bool DdecValidator::verify(const Cfg& init_target, const Cfg& init_rewrite) {
 
+  Telemetry::Timer timer(Telemetry::DDEC_VERIFY);
   benchmark_proof_succeeded_ = false;
   benchmark_starttime_ = system_clock::now();
   benchmark_searchstart_ = benchmark_starttime_;
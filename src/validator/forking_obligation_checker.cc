@@ -20,6 +20,7 @@
 #include "signal.h"
 #include <chrono>
 
+#include "src/telemetry/telemetry.h"
 #include "src/validator/forking_obligation_checker.h"
 
 #define DEBUG_FORKING_CHECKER(X) { X }
@@ -46,6 +47,52 @@ void ForkingObligationChecker::check(
   bool override_separate_stack,
   void* optional) {
 
+  fork_children([&] (ObligationChecker& child_checker, Callback& send) {
+    child_checker.check(target, rewrite, target_block, rewrite_block,
+                        p, q, assume, prove, testcases, send, override_separate_stack, optional);
+  }, callback, optional, {});
+}
+
+void ForkingObligationChecker::check_all(
+  const Cfg& target, const Cfg& rewrite,
+  Cfg::id_type target_block, Cfg::id_type rewrite_block,
+  const CfgPath& p, const CfgPath& q,
+  std::shared_ptr<Invariant> assume,
+  const std::vector<std::shared_ptr<Invariant>>& proves,
+  const std::vector<std::pair<CpuState, CpuState>>& testcases,
+  Callback& callback,
+  bool override_separate_stack,
+  const std::vector<void*>& optionals) {
+
+  assert(proves.size() == optionals.size());
+  if (proves.empty())
+    return;
+
+  // The child tags each result with its position; the parent maps it back to
+  // the caller's optional
+  vector<void*> positions;
+  for (size_t i = 0; i < proves.size(); ++i)
+    positions.push_back((void*)i);
+
+  fork_children([&] (ObligationChecker& child_checker, Callback& send) {
+    child_checker.check_all(target, rewrite, target_block, rewrite_block,
+                            p, q, assume, proves, testcases, send, override_separate_stack, positions);
+  }, callback, NULL, optionals);
+}
+
+void ForkingObligationChecker::fork_children(const function<void (ObligationChecker&, Callback&)>& job,
+    Callback& callback, void* optional, const vector<void*>& optionals) {
+
+  const auto fail = [&] (const string& s) {
+    if (optionals.empty()) {
+      return_error(callback, s, optional);
+    } else {
+      for (auto opt : optionals)
+        return_error(callback, s, opt);
+    }
+  };
+  const auto batched = !optionals.empty();
+
   vector<pid_t> friends;
   set<pid_t> friend_set;
 
@@ -74,7 +121,7 @@ void ForkingObligationChecker::check(
     int result = pipe2(pipefd, O_NONBLOCK);
     if (result != 0) {
       perror("[check] pipe");
-      return_error(callback, "Call to pipe() failed", optional);
+      fail("Call to pipe() failed");
       return;
     }
 
@@ -86,15 +133,12 @@ void ForkingObligationChecker::check(
     DEBUG_FORKING_CHECKER(cout << "[check] fork time: " << elapsed.count() << endl;)
     if (pid == 0) {
       // child
+      Telemetry::after_fork();
       close(pipefd[0]);
-      Callback callback = [&pipefd, child_checker] (Result& result, void* info) {
-        // send data back to parent proccess
-        stringstream ss;
-        result.write_text(ss);
-        ss << endl;
-        const char* buffer = ss.str().c_str();
+      auto send = [&pipefd] (const string& data) {
+        const char* buffer = data.c_str();
         DEBUG_FORKING_CHECKER(cout << "BUFFER: " << buffer << endl;)
-        size_t len = strlen(buffer);
+        size_t len = data.size();
 
         while (len > 0) {
           int n = write(pipefd[1], buffer, len);
@@ -111,9 +155,22 @@ void ForkingObligationChecker::check(
           }
         }
       };
-      child_checker->check(target, rewrite, target_block, rewrite_block,
-                           p, q, assume, prove, testcases, callback, override_separate_stack, optional);
+      Callback callback = [&send, batched] (Result& result, void* info) {
+        // send data back to parent proccess
+        stringstream ss;
+        if (batched)
+          ss << (size_t)info << endl;
+        result.write_text(ss);
+        ss << endl;
+        send(ss.str());
+      };
+      job(*child_checker, callback);
       child_checker->block_until_complete();
+
+      // and what it cost, so the parent can report it
+      stringstream ss;
+      Telemetry::snapshot().write(ss);
+      send(ss.str());
       close(pipefd[1]);
       exit(0);
     } else {
@@ -129,6 +186,7 @@ void ForkingObligationChecker::check(
 
       // record info on child
       ProcessInfo pi(callback, optional);
+      pi.optionals = optionals;
       pi.fd = pipefd[0];
       pi.pid = pid;
       pi.friends = friends;
@@ -308,14 +366,43 @@ void ForkingObligationChecker::poll_and_read(bool fast) {
 }
 
 void ForkingObligationChecker::finish_process(ProcessInfo& pi) const {
-  ObligationChecker::Result result;
   stringstream ss(pi.data);
-  ss >> result;
-  DEBUG_FORKING_CHECKER(cout << "[finish_process] got result: " << endl;
-                        result.write_text(cout);
-                        cout << endl;
-                        cout << "calling callback at addr " << (uint64_t)pi.callback << endl;)
-  (*pi.callback)(result, pi.optional);
+
+  if (pi.optionals.empty()) {
+    ObligationChecker::Result result;
+    ss >> result;
+
+    Telemetry::Snapshot snapshot;
+    if (snapshot.read(ss))
+      Telemetry::merge(snapshot);
+    DEBUG_FORKING_CHECKER(cout << "[finish_process] got result: " << endl;
+                          result.write_text(cout);
+                          cout << endl;
+                          cout << "calling callback at addr " << (uint64_t)pi.callback << endl;)
+    (*pi.callback)(result, pi.optional);
+    close(pi.fd);
+    return;
+  }
+
+  // A batch sends one result per claim, each after its position
+  vector<bool> reported(pi.optionals.size(), false);
+  for (size_t i = 0; i < pi.optionals.size(); ++i) {
+    size_t position;
+    if (!(ss >> position >> ws) || position >= pi.optionals.size())
+      break;
+    ObligationChecker::Result result;
+    ss >> result;
+    reported[position] = true;
+    (*pi.callback)(result, pi.optionals[position]);
+  }
+
+  Telemetry::Snapshot snapshot;
+  if (snapshot.read(ss))
+    Telemetry::merge(snapshot);
+
+  for (size_t i = 0; i < reported.size(); ++i)
+    if (!reported[i])
+      return_error(*pi.callback, "Checker process exited without a result", pi.optionals[i]);
   close(pi.fd);
 }
 
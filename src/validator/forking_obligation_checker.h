@@ -15,6 +15,7 @@
 #ifndef STOKE_SRC_VALIDATOR_FORKING_OBLIGATION_CHECKER_H
 #define STOKE_SRC_VALIDATOR_FORKING_OBLIGATION_CHECKER_H
 
+#include <functional>
 #include <iostream>
 #include <sstream>
 #include <vector>
@@ -24,12 +25,6 @@
 
 #include "src/validator/obligation_checker.h"
 
-//#define DEBUG_CHECKER_PERFORMANCE
-
-#ifdef DEBUG_CHECKER_PERFORMANCE
-#include "src/solver/z3solver.h"
-#endif
-
 namespace stoke {
 
 class ForkingObligationChecker : public ObligationChecker {
@@ -62,6 +57,18 @@ public:
                      bool override_separate_stack,
                      void* optional) override;
 
+  /** Checks every claim for one pair of paths in a single child process per
+    checker, so that the children can share work between claims. */
+  virtual void check_all(const Cfg& target, const Cfg& rewrite,
+                         Cfg::id_type target_block, Cfg::id_type rewrite_block,
+                         const CfgPath& p, const CfgPath& q,
+                         std::shared_ptr<Invariant> assume,
+                         const std::vector<std::shared_ptr<Invariant>>& proves,
+                         const std::vector<std::pair<CpuState, CpuState>>& testcases,
+                         Callback& callback,
+                         bool override_separate_stack,
+                         const std::vector<void*>& optionals) override;
+
   /** Get the filter */
   Filter& get_filter() {
     return child_checkers_[0]->get_filter();
@@ -109,6 +116,8 @@ private:
     // how client wants to get info back
     Callback* callback;
     void* optional;
+    // for a batch, the optional for each claim (empty otherwise)
+    std::vector<void*> optionals;
 
     // buffer with what we've read so far
     std::string data;
@@ -120,6 +129,11 @@ private:
   };
 
 
+  /** Forks a process for each child checker to run a job in; results are
+    passed back to the callback with optional, or with the matching entry of
+    optionals for a batch. */
+  void fork_children(const std::function<void (ObligationChecker&, Callback&)>& job,
+                     Callback& callback, void* optional, const std::vector<void*>& optionals);
   /** Tries to read from one of the processes */
   void poll_and_read(bool fast);
   /** Block until free thread. */
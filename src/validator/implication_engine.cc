@@ -0,0 +1,491 @@
+// Copyright 2013-2019 Stanford University
+//
+// Licensed under the Apache License, Version 2.0 (the License);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an AS IS BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <cassert>
+
+#include "src/validator/implication_engine.h"
+#include "src/validator/invariants/equality.h"
+#include "src/validator/invariants/inequality.h"
+#include "src/validator/invariants/memory_null.h"
+#include "src/validator/invariants/mod_2n.h"
+#include "src/validator/invariants/nonzero.h"
+#include "src/validator/invariants/range.h"
+#include "src/validator/invariants/sign.h"
+
+using namespace std;
+using namespace stoke;
+using namespace x64asm;
+
+namespace {
+
+uint64_t mask(size_t bits) {
+  return bits >= 64 ? (uint64_t)(-1) : ((uint64_t)1 << bits) - 1;
+}
+
+/** The inverse of an odd number modulo 2^64, by Newton's method. */
+uint64_t inverse(uint64_t a) {
+  assert(a & 1);
+  uint64_t x = a;
+  for (size_t i = 0; i < 5; ++i)
+    x *= 2 - a*x;
+  return x;
+}
+
+/** Identifies a variable regardless of the coefficient it carries. */
+Variable key(Variable v) {
+  v.coefficient = 1;
+  return v;
+}
+
+/** sum(coefficients[v] * v) == constant, modulo 2^bits. */
+struct Linear {
+  map<Variable, uint64_t> coefficients;
+  uint64_t constant;
+  size_t bits;
+
+  bool has_odd_coefficient() const {
+    for (auto it : coefficients)
+      if (it.second & 1)
+        return true;
+    return false;
+  }
+};
+
+/** Puts an equality in the form EqualityInvariant::operator() actually
+  proves: every coefficient divided by the largest power of two they share,
+  and the comparison made modulo a correspondingly smaller power of two. */
+bool get_linear(const shared_ptr<Invariant>& inv, Linear& out) {
+  auto eq = dynamic_pointer_cast<EqualityInvariant>(inv);
+  if (!eq || eq->get_modulus() != 0)
+    return false;
+
+  auto terms = eq->get_terms();
+  size_t k = 64;
+  for (auto t : terms) {
+    if (t.size > 8)
+      return false;
+    if (t.coefficient != 0)
+      k = min(k, (size_t)__builtin_ctzl(t.coefficient));
+  }
+  if (k >= 63)
+    return false;
+
+  out.bits = 64 - k;
+  out.coefficients.clear();
+  for (auto t : terms) {
+    if (t.coefficient == 0)
+      continue;
+    out.coefficients[key(t)] += (uint64_t)(t.coefficient / ((long)1 << k));
+  }
+  for (auto it = out.coefficients.begin(); it != out.coefficients.end(); ) {
+    it->second &= mask(out.bits);
+    if (it->second == 0)
+      it = out.coefficients.erase(it);
+    else
+      ++it;
+  }
+  out.constant = (uint64_t)eq->get_constant() & mask(out.bits);
+
+  return out.coefficients.size() > 0 && out.has_odd_coefficient();
+}
+
+/** One equality implies another when the second is a multiple of the first,
+  and only then: the first leaves every variable but one free. */
+ImplicationEngine::Answer linear_implies(const Linear& a, const Linear& b) {
+  if (b.bits > a.bits)
+    return ImplicationEngine::NO;
+
+  Variable pivot(rax, false);
+  for (auto it : a.coefficients) {
+    if (it.second & 1) {
+      pivot = it.first;
+      break;
+    }
+  }
+
+  auto lookup = [](const Linear& l, const Variable& v) -> uint64_t {
+    auto it = l.coefficients.find(v);
+    return it == l.coefficients.end() ? 0 : it->second;
+  };
+
+  uint64_t lambda = lookup(b, pivot) * inverse(lookup(a, pivot));
+  auto m = mask(b.bits);
+
+  for (auto it : a.coefficients)
+    if ((lookup(b, it.first) - lambda*it.second) & m)
+      return ImplicationEngine::NO;
+  for (auto it : b.coefficients)
+    if ((it.second - lambda*lookup(a, it.first)) & m)
+      return ImplicationEngine::NO;
+  if ((b.constant - lambda*a.constant) & m)
+    return ImplicationEngine::NO;
+
+  return ImplicationEngine::YES;
+}
+
+/** What an invariant says about a single variable: its unsigned value lies
+  in one of the intervals, and is a multiple of 2^zero_bits. */
+struct Fact {
+  Variable var;
+  size_t width;
+  vector<pair<uint64_t, uint64_t>> intervals;
+  size_t zero_bits;
+
+  Fact() : var(rax, false), width(64), zero_bits(0) { }
+};
+
+bool get_fact(const shared_ptr<Invariant>& inv, Fact& f) {
+  auto set_var = [&f](const Variable& v) -> bool {
+    if (v.size == 0 || v.size > 8)
+      return false;
+    f.var = key(v);
+    f.width = v.size*8;
+    f.zero_bits = 0;
+    f.intervals.clear();
+    return true;
+  };
+
+  if (auto range = dynamic_pointer_cast<RangeInvariant>(inv)) {
+    if (!set_var(range->get_variable()))
+      return false;
+    // The bounds get truncated to the variable's width
+    auto m = mask(f.width);
+    f.intervals.push_back({range->get_min() & m, range->get_max() & m});
+    return true;
+  }
+
+  if (auto nonzero = dynamic_pointer_cast<NonzeroInvariant>(inv)) {
+    if (!set_var(nonzero->get_variable()))
+      return false;
+    if (nonzero->is_negated())
+      f.intervals.push_back({0, 0});
+    else
+      f.intervals.push_back({1, mask(f.width)});
+    return true;
+  }
+
+  if (auto sign = dynamic_pointer_cast<SignInvariant>(inv)) {
+    if (!set_var(sign->get_variable()))
+      return false;
+    auto max_positive = mask(f.width) >> 1;
+    if (sign->is_positive()) {
+      f.intervals.push_back({0, max_positive});
+    } else {
+      f.intervals.push_back({0, 0});
+      f.intervals.push_back({max_positive + 1, mask(f.width)});
+    }
+    return true;
+  }
+
+  if (auto mod = dynamic_pointer_cast<Mod2NInvariant>(inv)) {
+    if (!set_var(mod->get_variable()) || mod->get_zero_bits() > 30)
+      return false;
+    if (mod->get_zero_bits() >= f.width) {
+      f.intervals.push_back({0, 0});
+    } else {
+      f.intervals.push_back({0, mask(f.width)});
+      f.zero_bits = mod->get_zero_bits();
+    }
+    return true;
+  }
+
+  // c*x == k, with c odd, pins x down
+  Linear l;
+  if (get_linear(inv, l) && l.bits == 64 && l.coefficients.size() == 1) {
+    auto term = *l.coefficients.begin();
+    if (!set_var(term.first))
+      return false;
+
+    // The equality is over the sign-extended value
+    uint64_t value = l.constant * inverse(term.second);
+    uint64_t low = value & mask(f.width);
+    uint64_t extended = low;
+    if (f.width < 64 && (low >> (f.width - 1)) & 1)
+      extended |= ~mask(f.width);
+    if (extended != value)
+      return false;
+
+    f.intervals.push_back({low, low});
+    return true;
+  }
+
+  return false;
+}
+
+/** The first multiple of 2^bits in [lo, hi], if any. */
+bool first_multiple(uint64_t lo, uint64_t hi, size_t bits, uint64_t& out) {
+  auto m = mask(bits);
+  auto r = lo & m;
+  out = r == 0 ? lo : lo + (m - r + 1);
+  return out >= lo && out <= hi;
+}
+
+/** Some member of a's set that isn't in any of b's intervals. */
+bool find_outside(const Fact& a, const Fact& b, uint64_t& witness) {
+  auto intervals = b.intervals;
+  sort(intervals.begin(), intervals.end());
+
+  for (auto piece : a.intervals) {
+    uint64_t cur = piece.first;
+    bool done = false;
+    for (auto in : intervals) {
+      if (in.second < cur)
+        continue;
+      if (in.first > piece.second)
+        break;
+      if (in.first > cur && first_multiple(cur, in.first - 1, a.zero_bits, witness))
+        return true;
+      if (in.second >= piece.second) {
+        done = true;
+        break;
+      }
+      cur = in.second + 1;
+    }
+    if (!done && first_multiple(cur, piece.second, a.zero_bits, witness))
+      return true;
+  }
+  return false;
+}
+
+ImplicationEngine::Answer fact_implies(const Fact& a, const Fact& b) {
+  // Nothing to reason about if a is unsatisfiable
+  uint64_t witness;
+  bool satisfiable = false;
+  for (auto piece : a.intervals)
+    if (piece.first <= piece.second && first_multiple(piece.first, piece.second, a.zero_bits, witness))
+      satisfiable = true;
+  if (!satisfiable)
+    return ImplicationEngine::UNKNOWN;
+
+  if (find_outside(a, b, witness))
+    return ImplicationEngine::NO;
+  if (a.zero_bits >= b.zero_bits)
+    return ImplicationEngine::YES;
+
+  // Every value a allows must be a multiple of 2^b.zero_bits
+  for (auto piece : a.intervals) {
+    uint64_t first;
+    if (piece.first > piece.second || !first_multiple(piece.first, piece.second, a.zero_bits, first))
+      continue;
+    if (first & mask(b.zero_bits))
+      return ImplicationEngine::NO;
+    uint64_t step = (uint64_t)1 << a.zero_bits;
+    if (first + step > first && first + step <= piece.second)
+      return ImplicationEngine::NO;
+  }
+  return ImplicationEngine::YES;
+}
+
+bool same_address(const Mem& m1, const Mem& m2) {
+  if (m1.contains_seg() != m2.contains_seg() || (m1.contains_seg() && m1.get_seg() != m2.get_seg()))
+    return false;
+  if (m1.contains_base() != m2.contains_base() || (m1.contains_base() && m1.get_base() != m2.get_base()))
+    return false;
+  if (m1.contains_index() != m2.contains_index())
+    return false;
+  if (m1.contains_index() && (m1.get_index() != m2.get_index() || m1.get_scale() != m2.get_scale()))
+    return false;
+  return m1.rip_offset() == m2.rip_offset();
+}
+
+/** Memory null checks on the same address expression, up to displacement. */
+ImplicationEngine::Answer memory_null_implies(const MemoryNullInvariant& a, const MemoryNullInvariant& b) {
+  auto ma = a.get_mem();
+  auto mb = b.get_mem();
+  if (a.is_rewrite() != b.is_rewrite() || !same_address(ma, mb))
+    return ImplicationEngine::UNKNOWN;
+
+  // Null and non-null never follow from each other: the bytes they don't
+  // share are free, and the ones they do share make them contradict.
+  if (a.is_null() != b.is_null())
+    return ImplicationEngine::NO;
+
+  int32_t a_disp = ma.get_disp();
+  int32_t b_disp = mb.get_disp();
+  int64_t a_lo = a_disp;
+  int64_t a_hi = a_lo + ma.size()/8;
+  int64_t b_lo = b_disp;
+  int64_t b_hi = b_lo + mb.size()/8;
+
+  // All zero covers fewer bytes; some byte non-zero covers more
+  bool inside = a.is_null() ? (a_lo <= b_lo && b_hi <= a_hi) : (b_lo <= a_lo && a_hi <= b_hi);
+  return inside ? ImplicationEngine::YES : ImplicationEngine::NO;
+}
+
+ImplicationEngine::Answer inequality_implies(const InequalityInvariant& a, const InequalityInvariant& b) {
+  if (key(a.get_variable1()) != key(b.get_variable1()) ||
+      key(a.get_variable2()) != key(b.get_variable2()) ||
+      a.is_signed() != b.is_signed() ||
+      a.get_lhs_constant() != b.get_lhs_constant())
+    return ImplicationEngine::UNKNOWN;
+
+  return a.is_strict() || !b.is_strict() ? ImplicationEngine::YES : ImplicationEngine::NO;
+}
+
+/** x - y == 0 gives x <= y and y <= x, but neither strictly. */
+ImplicationEngine::Answer equality_implies_inequality(const Linear& a, const InequalityInvariant& b) {
+  if (a.bits != 64 || a.constant != 0 || a.coefficients.size() != 2)
+    return ImplicationEngine::UNKNOWN;
+
+  auto first = *a.coefficients.begin();
+  auto second = *a.coefficients.rbegin();
+  if (first.second + second.second != 0 || (first.second != 1 && second.second != 1))
+    return ImplicationEngine::UNKNOWN;
+  if (first.first.size != second.first.size)
+    return ImplicationEngine::UNKNOWN;
+
+  auto v1 = key(b.get_variable1());
+  auto v2 = key(b.get_variable2());
+  bool same_pair = (v1 == first.first && v2 == second.first) ||
+                   (v1 == second.first && v2 == first.first);
+  if (!same_pair || b.get_lhs_constant() != 0)
+    return ImplicationEngine::UNKNOWN;
+
+  return b.is_strict() ? ImplicationEngine::NO : ImplicationEngine::YES;
+}
+
+} // namespace
+
+namespace stoke {
+
+ImplicationEngine::Answer ImplicationEngine::implies(shared_ptr<Invariant> a, shared_ptr<Invariant> b) {
+
+  if (a == b || *a == *b)
+    return YES;
+
+  Linear la, lb;
+  bool a_linear = get_linear(a, la);
+  bool b_linear = get_linear(b, lb);
+  if (a_linear && b_linear)
+    return linear_implies(la, lb);
+
+  Fact fa, fb;
+  if (get_fact(a, fa) && get_fact(b, fb)) {
+    if (fa.var == fb.var && fa.width == fb.width)
+      return fact_implies(fa, fb);
+    if (!fa.var.is_related(fb.var))
+      return NO;
+    return UNKNOWN;
+  }
+
+  auto ineq_a = dynamic_pointer_cast<InequalityInvariant>(a);
+  auto ineq_b = dynamic_pointer_cast<InequalityInvariant>(b);
+  if (ineq_a && ineq_b) {
+    auto answer = inequality_implies(*ineq_a, *ineq_b);
+    if (answer != UNKNOWN)
+      return answer;
+  }
+  if (a_linear && ineq_b) {
+    auto answer = equality_implies_inequality(la, *ineq_b);
+    if (answer != UNKNOWN)
+      return answer;
+  }
+
+  auto null_a = dynamic_pointer_cast<MemoryNullInvariant>(a);
+  auto null_b = dynamic_pointer_cast<MemoryNullInvariant>(b);
+  if (null_a && null_b)
+    return memory_null_implies(*null_a, *null_b);
+
+  // Facts about unrelated variables don't imply each other (short of one
+  // being unsatisfiable, or the other valid, which the learner never keeps).
+  auto vars_a = a->get_variables();
+  auto vars_b = b->get_variables();
+  if (vars_a.size() && vars_b.size()) {
+    bool related = false;
+    for (auto& x : vars_a)
+      for (auto& y : vars_b)
+        related |= x.is_related(y);
+    if (!related)
+      return NO;
+  }
+
+  return UNKNOWN;
+}
+
+void ImplicationEngine::LinearSystem::reduce(Row& r) const {
+  for (const auto& row : rows_) {
+    auto it = r.coefficients.find(row.pivot);
+    if (it == r.coefficients.end())
+      continue;
+
+    uint64_t c = it->second;
+    for (auto term : row.coefficients) {
+      auto& x = r.coefficients[term.first];
+      x -= c*term.second;
+      if (x == 0)
+        r.coefficients.erase(term.first);
+    }
+    r.constant -= c*row.constant;
+    r.sources.insert(row.sources.begin(), row.sources.end());
+  }
+}
+
+bool ImplicationEngine::LinearSystem::implies(shared_ptr<Invariant> inv,
+    vector<shared_ptr<Invariant>>* sources) const {
+  Linear l;
+  if (!get_linear(inv, l) || l.bits != 64)
+    return false;
+
+  Row r;
+  r.coefficients = l.coefficients;
+  r.constant = l.constant;
+  reduce(r);
+
+  if (r.coefficients.size() || r.constant)
+    return false;
+
+  if (sources) {
+    sources->clear();
+    for (auto i : r.sources)
+      sources->push_back(invariants_[i]);
+  }
+  return true;
+}
+
+bool ImplicationEngine::LinearSystem::add(shared_ptr<Invariant> inv) {
+  Linear l;
+  if (!get_linear(inv, l) || l.bits != 64)
+    return false;
+
+  Row r;
+  r.coefficients = l.coefficients;
+  r.constant = l.constant;
+  reduce(r);
+
+  // Only an odd coefficient can be scaled to one
+  auto pivot = r.coefficients.end();
+  for (auto it = r.coefficients.begin(); it != r.coefficients.end(); ++it) {
+    if (it->second & 1) {
+      pivot = it;
+      break;
+    }
+  }
+  if (pivot == r.coefficients.end())
+    return false;
+
+  r.pivot = pivot->first;
+  auto scale = inverse(pivot->second);
+  for (auto& term : r.coefficients)
+    term.second *= scale;
+  r.constant *= scale;
+
+  // The row is now a combination of inv and the rows it was reduced against
+  r.sources.insert(invariants_.size());
+  invariants_.push_back(inv);
+  rows_.push_back(r);
+  return true;
+}
+
+} // namespace stoke
@@ -0,0 +1,96 @@
+// Copyright 2013-2019 Stanford University
+//
+// Licensed under the Apache License, Version 2.0 (the License);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an AS IS BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef STOKE_SRC_VALIDATOR_IMPLICATION_ENGINE_H
+#define STOKE_SRC_VALIDATOR_IMPLICATION_ENGINE_H
+
+#include <map>
+#include <memory>
+#include <set>
+#include <vector>
+
+#include "src/validator/invariant.h"
+#include "src/validator/variable.h"
+
+namespace stoke {
+
+/** Decides implications between the invariants the learner produces without
+  going to the solver: linear equalities over 64-bit words, intervals,
+  sign, nonzero and mod 2^n facts about one variable, register inequalities
+  and memory null checks.  Distinct variables are treated as unrelated, so a
+  YES always holds; a NO may occasionally miss an implication through
+  overlapping registers or aliasing memory, which only costs a replacement. */
+class ImplicationEngine {
+
+public:
+
+  enum Answer {
+    NO,
+    YES,
+    /** Not a pair we know how to reason about; ask the solver. */
+    UNKNOWN
+  };
+
+  /** Does a imply b? */
+  static Answer implies(std::shared_ptr<Invariant> a, std::shared_ptr<Invariant> b);
+
+  /** A set of linear equalities over 64-bit words, kept in row-echelon form
+    with unit pivots, that can tell when a new equality follows from several
+    of the ones already there. */
+  class LinearSystem {
+
+  public:
+
+    /** Does the system imply inv?  If so, and sources is given, it receives
+      the equalities that were needed.  Always false for anything that isn't
+      a linear equality we can reason about. */
+    bool implies(std::shared_ptr<Invariant> inv,
+                 std::vector<std::shared_ptr<Invariant>>* sources = NULL) const;
+
+    /** Adds an equality.  Returns false if it can't be used, or if it's
+      already implied. */
+    bool add(std::shared_ptr<Invariant> inv);
+
+    /** The number of independent equalities in the system. */
+    size_t size() const {
+      return rows_.size();
+    }
+
+  private:
+
+    struct Row {
+      /** Coefficients by variable (with coefficient 1); never zero. */
+      std::map<Variable, uint64_t> coefficients;
+      uint64_t constant;
+      /** The pivot has coefficient 1 here and 0 in every later row. */
+      Variable pivot;
+      /** Indexes into invariants_. */
+      std::set<size_t> sources;
+
+      Row() : constant(0), pivot(x64asm::rax, false) { }
+    };
+
+    std::vector<Row> rows_;
+    std::vector<std::shared_ptr<Invariant>> invariants_;
+
+    /** Subtracts multiples of the rows from r until it has no pivots left. */
+    void reduce(Row& r) const;
+
+  };
+
+};
+
+} // namespace stoke
+
+#endif
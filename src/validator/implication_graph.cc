@@ -12,65 +12,99 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include "src/validator/implication_engine.h"
 #include "src/validator/implication_graph.h"
 #include "src/validator/invariants.h"
 
 using namespace std;
 using namespace stoke;
 
-size_t ImplicationGraph::compute(size_t i1, size_t i2) {
+bool ImplicationGraph::implies(shared_ptr<Invariant> inv1, shared_ptr<Invariant> inv2) {
+
+  auto answer = ImplicationEngine::implies(inv1, inv2);
+  if (answer != ImplicationEngine::UNKNOWN)
+    return answer == ImplicationEngine::YES;
+
+  if (!smt_fallback_ || inv1->does_not_imply(inv2))
+    return false;
+
+  // setup symbolic states
 
-  auto set1 = invariant_sets_[i1];
-  auto set2 = invariant_sets_[i2];
+  SymState ts("TARGET");
+  SymState rs("REWRITE");
+
+  ts.memory = new FlatMemory(separate_stack_);
+  rs.memory = new FlatMemory(separate_stack_);
+
+  // is it possible that states exist satisfying inv1 but not inv2?
+  //   if SAT   => no implication
+  //   if UNSAT => inv1 => inv2
 
   size_t dummy;
+  auto test = (*inv1)(ts, rs, dummy) & !(*inv2)(ts, rs, dummy);
+  solver_queries_++;
+  return !smt_.is_sat({test});
+}
+
+size_t ImplicationGraph::compute(size_t i1, size_t i2) {
+
+  const auto& set1 = invariant_sets_[i1];
+  const auto& set2 = invariant_sets_[i2];
+
   size_t success = 0;
   size_t failures = 0;
+  size_t queries = solver_queries_;
 
   for (auto inv1 : set1) {
     for (auto inv2 : set2) {
       if (inv1 == inv2)
         continue;
 
-      if (inv1->does_not_imply(inv2)) {
-        cout << "Skipping check for ( " << *inv1 <<  " ) ==> ( " << *inv2 << " )" << endl;
+      // Of two equivalent invariants, only one goes
+      if (replacements_.count(inv2) && replacements_[inv2].count(inv1))
         continue;
-      }
-
-      // setup symbolic states
-
-      SymState ts("TARGET");
-      SymState rs("REWRITE");
-
-      ts.memory = new FlatMemory(separate_stack_);
-      rs.memory = new FlatMemory(separate_stack_);
 
-      // is it possible that states exist satisfying inv1 but not inv2?
-      //   if SAT   => no implication
-      //   if UNSAT => inv1 => inv2
-
-      cout << "( " << *inv1 << " ) ==> ( " << *inv2 << " )" << endl;
-      auto test = (*inv1)(ts, rs, dummy) & !(*inv2)(ts, rs, dummy);
-      //cout << "INV1: " <<  (*inv1)(ts, rs, dummy) << endl;
-      //cout << "INV2: " << (*inv2)(ts, rs, dummy) << endl;
-      //cout << "CONJ: " << test << endl;
-
-      bool worked;
-      if (smt_.is_sat({test})) {
+      if (implies(inv1, inv2)) {
+        supersede(inv1, inv2);
+        success++;
+      } else {
         failures++;
-        worked = false;
+      }
+    }
+  }
+
+  // Equalities that only follow from several others together
+  ImplicationEngine::LinearSystem system;
+  vector<shared_ptr<Invariant>> sources;
+  if (i1 == i2) {
+    for (auto inv : set1) {
+      if (is_superseded(inv))
+        continue;
+      if (system.implies(inv, &sources)) {
+        for (auto s : sources)
+          supersede(s, inv);
+        success++;
       } else {
-        superseded_.insert(inv2);
-        replacements_[inv1].insert(inv2);
+        system.add(inv);
+      }
+    }
+  } else {
+    for (auto inv : set1)
+      if (!is_superseded(inv))
+        system.add(inv);
+    for (auto inv : set2) {
+      if (is_superseded(inv) || set1.count(inv))
+        continue;
+      if (system.implies(inv, &sources)) {
+        for (auto s : sources)
+          supersede(s, inv);
         success++;
-        worked = true;
       }
-
-      cout << "  OUTCOME: " << worked << endl;
     }
   }
 
-  cout << "SUCCESS : " << success << "  FAILURE : " << failures << endl;
+  cout << "[implication_graph] SUCCESS : " << success << "  FAILURE : " << failures
+       << "  SOLVER QUERIES : " << solver_queries_ - queries << endl;
   return success;
 }
 
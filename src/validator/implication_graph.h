@@ -28,26 +28,27 @@ class ImplicationGraph {
 public:
 
   ImplicationGraph(const Cfg& target, const Cfg& rewrite) :
-    target_(target), rewrite_(rewrite), smt_() {
+    target_(target), rewrite_(rewrite), smt_(), solver_queries_(0) {
     set_separate_stack(false);
+    set_smt_fallback(true);
   }
 
   std::set<std::shared_ptr<Invariant>> get_replacements(std::shared_ptr<Invariant> inv) {
-    //if(has_replacements(inv))
-    //  return replacements_[inv];
-    //else
-    return std::set<std::shared_ptr<Invariant>>();
+    if (has_replacements(inv))
+      return replacements_[inv];
+    else
+      return std::set<std::shared_ptr<Invariant>>();
   }
 
   bool has_replacements(std::shared_ptr<Invariant> inv) {
-    //if(replacements_.count(inv))
-    //  return replacements_[inv].size() > 0;
-    //else
-    return false;
+    if (replacements_.count(inv))
+      return replacements_[inv].size() > 0;
+    else
+      return false;
   }
 
   void add_replacement(std::shared_ptr<Invariant> inv, std::shared_ptr<Invariant> replacement) {
-    //replacements_[inv].insert(replacement);
+    replacements_[inv].insert(replacement);
   }
 
   bool is_superseded(std::shared_ptr<Invariant> inv) {
@@ -64,12 +65,12 @@ public:
 
   /** Add an invariant to the current class. */
   void add_invariant(std::shared_ptr<Invariant> inv) {
-    //invariant_sets_[current_set].insert(inv);
+    invariant_sets_[current_set].insert(inv);
   }
   /** Add an invariant to the current class. */
   void add_invariant(const std::vector<std::shared_ptr<Invariant>>& inv) {
-    //for(auto i : inv)
-    //  add_invariant(i);
+    for (auto i : inv)
+      add_invariant(i);
   }
 
 
@@ -80,6 +81,17 @@ public:
     separate_stack_ = b;
   }
 
+  /** Ask the solver about pairs the implication engine can't decide?  On by
+    default; without it, those pairs are assumed not to imply each other. */
+  void set_smt_fallback(bool b) {
+    smt_fallback_ = b;
+  }
+
+  /** How many implications went to the solver. */
+  size_t get_solver_queries() const {
+    return solver_queries_;
+  }
+
   void print();
 
 
@@ -89,12 +101,22 @@ private:
   const Cfg& rewrite_;
   Z3Solver smt_;
   bool separate_stack_;
+  bool smt_fallback_;
+  size_t solver_queries_;
 
   std::map<std::shared_ptr<Invariant>, std::set<std::shared_ptr<Invariant>>> replacements_;
   std::set<std::shared_ptr<Invariant>> superseded_;
 
   std::vector<std::set<std::shared_ptr<Invariant>>> invariant_sets_;
   size_t current_set = 0;
+
+  /** Does inv1 imply inv2, according to the engine or else the solver? */
+  bool implies(std::shared_ptr<Invariant> inv1, std::shared_ptr<Invariant> inv2);
+  /** Records that inv1 implies inv2, so inv2 isn't needed. */
+  void supersede(std::shared_ptr<Invariant> inv1, std::shared_ptr<Invariant> inv2) {
+    replacements_[inv1].insert(inv2);
+    superseded_.insert(inv2);
+  }
   /*
   std::map<std::shared_ptr<Invariant>, std::map<std::shared_ptr<Invariant>, bool>> implication_table_;
 
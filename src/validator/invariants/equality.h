@@ -210,6 +210,12 @@ public:
   std::vector<Variable> get_terms() const {
     return terms_;
   }
+  long get_constant() const {
+    return constant_;
+  }
+  uint64_t get_modulus() const {
+    return modulus_;
+  }
 
   /** return true if we're sure that *this does not imply inv. */
   virtual bool does_not_imply(std::shared_ptr<Invariant> inv) const override {
@@ -175,6 +175,22 @@ public:
     return std::make_shared<InequalityInvariant>(variable1_, variable2_, is_strict_, is_signed_, lhs_constant_);
   }
 
+  Variable get_variable1() const {
+    return variable1_;
+  }
+  Variable get_variable2() const {
+    return variable2_;
+  }
+  bool is_strict() const {
+    return is_strict_;
+  }
+  bool is_signed() const {
+    return is_signed_;
+  }
+  uint64_t get_lhs_constant() const {
+    return lhs_constant_;
+  }
+
 private:
 
   Variable variable1_;
@@ -114,6 +114,16 @@ public:
     return std::make_shared<MemoryNullInvariant>(m_, is_rewrite_, is_null_);
   }
 
+  x64asm::Mem get_mem() const {
+    return m_;
+  }
+  bool is_rewrite() const {
+    return is_rewrite_;
+  }
+  bool is_null() const {
+    return is_null_;
+  }
+
 private:
 
   x64asm::Mem m_;
@@ -76,6 +76,13 @@ public:
     return std::make_shared<Mod2NInvariant>(variable_, zero_bits_);
   }
 
+  Variable get_variable() const {
+    return variable_;
+  }
+  size_t get_zero_bits() const {
+    return zero_bits_;
+  }
+
 private:
 
   Variable variable_;
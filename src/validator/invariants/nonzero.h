@@ -81,6 +81,14 @@ public:
     return std::make_shared<NonzeroInvariant>(variable_, negate_);
   }
 
+  Variable get_variable() const {
+    return variable_;
+  }
+  /** True if this says the variable is zero. */
+  bool is_negated() const {
+    return negate_;
+  }
+
   virtual bool does_not_imply(std::shared_ptr<Invariant> inv) const override {
     auto casted = std::dynamic_pointer_cast<NonzeroInvariant>(inv);
     if (casted) {
@@ -81,6 +81,16 @@ public:
     return std::make_shared<RangeInvariant>(variable_, min_, max_);
   }
 
+  Variable get_variable() const {
+    return variable_;
+  }
+  uint64_t get_min() const {
+    return min_;
+  }
+  uint64_t get_max() const {
+    return max_;
+  }
+
 
 private:
 
@@ -84,6 +84,13 @@ public:
     return std::make_shared<SignInvariant>(variable_, positive_);
   }
 
+  Variable get_variable() const {
+    return variable_;
+  }
+  bool is_positive() const {
+    return positive_;
+  }
+
 private:
 
   Variable variable_;
@@ -15,6 +15,7 @@
 #include <chrono>
 
 #include "src/state/cpu_state.h"
+#include "src/telemetry/telemetry.h"
 #include "src/validator/invariants/conjunction.h"
 #include "src/validator/invariants/disjunction.h"
 #include "src/validator/invariants/equality.h"
@@ -923,6 +924,8 @@ std::shared_ptr<ConjunctionInvariant> InvariantLearner::learn(
   string target_cc,
   string rewrite_cc) {
 
+  Telemetry::Timer timer(Telemetry::LEARNER_LEARN);
+
   auto memequ = learn_memory_equality(states, states2, target_regs, rewrite_regs);
 
   if (memequ) {
@@ -13,8 +13,12 @@
 // limitations under the License.
 
 #include <chrono>
+#include <streambuf>
+#include <unordered_map>
+#include <zlib.h>
 
 #include "src/cfg/paths.h"
+#include "src/serialize/hash64.h"
 #include "src/serialize/serialize.h"
 #include "src/validator/obligation_checker.h"
 
@@ -122,6 +126,273 @@ istream& ObligationChecker::Obligation::read_text(istream& is) {
   return is;
 }
 
+namespace {
+
+/** Binary obligations start with these bytes, then a version and a flag
+  saying whether the rest is compressed. */
+const char bin_magic[4] = { 'S', 'T', 'K', 'O' };
+const uint8_t bin_version = 1;
+const size_t bin_header_size = 6;
+/** Encodings smaller than this aren't worth compressing. */
+const size_t bin_compress_threshold = 256;
+/** No sane obligation inflates to more than this. */
+const uint64_t bin_max_size = 1ull << 32;
+
+/** Appends an unsigned LEB128 integer. */
+void put_varint(string& out, uint64_t x) {
+  while (x >= 0x80) {
+    out.push_back((char)(x | 0x80));
+    x >>= 7;
+  }
+  out.push_back((char)x);
+}
+
+/** Reads an unsigned LEB128 integer and advances past it. */
+bool get_varint(const char*& cur, const char* end, uint64_t& x) {
+  x = 0;
+  for (size_t shift = 0; shift < 64 && cur != end; shift += 7) {
+    auto b = (uint8_t)*cur++;
+    x |= (uint64_t)(b & 0x7f) << shift;
+    if (!(b & 0x80))
+      return true;
+  }
+  return false;
+}
+
+/** Builds the uncompressed encoding.  Anything with a text serialization goes
+  into a pool of distinct blobs, and everything else refers to the pool. */
+class BinWriter {
+public:
+  void varint(uint64_t x) {
+    put_varint(body_, x);
+  }
+
+  /** Adds the text to the pool if it's new, and refers to it. */
+  void blob(const string& text) {
+    auto& candidates = index_[hash64(text)];
+    for (auto i : candidates) {
+      if (pool_[i] == text) {
+        varint(i);
+        return;
+      }
+    }
+    candidates.push_back(pool_.size());
+    varint(pool_.size());
+    pool_.push_back(text);
+  }
+
+  /** Writes the pool followed by the body. */
+  void finish(string& out) {
+    out.clear();
+    put_varint(out, pool_.size());
+    for (auto& text : pool_) {
+      put_varint(out, text.size());
+      out.append(text);
+    }
+    out.append(body_);
+  }
+
+private:
+  string body_;
+  vector<string> pool_;
+  unordered_map<uint64_t, vector<size_t>> index_;
+};
+
+/** Reads the uncompressed encoding in place. */
+class BinReader {
+public:
+  BinReader(const char* begin, const char* end) : cur_(begin), end_(end), ok_(true) { }
+
+  bool ok() const {
+    return ok_;
+  }
+
+  uint64_t varint() {
+    uint64_t x = 0;
+    ok_ = ok_ && get_varint(cur_, end_, x);
+    return ok_ ? x : 0;
+  }
+
+  /** Reads the length of a list whose entries each take at least one byte. */
+  uint64_t count() {
+    auto n = varint();
+    if (n > (uint64_t)(end_ - cur_))
+      ok_ = false;
+    return ok_ ? n : 0;
+  }
+
+  /** Reads the pool, keeping pointers into the buffer rather than copies. */
+  void pool() {
+    auto n = count();
+    for (size_t i = 0; ok_ && i < n; ++i) {
+      auto size = varint();
+      if (size > (uint64_t)(end_ - cur_)) {
+        ok_ = false;
+        return;
+      }
+      pool_.push_back({cur_, size});
+      cur_ += size;
+    }
+  }
+
+  /** Parses the pool entry that comes next in the body. */
+  template <typename F>
+  void blob(F parse) {
+    auto i = varint();
+    if (!ok_ || i >= pool_.size()) {
+      ok_ = false;
+      return;
+    }
+    ViewBuf buf(pool_[i].first, pool_[i].second);
+    istream is(&buf);
+    parse(is);
+    ok_ = ok_ && !is.fail();
+  }
+
+private:
+  /** Lets a stream read straight out of the buffer. */
+  struct ViewBuf : public streambuf {
+    ViewBuf(const char* data, size_t size) {
+      auto p = const_cast<char*>(data);
+      setg(p, p, p + size);
+    }
+  };
+
+  const char* cur_;
+  const char* end_;
+  bool ok_;
+  vector<pair<const char*, size_t>> pool_;
+};
+
+} // namespace
+
+bool ObligationChecker::Obligation::is_bin(const char* data, size_t size) {
+  return size >= bin_header_size && !memcmp(data, bin_magic, sizeof(bin_magic));
+}
+
+void ObligationChecker::Obligation::write_bin(string& out, uint64_t* hash) const {
+  BinWriter w;
+
+  auto write_cfg = [&w](const Cfg& cfg) {
+    stringstream ss;
+    cfg.serialize(ss);
+    w.blob(ss.str());
+  };
+  auto write_invariant = [&w](const shared_ptr<Invariant>& inv) {
+    stringstream ss;
+    inv->serialize(ss);
+    w.blob(ss.str());
+  };
+  auto write_state = [&w](const CpuState& cs) {
+    stringstream ss;
+    cs.write_text(ss);
+    w.blob(ss.str());
+  };
+
+  write_cfg(target);
+  write_cfg(rewrite);
+  w.varint(target_block);
+  w.varint(rewrite_block);
+  w.varint(P.size());
+  for (auto b : P)
+    w.varint(b);
+  w.varint(Q.size());
+  for (auto b : Q)
+    w.varint(b);
+  write_invariant(assume);
+  write_invariant(prove);
+  w.varint(testcases.size());
+  for (auto& tc : testcases) {
+    write_state(tc.first);
+    write_state(tc.second);
+  }
+  w.varint(separate_stack);
+
+  string raw;
+  w.finish(raw);
+  if (hash != NULL)
+    *hash = hash64(raw, bin_version);
+
+  out.assign(bin_magic, sizeof(bin_magic));
+  out.push_back((char)bin_version);
+
+  // Mostly this squeezes the memory segments of the testcases
+  if (raw.size() >= bin_compress_threshold) {
+    auto bound = compressBound(raw.size());
+    string compressed(bound, '\0');
+    if (compress2((Bytef*)&compressed[0], &bound, (const Bytef*)raw.data(), raw.size(),
+                  Z_DEFAULT_COMPRESSION) == Z_OK) {
+      compressed.resize(bound);
+      out.push_back(1);
+      put_varint(out, raw.size());
+      out.append(compressed);
+      return;
+    }
+  }
+
+  out.push_back(0);
+  out.append(raw);
+}
+
+bool ObligationChecker::Obligation::read_bin(const char* data, size_t size) {
+  if (!is_bin(data, size) || (uint8_t)data[4] != bin_version)
+    return false;
+
+  const char* begin = data + bin_header_size;
+  const char* end = data + size;
+
+  string inflated;
+  if (data[5]) {
+    uint64_t raw_size;
+    if (!get_varint(begin, end, raw_size) || raw_size > bin_max_size)
+      return false;
+
+    inflated.resize(raw_size);
+    uLongf inflated_size = raw_size;
+    if (uncompress((Bytef*)&inflated[0], &inflated_size, (const Bytef*)begin, end - begin) != Z_OK ||
+        inflated_size != raw_size)
+      return false;
+    begin = inflated.data();
+    end = begin + inflated.size();
+  }
+
+  BinReader r(begin, end);
+  r.pool();
+
+  r.blob([this](istream& is) {
+    target = Cfg::deserialize(is);
+  });
+  r.blob([this](istream& is) {
+    rewrite = Cfg::deserialize(is);
+  });
+  target_block = r.varint();
+  rewrite_block = r.varint();
+  P.resize(r.count());
+  for (size_t i = 0; r.ok() && i < P.size(); ++i)
+    P[i] = r.varint();
+  Q.resize(r.count());
+  for (size_t i = 0; r.ok() && i < Q.size(); ++i)
+    Q[i] = r.varint();
+  r.blob([this](istream& is) {
+    assume = Invariant::deserialize(is);
+  });
+  r.blob([this](istream& is) {
+    prove = Invariant::deserialize(is);
+  });
+  testcases.resize(r.count());
+  for (size_t i = 0; r.ok() && i < testcases.size(); ++i) {
+    auto& tc = testcases[i];
+    r.blob([&tc](istream& is) {
+      tc.first.read_text(is);
+    });
+    r.blob([&tc](istream& is) {
+      tc.second.read_text(is);
+    });
+  }
+  separate_stack = r.varint();
+
+  return r.ok();
+}
 
 /** Given a path and start state, figure out if the ith block has a jump */
 ObligationChecker::JumpType ObligationChecker::is_jump(const Cfg& cfg, Cfg::id_type end_block, const CfgPath& P_copy, size_t i) {
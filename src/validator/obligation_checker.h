@@ -36,15 +36,10 @@
 #include "src/symstate/memory/arm.h"
 #include "src/validator/data_collector.h"
 #include "src/validator/invariant.h"
+#include "src/validator/invariants/conjunction.h"
 #include "src/validator/filters/default.h"
 #include "src/validator/filters/bound_away.h"
 
-//#define DEBUG_CHECKER_PERFORMANCE
-
-#ifdef DEBUG_CHECKER_PERFORMANCE
-#include "src/solver/z3solver.h"
-#endif
-
 namespace stoke {
 
 class ObligationChecker {
@@ -117,6 +112,17 @@ public:
     std::istream& read_text(std::istream& is);
     std::ostream& write_text(std::ostream& os) const;
 
+    /** Write a compact, compressed binary encoding.  Cfgs, invariants and
+      states that appear more than once are only stored once.  If hash is
+      non-null, it receives a hash of the uncompressed encoding, which names
+      the obligation independently of how it gets compressed. */
+    void write_bin(std::string& out, uint64_t* hash = NULL) const;
+    /** Read an encoding made by write_bin().  Returns false if the data is
+      malformed or from an unknown version of the format. */
+    bool read_bin(const char* data, size_t size);
+    /** Does this data look like it came from write_bin()? */
+    static bool is_bin(const char* data, size_t size);
+
     Obligation() :
       target(TUnit(), x64asm::RegSet::empty(), x64asm::RegSet::empty()),
       rewrite(TUnit(), x64asm::RegSet::empty(), x64asm::RegSet::empty())
@@ -135,6 +141,7 @@ public:
     set_basic_block_ghosts(true);
     set_fixpoint_up(false);
     set_separate_stack(false);
+    set_priority(0);
   }
 
   ObligationChecker(const ObligationChecker& oc)
@@ -144,6 +151,7 @@ public:
     fixpoint_up_ = oc.fixpoint_up_;
     alias_strategy_ = oc.alias_strategy_;
     separate_stack_ = oc.separate_stack_;
+    priority_ = oc.priority_;
   }
 
   virtual ~ObligationChecker() {
@@ -190,6 +198,13 @@ public:
     return *this;
   }
 
+  /** Set the priority of obligations dispatched from now on.  Checkers that
+    queue work up start higher priority obligations first; the rest ignore it. */
+  virtual ObligationChecker& set_priority(int priority) {
+    priority_ = priority;
+    return *this;
+  }
+
   /** Turn checking into a synchronous operation. */
   Result check_wait(const Cfg& target, const Cfg& rewrite,
                     Cfg::id_type target_block, Cfg::id_type rewrite_block,
@@ -215,6 +230,40 @@ public:
     return await_result;
   }
 
+  /** Checks every conjunct of prove at once and returns the indexes of the
+    ones that don't hold (a conjunct whose check errors out counts as not
+    holding). */
+  std::vector<size_t> failing_conjuncts(const Cfg& target, const Cfg& rewrite,
+                                        Cfg::id_type target_block, Cfg::id_type rewrite_block,
+                                        const CfgPath& p, const CfgPath& q,
+                                        std::shared_ptr<Invariant> assume,
+                                        std::shared_ptr<ConjunctionInvariant> prove,
+                                        const std::vector<std::pair<CpuState, CpuState>>& testcases,
+                                        bool override_separate_stack) {
+
+    std::vector<std::shared_ptr<Invariant>> proves;
+    std::vector<void*> optionals;
+    for (size_t i = 0; i < prove->size(); ++i) {
+      proves.push_back((*prove)[i]);
+      optionals.push_back((void*)i);
+    }
+
+    std::vector<bool> holds(proves.size(), false);
+    Callback callback = [&] (Result& result, void* optional) {
+      holds[(size_t)optional] = result.verified && !result.has_error;
+    };
+
+    check_all(target, rewrite, target_block, rewrite_block, p, q, assume, proves, testcases,
+              callback, override_separate_stack, optionals);
+    block_until_complete();
+
+    std::vector<size_t> failing;
+    for (size_t i = 0; i < holds.size(); ++i)
+      if (!holds[i])
+        failing.push_back(i);
+    return failing;
+  }
+
   /** Check.  This performs the requested obligation check, and depending on the implementation may
     choose to either:
       (1) block, call the callback (in the same thread/process), and then return; or
@@ -229,6 +278,28 @@ public:
                      bool override_separate_stack,
                      void* optional) = 0;
 
+  /** Check several claims along the same pair of paths, under the same
+    assumption.  The callback is invoked once for each claim, with the
+    matching entry of optionals.  Checkers that can share work between the
+    claims (e.g. building the path circuits once) override this; by default
+    each claim is checked on its own. */
+  virtual void check_all(const Cfg& target, const Cfg& rewrite,
+                         Cfg::id_type target_block, Cfg::id_type rewrite_block,
+                         const CfgPath& p, const CfgPath& q,
+                         std::shared_ptr<Invariant> assume,
+                         const std::vector<std::shared_ptr<Invariant>>& proves,
+                         const std::vector<std::pair<CpuState, CpuState>>& testcases,
+                         Callback& callback,
+                         bool override_separate_stack,
+                         const std::vector<void*>& optionals) {
+    assert(proves.size() == optionals.size());
+    for (size_t i = 0; i < proves.size(); ++i) {
+      // checkers are allowed to take apart the assumption
+      check(target, rewrite, target_block, rewrite_block, p, q, assume->clone(), proves[i],
+            testcases, callback, override_separate_stack, optionals[i]);
+    }
+  }
+
   void check(const Obligation& problem, Callback& callback, void* optional = NULL) {
     check(problem.target, problem.rewrite, problem.target_block, problem.rewrite_block,
           problem.P, problem.Q, problem.assume, problem.prove, problem.testcases,
@@ -271,6 +342,7 @@ protected:
   bool nacl_;
   bool fixpoint_up_;
   bool separate_stack_;
+  int priority_;
 
 };
 
@@ -0,0 +1,128 @@
+// Copyright 2013-2019 Stanford University
+//
+// Licensed under the Apache License, Version 2.0 (the License);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an AS IS BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/validator/obligation_corpus.h"
+
+using namespace std;
+using namespace stoke;
+
+void ObligationCorpus::write_word(string& buf, uint64_t w) {
+  for (size_t i = 0; i < 8; ++i)
+    buf.push_back((char)(w >> (8*i)));
+}
+
+bool ObligationCorpus::read_word(istream& is, uint64_t& w) {
+  char bytes[8];
+  is.read(bytes, 8);
+  if (!is)
+    return false;
+
+  w = 0;
+  for (size_t i = 0; i < 8; ++i)
+    w |= (uint64_t)(uint8_t)bytes[i] << (8*i);
+  return true;
+}
+
+void ObligationCorpus::append(const ObligationChecker::Obligation& o) {
+  append_batch({ o });
+}
+
+void ObligationCorpus::append_batch(const vector<ObligationChecker::Obligation>& os) {
+  string record;
+  write_word(record, os.size());
+  for (const auto& o : os) {
+    string data;
+    o.write_bin(data);
+    write_word(record, data.size());
+    record += data;
+  }
+
+  lock_guard<mutex> guard(mutex_);
+  os_.write(record.data(), record.size());
+  os_.flush();
+  size_ += os.size();
+}
+
+void ObligationCorpus::append(const Cfg& target, const Cfg& rewrite,
+                              Cfg::id_type target_block, Cfg::id_type rewrite_block,
+                              const CfgPath& p, const CfgPath& q,
+                              shared_ptr<Invariant> assume, shared_ptr<Invariant> prove,
+                              const vector<pair<CpuState, CpuState>>& testcases,
+                              bool separate_stack) {
+  append_all(target, rewrite, target_block, rewrite_block, p, q, assume, { prove },
+             testcases, separate_stack);
+}
+
+void ObligationCorpus::append_all(const Cfg& target, const Cfg& rewrite,
+                                  Cfg::id_type target_block, Cfg::id_type rewrite_block,
+                                  const CfgPath& p, const CfgPath& q,
+                                  shared_ptr<Invariant> assume,
+                                  const vector<shared_ptr<Invariant>>& proves,
+                                  const vector<pair<CpuState, CpuState>>& testcases,
+                                  bool separate_stack) {
+  vector<ObligationChecker::Obligation> os(proves.size());
+  for (size_t i = 0; i < proves.size(); ++i) {
+    auto& o = os[i];
+    o.target = target;
+    o.rewrite = rewrite;
+    o.target_block = target_block;
+    o.rewrite_block = rewrite_block;
+    o.P = p;
+    o.Q = q;
+    o.assume = assume;
+    o.prove = proves[i];
+    o.testcases = testcases;
+    o.separate_stack = separate_stack;
+  }
+  append_batch(os);
+}
+
+bool ObligationCorpus::read(istream& is, vector<ObligationChecker::Obligation>& batch) {
+  batch.clear();
+
+  uint64_t count = 0;
+  if (!read_word(is, count)) {
+    if (is.gcount() == 0 && is.eof()) {
+      is.clear(ios::eofbit);
+      return false;
+    }
+    is.clear(ios::failbit);
+    return false;
+  }
+
+  for (uint64_t n = 0; n < count; ++n) {
+    uint64_t size = 0;
+    if (!read_word(is, size)) {
+      is.clear(ios::failbit);
+      return false;
+    }
+
+    string data(size, '\0');
+    is.read(&data[0], size);
+    ObligationChecker::Obligation o;
+    if (!is || !o.read_bin(data.data(), data.size())) {
+      is.clear(ios::failbit);
+      return false;
+    }
+    batch.push_back(o);
+  }
+  return true;
+}
+
+bool ObligationCorpus::read_all(istream& is, vector<vector<ObligationChecker::Obligation>>& batches) {
+  vector<ObligationChecker::Obligation> batch;
+  while (read(is, batch))
+    batches.push_back(batch);
+  return !is.fail();
+}
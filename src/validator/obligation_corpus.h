@@ -0,0 +1,89 @@
+// Copyright 2013-2019 Stanford University
+//
+// Licensed under the Apache License, Version 2.0 (the License);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an AS IS BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef STOKE_SRC_VALIDATOR_OBLIGATION_CORPUS_H
+#define STOKE_SRC_VALIDATOR_OBLIGATION_CORPUS_H
+
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "src/validator/obligation_checker.h"
+
+namespace stoke {
+
+/** A file of obligations, as dispatched during a verification, for replaying
+  later.  Each record is one batch, as dispatched together by check_all():
+  an 8-byte little-endian count, followed by that many obligations, each an
+  8-byte little-endian length and the obligation in the format of
+  Obligation::write_bin().  A single check() is a batch of one. */
+class ObligationCorpus {
+
+public:
+
+  /** Appends to the given stream, which should be opened in binary mode. */
+  ObligationCorpus(std::ostream& os) : os_(os), size_(0) { }
+
+  /** Records one obligation.  Safe to call from several threads. */
+  void append(const ObligationChecker::Obligation& o);
+  /** Records obligations that are dispatched together.  Safe to call from several threads. */
+  void append_batch(const std::vector<ObligationChecker::Obligation>& os);
+
+  /** Records one obligation from its parts, as passed to ObligationChecker::check(). */
+  void append(const Cfg& target, const Cfg& rewrite,
+              Cfg::id_type target_block, Cfg::id_type rewrite_block,
+              const CfgPath& p, const CfgPath& q,
+              std::shared_ptr<Invariant> assume, std::shared_ptr<Invariant> prove,
+              const std::vector<std::pair<CpuState, CpuState>>& testcases,
+              bool separate_stack);
+  /** Records one batch from its parts, as passed to ObligationChecker::check_all(). */
+  void append_all(const Cfg& target, const Cfg& rewrite,
+                  Cfg::id_type target_block, Cfg::id_type rewrite_block,
+                  const CfgPath& p, const CfgPath& q,
+                  std::shared_ptr<Invariant> assume,
+                  const std::vector<std::shared_ptr<Invariant>>& proves,
+                  const std::vector<std::pair<CpuState, CpuState>>& testcases,
+                  bool separate_stack);
+
+  /** The number of obligations recorded through this object. */
+  size_t size() const {
+    return size_;
+  }
+
+  /** Reads the next batch.  Returns false at the end of the stream, or
+    if the record is malformed; in the latter case the stream is left failed
+    rather than at eof. */
+  static bool read(std::istream& is, std::vector<ObligationChecker::Obligation>& batch);
+
+  /** Reads every batch in a stream.  Returns false if any is malformed. */
+  static bool read_all(std::istream& is,
+                       std::vector<std::vector<ObligationChecker::Obligation>>& batches);
+
+private:
+
+  /** Appends an 8-byte little-endian word to a buffer. */
+  static void write_word(std::string& buf, uint64_t w);
+  /** Reads an 8-byte little-endian word; returns false if the stream runs out. */
+  static bool read_word(std::istream& is, uint64_t& w);
+
+  std::ostream& os_;
+  std::mutex mutex_;
+  size_t size_;
+
+};
+
+} // namespace stoke
+
+#endif
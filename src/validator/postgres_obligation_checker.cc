@@ -12,9 +12,9 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include "src/serialize/hash64.h"
 #include "src/serialize/serialize.h"
 #include "src/validator/postgres_obligation_checker.h"
-#include "src/validator/md5.h"
 
 using namespace std;
 using namespace stoke;
@@ -27,6 +27,8 @@ void PostgresObligationChecker::make_tables() {
     "CREATE TABLE IF NOT EXISTS ProofObligation("                  \
     "hash         VARCHAR(50) PRIMARY KEY,"                      \
     "problem      TEXT,"                                         \
+    "payload      BYTEA,"                                        \
+    "shape        INTEGER,"                                      \
     "created_at   TIMESTAMP WITH TIME ZONE DEFAULT NOW()"        \
     ")";
 
@@ -63,11 +65,29 @@ void PostgresObligationChecker::make_tables() {
     "hash               VARCHAR(50),"                             \
     "solver             VARCHAR(8),"                              \
     "strategy           VARCHAR(8),"                              \
+    "priority           INTEGER DEFAULT 0,"                       \
+    "predicted_time     BIGINT DEFAULT 0,"                        \
     "locked_by          BIGINT,"                                  \
     "expiration         TIMESTAMP WITH TIME ZONE,"                \
     "created_at         TIMESTAMP WITH TIME ZONE DEFAULT NOW()"   \
     ")";
 
+  // Databases made before obligations were prioritized lack these columns
+  const char* sql_proof_obligation_upgrade =
+    "ALTER TABLE ProofObligation "                                  \
+    "ADD COLUMN IF NOT EXISTS shape INTEGER, "                      \
+    "ADD COLUMN IF NOT EXISTS payload BYTEA";
+
+  const char* sql_proof_obligation_queue_upgrade =
+    "ALTER TABLE ProofObligationQueue "                             \
+    "ADD COLUMN IF NOT EXISTS priority INTEGER DEFAULT 0, "         \
+    "ADD COLUMN IF NOT EXISTS predicted_time BIGINT DEFAULT 0";
+
+  // Workers claim jobs in this order
+  const char* sql_proof_obligation_queue_index =
+    "CREATE INDEX IF NOT EXISTS proofobligationqueue_order "        \
+    "ON ProofObligationQueue(priority DESC, predicted_time ASC, id ASC)";
+
   nontransaction tx(connection_);
   tx.exec(sql_proof_obligation);
   tx.commit();
@@ -89,13 +109,86 @@ void PostgresObligationChecker::make_tables() {
   tx5.commit();
 
   nontransaction tx6(connection_);
-  tx6.exec("SET SESSION synchronous_commit TO OFF");
+  tx6.exec(sql_proof_obligation_upgrade);
+  tx6.exec(sql_proof_obligation_queue_upgrade);
+  tx6.exec(sql_proof_obligation_queue_index);
   tx6.commit();
 
+  nontransaction tx7(connection_);
+  tx7.exec("SET SESSION synchronous_commit TO OFF");
+  tx7.commit();
+
   cout << "make_tables() complete" << endl;
 
 }
 
+void PostgresObligationChecker::train_predictor() {
+
+  shape_times_.clear();
+  overall_times_.clear();
+
+  // Timeouts and errors count at the time they took, so combinations that
+  // often fail look slow
+  nontransaction tx(connection_);
+  result r = tx.exec(
+               "SELECT ProofObligation.shape, solver, strategy, "
+               "  AVG(smt_time+gen_time)::BIGINT as mean_time "
+               "FROM ProofObligationResult JOIN ProofObligation "
+               "  ON ProofObligation.hash = ProofObligationResult.hash "
+               "WHERE ProofObligation.shape IS NOT NULL "
+               "GROUP BY ProofObligation.shape, solver, strategy");
+  tx.commit();
+
+  map<pair<string, string>, pair<uint64_t, size_t>> totals;
+  for (auto row : r) {
+    auto shape = row["shape"].as<int>();
+    auto solver = row["solver"].as<string>();
+    auto strategy = row["strategy"].as<string>();
+    auto time = row["mean_time"].as<uint64_t>();
+
+    shape_times_[make_tuple(shape, solver, strategy)] = time;
+    auto& total = totals[make_pair(solver, strategy)];
+    total.first += time;
+    total.second++;
+  }
+  for (auto& it : totals) {
+    overall_times_[it.first] = it.second.first / it.second.second;
+  }
+
+  cout << "train_predictor() learned " << shape_times_.size() << " shapes" << endl;
+}
+
+uint64_t PostgresObligationChecker::predict_time(int shape, const string& solver,
+    const string& strategy) const {
+
+  auto exact = shape_times_.find(make_tuple(shape, solver, strategy));
+  if (exact != shape_times_.end())
+    return exact->second;
+
+  auto overall = overall_times_.find(make_pair(solver, strategy));
+  if (overall != overall_times_.end())
+    return overall->second;
+
+  // Nothing to go on; treat every combination the same
+  return 0;
+}
+
+int PostgresObligationChecker::get_shape(const Cfg& target, const Cfg& rewrite,
+    const CfgPath& p, const CfgPath& q) {
+
+  size_t instrs = 0;
+  for (auto block : p)
+    instrs += target.num_instrs(block);
+  for (auto block : q)
+    instrs += rewrite.num_instrs(block);
+
+  // Bucket by powers of two
+  int shape = 0;
+  for (; instrs > 0; instrs >>= 1)
+    shape++;
+  return shape;
+}
+
 void PostgresObligationChecker::check(const Cfg& target, const Cfg& rewrite,
                                       Cfg::id_type target_block, Cfg::id_type rewrite_block,
                                       const CfgPath& p, const CfgPath& q,
@@ -129,9 +222,10 @@ void PostgresObligationChecker::check(const Cfg& target, const Cfg& rewrite,
   obligation.testcases = sampled_testcases;
   obligation.separate_stack = separate_stack_ || override_separate_stack;
 
-  stringstream ss;
-  obligation.write_text(ss);
-  auto hash = md5(ss.str());
+  string payload;
+  uint64_t payload_hash;
+  obligation.write_bin(payload, &payload_hash);
+  auto hash = hash64_hex(payload_hash);
 
   if (local_cache_.count(hash)) {
     // this lightens the load on the database, and maybe even the local solver
@@ -161,11 +255,13 @@ void PostgresObligationChecker::check(const Cfg& target, const Cfg& rewrite,
   //nontransaction ntx1(connection_);
 
   auto hash_esc = pipeline_tx_->esc(hash);
-  auto prob_esc = pipeline_tx_->esc(ss.str());
+  auto payload_esc = pipeline_tx_->esc_raw((const unsigned char*)payload.data(), payload.size());
+
+  auto shape = get_shape(target, rewrite, p, q);
 
   stringstream sql_add_po;
-  sql_add_po << "INSERT INTO ProofObligation(hash, problem) "
-             << "SELECT '" << hash_esc << "', '" << prob_esc << "' "
+  sql_add_po << "INSERT INTO ProofObligation(hash, payload, shape) "
+             << "SELECT '" << hash_esc << "', '" << payload_esc << "'::bytea, " << shape << " "
              << "WHERE"
              << "   NOT EXISTS (SELECT hash FROM ProofObligation WHERE hash='" << hash_esc << "')";
 
@@ -177,10 +273,21 @@ void PostgresObligationChecker::check(const Cfg& target, const Cfg& rewrite,
   /** Add to queue, as needed */
   //nontransaction ntx2(connection_);
   stringstream sql_add_poq;
-  sql_add_poq << "INSERT INTO ProofObligationQueue(hash, solver, strategy) "
-              << "SELECT '" << hash_esc << "', tmp.solver, tmp.strategy FROM "
-              << "  (VALUES ('z3','flat'), ('cvc4','flat'), ('z3','arm'), ('cvc4','arm'))"
-              << "     as tmp (solver, strategy) "
+  sql_add_poq << "INSERT INTO ProofObligationQueue(hash, solver, strategy, priority, predicted_time) "
+              << "SELECT '" << hash_esc << "', tmp.solver, tmp.strategy, "
+              << priority_ << ", tmp.predicted_time FROM "
+              << "  (VALUES ";
+  bool first = true;
+  for (auto solver : { "z3", "cvc4" }) {
+    for (auto strategy : { "flat", "arm" }) {
+      sql_add_poq << (first ? "" : ", ")
+                  << "('" << solver << "','" << strategy << "',"
+                  << predict_time(shape, solver, strategy) << ")";
+      first = false;
+    }
+  }
+  sql_add_poq << ")"
+              << "     as tmp (solver, strategy, predicted_time) "
               << "WHERE "
               << "   (NOT EXISTS (SELECT hash FROM ProofObligationResult "
               << "    WHERE hash='" << hash_esc << "' "
@@ -202,41 +309,61 @@ void PostgresObligationChecker::check(const Cfg& target, const Cfg& rewrite,
   Job& j = outstanding_jobs[hash]; //create new job or use existing one
   j.callbacks.push_back(&callback);
   j.optionals.push_back(optional);
+  fresh_.insert(hash);
 
   cout << "Dispatching hash " << hash << endl;
 
   dispatches_++;
   if (dispatches_ % 25 == 0) {
-    cout << "Waiting on pipeline..." << endl;
-    pipeline_->complete();
-    cout << "Closing up nontransaction..." << endl;
-    pipeline_tx_->commit();
-    delete pipeline_;
-    delete pipeline_tx_;
-    pipeline_ = NULL;
-    pipeline_tx_ = NULL;
-    dispatches_ = 0;
     // see if anyone is done
     poll_database();
   }
 
 }
 
+void PostgresObligationChecker::flush_pipeline() {
 
-void PostgresObligationChecker::poll_database() {
+  if (pipeline_ == NULL)
+    return;
 
+  cout << "Waiting on pipeline..." << endl;
+  pipeline_->complete();
   if (dispatches_ > 0) {
-    cout << "Waiting on pipeline..." << endl;
-    pipeline_->complete();
-    cout << "Closing up nontransaction..." << endl;
-    pipeline_tx_->commit();
+    // wake up any workers waiting for jobs
+    pipeline_tx_->exec("NOTIFY stoke_job");
   }
+  cout << "Closing up nontransaction..." << endl;
+  pipeline_tx_->commit();
+  delete pipeline_;
+  delete pipeline_tx_;
+  pipeline_ = NULL;
+  pipeline_tx_ = NULL;
+  dispatches_ = 0;
+}
 
+void PostgresObligationChecker::poll_database(bool full) {
 
-  if (outstanding_jobs.size() == 0)
+  flush_pipeline();
+
+  // Pick up any results announced since we last looked
+  connection_.get_notifs();
+
+  set<string> hashes;
+  for (auto& pair : outstanding_jobs) {
+    auto& hash = pair.first;
+    if (pair.second.completed)
+      continue;
+    if (full || fresh_.count(hash) || notified_.count(hash))
+      hashes.insert(hash);
+  }
+  fresh_.clear();
+  notified_.clear();
+
+  if (hashes.size() == 0)
     return;
 
-  cout << "[poll_database] querying for " << outstanding_jobs.size() << " jobs." << endl;
+  cout << "[poll_database] querying for " << hashes.size() << " of "
+       << outstanding_jobs.size() << " jobs." << endl;
 
   nontransaction tx(connection_);
   stringstream sql;
@@ -245,11 +372,7 @@ void PostgresObligationChecker::poll_database() {
       << "WHERE hash in (";
 
   bool first = true;
-  for (auto pair : outstanding_jobs) {
-    auto hash = pair.first;
-    auto data = pair.second;
-    if (data.completed)
-      continue;
+  for (auto& hash : hashes) {
     if (!first)
       sql << ", ";
     sql << "'" << tx.esc(hash) << "'";
@@ -357,19 +480,14 @@ void PostgresObligationChecker::poll_database() {
 
 /** Blocks until all the checking has done and the callbacks have been called. */
 void PostgresObligationChecker::block_until_complete() {
-  if (pipeline_) {
-    cout << "Waiting on pipeline..." << endl;
-    pipeline_->complete();
-    cout << "Closing up nontransaction..." << endl;
-    pipeline_tx_->commit();
-  }
 
   cout << "Polling!" << endl;
 
-  poll_database();
+  poll_database(true);
   while (outstanding_jobs.size() > 0) {
-    sleep(60);
-    poll_database();
+    // Sleep until a worker announces a result.  If nothing arrives for a
+    // while, look at everything in case a notification was lost.
+    auto n = connection_.await_notification(60, 0);
+    poll_database(n == 0);
   }
 }
-
@@ -16,6 +16,9 @@
 #define STOKE_SRC_VALIDATOR_POSTGRES_OBLIGATION_CHECKER_H
 
 #include <functional>
+#include <map>
+#include <set>
+#include <tuple>
 #include <vector>
 #include <pqxx/pqxx>
 
@@ -31,7 +34,7 @@ public:
 
   PostgresObligationChecker(std::string connection_string, SmtObligationChecker& smt_checker) :
     handler_(), filter_(handler_), connection_string_(connection_string),
-    connection_(connection_string.c_str()), pipeline_(NULL), pipeline_tx_(NULL),
+    connection_(connection_string.c_str()), receiver_(NULL), pipeline_(NULL), pipeline_tx_(NULL),
     dispatches_(0),
     smt_checker_(smt_checker)
   {
@@ -48,10 +51,15 @@ public:
     }
 
     make_tables();
+    train_predictor();
+
+    // Workers announce each result they record on this channel
+    receiver_ = new ResultReceiver(connection_, notified_);
   }
 
   ~PostgresObligationChecker() {
     std::cout << "Closing database connection." << std::endl;
+    delete receiver_;
     connection_.disconnect();
   }
 
@@ -100,18 +108,10 @@ public:
 
   /** Forget about everything that has been started. */
   virtual void delete_all() {
-    if (dispatches_ > 0) {
-      std::cout << "Waiting on pipeline..." << std::endl;
-      pipeline_->complete();
-      std::cout << "Closing up nontransaction..." << std::endl;
-      pipeline_tx_->commit();
-    }
-    dispatches_ = 0;
+    flush_pipeline();
     outstanding_jobs.clear();
-    delete pipeline_;
-    delete pipeline_tx_;
-    pipeline_ = NULL;
-    pipeline_tx_ = NULL;
+    fresh_.clear();
+    notified_.clear();
   }
 
 
@@ -123,6 +123,19 @@ public:
 
 private:
 
+  /** Records the hash carried by each result notification. */
+  class ResultReceiver : public pqxx::notification_receiver {
+  public:
+    ResultReceiver(pqxx::connection_base& c, std::set<std::string>& notified) :
+      pqxx::notification_receiver(c, "stoke_result"), notified_(notified) { }
+
+    void operator()(const std::string& payload, int backend_pid) override {
+      notified_.insert(payload);
+    }
+
+  private:
+    std::set<std::string>& notified_;
+  };
 
   /** Book keeping */
   ComboHandler handler_;
@@ -131,6 +144,7 @@ private:
   /** Database connection */
   std::string connection_string_;
   pqxx::connection connection_;
+  ResultReceiver* receiver_;
   pqxx::pipeline* pipeline_;
   pqxx::transaction_base* pipeline_tx_;
 
@@ -141,14 +155,31 @@ private:
   bool enable_flat_;
   bool enable_arm_;
 
+  /** Mean running time of past results, by shape, solver and strategy. */
+  std::map<std::tuple<int, std::string, std::string>, uint64_t> shape_times_;
+  /** Mean running time of past results, by solver and strategy alone. */
+  std::map<std::pair<std::string, std::string>, uint64_t> overall_times_;
+
   /** For quick obligations. */
   size_t shortcircuit_;
   SmtObligationChecker smt_checker_;
 
   /** Make the tables we need, if they don't already exist. */
   void make_tables();
-  /** Poll the database for callbacks */
-  void poll_database();
+  /** Learn how long each solver and strategy takes on obligations of each
+    shape from the results recorded so far. */
+  void train_predictor();
+  /** Predict how long (in microseconds) a solver and strategy will take on an
+    obligation of some shape. */
+  uint64_t predict_time(int shape, const std::string& solver, const std::string& strategy) const;
+  /** Summarize the size of an obligation; obligations with the same shape
+    tend to be about equally hard. */
+  static int get_shape(const Cfg& target, const Cfg& rewrite, const CfgPath& p, const CfgPath& q);
+  /** Send any queued inserts to the database and wake up idle workers. */
+  void flush_pipeline();
+  /** Poll the database for callbacks.  Unless full is set, only the jobs
+    dispatched or announced since the last poll are queried. */
+  void poll_database(bool full = false);
 
   /** Info to track the jobs that should be running. */
   /** Sometimes two jobs with the same hash will be submitted, in which case we need to
@@ -175,6 +206,12 @@ private:
   std::map<std::string, Job> outstanding_jobs;
   std::map<std::string, Result> local_cache_;
 
+  /** Hashes dispatched since the last poll.  Their results may already be in
+    the database, in which case no notification will ever arrive. */
+  std::set<std::string> fresh_;
+  /** Hashes that workers have announced results for since the last poll. */
+  std::set<std::string> notified_;
+
 };
 
 } //namespace stoke
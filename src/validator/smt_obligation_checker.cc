@@ -13,6 +13,7 @@
 // limitations under the License.
 
 #include <chrono>
+#include <random>
 
 #include "src/cfg/cfg.h"
 #include "src/cfg/paths.h"
@@ -29,6 +30,8 @@
 #include "src/validator/smt_obligation_checker.h"
 #include "src/solver/z3solver.h"
 #include "src/symstate/memory_manager.h"
+#include "src/serialize/hash64.h"
+#include "src/telemetry/telemetry.h"
 
 #include "tools/io/state_diff.h"
 #include "tools/common/version_info.h"
@@ -69,15 +72,6 @@ using namespace stoke;
 using namespace x64asm;
 using namespace std::chrono;
 
-#ifdef DEBUG_CHECKER_PERFORMANCE
-uint64_t SmtObligationChecker::number_queries_ = 0;
-uint64_t SmtObligationChecker::number_cases_ = 0;
-uint64_t SmtObligationChecker::constraint_gen_time_ = 0;
-uint64_t SmtObligationChecker::solver_time_ = 0;
-uint64_t SmtObligationChecker::aliasing_time_ = 0;
-uint64_t SmtObligationChecker::ceg_time_ = 0;
-#endif
-
 template <typename K, typename V>
 map<K,V> append_maps(vector<map<K,V>> maps) {
 
@@ -199,113 +193,50 @@ bool SmtObligationChecker::build_testcase_from_array(CpuState& ceg, SymArray hea
 }
 
 
-CpuState SmtObligationChecker::run_sandbox_on_path(const Cfg& cfg, const CfgPath& P, const CpuState& state) {
-
-  // TODO: fixme
-  CpuState output;
-  return output;
-
-}
-
 bool SmtObligationChecker::check_counterexample(
-  const Cfg& target,
-  const Cfg& rewrite,
   const Code& target_unroll,
   const Code& rewrite_unroll,
-  const CfgPath& P,
-  const CfgPath& Q,
-  const LineMap& target_linemap,
-  const LineMap& rewrite_linemap,
   const std::shared_ptr<Invariant> assume,
   const std::shared_ptr<Invariant> prove,
   const CpuState& ceg_t,
   const CpuState& ceg_r,
-  CpuState& ceg_t_expected,
-  CpuState& ceg_r_expected,
-  bool separate_stack) {
+  const CpuState& ceg_t_expected,
+  const CpuState& ceg_r_expected,
+  const CounterexampleSandbox::Run& target_run,
+  const CounterexampleSandbox::Run& rewrite_run) {
 
-  CpuState target_output;
-  CpuState rewrite_output;
   for (size_t k = 0; k < 2; ++k) {
     const CpuState& start = k ? ceg_r : ceg_t;
-    CpuState& expected = k ? ceg_r_expected : ceg_t_expected;
-    const Cfg& program = k ? rewrite : target;
+    const CpuState& expected = k ? ceg_r_expected : ceg_t_expected;
     const Code& unroll = k ? rewrite_unroll : target_unroll;
-    const CfgPath& path = k ? Q : P;
-    const LineMap& linemap = k ? rewrite_linemap : target_linemap;
-    CpuState& output = k ? rewrite_output : target_output;
+    const auto& run = k ? rewrite_run : target_run;
     string name = k ? "rewrite" : "target";
-    Cfg cfg(unroll, program.def_ins(), program.live_outs());
 
-    DEBUG_CHECK_CEG(
-      stringstream ss;
-      ss << "ceg-check-debug-";
-      if (k == 0)
-      ss << "target";
-      else
-        ss << "rewrite";
-        ofstream debug(ss.str()+".cfg");
-        debug << cfg.get_function() << endl;
-        debug.close();
-        ofstream debug2(ss.str()+".cs");
-        debug2 << start << endl;
-        debug2.close();
-        cout << "LINEMAP" << endl;
-      for (auto entry : linemap) {
-        cout << entry.first << " -> lineno: " << entry.second.line_number << " bb: " << entry.second.block_number << endl;
-      }
-  )
-
-    /** Setup Sandbox */
-    Sandbox sb;
-    sb.set_abi_check(false);
-    sb.set_stack_check(false);
-    sb.set_linemap(linemap);
-    sb.insert_input(start);
-
-    /** Run Sandbox */
-    DataCollector dc(sb);
-    auto traces = dc.get_detailed_traces(cfg, &linemap);
-    assert(traces.size() > 0);
-    auto trace = traces[0];
-
-    auto last_state = *sb.get_output(0);
-    if (last_state.code != ErrorCode::NORMAL) {
+    if (run.code != ErrorCode::NORMAL) {
       cout << "  (Counterexample fails in sandbox for " << name << ".)" << endl;
       cout << "  START STATE " << endl << start << endl << endl;
       cout << "  EXPECTED STATE " << endl << expected << endl << endl;
       return false;
     }
 
-    /** Get output */
-    output = traces[0].back().cs;
-
     /** Compare */
-    DEBUG_CHECK_CEG(
-      assert(path.size() > 0);
-      auto last_block = path.back();
-      RegSet registers;
-      if (last_block == program.get_exit())
-      registers = program.def_outs();
-      else
-        registers = program.def_ins(last_block);
-        cout << "registers that should be compared: " << registers << endl;)
-        if (output != expected) {
-          cout << "  (Counterexample execution differs in sandbox for " << name << ".)" << endl;
-          cout << "  START STATE " << endl << start << endl << endl;
-          cout << "  EXPECTED STATE " << endl << expected << endl << endl;
-          cout << "  ACTUAL STATE " << endl << output << endl << endl;
-          cout << diff_states(expected, output, false, true, x64asm::RegSet::universe());
-          cout << "  CODE " << endl << unroll << endl << endl;
-          return false;
-        }
+    const auto& output = run.output;
+    if (output != expected) {
+      cout << "  (Counterexample execution differs in sandbox for " << name << ".)" << endl;
+      cout << "  START STATE " << endl << start << endl << endl;
+      cout << "  EXPECTED STATE " << endl << expected << endl << endl;
+      cout << "  ACTUAL STATE " << endl << output << endl << endl;
+      cout << diff_states(expected, output, false, true, x64asm::RegSet::universe());
+      cout << "  CODE " << endl << unroll << endl << endl;
+      return false;
+    }
   }
 
   // First, the counterexample has to pass the invariant.
   if (!assume->check(ceg_t, ceg_r)) {
     cout << "  (Counterexample does not meet assumed invariant.)" << endl;
     auto conj = dynamic_pointer_cast<ConjunctionInvariant>(assume);
-    for (size_t i = 0; i < conj->size(); ++i) {
+    for (size_t i = 0; conj && i < conj->size(); ++i) {
       auto inv = (*conj)[i];
       if (!inv->check(ceg_t, ceg_r))
         cout << "     " << *inv << endl;
@@ -314,7 +245,7 @@ bool SmtObligationChecker::check_counterexample(
   }
 
   // Check the sandbox-provided output states to see if they fail the 'prove' invariant
-  if (prove->check(target_output, rewrite_output)) {
+  if (prove->check(target_run.output, rewrite_run.output)) {
     cout << "  (Counterexample satisfies desired invariant; it shouldn't)" << endl;
     return false;
   }
@@ -529,14 +460,210 @@ void SmtObligationChecker::check(
   bool override_separate_stack,
   void* optional) {
 
+  check_all(target, rewrite, target_block, rewrite_block, P, Q, assume, {prove},
+            given_testcases, callback, override_separate_stack, {optional});
+}
+
+namespace {
+
+/** Moves a testcase pair to a nearby one.  Whatever happens to a register in
+  the target happens to it in the rewrite too, so that the relationships an
+  assumption is likely to talk about have a chance of surviving. */
+void mutate_testcase(CpuState& t, CpuState& r, default_random_engine& gen) {
+  static const vector<R64> regs = {rax, rcx, rdx, rbx, rbp, rsi, rdi,
+                                   r8, r9, r10, r11, r12, r13, r14, r15
+                                  };
+  static const vector<uint64_t> boundaries = {0, 1, (uint64_t)-1,
+                                              0x7fffffffffffffff, 0x8000000000000000,
+                                              0x7fffffff, 0x80000000, 0xffffffff
+                                             };
+
+  auto reg = regs[gen() % regs.size()];
+  auto& vt = t.gp[reg].get_fixed_quad(0);
+  auto& vr = r.gp[reg].get_fixed_quad(0);
+
+  switch (gen() % 3) {
+  case 0: {
+    auto bit = (uint64_t)1 << (gen() % 64);
+    vt ^= bit;
+    vr ^= bit;
+    break;
+  }
+  case 1: {
+    auto value = boundaries[gen() % boundaries.size()];
+    vt = value;
+    vr = value;
+    break;
+  }
+  default: {
+    uint64_t delta = (gen() % 2) ? 1 : (uint64_t)-1;
+    vt += delta;
+    vr += delta;
+    break;
+  }
+  }
+}
+
+}
+
+void SmtObligationChecker::refute_concretely(
+  const Cfg& target,
+  const Cfg& rewrite,
+  Cfg::id_type target_block,
+  Cfg::id_type rewrite_block,
+  const CfgPath& P,
+  const CfgPath& Q,
+  std::shared_ptr<Invariant> assume,
+  const vector<std::shared_ptr<Invariant>>& proves,
+  const vector<pair<CpuState, CpuState>>& testcases,
+  Callback& callback,
+  const vector<void*>& optionals,
+  vector<bool>& refuted) {
+
+  if (!concrete_refutation_ || testcases.size() == 0)
+    return;
+
+  Telemetry::Timer timer(Telemetry::OBLIGATION_REFUTATION);
   auto start_time = system_clock::now();
 
-  auto testcases = given_testcases;
+  // The testcases that meet the assumption, and some of their neighbors that do too
+  vector<CpuState> target_starts;
+  vector<CpuState> rewrite_starts;
+  default_random_engine gen(0);
+  for (const auto& tc : testcases) {
+    if (!assume->check(tc.first, tc.second))
+      continue;
+    target_starts.push_back(tc.first);
+    rewrite_starts.push_back(tc.second);
+
+    for (size_t i = 0; i < refutation_mutants_; ++i) {
+      auto t = tc.first;
+      auto r = tc.second;
+      mutate_testcase(t, r, gen);
+      if (!assume->check(t, r))
+        continue;
+      target_starts.push_back(t);
+      rewrite_starts.push_back(r);
+    }
+  }
+  if (target_starts.size() == 0)
+    return;
+
+  LineMap target_linemap;
+  LineMap rewrite_linemap;
+  Code target_unroll;
+  Code rewrite_unroll;
+  PathUnroller::generate_linemap(target, P, target_linemap, false, target_unroll);
+  PathUnroller::generate_linemap(rewrite, Q, rewrite_linemap, true, rewrite_unroll);
+
+  auto target_runs = ceg_sandbox_.run(target, target_unroll, target_linemap, target_starts,
+                                      CounterexampleSandbox::get_guards(target, target_block, P));
+  auto rewrite_runs = ceg_sandbox_.run(rewrite, rewrite_unroll, rewrite_linemap, rewrite_starts,
+                                       CounterexampleSandbox::get_guards(rewrite, rewrite_block, Q));
+
+  uint64_t gen_duration = duration_cast<microseconds>(system_clock::now() - start_time).count();
+
+  for (size_t g = 0; g < proves.size(); ++g) {
+    for (size_t i = 0; i < target_starts.size(); ++i) {
+      const auto& target_run = target_runs[i];
+      const auto& rewrite_run = rewrite_runs[i];
+      if (target_run.code != ErrorCode::NORMAL || rewrite_run.code != ErrorCode::NORMAL)
+        continue;
+      if (!target_run.on_path || !rewrite_run.on_path)
+        continue;
+      if (proves[g]->check(target_run.output, rewrite_run.output))
+        continue;
+
+      ObligationChecker::Result result;
+      result.solver = solver_.get_enum();
+      result.strategy = alias_strategy_;
+      result.smt_time_microseconds = 0;
+      result.gen_time_microseconds = gen_duration;
+      result.source_version = string(version_info);
+      result.comments = "Refuted by testcase";
+      result.verified = false;
+      result.has_ceg = true;
+      result.has_error = false;
+      result.error_message = "";
+      result.target_ceg = target_starts[i];
+      result.rewrite_ceg = rewrite_starts[i];
+      result.target_final_ceg = target_run.output;
+      result.rewrite_final_ceg = rewrite_run.output;
+
+      callback(result, optionals[g]);
+      refuted[g] = true;
+      break;
+    }
+  }
+}
+
+void SmtObligationChecker::check_all(
+  const Cfg& target,
+  const Cfg& rewrite,
+  Cfg::id_type target_block,
+  Cfg::id_type rewrite_block,
+  const CfgPath& P,
+  const CfgPath& Q,
+  std::shared_ptr<Invariant> assume,
+  const vector<std::shared_ptr<Invariant>>& proves,
+  const vector<pair<CpuState, CpuState>>& given_testcases,
+  Callback& callback,
+  bool override_separate_stack,
+  const vector<void*>& optionals) {
+
+  assert(proves.size() == optionals.size());
+  Telemetry::Timer timer(Telemetry::OBLIGATION_CHECK);
+
+  // Anything the testcases already refute doesn't need the solver
+  vector<bool> refuted(proves.size(), false);
+  refute_concretely(target, rewrite, target_block, rewrite_block, P, Q, assume, proves,
+                    given_testcases, callback, optionals, refuted);
+
+  vector<std::shared_ptr<Invariant>> remaining_proves;
+  vector<void*> remaining_optionals;
+  for (size_t g = 0; g < proves.size(); ++g) {
+    if (refuted[g])
+      continue;
+    remaining_proves.push_back(proves[g]);
+    remaining_optionals.push_back(optionals[g]);
+  }
+  if (remaining_proves.size() == 0)
+    return;
+
+  check_all_smt(target, rewrite, target_block, rewrite_block, P, Q, assume, remaining_proves,
+                given_testcases, callback, override_separate_stack, remaining_optionals);
+}
+
+void SmtObligationChecker::check_all_smt(
+  const Cfg& target,
+  const Cfg& rewrite,
+  Cfg::id_type target_block,
+  Cfg::id_type rewrite_block,
+  const CfgPath& P,
+  const CfgPath& Q,
+  std::shared_ptr<Invariant> assume,
+  const vector<std::shared_ptr<Invariant>>& proves,
+  const vector<pair<CpuState, CpuState>>& given_testcases,
+  Callback& callback,
+  bool override_separate_stack,
+  const vector<void*>& optionals) {
+
+  assert(proves.size() == optionals.size());
+  auto start_time = system_clock::now();
 
-#ifdef DEBUG_CHECKER_PERFORMANCE
-  number_queries_++;
-  microseconds perf_start = duration_cast<microseconds>(system_clock::now().time_since_epoch());
-#endif
+  // Until the very end, every claim shares the same fate
+  auto return_errors = [&](string& s, uint64_t smt_time, uint64_t gen_time) {
+    for (auto optional : optionals)
+      return_error(callback, s, optional, smt_time, gen_time);
+  };
+  auto return_results = [&](const ObligationChecker::Result& result) {
+    for (auto optional : optionals) {
+      auto copy = result;
+      callback(copy, optional);
+    }
+  };
+
+  auto testcases = given_testcases;
 
   // TEMPORARY -- for debugging
   /*
@@ -577,17 +704,8 @@ void SmtObligationChecker::check(
 
   //OBLIG_DEBUG(cout << "[check_core] arm_testcases = " << arm_testcases << endl;)
 
-#ifdef DEBUG_CHECKER_PERFORMANCE
-  microseconds perf_alias = duration_cast<microseconds>(system_clock::now().time_since_epoch());
-  aliasing_time_ += (perf_alias - perf_start).count();
-#endif
-
-#ifdef DEBUG_CHECKER_PERFORMANCE
-  microseconds perf_constr_start = duration_cast<microseconds>(system_clock::now().time_since_epoch());
-  number_cases_++;
-#endif
-
   // Step 2: Build circuits
+  Telemetry::Timer constraints_timer(Telemetry::OBLIGATION_CONSTRAINTS);
   vector<SymBool> constraints;
 
   SymState state_t("1_INIT");
@@ -654,6 +772,18 @@ void SmtObligationChecker::check(
   PathUnroller::generate_linemap(target, P, target_linemap, false, target_unroll);
   PathUnroller::generate_linemap(rewrite, Q, rewrite_linemap, true, rewrite_unroll);
 
+  // Counterexamples we've already validated along these paths are concrete
+  // witnesses that the paths are feasible; those that meet this assumption
+  // can stand in as testcases.
+  auto path_key = hash64(CounterexampleSandbox::key(target, target_unroll, target_linemap) + "|" +
+                         CounterexampleSandbox::key(rewrite, rewrite_unroll, rewrite_linemap));
+  if (testcases.size() == 0 && learned_testcases_.count(path_key)) {
+    for (const auto& tc : learned_testcases_[path_key])
+      if (assume->check(tc.first, tc.second))
+        testcases.push_back(tc);
+    arm_testcases = arm_model && (testcases.size() > 0);
+  }
+
 
 
   // Build the circuits
@@ -671,7 +801,7 @@ void SmtObligationChecker::check(
     message << e.get_file() << ":" << e.get_line() << ": " << e.get_message();
     auto str = message.str();
     uint64_t gen_time = duration_cast<microseconds>(system_clock::now() - start_time).count();
-    return_error(callback, str, optional, 0, gen_time);
+    return_errors(str, 0, gen_time);
     delete state_t.memory;
     delete state_r.memory;
     return;
@@ -696,7 +826,7 @@ void SmtObligationChecker::check(
 
   if (error_ != "") {
     uint64_t gen_time = duration_cast<microseconds>(system_clock::now() - start_time).count();
-    return_error(callback, error_, optional, 0, gen_time);
+    return_errors(error_, 0, gen_time);
     return;
   }
 
@@ -710,7 +840,10 @@ void SmtObligationChecker::check(
     // a test case for it...
     auto sat_start = system_clock::now();
     //simplifier_.simplify(constraints);
-    if (!solver_.is_sat(constraints) && !solver_.has_error()) {
+    Telemetry::Timer solve_timer(Telemetry::OBLIGATION_SOLVE);
+    bool is_sat = solver_.is_sat(constraints);
+    solve_timer.stop();
+    if (!is_sat && !solver_.has_error()) {
       cout << "We've finished early without modeling memory!" << endl;
       /** we're done, yo. */
       uint64_t smt_duration = duration_cast<microseconds>(system_clock::now() - sat_start).count();
@@ -727,7 +860,7 @@ void SmtObligationChecker::check(
       result.has_ceg = false;
       result.has_error = false;
       result.error_message = "";
-      callback(result, optional);
+      return_results(result);
       return;
     } else {
       cout << "Couldn't take short-circuit option without memory." << endl;
@@ -736,27 +869,39 @@ void SmtObligationChecker::check(
   }
 
 
-  auto prove_conj = dynamic_pointer_cast<ConjunctionInvariant>(prove);
-  shared_ptr<MemoryEqualityInvariant> prove_memequ;
-  if (!prove_conj) {
-    prove_conj = make_shared<ConjunctionInvariant>();
-    prove_conj->add_invariant(prove);
-  }
-  for (size_t i = 0; i < prove_conj->size(); ++i) {
-    auto inv = (*prove_conj)[i];
-    auto memequ = dynamic_pointer_cast<MemoryEqualityInvariant>(inv);
-    if (memequ) {
-      prove_memequ = memequ;
-      prove_conj->remove(i);
-      break;
+  // Split each claim into its memory equality (if any) and everything else
+  vector<shared_ptr<ConjunctionInvariant>> prove_conjs;
+  vector<shared_ptr<MemoryEqualityInvariant>> prove_memequs;
+  for (auto prove : proves) {
+    vector<shared_ptr<Invariant>> parts;
+    auto given_conj = dynamic_pointer_cast<ConjunctionInvariant>(prove);
+    if (given_conj) {
+      for (size_t i = 0; i < given_conj->size(); ++i)
+        parts.push_back((*given_conj)[i]);
+    } else {
+      parts.push_back(prove);
+    }
+
+    auto prove_conj = make_shared<ConjunctionInvariant>();
+    shared_ptr<MemoryEqualityInvariant> prove_memequ;
+    for (auto inv : parts) {
+      auto memequ = dynamic_pointer_cast<MemoryEqualityInvariant>(inv);
+      if (memequ && !prove_memequ)
+        prove_memequ = memequ;
+      else
+        prove_conj->add_invariant(inv);
     }
+    prove_conjs.push_back(prove_conj);
+    prove_memequs.push_back(prove_memequ);
   }
 
-  // Build inequality constraint
-  auto prove_part2 = !(*prove_conj)(state_t, state_r, invariant_lineno);
-  //cout << "prove constraints part 2 = " << prove_part2 << endl;
+  // Build inequality constraints
+  vector<SymBool> prove_part2s;
+  for (auto prove_conj : prove_conjs)
+    prove_part2s.push_back(!(*prove_conj)(state_t, state_r, invariant_lineno));
 
   // Try to generate ARM testcase if needed
+  Telemetry::Timer aliasing_timer(Telemetry::OBLIGATION_ALIASING);
   if (arm_model && (testcases.size() == 0)) {
     generate_arm_testcases(target, rewrite, target_unroll, rewrite_unroll,
                            target_linemap, rewrite_linemap, separate_stack,
@@ -789,7 +934,8 @@ void SmtObligationChecker::check(
       for (auto it : deref_map) {
       cout << it.first.invariant_number << " -> " << it.second << endl;
     })
-      prove->get_dereference_map(deref_map, tc_pair.first, tc_pair.second, tmp_invariant_lineno);
+      for (auto prove_conj : prove_conjs)
+        prove_conj->get_dereference_map(deref_map, tc_pair.first, tc_pair.second, tmp_invariant_lineno);
       DEBUG_ARM(
         cout << "[check_core] debugging prove dereference map 1" << endl;
         cout << "deref_map size = " << deref_map.size() << endl;
@@ -850,7 +996,8 @@ void SmtObligationChecker::check(
       auto& deref_map = deref_maps[i];
       const auto& tc_pair = testcases[i];
       //cout << "[check_core] adding prove dereference map" << endl;
-      prove->get_dereference_map(deref_map, last_target, last_rewrite, tmp_invariant_lineno);
+      for (auto prove_conj : prove_conjs)
+        prove_conj->get_dereference_map(deref_map, last_target, last_rewrite, tmp_invariant_lineno);
     }
   }
 
@@ -906,7 +1053,7 @@ void SmtObligationChecker::check(
       result.has_ceg = false;
       result.has_error = false;
       result.error_message = "";
-      callback(result, optional);
+      return_results(result);
       return;
     }
 
@@ -920,8 +1067,18 @@ void SmtObligationChecker::check(
                        rewrite_con.end());
   }
 
-  // Add prove memequ constraint
-  if (prove_memequ) {
+  aliasing_timer.stop();
+
+  // The negation of each claim, including its memory equality
+  vector<SymBool> negations;
+  for (size_t g = 0; g < proves.size(); ++g) {
+    auto prove_memequ = prove_memequs[g];
+    auto prove_part2 = prove_part2s[g];
+    if (!prove_memequ) {
+      negations.push_back(prove_part2);
+      continue;
+    }
+
     vector<SymBitVector> excluded_badaddrs = prove_memequ->get_excluded_addresses(state_t, state_r);
 
     auto target_heap = arm_model ? static_cast<ArmMemory*>(state_t.memory)->get_variable()
@@ -943,14 +1100,10 @@ void SmtObligationChecker::check(
       prove_part1 = prove_part1 | is_badaddr;
       //cout << "Generating prove_part1 = " << prove_part1 << endl;
 
-      auto prove_constraint = prove_part1 | prove_part2;
-      constraints.push_back(prove_constraint);
+      negations.push_back(prove_part1 | prove_part2);
     } else {
-      auto prove_constraint = !(target_heap == rewrite_heap) | prove_part2;
-      constraints.push_back(prove_constraint);
+      negations.push_back(!(target_heap == rewrite_heap) | prove_part2);
     }
-  } else {
-    constraints.push_back(prove_part2);
   }
 
 
@@ -964,88 +1117,110 @@ void SmtObligationChecker::check(
   CONSTRAINT_DEBUG(print_m.unlock();)
 
   // Step 4: Invoke the solver
-#ifdef DEBUG_CHECKER_PERFORMANCE
-  microseconds perf_constr_end = duration_cast<microseconds>(system_clock::now().time_since_epoch());
-  constraint_gen_time_ += (perf_constr_end - perf_constr_start).count();
-#endif
-
-  auto sat_start = system_clock::now();
-
-  //simplifier_.simplify(constraints);
-  bool is_sat = solver_.is_sat(constraints);
-  uint64_t smt_duration = duration_cast<microseconds>(system_clock::now() - sat_start).count();
-  uint64_t gen_duration = duration_cast<microseconds>(sat_start - start_time).count();
-
-  if (solver_.has_error()) {
-    stringstream err;
-    err << "solver: " << solver_.get_error();
-    auto str = err.str();
-    return_error(callback, str, optional, smt_duration, gen_duration);
-    return;
+  constraints_timer.stop();
+
+  // The circuits and memory model are built; now discharge the claims against
+  // them.  Each claim gets an indicator that's true exactly when the claim is
+  // falsified.  We ask for a model falsifying any claim still standing; every
+  // claim the model falsifies fails at once with that counterexample, and we
+  // go again with the rest.  Once that's unsat, whatever is left is verified.
+  uint64_t gen_duration = duration_cast<microseconds>(system_clock::now() - start_time).count();
+  uint64_t smt_duration = 0;
+
+  vector<string> indicators;
+  for (size_t g = 0; g < proves.size(); ++g) {
+    stringstream name;
+    name << "CLAIM_" << g << "_FALSIFIED";
+    indicators.push_back(name.str());
+    constraints.push_back(SymBool::var(indicators[g]) == negations[g]);
   }
+  constraints.push_back(SymBool::_true());
+
+  vector<size_t> remaining;
+  for (size_t g = 0; g < proves.size(); ++g)
+    remaining.push_back(g);
+
+  struct PendingCounterexample {
+    CpuState ceg_t;
+    CpuState ceg_r;
+    CpuState ceg_tf;
+    CpuState ceg_rf;
+    bool ok;
+    uint64_t smt_duration;
+    vector<size_t> falsified;
+  };
+  vector<PendingCounterexample> pending;
+
+  auto make_result = [&]() {
+    ObligationChecker::Result result;
+    result.solver = solver_.get_enum();
+    result.strategy = alias_strategy_;
+    result.smt_time_microseconds = smt_duration;
+    result.gen_time_microseconds = gen_duration;
+    result.source_version = string(version_info);
+    result.has_error = false;
+    result.error_message = "";
+    return result;
+  };
 
-#ifdef DEBUG_CHECKER_PERFORMANCE
-  microseconds perf_solve = duration_cast<microseconds>(system_clock::now().time_since_epoch());
-  solver_time_ += (perf_solve - perf_constr_end).count();
-#endif
+  while (remaining.size() > 0) {
+    auto any_falsified = SymBool::_false();
+    for (auto g : remaining)
+      any_falsified = any_falsified | SymBool::var(indicators[g]);
+    constraints.back() = any_falsified;
 
+    auto sat_start = system_clock::now();
 
+    //simplifier_.simplify(constraints);
+    Telemetry::Timer solve_timer(Telemetry::OBLIGATION_SOLVE);
+    bool is_sat = solver_.is_sat(constraints);
+    solve_timer.stop();
+    smt_duration += duration_cast<microseconds>(system_clock::now() - sat_start).count();
+
+    if (solver_.has_error()) {
+      stringstream err;
+      err << "solver: " << solver_.get_error();
+      auto str = err.str();
+      for (auto g : remaining)
+        return_error(callback, str, optionals[g], smt_duration, gen_duration);
+      break;
+    }
 
-  ObligationChecker::Result result;
-  result.solver = solver_.get_enum();
-  result.strategy = alias_strategy_;
-  result.smt_time_microseconds = smt_duration;
-  result.gen_time_microseconds = gen_duration;
-  result.source_version = string(version_info);
+    if (!is_sat) {
+
+      CEG_DEBUG(cout << "  (This case verified)" << endl;)
 
-  if (is_sat) {
-    bool have_ceg;
-    CpuState ceg_t = state_from_model("_1_INIT");
-    CpuState ceg_r = state_from_model("_2_INIT");
-    CpuState ceg_tf = state_from_model("_1_FINAL");
-    CpuState ceg_rf = state_from_model("_2_FINAL");
-
-    auto target_rsp = ceg_t[rsp];
-    auto rewrite_rsp = ceg_r[rsp];
-
-    bool ok = true;
-    if (flat_model) {
-      auto target_flat = static_cast<FlatMemory*>(state_t.memory);
-      auto rewrite_flat = static_cast<FlatMemory*>(state_r.memory);
-
-      vector<map<const SymBitVectorAbstract*, uint64_t>> other_maps;
-      other_maps.push_back(target_flat->get_access_list());
-      other_maps.push_back(rewrite_flat->get_access_list());
-      auto other_map = append_maps(other_maps);
-
-      ok &= build_testcase_from_array(ceg_t, target_flat->get_start_variable(),
-                                      target_flat->get_stack_start_variables(), other_map, target_rsp);
-      ok &= build_testcase_from_array(ceg_r, rewrite_flat->get_start_variable(),
-                                      rewrite_flat->get_stack_start_variables(), other_map, rewrite_rsp);
-      build_testcase_from_array(ceg_tf, target_flat->get_variable(),
-                                target_flat->get_stack_end_variables(), other_map, target_rsp);
-      build_testcase_from_array(ceg_rf, rewrite_flat->get_variable(),
-                                rewrite_flat->get_stack_end_variables(), other_map, rewrite_rsp);
-
-    } else if (arm_model) {
-      auto target_arm = static_cast<ArmMemory*>(state_t.memory);
-      auto rewrite_arm = static_cast<ArmMemory*>(state_r.memory);
-
-      vector<map<const SymBitVectorAbstract*, uint64_t>> other_maps;
-      other_maps.push_back(target_arm->get_access_list());
-      other_maps.push_back(rewrite_arm->get_access_list());
-      auto other_map = append_maps(other_maps);
-
-      ok &= build_testcase_from_array(ceg_t, target_arm->get_start_variable(),
-                                      target_arm->get_stack_start_variables(), other_map, target_rsp);
-      ok &= build_testcase_from_array(ceg_r, rewrite_arm->get_start_variable(),
-                                      rewrite_arm->get_stack_start_variables(), other_map, rewrite_rsp);
-      build_testcase_from_array(ceg_tf, target_arm->get_variable(),
-                                target_arm->get_stack_end_variables(), other_map, target_rsp);
-      build_testcase_from_array(ceg_rf, rewrite_arm->get_variable(),
-                                rewrite_arm->get_stack_end_variables(), other_map, rewrite_rsp);
+      auto result = make_result();
+      result.verified = true;
+      result.has_ceg = false;
+      for (auto g : remaining) {
+        auto copy = result;
+        callback(copy, optionals[g]);
+      }
+      break;
+    }
+
+    // Sort out which claims this model falsifies
+    vector<size_t> falsified;
+    vector<size_t> standing;
+    for (auto g : remaining) {
+      if (solver_.get_model_bool(indicators[g]))
+        falsified.push_back(g);
+      else
+        standing.push_back(g);
+    }
+    if (solver_.has_error() || falsified.size() == 0) {
+      string str = "solver: model doesn't falsify any remaining claim";
+      if (solver_.has_error())
+        str = "solver: " + solver_.get_error();
+      for (auto g : remaining)
+        return_error(callback, str, optionals[g], smt_duration, gen_duration);
+      break;
     }
 
+    CpuState ceg_t, ceg_r, ceg_tf, ceg_rf;
+    bool ok = counterexample_from_model(state_t, state_r, ceg_t, ceg_r, ceg_tf, ceg_rf);
+
     if (!ok) {
       // We don't have memory accurate in our counterexample.  Just leave.
       CEG_DEBUG(cout << "[counterexample-debug] for P: " << P << " Q: " << Q << endl;)
@@ -1054,7 +1229,7 @@ void SmtObligationChecker::check(
 
     CEG_DEBUG(print_m.lock();)
     CEG_DEBUG(cout << "[counterexample-debug] for P: " << P << " Q: " << Q << endl;)
-    CEG_DEBUG(cout << "  (Got counterexample)" << endl;)
+    CEG_DEBUG(cout << "  (Got counterexample for " << falsified.size() << " of " << remaining.size() << " claims)" << endl;)
     CEG_DEBUG(cout << "TARGET START STATE" << endl;)
     CEG_DEBUG(cout << ceg_t << endl;)
     CEG_DEBUG(cout << "REWRITE START STATE" << endl;)
@@ -1065,55 +1240,122 @@ void SmtObligationChecker::check(
     CEG_DEBUG(cout << ceg_rf << endl;)
     CEG_DEBUG(print_m.unlock();)
 
+    // Validation waits until we have all the counterexamples, so they can go
+    // through the sandbox together
+    pending.push_back({ceg_t, ceg_r, ceg_tf, ceg_rf, ok, smt_duration, falsified});
 
-    /** Checks ceg with sandbox. */
-    if (!check_counterexamples_ || check_counterexample(target, rewrite, target_unroll, rewrite_unroll, P, Q, target_linemap, rewrite_linemap, assume, prove, ceg_t, ceg_r, ceg_tf, ceg_rf, separate_stack)) {
-    } else {
-      ok = false;
-      CEG_DEBUG(cout << "  (Spurious counterexample detected) P=" << P << " Q=" << Q << endl;)
+    remaining = standing;
+  }
+
+  /** Checks cegs with sandbox. */
+  Telemetry::Timer ceg_timer(Telemetry::OBLIGATION_CEG_CHECK);
+  vector<CounterexampleSandbox::Run> target_runs;
+  vector<CounterexampleSandbox::Run> rewrite_runs;
+  if (check_counterexamples_ && pending.size() > 0) {
+    vector<CpuState> target_starts;
+    vector<CpuState> rewrite_starts;
+    for (const auto& pc : pending) {
+      target_starts.push_back(pc.ceg_t);
+      rewrite_starts.push_back(pc.ceg_r);
     }
+    target_runs = ceg_sandbox_.run(target, target_unroll, target_linemap, target_starts);
+    rewrite_runs = ceg_sandbox_.run(rewrite, rewrite_unroll, rewrite_linemap, rewrite_starts);
+  }
 
-    delete state_t.memory;
-    delete state_r.memory;
+  for (size_t i = 0; i < pending.size(); ++i) {
+    const auto& pc = pending[i];
+    bool learned = false;
 
-#ifdef DEBUG_CHECKER_PERFORMANCE
-    microseconds perf_ceg = duration_cast<microseconds>(system_clock::now().time_since_epoch());
-    ceg_time_ += (perf_ceg - perf_solve).count();
-    print_performance();
-#endif
+    for (auto g : pc.falsified) {
+      bool claim_ok = pc.ok;
+      if (check_counterexamples_ && !check_counterexample(target_unroll, rewrite_unroll, assume, prove_conjs[g],
+          pc.ceg_t, pc.ceg_r, pc.ceg_tf, pc.ceg_rf, target_runs[i], rewrite_runs[i])) {
+        claim_ok = false;
+        CEG_DEBUG(cout << "  (Spurious counterexample detected) P=" << P << " Q=" << Q << endl;)
+      }
 
-    result.verified = false;
-    result.has_ceg = ok;
-    result.has_error = false;
-    result.error_message = "";
-    result.target_ceg = ceg_t;
-    result.rewrite_ceg = ceg_r;
-    result.target_final_ceg = ceg_tf;
-    result.rewrite_final_ceg = ceg_rf;
+      if (claim_ok && check_counterexamples_ && !learned) {
+        if (learned_testcases_.size() >= max_learned_paths_ && !learned_testcases_.count(path_key))
+          learned_testcases_.clear();
+        auto& learned_list = learned_testcases_[path_key];
+        if (learned_list.size() < max_learned_testcases_)
+          learned_list.push_back({pc.ceg_t, pc.ceg_r});
+        learned = true;
+      }
 
-    callback(result, optional);
+      ObligationChecker::Result result;
+      result.solver = solver_.get_enum();
+      result.strategy = alias_strategy_;
+      result.smt_time_microseconds = pc.smt_duration;
+      result.gen_time_microseconds = gen_duration;
+      result.source_version = string(version_info);
+      result.verified = false;
+      result.has_ceg = claim_ok;
+      result.has_error = false;
+      result.error_message = "";
+      result.target_ceg = pc.ceg_t;
+      result.rewrite_ceg = pc.ceg_r;
+      result.target_final_ceg = pc.ceg_tf;
+      result.rewrite_final_ceg = pc.ceg_rf;
 
-  } else {
+      callback(result, optionals[g]);
+    }
+  }
 
-    delete state_t.memory;
-    delete state_r.memory;
+  delete state_t.memory;
+  delete state_r.memory;
+}
 
-    CEG_DEBUG(cout << "  (This case verified)" << endl;)
+bool SmtObligationChecker::counterexample_from_model(SymState& state_t, SymState& state_r,
+    CpuState& ceg_t, CpuState& ceg_r, CpuState& ceg_tf, CpuState& ceg_rf) {
 
-#ifdef DEBUG_CHECKER_PERFORMANCE
-    microseconds perf_ceg = duration_cast<microseconds>(system_clock::now().time_since_epoch());
-    ceg_time_ += (perf_ceg - perf_solve).count();
-#endif
+  ceg_t = state_from_model("_1_INIT");
+  ceg_r = state_from_model("_2_INIT");
+  ceg_tf = state_from_model("_1_FINAL");
+  ceg_rf = state_from_model("_2_FINAL");
 
-    result.verified = true;
-    result.has_ceg = false;
-    result.has_error = false;
-    result.error_message = "";
-    callback(result, optional);
+  auto target_rsp = ceg_t[rsp];
+  auto rewrite_rsp = ceg_r[rsp];
 
-  }
+  bool ok = true;
+  if (alias_strategy_ == AliasStrategy::FLAT) {
+    auto target_flat = static_cast<FlatMemory*>(state_t.memory);
+    auto rewrite_flat = static_cast<FlatMemory*>(state_r.memory);
 
+    vector<map<const SymBitVectorAbstract*, uint64_t>> other_maps;
+    other_maps.push_back(target_flat->get_access_list());
+    other_maps.push_back(rewrite_flat->get_access_list());
+    auto other_map = append_maps(other_maps);
+
+    ok &= build_testcase_from_array(ceg_t, target_flat->get_start_variable(),
+                                    target_flat->get_stack_start_variables(), other_map, target_rsp);
+    ok &= build_testcase_from_array(ceg_r, rewrite_flat->get_start_variable(),
+                                    rewrite_flat->get_stack_start_variables(), other_map, rewrite_rsp);
+    build_testcase_from_array(ceg_tf, target_flat->get_variable(),
+                              target_flat->get_stack_end_variables(), other_map, target_rsp);
+    build_testcase_from_array(ceg_rf, rewrite_flat->get_variable(),
+                              rewrite_flat->get_stack_end_variables(), other_map, rewrite_rsp);
+
+  } else if (alias_strategy_ == AliasStrategy::ARM) {
+    auto target_arm = static_cast<ArmMemory*>(state_t.memory);
+    auto rewrite_arm = static_cast<ArmMemory*>(state_r.memory);
+
+    vector<map<const SymBitVectorAbstract*, uint64_t>> other_maps;
+    other_maps.push_back(target_arm->get_access_list());
+    other_maps.push_back(rewrite_arm->get_access_list());
+    auto other_map = append_maps(other_maps);
+
+    ok &= build_testcase_from_array(ceg_t, target_arm->get_start_variable(),
+                                    target_arm->get_stack_start_variables(), other_map, target_rsp);
+    ok &= build_testcase_from_array(ceg_r, rewrite_arm->get_start_variable(),
+                                    rewrite_arm->get_stack_start_variables(), other_map, rewrite_rsp);
+    build_testcase_from_array(ceg_tf, target_arm->get_variable(),
+                              target_arm->get_stack_end_variables(), other_map, target_rsp);
+    build_testcase_from_array(ceg_rf, rewrite_arm->get_variable(),
+                              rewrite_arm->get_stack_end_variables(), other_map, rewrite_rsp);
+  }
 
+  return ok;
 }
 
 
@@ -19,6 +19,7 @@
 #include <vector>
 #include <string>
 #include <thread>
+#include <unordered_map>
 #include <atomic>
 
 #include "gtest/gtest_prod.h"
@@ -37,14 +38,9 @@
 #include "src/validator/line_info.h"
 #include "src/validator/filters/default.h"
 #include "src/validator/filters/bound_away.h"
+#include "src/validator/counterexample_sandbox.h"
 #include "src/validator/obligation_checker.h"
 
-//#define DEBUG_CHECKER_PERFORMANCE
-
-#ifdef DEBUG_CHECKER_PERFORMANCE
-#include "src/solver/z3solver.h"
-#endif
-
 namespace stoke {
 
 class SmtObligationChecker : public ObligationChecker {
@@ -54,6 +50,8 @@ public:
   SmtObligationChecker(SMTSolver& solver, Filter& filter) :
     ObligationChecker(),
     check_counterexamples_(true),
+    concrete_refutation_(true),
+    refutation_mutants_(8),
     solver_(solver),
     filter_(filter)
   {
@@ -62,6 +60,8 @@ public:
   SmtObligationChecker(const SmtObligationChecker& oc) :
     ObligationChecker(),
     check_counterexamples_(oc.check_counterexamples_),
+    concrete_refutation_(oc.concrete_refutation_),
+    refutation_mutants_(oc.refutation_mutants_),
     solver_(oc.solver_),
     filter_(oc.filter_),
     memory_manager_()
@@ -80,6 +80,19 @@ public:
     return *this;
   }
 
+  /** Before going to the solver, try refuting claims by running the
+    testcases (and some states near them) down the paths. */
+  SmtObligationChecker& set_concrete_refutation(bool b) {
+    concrete_refutation_ = b;
+    return *this;
+  }
+
+  /** How many nearby states to try for each testcase when refuting claims. */
+  SmtObligationChecker& set_refutation_mutants(size_t n) {
+    refutation_mutants_ = n;
+    return *this;
+  }
+
   /** Check.  This is a wrapper around check_* functions that handles parallelism and fixpoint. */
   void check(const Cfg& target, const Cfg& rewrite,
              Cfg::id_type target_block, Cfg::id_type rewrite_block,
@@ -90,13 +103,31 @@ public:
              bool override_separate_stack,
              void* optional) override;
 
+  /** Builds the path circuits and memory model once, and checks every claim against them. */
+  void check_all(const Cfg& target, const Cfg& rewrite,
+                 Cfg::id_type target_block, Cfg::id_type rewrite_block,
+                 const CfgPath& p, const CfgPath& q,
+                 std::shared_ptr<Invariant> assume,
+                 const std::vector<std::shared_ptr<Invariant>>& proves,
+                 const std::vector<std::pair<CpuState, CpuState>>& testcases,
+                 Callback& callback,
+                 bool override_separate_stack,
+                 const std::vector<void*>& optionals) override;
+
   Filter& get_filter() {
     return filter_;
   }
 
+  /** The sandbox used to check counterexamples. */
+  const CounterexampleSandbox& get_counterexample_sandbox() const {
+    return ceg_sandbox_;
+  }
+
 private:
 
   bool check_counterexamples_;
+  bool concrete_refutation_;
+  size_t refutation_mutants_;
 
   SymSimplify simplifier_;
 
@@ -108,9 +139,21 @@ private:
 
   /** Sandbox and Data Collector for working with test cases */
   Sandbox oc_sandbox_;
+  /** Compiled paths for checking counterexamples */
+  CounterexampleSandbox ceg_sandbox_;
+  /** Validated counterexamples, by a hash of the pair of unrolled paths they run down */
+  std::unordered_map<uint64_t, std::vector<std::pair<CpuState, CpuState>>> learned_testcases_;
+  /** How many of those we keep for each pair of paths */
+  static constexpr size_t max_learned_testcases_ = 4;
+  /** How many pairs of paths we keep them for; past this we start over */
+  static constexpr size_t max_learned_paths_ = 256;
 
   /** Extract a CPU state from SMT solver */
   CpuState state_from_model(const std::string& name_suffix);
+  /** Extract initial and final states, with memory, for target and rewrite
+    from the SMT solver.  Returns false if the memory isn't accurate. */
+  bool counterexample_from_model(SymState& state_t, SymState& state_r,
+                                 CpuState& ceg_t, CpuState& ceg_r, CpuState& ceg_tf, CpuState& ceg_rf);
 
 
   /** Populate a CPU state with memory from the model. */
@@ -162,20 +205,38 @@ private:
     return os.str();
   }
 
-  /** Check if a counterexample actually works.  Updates the output states
-    (ceg_expected, ceg_expected2) with data from the sandbox. */
-  bool check_counterexample(const Cfg& target, const Cfg& rewrite,
-                            const x64asm::Code& target_unroll,
+  /** Builds the circuits once and checks each claim with the solver. */
+  void check_all_smt(const Cfg& target, const Cfg& rewrite,
+                     Cfg::id_type target_block, Cfg::id_type rewrite_block,
+                     const CfgPath& p, const CfgPath& q,
+                     std::shared_ptr<Invariant> assume,
+                     const std::vector<std::shared_ptr<Invariant>>& proves,
+                     const std::vector<std::pair<CpuState, CpuState>>& testcases,
+                     Callback& callback,
+                     bool override_separate_stack,
+                     const std::vector<void*>& optionals);
+
+  /** Runs the testcases (and states near them) down the paths, and reports a
+    counterexample for each claim one of them falsifies.  Marks those claims
+    in refuted. */
+  void refute_concretely(const Cfg& target, const Cfg& rewrite,
+                         Cfg::id_type target_block, Cfg::id_type rewrite_block,
+                         const CfgPath& p, const CfgPath& q,
+                         std::shared_ptr<Invariant> assume,
+                         const std::vector<std::shared_ptr<Invariant>>& proves,
+                         const std::vector<std::pair<CpuState, CpuState>>& testcases,
+                         Callback& callback,
+                         const std::vector<void*>& optionals,
+                         std::vector<bool>& refuted);
+
+  /** Check if a counterexample actually works, given what became of its
+    start states in the sandbox. */
+  bool check_counterexample(const x64asm::Code& target_unroll,
                             const x64asm::Code& rewrite_unroll,
-                            const CfgPath& P, const CfgPath& Q,
-                            const LineMap& target_linemap, const LineMap& rewrite_linemap,
                             const std::shared_ptr<Invariant> assume, const std::shared_ptr<Invariant> prove,
                             const CpuState& ceg, const CpuState& ceg2,
-                            CpuState& ceg_expected, CpuState& ceg_expected2,
-                            bool separate_stack);
-
-  /** Run the sandbox on a state, cfg along a path.  Used for checking counterexamples. */
-  CpuState run_sandbox_on_path(const Cfg& cfg, const CfgPath& P, const CpuState& state);
+                            const CpuState& ceg_expected, const CpuState& ceg_expected2,
+                            const CounterexampleSandbox::Run& run, const CounterexampleSandbox::Run& run2);
 
   /** Rewrite a CFG so that it always executes a particular path, replacing
     jumps with NOPs.  Fill a map that contains information relating the new
@@ -188,28 +249,6 @@ private:
   /** Rules to transform instructions for a custom purpose */
   Filter& filter_;
 
-#ifdef DEBUG_CHECKER_PERFORMANCE
-  static uint64_t number_queries_;
-  static uint64_t number_cases_;
-
-  static uint64_t constraint_gen_time_;
-  static uint64_t solver_time_;
-  static uint64_t aliasing_time_;
-  static uint64_t ceg_time_;
-
-  void print_performance() {
-    std::cout << "====== Obligation Checker Performance Report ======" << std::endl;
-    std::cout << "Number queries: "<< number_queries_ << std::endl;
-    std::cout << "Number aliasing cases: "<< number_cases_ << std::endl;
-    std::cout << "Alias case enumeration time (ms): " << (aliasing_time_ / 1000) << std::endl;
-    std::cout << "Constraint generation time (ms): " << (constraint_gen_time_ / 1000) << std::endl;
-    std::cout << "Solver time (ms): " << (solver_time_ / 1000) << std::endl;
-    std::cout << "Counterexample extraction time (ms): " << (ceg_time_ / 1000) << std::endl;
-    std::cout << "Total time accounted for (ms): " << ((ceg_time_ + solver_time_ + constraint_gen_time_ + aliasing_time_)/1000) << std::endl;
-    Z3Solver::print_performance();
-  }
-#endif
-
   /** Push a new memory manager onto the stack. */
   void init_mm() {
     auto manager = new SymMemoryManager();
@@ -223,5 +223,56 @@ TEST(CfgTest, Issue856) {
   EXPECT_TRUE(cfg.check_invariants());
 }
 
+
+TEST(CfgTest, IncrementalDefsMatchFull) {
+
+  std::stringstream ss;
+  ss << ".foo:" << std::endl;
+  ss << "cmpq %rdi, %rsi" << std::endl;
+  ss << ".L1:" << std::endl;
+  ss << "imulq %rdi, %rsi" << std::endl;
+  ss << "jne .L1" << std::endl;
+  ss << "movq %rsi, %rax" << std::endl;
+  ss << "retq" << std::endl;
+
+  x64asm::Code code;
+  ss >> code;
+
+  x64asm::RegSet di = x64asm::RegSet::empty() + x64asm::rdi + x64asm::rsi;
+  Cfg cfg(code, di, x64asm::RegSet::empty() + x64asm::rax);
+  const Cfg original = cfg;
+
+  const auto expect_same_defs = [](const Cfg& actual, const Cfg& expected) {
+    EXPECT_EQ(expected.def_outs(), actual.def_outs());
+    for (size_t i = 1, ie = expected.get_code().size(); i < ie; ++i) {
+      const auto loc = expected.get_loc(i);
+      if (expected.is_reachable(loc.first)) {
+        EXPECT_EQ(expected.def_ins(loc), actual.def_ins(loc)) << "at " << expected.get_code()[i];
+      }
+    }
+  };
+
+  // imulq leaves %af undefined inside the loop; movq lets its value from cmpq
+  // flow all the way around
+  std::stringstream is;
+  is << "movq %rdi, %rsi" << std::endl;
+  x64asm::Code replacement;
+  is >> replacement;
+  ASSERT_EQ(1ul, replacement.size());
+
+  cfg.get_function().replace(3, replacement[0]);
+  cfg.recompute_defs({3});
+
+  auto expected = cfg;
+  expected.recompute_defs();
+  expect_same_defs(cfg, expected);
+  EXPECT_TRUE(cfg.def_ins(cfg.get_loc(4)).contains(x64asm::eflags_af));
+
+  // Putting the instruction back restores the old values exactly
+  cfg.get_function().replace(3, original.get_code()[3]);
+  cfg.undo_defs();
+  expect_same_defs(cfg, original);
+}
+
 } //namespace stoke
 #endif
@@ -18,3 +18,4 @@
 #include "dominators.h"
 #include "paths.h"
 #include "sccs.h"
+#include "stack_offsets.h"
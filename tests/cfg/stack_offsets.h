@@ -0,0 +1,103 @@
+// Copyright 2013-2019 Stanford University
+//
+// Licensed under the Apache License, Version 2.0 (the License);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an AS IS BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _STOKE_TEST_CFG_STACK_OFFSETS_H
+#define _STOKE_TEST_CFG_STACK_OFFSETS_H
+
+#include <sstream>
+
+#include "src/cfg/cfg.h"
+#include "src/cfg/stack_offsets.h"
+
+#include "tests/fixture.h"
+
+namespace stoke {
+
+TEST(StackOffsetsTest, StraightLine) {
+
+  std::stringstream ss;
+  ss << ".foo:" << std::endl;                 // 0
+  ss << "pushq %rbp" << std::endl;            // 1
+  ss << "subq $0x20, %rsp" << std::endl;      // 2
+  ss << "pushw %ax" << std::endl;             // 3
+  ss << "movq %rax, 0x8(%rsp)" << std::endl;  // 4
+  ss << "leaq 0x22(%rsp), %rsp" << std::endl; // 5
+  ss << "popq %rbp" << std::endl;             // 6
+  ss << "retq" << std::endl;                  // 7
+
+  x64asm::Code c;
+  ss >> c;
+
+  Cfg cfg(c);
+  CfgStackOffsets offsets(cfg);
+
+  const std::vector<int64_t> answers = {0, 0, -8, -0x28, -0x2a, -0x2a, -8, 0};
+  for (size_t i = 0; i < answers.size(); ++i) {
+    ASSERT_TRUE(offsets.is_known(i)) << " i = " << i;
+    EXPECT_EQ(answers[i], offsets.get_offset(i)) << " i = " << i;
+  }
+}
+
+TEST(StackOffsetsTest, DisagreeingPathsAreUnknown) {
+
+  std::stringstream ss;
+  ss << ".foo:" << std::endl;                 // 0
+  ss << "je .bar" << std::endl;               // 1
+  ss << "pushq %rax" << std::endl;            // 2
+  ss << ".bar:" << std::endl;                 // 3
+  ss << "movq %rax, (%rsp)" << std::endl;     // 4
+  ss << "movq %rax, %rsp" << std::endl;       // 5
+  ss << "retq" << std::endl;                  // 6
+
+  x64asm::Code c;
+  ss >> c;
+
+  Cfg cfg(c);
+  CfgStackOffsets offsets(cfg);
+
+  EXPECT_TRUE(offsets.is_known(2));
+  EXPECT_EQ(0, offsets.get_offset(2));
+  EXPECT_FALSE(offsets.is_known(3));
+  EXPECT_FALSE(offsets.is_known(4));
+  EXPECT_FALSE(offsets.is_known(6));
+}
+
+TEST(StackOffsetsTest, BalancedLoopIsKnown) {
+
+  std::stringstream ss;
+  ss << ".foo:" << std::endl;                 // 0
+  ss << "subq $0x10, %rsp" << std::endl;      // 1
+  ss << ".loop:" << std::endl;                // 2
+  ss << "pushq %rax" << std::endl;            // 3
+  ss << "popq %rax" << std::endl;             // 4
+  ss << "decq %rax" << std::endl;             // 5
+  ss << "jne .loop" << std::endl;             // 6
+  ss << "addq $0x10, %rsp" << std::endl;      // 7
+  ss << "retq" << std::endl;                  // 8
+
+  x64asm::Code c;
+  ss >> c;
+
+  Cfg cfg(c);
+  CfgStackOffsets offsets(cfg);
+
+  ASSERT_TRUE(offsets.is_known(4));
+  EXPECT_EQ(-0x18, offsets.get_offset(4));
+  ASSERT_TRUE(offsets.is_known(8));
+  EXPECT_EQ(0, offsets.get_offset(8));
+}
+
+} // namespace stoke
+
+#endif
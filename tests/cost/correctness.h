@@ -49,6 +49,37 @@ protected:
     return Cfg(c, rs, rs);
   }
 
+  /** Adds n testcases, the ith of which has rax = i. */
+  void add_counting_testcases(size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+      auto cs = get_state();
+      cs.gp[x64asm::rax].get_fixed_quad(0) = i;
+      sb_.insert_input(cs);
+    }
+  }
+
+  /** Keeps only the low bit of rax. */
+  Cfg parity_target() {
+    std::stringstream ss;
+    x64asm::Code c;
+    ss << ".foo:" << std::endl;
+    ss << "andq $0x1, %rax" << std::endl;
+    ss << "retq" << std::endl;
+    ss >> c;
+    return make_cfg(c, x64asm::RegSet::empty() + x64asm::rax);
+  }
+
+  /** Differs from parity_target() in one bit, exactly when rax is odd. */
+  Cfg parity_rewrite() {
+    std::stringstream ss;
+    x64asm::Code c;
+    ss << ".foo:" << std::endl;
+    ss << "movq $0x0, %rax" << std::endl;
+    ss << "retq" << std::endl;
+    ss >> c;
+    return make_cfg(c, x64asm::RegSet::empty() + x64asm::rax);
+  }
+
   Cost misalign_penalty_;
   Cost signal_penalty_;
 
@@ -346,4 +377,166 @@ TEST_F(CorrectnessCostTest, SignalPenalty) {
 
 }
 
+TEST_F(CorrectnessCostTest, HeapErrorCountsValidBytes) {
+
+  // A testcase with 16 valid heap bytes at 0x1000, only half of which get written
+  CpuState tc;
+  tc.gp[x64asm::rdi].get_fixed_quad(0) = 0x1000;
+  tc.gp[x64asm::rax].get_fixed_quad(0) = 0xffffffff00000000;
+  tc.heap.resize(0x1000, 16);
+  for (uint64_t i = 0x1000; i < 0x1010; ++i) {
+    tc.heap.set_valid(i, true);
+    tc.heap[i] = 0;
+  }
+  sb_.set_abi_check(false);
+  sb_.insert_input(tc);
+
+  // Setup
+  std::stringstream ss;
+  x64asm::Code target, rewrite;
+
+  // Target
+  ss.clear();
+  ss << ".foo:" << std::endl;
+  ss << "movq %rax, (%rdi)" << std::endl;
+  ss << "retq" << std::endl;
+  ss >> target;
+
+  // Rewrite; misses the upper 32 bits of rax
+  ss.clear();
+  ss << ".foo:" << std::endl;
+  ss << "movl %eax, (%rdi)" << std::endl;
+  ss << "retq" << std::endl;
+  ss >> rewrite;
+
+  auto cfg_t = make_cfg(target, x64asm::RegSet::empty() + x64asm::rax + x64asm::rdi);
+  auto cfg_r = make_cfg(rewrite, x64asm::RegSet::empty() + x64asm::rax + x64asm::rdi);
+
+  fxn_.set_target(cfg_t, false, true);
+  sb_.run(cfg_r);
+
+  auto cost = fxn_(cfg_r);
+  EXPECT_FALSE(cost.first);
+  EXPECT_EQ(32ul, cost.second);
+
+  // With a smaller budget we may stop early, but never below the budget
+  sb_.run(cfg_r);
+  cost = fxn_(cfg_r, 10);
+  EXPECT_FALSE(cost.first);
+  EXPECT_LE(10ul, cost.second);
+  EXPECT_GE(32ul, cost.second);
+}
+
+TEST_F(CorrectnessCostTest, RelaxedRegistersFindMisalignedValues) {
+
+  // Add 10 testcases
+  add_testcases(10);
+
+  // Setup
+  std::stringstream ss;
+  x64asm::Code target, rewrite;
+
+  // Target
+  ss.clear();
+  ss << ".foo:" << std::endl;
+  ss << "movq %rdi, %rax" << std::endl;
+  ss << "retq" << std::endl;
+  ss >> target;
+
+  // Rewrite; the right value, but in the wrong place
+  ss.clear();
+  ss << ".foo:" << std::endl;
+  ss << "movq %rdi, %rdx" << std::endl;
+  ss << "retq" << std::endl;
+  ss >> rewrite;
+
+  auto cfg_t = make_cfg(target, x64asm::RegSet::empty() + x64asm::rdi + x64asm::rax);
+  auto cfg_r = make_cfg(rewrite, x64asm::RegSet::empty() + x64asm::rdi + x64asm::rax + x64asm::rdx);
+
+  fxn_.set_relax(true, false, false);
+  fxn_.set_target(cfg_t, false, false);
+  sb_.run(cfg_r);
+  auto cost = fxn_(cfg_r);
+
+  // rdi itself is also a candidate, and holds the same value as rdx
+  EXPECT_FALSE(cost.first);
+  EXPECT_EQ(misalign_penalty_ * 10, cost.second);
+}
+
+
+TEST_F(CorrectnessCostTest, FusedMatchesUnfused) {
+
+  // Testcases 1, 3, ..., 19 fail, by one bit each
+  add_counting_testcases(20);
+
+  auto cfg_t = parity_target();
+  auto cfg_r = parity_rewrite();
+
+  fxn_.set_target(cfg_t, false, false);
+  sb_.run(cfg_r);
+  auto expected = fxn_(cfg_r);
+  ASSERT_FALSE(expected.first);
+  ASSERT_EQ(10ul, expected.second);
+  ASSERT_EQ(1ul, fxn_.get_counter_example().gp[x64asm::rax].get_fixed_quad(0));
+
+  fxn_.set_fused(true);
+  auto cost = fxn_(cfg_r);
+  EXPECT_EQ(expected, cost);
+  EXPECT_EQ(1ul, fxn_.get_counter_example().gp[x64asm::rax].get_fixed_quad(0));
+
+  // Asking again with a budget stops at the counter-example, which now goes first
+  cost = fxn_(cfg_r, 1);
+  EXPECT_FALSE(cost.first);
+  EXPECT_EQ(1ul, cost.second);
+  EXPECT_EQ(1ul, fxn_.get_counter_example().gp[x64asm::rax].get_fixed_quad(0));
+
+  // The target itself is still correct
+  cost = fxn_(cfg_t);
+  EXPECT_TRUE(cost.first);
+  EXPECT_EQ(0ul, cost.second);
+}
+
+
+TEST_F(CorrectnessCostTest, TestcaseLimitGivesLowerBound) {
+
+  // Testcases 1, 3, ..., 19 fail, by one bit each
+  add_counting_testcases(20);
+
+  auto cfg_t = parity_target();
+  auto cfg_r = parity_rewrite();
+
+  fxn_.set_target(cfg_t, false, false);
+  sb_.run(cfg_r);
+  auto expected = fxn_(cfg_r);
+  ASSERT_FALSE(expected.first);
+  ASSERT_EQ(10ul, expected.second);
+  ASSERT_EQ(1, fxn_.get_failing_testcase());
+
+  // The first five in the default order; 1 and 3 fail
+  fxn_.set_testcase_limit(5);
+  EXPECT_TRUE(fxn_.fuses_test_sandbox());
+  auto cost = fxn_(cfg_r);
+  EXPECT_FALSE(cost.first);
+  EXPECT_EQ(2ul, cost.second);
+  EXPECT_EQ(1, fxn_.get_failing_testcase());
+
+  // The first five backwards; 19, 17 and 15 fail
+  std::vector<size_t> order;
+  for (size_t i = 0; i < 20; ++i) {
+    order.push_back(19 - i);
+  }
+  fxn_.set_testcase_order(order);
+  cost = fxn_(cfg_r);
+  EXPECT_FALSE(cost.first);
+  EXPECT_EQ(3ul, cost.second);
+  EXPECT_EQ(19, fxn_.get_failing_testcase());
+
+  // All of them again, in the new order
+  fxn_.set_testcase_limit(-1);
+  EXPECT_FALSE(fxn_.fuses_test_sandbox());
+  sb_.run(cfg_r);
+  EXPECT_EQ(expected, fxn_(cfg_r));
+  EXPECT_EQ(19, fxn_.get_failing_testcase());
+}
+
 } //namespace
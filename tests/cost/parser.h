@@ -233,4 +233,90 @@ TEST_F(CostParserTest, TwoLeafFunctions) {
   EXPECT_EQ(a, cf->leaf_functions());
 }
 
+TEST_F(CostParserTest, ConstantsAreFolded) {
+  auto cf = parse("a + (3*4 - (1 << 2))");
+  EXPECT_EQ(10ul, (*cf)(Cfg({}, x64asm::RegSet::empty(), x64asm::RegSet::empty())).second);
+
+  // a, 8, +
+  EXPECT_EQ(3ul, cf->cost_prog_.size());
+}
+
+/** A leaf that counts how often it is evaluated. */
+class CountingCost : public CostFunction {
+public:
+  CountingCost(Cost value) : value_(value), calls_(0) {}
+
+  result_type operator()(const Cfg& cfg, Cost max) {
+    calls_++;
+    return result_type(true, value_ < max ? value_ : max);
+  }
+
+  Cost value_;
+  size_t calls_;
+};
+
+TEST_F(CostParserTest, BoundSkipsRemainingTerms) {
+  CountingCost cheap(100);
+  CountingCost expensive(5);
+
+  CostParser::SymbolTable st;
+  st["cheap"] = &cheap;
+  st["expensive"] = &expensive;
+  CostParser cp("cheap + expensive", st);
+  auto cf = cp.run();
+  ASSERT_TRUE(cf);
+
+  Cfg empty({}, x64asm::RegSet::empty(), x64asm::RegSet::empty());
+  EXPECT_EQ(105ul, (*cf)(empty).second);
+  EXPECT_EQ(50ul, (*cf)(empty, 50).second);
+
+  // Both leaves cost the same, so they're evaluated in order; once the first
+  // puts us over budget, the second is never run
+  EXPECT_EQ(2ul, cheap.calls_);
+  EXPECT_EQ(1ul, expensive.calls_);
+}
+
+TEST_F(CostParserTest, BoundRespectsDivision) {
+  CountingCost leaf(100);
+
+  CostParser::SymbolTable st;
+  st["leaf"] = &leaf;
+  CostParser cp("leaf / 4", st);
+  auto cf = cp.run();
+  ASSERT_TRUE(cf);
+
+  // A leaf cut short at 30 would report 7; it has to be evaluated exactly
+  Cfg empty({}, x64asm::RegSet::empty(), x64asm::RegSet::empty());
+  EXPECT_EQ(25ul, (*cf)(empty, 30).second);
+}
+
+TEST_F(CostParserTest, BoundKeepsCorrectness) {
+  CountingCost cheap(100);
+  CountingCost good(0);
+  CountingCost bad(3);
+
+  CostParser::SymbolTable st;
+  st["cheap"] = &cheap;
+  st["good"] = &good;
+  st["bad"] = &bad;
+  auto cf = CostParser("cheap + good + bad", st).run();
+  auto good_only = CostParser("good == 0", st).run();
+  auto both = CostParser("good + bad == 0", st).run();
+  ASSERT_TRUE(cf);
+  ASSERT_TRUE(good_only);
+  ASSERT_TRUE(both);
+
+  // Over budget after the first leaf, but the correctness term is still decided
+  Cfg empty({}, x64asm::RegSet::empty(), x64asm::RegSet::empty());
+  cf->set_correctness(good_only);
+  auto res = (*cf)(empty, 50);
+  EXPECT_TRUE(res.first);
+  EXPECT_EQ(50ul, res.second);
+
+  cf->set_correctness(both);
+  res = (*cf)(empty, 50);
+  EXPECT_FALSE(res.first);
+  EXPECT_EQ(50ul, res.second);
+}
+
 }//namespace stoke
@@ -0,0 +1,102 @@
+// Copyright 2013-2019 Stanford University
+//
+// Licensed under the Apache License, Version 2.0 (the License);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an AS IS BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <sstream>
+
+#include "src/cfg/cfg.h"
+#include "src/cost/cost_function.h"
+#include "src/cost/pipeline.h"
+
+namespace stoke {
+
+class PipelineCostTest : public ::testing::Test {
+
+protected:
+
+  PipelineCost fxn_;
+
+  Cost pipeline(std::string s) {
+    x64asm::Code c;
+
+    std::stringstream str;
+    str << ".dummy:" << std::endl;
+    str << s << std::endl;
+    str << "retq" << std::endl;
+    str >> c;
+
+    Cfg cfg(c, x64asm::RegSet::empty(), x64asm::RegSet::empty());
+
+    auto res = fxn_(cfg);
+    return res.second;
+  }
+
+
+private:
+  void SetUp() {
+    fxn_.set_uarch(Uarch::HASWELL).set_nesting_penalty(5);
+  }
+};
+
+TEST_F(PipelineCostTest, DependencyChainsCostMore) {
+
+  const auto chain = pipeline("addq %rax, %rbx\naddq %rbx, %rcx\naddq %rcx, %rdx\naddq %rdx, %rsi");
+  const auto parallel = pipeline("addq %rax, %rbx\naddq %rax, %rcx\naddq %rax, %rdx\naddq %rax, %rsi");
+
+  EXPECT_LT(parallel, chain);
+}
+
+TEST_F(PipelineCostTest, PortPressureCostsMore) {
+
+  // Haswell can only issue imul on port 1
+  const auto imuls = pipeline("imulq %rax, %rbx\nimulq %rax, %rcx\nimulq %rax, %rdx\n"
+                              "imulq %rax, %rsi\nimulq %rax, %rdi\nimulq %rax, %r8");
+  const auto adds = pipeline("addq %rax, %rbx\naddq %rax, %rcx\naddq %rax, %rdx\n"
+                             "addq %rax, %rsi\naddq %rax, %rdi\naddq %rax, %r8");
+
+  EXPECT_LE(6ul, imuls);
+  EXPECT_LT(adds, imuls);
+}
+
+TEST_F(PipelineCostTest, LoopsArePenalized) {
+
+  const auto straight = pipeline("addq %rax, %rbx\n"
+                                 "cmpq %rbx, %rcx\n"
+                                 "jne .done\n"
+                                 ".done:");
+  const auto loop = pipeline(".loop:\n"
+                             "addq %rax, %rbx\n"
+                             "cmpq %rbx, %rcx\n"
+                             "jne .loop");
+
+  EXPECT_LT(straight, loop);
+}
+
+TEST_F(PipelineCostTest, MaxShortCircuits) {
+  x64asm::Code c;
+
+  std::stringstream str;
+  str << ".dummy:" << std::endl;
+  str << "addq %rax, %rbx" << std::endl;
+  str << "addq %rbx, %rcx" << std::endl;
+  str << "retq" << std::endl;
+  str >> c;
+
+  Cfg cfg(c, x64asm::RegSet::empty(), x64asm::RegSet::empty());
+
+  EXPECT_EQ(1ul, fxn_(cfg, 1).second);
+}
+
+
+} //namespace stoke
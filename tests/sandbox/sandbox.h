@@ -1128,4 +1128,276 @@ TEST(SandboxTest, DivideBySpl1) {
 
 }
 
+TEST(SandboxTest, CountCyclesRecordsElapsedTime) {
+
+  x64asm::Code c;
+  std::stringstream ss;
+
+  // A loop long enough to dwarf the harness overhead
+  ss << ".foo:" << std::endl;
+  ss << "xorq %rcx, %rcx" << std::endl;
+  ss << ".L1:" << std::endl;
+  ss << "incq %rcx" << std::endl;
+  ss << "cmpq $0x40, %rcx" << std::endl;
+  ss << "jne .L1" << std::endl;
+  ss << "retq" << std::endl;
+
+  ss >> c;
+
+  // Setup the sandbox
+  Sandbox sb;
+  CpuState tc;
+  StateGen sg(&sb);
+  sg.get(tc);
+
+  sb.set_max_jumps(0x41);
+  sb.set_abi_check(false);
+  sb.insert_input(tc);
+  sb.set_count_cycles(true);
+
+  // Run it
+  sb.run(Cfg(TUnit(c)));
+
+  ASSERT_EQ(ErrorCode::NORMAL, sb.result_begin()->code);
+  EXPECT_EQ((uint64_t)0x40, sb.result_begin()->gp[1].get_fixed_quad(0));
+
+  const auto overhead = sb.get_cycle_overhead();
+  EXPECT_LT((uint64_t)0, overhead);
+
+  // Measuring the overhead must not disturb the output
+  EXPECT_EQ((uint64_t)0x40, sb.result_begin()->gp[1].get_fixed_quad(0));
+
+  sb.run(0);
+  EXPECT_LT(overhead, sb.get_cycles(0));
+}
+
+TEST(SandboxTest, TraceRecordsMaskedRegisters) {
+
+  x64asm::Code c;
+  std::stringstream ss;
+
+  // Here's the input program
+  ss << ".foo:" << std::endl;
+  ss << "xorq %rcx, %rcx" << std::endl;
+  ss << ".L1:" << std::endl;
+  ss << "incq %rcx" << std::endl;
+  ss << "cmpq $0x10, %rcx" << std::endl;
+  ss << "jne .L1" << std::endl;
+  ss << "retq" << std::endl;
+
+  ss >> c;
+
+  // Setup the sandbox
+  Sandbox sb;
+  CpuState tc;
+  StateGen sg(&sb);
+  sg.get(tc);
+
+  sb.set_max_jumps(17);
+  sb.insert_input(tc);
+  sb.set_abi_check(false);
+
+  const auto label = c[0].get_operand<x64asm::Label>(0);
+  sb.insert_function(Cfg(TUnit(c)));
+  sb.set_entrypoint(label);
+
+  // Tracing between the compare and the jump must not disturb the flags
+  x64asm::RegSet rs = x64asm::RegSet::empty() + x64asm::rax + x64asm::rcx;
+  TraceBuffer trace(rs, 3);
+  sb.insert_trace_after(label, 4, &trace, 7);
+
+  // Run it
+  sb.run();
+
+  ASSERT_EQ(ErrorCode::NORMAL, sb.result_begin()->code);
+  EXPECT_EQ((uint64_t)0x10, sb.result_begin()->gp[1].get_fixed_quad(0));
+
+  // Only the last four iterations fit
+  ASSERT_EQ(4ul, trace.capacity());
+  ASSERT_EQ(4ul, trace.size());
+  EXPECT_EQ(12ul, trace.dropped());
+  ASSERT_EQ(2ul, trace.get_regs().size());
+  for (size_t i = 0; i < trace.size(); ++i) {
+    EXPECT_EQ(7ul, trace.get_tag(i));
+    EXPECT_EQ(tc.gp[0].get_fixed_quad(0), trace.get_reg(i, 0));
+    EXPECT_EQ(0xd + i, trace.get_reg(i, 1));
+  }
+}
+
+TEST(SandboxTest, TracesInChildAreAnError) {
+
+  x64asm::Code c;
+  std::stringstream ss;
+
+  ss << ".foo:" << std::endl;
+  ss << "incq %rax" << std::endl;
+  ss << "retq" << std::endl;
+
+  ss >> c;
+
+  Sandbox sb;
+  CpuState tc;
+  StateGen sg(&sb);
+  sg.get(tc);
+
+  sb.insert_input(tc);
+  sb.set_abi_check(false);
+  sb.set_use_child(true);
+
+  const auto label = c[0].get_operand<x64asm::Label>(0);
+  sb.insert_function(Cfg(TUnit(c)));
+  sb.set_entrypoint(label);
+
+  // A child can't fill in our trace buffer, so the run is refused
+  TraceBuffer trace(x64asm::RegSet::empty() + x64asm::rax);
+  sb.insert_trace_before(label, 1, &trace, 0);
+  sb.run();
+
+  EXPECT_EQ(ErrorCode::SIGCUSTOM_UNSUPPORTED_IN_CHILD, sb.result_begin()->code);
+  EXPECT_EQ(0ul, trace.size());
+}
+
+TEST(SandboxTest, UncheckedStackAccessesRecheckedForNewInputs) {
+
+  x64asm::Code c;
+  std::stringstream ss;
+
+  // Here's the input program
+  ss << ".foo:" << std::endl;
+  ss << "pushq %rax" << std::endl;
+  ss << "movq $0x2a, (%rsp)" << std::endl;
+  ss << "popq %rbx" << std::endl;
+  ss << "retq" << std::endl;
+
+  ss >> c;
+
+  // Setup the sandbox
+  Sandbox sb;
+  sb.set_abi_check(false);
+  CpuState tc;
+  StateGen sg(&sb);
+  sg.get(tc);
+  sb.insert_input(tc);
+
+  // The stack slot is valid for this input, so it's compiled without checks
+  sb.insert_function(Cfg(TUnit(c)));
+  sb.run();
+
+  ASSERT_EQ(ErrorCode::NORMAL, sb.get_output(0)->code);
+  EXPECT_EQ((uint64_t)0x2a, sb.get_output(0)->gp[x64asm::rbx].get_fixed_quad(0));
+
+  // An input whose %rsp points nowhere must still fault
+  CpuState bad = tc;
+  bad.gp[x64asm::rsp].get_fixed_quad(0) = tc.stack.lower_bound() - 0x1000;
+  sb.insert_input(bad);
+  sb.run();
+
+  EXPECT_EQ(ErrorCode::NORMAL, sb.get_output(0)->code);
+  EXPECT_EQ((uint64_t)0x2a, sb.get_output(0)->gp[x64asm::rbx].get_fixed_quad(0));
+  EXPECT_EQ(ErrorCode::SIGSEGV_, sb.get_output(1)->code);
+}
+
+TEST(SandboxTest, ForkServerMatchesInProcess) {
+
+  x64asm::Code c;
+  std::stringstream ss;
+
+  ss << ".foo:" << std::endl;
+  ss << "pushq %rax" << std::endl;
+  ss << "movq $0x2a, (%rsp)" << std::endl;
+  ss << "popq %rbx" << std::endl;
+  ss << "incq %rax" << std::endl;
+  ss << "retq" << std::endl;
+
+  ss >> c;
+
+  Sandbox local;
+  local.set_abi_check(false);
+  StateGen sg(&local);
+  std::vector<CpuState> tcs(3);
+  for (auto& tc : tcs) {
+    sg.get(tc);
+    local.insert_input(tc);
+  }
+  local.insert_function(Cfg(TUnit(c)));
+
+  Sandbox child(local);
+  child.set_use_child(true);
+
+  // Twice, so the second pass reuses the server
+  for (size_t pass = 0; pass < 2; ++pass) {
+    local.run();
+    child.run();
+    for (size_t i = 0; i < tcs.size(); ++i) {
+      ASSERT_EQ(ErrorCode::NORMAL, child.get_output(i)->code);
+      EXPECT_EQ(*local.get_output(i), *child.get_output(i));
+      EXPECT_EQ((uint64_t)0x2a, child.get_output(i)->gp[x64asm::rbx].get_fixed_quad(0));
+    }
+  }
+
+  // New code means a new server
+  std::stringstream ss2;
+  ss2 << ".foo:" << std::endl;
+  ss2 << "movq $0x7, %rbx" << std::endl;
+  ss2 << "retq" << std::endl;
+  x64asm::Code c2;
+  ss2 >> c2;
+  child.insert_function(Cfg(TUnit(c2)));
+  child.run();
+  EXPECT_EQ((uint64_t)0x7, child.get_output(0)->gp[x64asm::rbx].get_fixed_quad(0));
+}
+
+TEST(SandboxTest, RunsRestoreWrittenPages) {
+
+  x64asm::Code c;
+  std::stringstream ss;
+
+  // Bump a counter two pages into the heap
+  ss << ".foo:" << std::endl;
+  ss << "movq 0x2000(%rdi), %rax" << std::endl;
+  ss << "incq %rax" << std::endl;
+  ss << "movq %rax, 0x2000(%rdi)" << std::endl;
+  ss << "retq" << std::endl;
+
+  ss >> c;
+
+  CpuState tc;
+  uint64_t base = 0x100000000;
+  tc.gp[x64asm::rdi].get_fixed_quad(0) = base;
+  tc.heap.resize(base, 0x4000);
+  for (uint64_t i = base; i < base + 0x4000; ++i) {
+    tc.heap.set_valid(i, true);
+    tc.heap[i] = 0x1;
+  }
+
+  Sandbox sb;
+  sb.set_abi_check(false);
+  sb.insert_input(tc);
+  sb.insert_function(Cfg(TUnit(c)));
+
+  // Every run starts from the input, not from where the last one left off
+  for (size_t i = 0; i < 3; ++i) {
+    sb.run();
+    ASSERT_EQ(ErrorCode::NORMAL, sb.get_output(0)->code);
+    EXPECT_EQ(0x0101010101010102ul, sb.get_output(0)->gp[x64asm::rax].get_fixed_quad(0));
+    EXPECT_EQ(0x02, (*sb.get_output(0)).heap[base + 0x2000]);
+  }
+
+  // Same again for code that writes elsewhere
+  std::stringstream ss2;
+  ss2 << ".foo:" << std::endl;
+  ss2 << "movq $0x0, 0x3ff8(%rdi)" << std::endl;
+  ss2 << "retq" << std::endl;
+  x64asm::Code c2;
+  ss2 >> c2;
+  sb.insert_function(Cfg(TUnit(c2)));
+  sb.run();
+
+  const auto& out = *sb.get_output(0);
+  EXPECT_EQ(0x01, out.heap[base + 0x2000]);
+  EXPECT_EQ(0x00, out.heap[base + 0x3ff8]);
+  EXPECT_EQ(0x01, out.heap[base + 0x3ff7]);
+  EXPECT_EQ(tc.heap.size(), out.heap.size());
+}
+
 } //namespace
@@ -0,0 +1,134 @@
+// Copyright 2013-2019 Stanford University
+//
+// Licensed under the Apache License, Version 2.0 (the License);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an AS IS BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "src/cfg/cfg.h"
+#include "src/search/candidate_board.h"
+#include "src/state/cpu_state.h"
+
+namespace stoke {
+
+class CandidateBoardTest : public ::testing::Test {
+
+protected:
+
+  Cfg make_cfg(std::string s) {
+    x64asm::Code c;
+
+    std::stringstream str;
+    str << ".dummy:" << std::endl;
+    str << s << std::endl;
+    str << "retq" << std::endl;
+    str >> c;
+
+    return Cfg(c, x64asm::RegSet::empty(), x64asm::RegSet::empty());
+  }
+};
+
+TEST_F(CandidateBoardTest, NewerCandidateSupersedes) {
+  CandidateBoard board(2);
+
+  board.publish(0, make_cfg("addq %rax, %rbx"), 5);
+  board.publish(0, make_cfg("addq %rax, %rcx"), 3);
+  board.publish(1, make_cfg("addq %rax, %rdx"), 4);
+  EXPECT_EQ(2ul, board.pending());
+
+  auto a = board.take();
+  auto b = board.take();
+  ASSERT_NE(nullptr, a);
+  ASSERT_NE(nullptr, b);
+  EXPECT_EQ(nullptr, board.take());
+
+  // Searcher 0's first candidate never made it to a verifier
+  const auto from0 = a->searcher == 0 ? a : b;
+  EXPECT_EQ(3ul, from0->cost);
+
+  board.finish(a);
+  EXPECT_EQ(1ul, board.pending());
+  board.finish(b);
+  EXPECT_EQ(0ul, board.pending());
+}
+
+TEST_F(CandidateBoardTest, FirstVerifiedWins) {
+  CandidateBoard board(1);
+  EXPECT_EQ(nullptr, board.get_verified());
+
+  board.publish(0, make_cfg("addq %rax, %rbx"), 7);
+  auto c = board.take();
+  board.set_verified(*c);
+  board.finish(c);
+
+  board.publish(0, make_cfg("addq %rax, %rcx"), 2);
+  c = board.take();
+  board.set_verified(*c);
+  board.finish(c);
+
+  ASSERT_NE(nullptr, board.get_verified());
+  EXPECT_EQ(7ul, board.get_verified()->cost);
+}
+
+TEST_F(CandidateBoardTest, EverySearcherSeesEveryCounterexample) {
+  CandidateBoard board(2);
+
+  CpuState cs;
+  for (size_t i = 0; i < 3; ++i) {
+    cs.gp[x64asm::rax].get_fixed_quad(0) = i;
+    board.add_counterexample(cs);
+  }
+
+  std::vector<CpuState> seen0;
+  EXPECT_EQ(3ul, board.drain_counterexamples(0, seen0));
+  EXPECT_EQ(0ul, board.drain_counterexamples(0, seen0));
+
+  cs.gp[x64asm::rax].get_fixed_quad(0) = 3;
+  board.add_counterexample(cs);
+  EXPECT_EQ(1ul, board.drain_counterexamples(0, seen0));
+
+  std::vector<CpuState> seen1;
+  EXPECT_EQ(4ul, board.drain_counterexamples(1, seen1));
+
+  // Counterexamples come back in the order they were added
+  ASSERT_EQ(4ul, seen0.size());
+  for (size_t i = 0; i < 4; ++i) {
+    EXPECT_EQ(i, seen0[i].gp[x64asm::rax].get_fixed_quad(0));
+    EXPECT_EQ(i, seen1[i].gp[x64asm::rax].get_fixed_quad(0));
+  }
+  EXPECT_EQ(4ul, board.num_counterexamples());
+}
+
+TEST_F(CandidateBoardTest, ConcurrentCounterexamplesAreNotLost) {
+  CandidateBoard board(1);
+
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < 4; ++i) {
+    threads.push_back(std::thread([&board]() {
+      CpuState cs;
+      for (size_t j = 0; j < 100; ++j) {
+        board.add_counterexample(cs);
+      }
+    }));
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  std::vector<CpuState> seen;
+  EXPECT_EQ(400ul, board.drain_counterexamples(0, seen));
+}
+
+} //namespace stoke
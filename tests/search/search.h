@@ -16,7 +16,18 @@
 #ifndef _STOKE_TEST_SEARCH_SEARCH_H
 #define _STOKE_TEST_SEARCH_SEARCH_H
 
+#include <algorithm>
+#include <sstream>
+#include <vector>
+
 #include "src/cfg/cfg_transforms.h"
+#include "src/cost/correctness.h"
+#include "src/cost/cost_parser.h"
+#include "src/sandbox/sandbox.h"
+#include "src/search/search.h"
+#include "src/search/search_state.h"
+#include "src/stategen/stategen.h"
+#include "src/transform/weighted.h"
 
 namespace stoke {
 
@@ -91,6 +102,103 @@ INSTANTIATE_TEST_CASE_P(Many1, SearchTest, ::testing::Values(
                           "%of %sf %zf %af %cf %pf %r8"
                         ));
 
+/** Leaves the rewrite as it is, so every proposal gets evaluated. */
+class IdentityTransform : public Transform {
+public:
+  IdentityTransform(TransformPools& pools) : Transform(pools) {}
+
+  std::string get_name() const {
+    return "Identity";
+  }
+  TransformInfo operator()(Cfg& cfg) {
+    TransformInfo ti;
+    ti.success = true;
+    return ti;
+  }
+  void undo(Cfg& cfg, const TransformInfo& ti) const {}
+};
+
+/** Remembers the testcase limits and orders search asks for. */
+class RecordingCorrectness : public CorrectnessCost {
+public:
+  RecordingCorrectness(Sandbox* sb) : CorrectnessCost(sb) {}
+
+  RecordingCorrectness& set_testcase_order(const std::vector<size_t>& order) {
+    orders.push_back(order);
+    CorrectnessCost::set_testcase_order(order);
+    return *this;
+  }
+  RecordingCorrectness& set_testcase_limit(size_t n) {
+    limits.push_back(n);
+    CorrectnessCost::set_testcase_limit(n);
+    return *this;
+  }
+
+  std::vector<std::vector<size_t>> orders;
+  std::vector<size_t> limits;
+};
+
+TEST(SearchTestcasesTest, SubsetReachesLeaves) {
+
+  // Half of these have an odd rax, which the rewrite gets wrong
+  Sandbox sb;
+  for (size_t i = 0; i < 8; ++i) {
+    CpuState cs;
+    StateGen sg(&sb);
+    sg.get(cs);
+    cs.gp[x64asm::rax].get_fixed_quad(0) = i;
+    sb.insert_input(cs);
+  }
+
+  std::stringstream ss;
+  x64asm::Code code;
+  ss << ".foo:" << std::endl;
+  ss << "andq $0x1, %rax" << std::endl;
+  ss << "retq" << std::endl;
+  ss >> code;
+  const auto rs = x64asm::RegSet::empty() + x64asm::rax;
+  Cfg target(code, rs, rs);
+
+  // Built the way stoke_search builds it, through the expression parser
+  RecordingCorrectness correctness(&sb);
+  correctness.set_target(target, false, false);
+  CostParser::SymbolTable st;
+  st["correctness"] = &correctness;
+  auto fxn = CostParser("correctness", st).run();
+  auto correct = CostParser("correctness == 0", st).run();
+  ASSERT_TRUE(fxn);
+  ASSERT_TRUE(correct);
+  fxn->set_correctness(correct).setup_test_sandbox(&sb);
+  ASSERT_EQ(8ul, fxn->num_testcases());
+
+  TransformPools pools;
+  IdentityTransform identity(pools);
+  WeightedTransform transform(pools);
+  transform.insert_transform(&identity);
+
+  Search search(&transform);
+  search.set_timeout_itr(50)
+  .set_testcase_subset(2)
+  .set_reorder_interval(10);
+
+  SearchState state(target, target, Init::ZERO, 8);
+  std::vector<TUnit> aux_fxns;
+  search.run(target, *fxn, Init::ZERO, state, aux_fxns);
+
+  // Proposals went to the first two testcases before the rest, and the order
+  // was handed down again at every reordering
+  auto& limits = correctness.limits;
+  EXPECT_NE(limits.end(), std::find(limits.begin(), limits.end(), 2ul));
+  EXPECT_NE(limits.end(), std::find(limits.begin(), limits.end(), 8ul));
+  EXPECT_LE(6ul, correctness.orders.size());
+  for (const auto& order : correctness.orders) {
+    EXPECT_EQ(8ul, order.size());
+  }
+
+  delete fxn;
+  delete correct;
+}
+
 } //namespace stoke
 
 #endif
@@ -370,6 +370,93 @@ TEST(StateGenTest, EasyToAvoidMisalign) {
   EXPECT_TRUE(sg.get(tc, cfg_t));
 }
 
+TEST(StateGenTest, ParallelStatesAllRun) {
+
+  // Build example; the first two addresses are known up front, the last isn't
+  std::stringstream ss;
+
+  ss << ".foo:" << std::endl;
+  ss << "movq (%rdi), %rax" << std::endl;
+  ss << "movq %rax, 0x20(%rsi)" << std::endl;
+  ss << "addq $0x8, %rdi" << std::endl;
+  ss << "movq (%rdi), %rcx" << std::endl;
+  ss << "retq" << std::endl;
+
+  x64asm::Code c;
+  ss >> c;
+
+  // Run stategen
+  Sandbox sg_sb;
+  sg_sb.set_max_jumps(2)
+  .set_abi_check(false);
+
+  Cfg cfg_t(c, x64asm::RegSet::universe(), x64asm::RegSet::empty());
+  StateGen sg(&sg_sb);
+  sg.set_max_attempts(10)
+  .set_max_memory(1000)
+  .set_seed(0);
+
+  std::vector<CpuState> tcs;
+  ASSERT_EQ(16ul, sg.get(tcs, 16, cfg_t, 4)) << sg.get_error();
+  ASSERT_EQ(16ul, tcs.size());
+
+  // Check that the testcases work in the Sandbox
+  Sandbox sb;
+  sb.set_max_jumps(2)
+  .set_abi_check(false);
+  for (const auto& tc : tcs) {
+    sb.insert_input(tc);
+  }
+  sb.run(Cfg(TUnit(c)));
+  for (auto i = sb.result_begin(), ie = sb.result_end(); i != ie; ++i) {
+    EXPECT_EQ(ErrorCode::NORMAL, i->code);
+  }
+
+  // The same seed gives the same states, however many threads there are
+  StateGen sg2(&sg_sb);
+  sg2.set_max_attempts(10)
+  .set_max_memory(1000)
+  .set_seed(0);
+
+  std::vector<CpuState> tcs2;
+  ASSERT_EQ(16ul, sg2.get(tcs2, 16, cfg_t, 1));
+  EXPECT_EQ(tcs, tcs2);
+}
+
+TEST(StateGenTest, GuardedAccessNotLaidOut) {
+
+  // The dereference is behind a branch that's always taken, so it never runs
+  std::stringstream ss;
+
+  ss << ".foo:" << std::endl;
+  ss << "movq $0x1, %rcx" << std::endl;
+  ss << "testq %rcx, %rcx" << std::endl;
+  ss << "jne .skip" << std::endl;
+  ss << "movq (%rsi), %rax" << std::endl;
+  ss << ".skip:" << std::endl;
+  ss << "retq" << std::endl;
+
+  x64asm::Code c;
+  ss >> c;
+
+  Sandbox sg_sb;
+  sg_sb.set_max_jumps(2)
+  .set_abi_check(false);
+
+  Cfg cfg_t(c, x64asm::RegSet::universe(), x64asm::RegSet::empty());
+  StateGen sg(&sg_sb);
+  sg.set_max_attempts(10)
+  .set_max_memory(1000)
+  .set_seed(0);
+
+  CpuState tc;
+  ASSERT_TRUE(sg.get(tc, cfg_t)) << sg.get_error();
+
+  const auto rsi = tc.gp[x64asm::rsi].get_fixed_quad(0);
+  EXPECT_FALSE(tc.heap.in_range(rsi) && tc.heap.is_valid(rsi));
+  EXPECT_FALSE(tc.stack.in_range(rsi) && tc.stack.is_valid(rsi));
+}
+
 INSTANTIATE_TEST_CASE_P(
   StategenFixtures,
   StateGenParamTest,
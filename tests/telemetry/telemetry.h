@@ -0,0 +1,92 @@
+// Copyright 2013-2019 Stanford University
+//
+// Licensed under the Apache License, Version 2.0 (the License);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an AS IS BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <sstream>
+#include <thread>
+
+#include "src/telemetry/telemetry.h"
+
+namespace stoke {
+
+class TelemetryTest : public ::testing::Test {
+
+protected:
+  void SetUp() {
+    Telemetry::reset();
+    Telemetry::set_tracing(false);
+  }
+
+  void TearDown() {
+    Telemetry::reset();
+    Telemetry::set_tracing(false);
+  }
+};
+
+TEST_F(TelemetryTest, RecordsAcrossThreads) {
+  Telemetry::record(Telemetry::SANDBOX_RUN, 10);
+  std::thread t([]() {
+    Telemetry::record(Telemetry::SANDBOX_RUN, 30);
+    Telemetry::record(Telemetry::SANDBOX_RUN, 20);
+  });
+  t.join();
+
+  auto s = Telemetry::snapshot().stats[Telemetry::SANDBOX_RUN];
+  EXPECT_EQ(3ul, s.count);
+  EXPECT_EQ(60ul, s.total);
+  EXPECT_EQ(10ul, s.min);
+  EXPECT_EQ(30ul, s.max);
+  EXPECT_EQ(0ul, Telemetry::snapshot().stats[Telemetry::SOLVER_CHECK].count);
+}
+
+TEST_F(TelemetryTest, QuantilesBoundObservations) {
+  for (uint64_t i = 1; i <= 100; ++i)
+    Telemetry::record(Telemetry::SOLVER_CHECK, i);
+
+  auto s = Telemetry::snapshot().stats[Telemetry::SOLVER_CHECK];
+  EXPECT_LE(50ul, s.quantile(0.5));
+  EXPECT_GE(127ul, s.quantile(0.5));
+  EXPECT_LE(99ul, s.quantile(0.99));
+  EXPECT_GE(100ul, s.quantile(0.99));
+}
+
+TEST_F(TelemetryTest, SnapshotsRoundTripAndMerge) {
+  Telemetry::set_tracing(true);
+  {
+    Telemetry::Timer timer(Telemetry::OBLIGATION_SOLVE);
+  }
+  Telemetry::record(Telemetry::LEARNER_LEARN, 42);
+
+  std::stringstream ss;
+  Telemetry::snapshot().write(ss);
+
+  Telemetry::Snapshot read;
+  ASSERT_TRUE(read.read(ss));
+  EXPECT_EQ(1ul, read.stats[Telemetry::OBLIGATION_SOLVE].count);
+  EXPECT_EQ(42ul, read.stats[Telemetry::LEARNER_LEARN].total);
+  ASSERT_EQ(1ul, read.events.size());
+  EXPECT_EQ(Telemetry::OBLIGATION_SOLVE, read.events[0].metric);
+
+  // As if a worker process had sent it back
+  Telemetry::merge(read);
+  auto merged = Telemetry::snapshot();
+  EXPECT_EQ(2ul, merged.stats[Telemetry::LEARNER_LEARN].count);
+  EXPECT_EQ(84ul, merged.stats[Telemetry::LEARNER_LEARN].total);
+  EXPECT_EQ(2ul, merged.events.size());
+
+  Telemetry::Snapshot empty;
+  std::stringstream nothing;
+  EXPECT_FALSE(empty.read(nothing));
+}
+
+} // namespace stoke
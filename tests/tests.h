@@ -40,6 +40,7 @@ using namespace x64asm;
 // very fast tests (much less 1 sec per test)
 #include "tests/trivial.h"
 #include "tests/sandbox/sandbox.h"
+#include "tests/search/candidate_board.h"
 #include "tests/search/search.h"
 #include "tests/serialize/serialize.h"
 #include "tests/x64asm/r.h"
@@ -56,10 +57,16 @@ using namespace x64asm;
 #include "tests/state/state.h"
 #include "tests/stategen/stategen.h"
 #include "tests/symstate/bitvector.h"
+#include "tests/telemetry/telemetry.h"
+#include "tests/transform/alias_sampler.h"
 #include "tests/tunit/tunit.h"
 #include "tests/unionfind/unionfind.h"
+#include "tests/validator/check_all.h"
+#include "tests/validator/implication_engine.h"
 #include "tests/validator/invariants.h"
 #include "tests/validator/invariant_serialize.h"
+#include "tests/validator/obligation_serialize.h"
+#include "tests/validator/postgres.h"
 #include "tests/validator/variables.h"
 #include "tests/verifier/verifier.h"
 #include "tests/fixture.h"
@@ -0,0 +1,63 @@
+// Copyright 2013-2019 Stanford University
+//
+// Licensed under the Apache License, Version 2.0 (the License);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an AS IS BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _STOKE_TEST_TRANSFORM_ALIAS_SAMPLER_H
+#define _STOKE_TEST_TRANSFORM_ALIAS_SAMPLER_H
+
+#include <random>
+#include <vector>
+
+#include "src/transform/alias_sampler.h"
+
+namespace stoke {
+
+TEST(AliasSamplerTest, FollowsWeights) {
+
+  AliasSampler sampler;
+  sampler.reset({0.5, 0, 3, 1.5});
+  ASSERT_FALSE(sampler.empty());
+
+  std::default_random_engine gen(17);
+  std::vector<size_t> counts(4, 0);
+  const size_t n = 100000;
+  for (size_t i = 0; i < n; ++i) {
+    counts[sampler(gen)]++;
+  }
+
+  // Expected shares are 10%, 0%, 60% and 30%
+  EXPECT_NEAR(0.1, (double)counts[0] / n, 0.01);
+  EXPECT_EQ(0ul, counts[1]);
+  EXPECT_NEAR(0.6, (double)counts[2] / n, 0.01);
+  EXPECT_NEAR(0.3, (double)counts[3] / n, 0.01);
+}
+
+TEST(AliasSamplerTest, EmptyWithoutWeight) {
+
+  AliasSampler sampler;
+  sampler.reset({});
+  EXPECT_TRUE(sampler.empty());
+  sampler.reset({0, 0});
+  EXPECT_TRUE(sampler.empty());
+  sampler.reset({0, 2});
+  EXPECT_FALSE(sampler.empty());
+
+  std::default_random_engine gen(3);
+  for (size_t i = 0; i < 100; ++i) {
+    EXPECT_EQ(1ul, sampler(gen));
+  }
+}
+
+} //namespace stoke
+
+#endif
@@ -0,0 +1,169 @@
+// Copyright 2013-2019 Stanford University
+//
+// Licensed under the Apache License, Version 2.0 (the License);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an AS IS BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/solver/z3solver.h"
+#include "src/validator/filters/default.h"
+#include "src/validator/handlers/combo_handler.h"
+#include "src/validator/invariants/conjunction.h"
+#include "src/validator/invariants/equality.h"
+#include "src/validator/invariants/state_equality.h"
+#include "src/validator/smt_obligation_checker.h"
+
+namespace stoke {
+
+class ObligationCheckAllTest : public ::testing::Test {
+
+public:
+  ObligationCheckAllTest() : filter_(handler_), checker_(solver_, filter_) { }
+
+protected:
+
+  Z3Solver solver_;
+  ComboHandler handler_;
+  DefaultFilter filter_;
+  SmtObligationChecker checker_;
+
+  Cfg make_cfg(const std::string& s) {
+    std::stringstream ss;
+    ss << ".foo:" << std::endl << s << std::endl << "retq" << std::endl;
+    x64asm::Code c;
+    ss >> c;
+    return Cfg(c, x64asm::RegSet::universe(), x64asm::RegSet::universe());
+  }
+
+  std::shared_ptr<Invariant> assume() {
+    auto assume = std::make_shared<ConjunctionInvariant>();
+    assume->add_invariant(std::make_shared<StateEqualityInvariant>(x64asm::RegSet::empty() + x64asm::rax + x64asm::rbx));
+    return assume;
+  }
+
+  /** The first and last claims hold; the middle one doesn't. */
+  std::vector<std::shared_ptr<Invariant>> claims() {
+    std::vector<Variable> rax_is_five;
+    rax_is_five.push_back(Variable(x64asm::rax, false));
+
+    std::vector<std::shared_ptr<Invariant>> claims;
+    claims.push_back(std::make_shared<StateEqualityInvariant>(x64asm::RegSet::empty() + x64asm::rax));
+    claims.push_back(std::make_shared<EqualityInvariant>(rax_is_five, 5));
+    claims.push_back(std::make_shared<StateEqualityInvariant>(x64asm::RegSet::empty() + x64asm::rbx));
+    return claims;
+  }
+};
+
+TEST_F(ObligationCheckAllTest, EachClaimGetsItsOwnResult) {
+
+  auto target = make_cfg("incq %rax");
+  auto rewrite = make_cfg("addq $0x1, %rax");
+  CfgPath p = {1};
+
+  std::vector<ObligationChecker::Result> results(3);
+  std::vector<bool> called(3, false);
+  ObligationChecker::Callback callback = [&] (ObligationChecker::Result& r, void* optional) {
+    auto i = (size_t)optional;
+    results[i] = r;
+    called[i] = true;
+  };
+
+  checker_.check_all(target, rewrite, 2, 2, p, p, assume(), claims(), {}, callback, false,
+  {(void*)0, (void*)1, (void*)2});
+
+  for (size_t i = 0; i < 3; ++i) {
+    ASSERT_TRUE(called[i]) << "claim " << i;
+    EXPECT_FALSE(results[i].has_error) << "claim " << i;
+  }
+  EXPECT_TRUE(results[0].verified);
+  EXPECT_FALSE(results[1].verified);
+  EXPECT_TRUE(results[1].has_ceg);
+  EXPECT_TRUE(results[2].verified);
+
+  // One at a time gives the same answers
+  auto claim_list = claims();
+  for (size_t i = 0; i < 3; ++i) {
+    auto r = checker_.check_wait(target, rewrite, 2, 2, p, p, assume(), claim_list[i], {}, false);
+    EXPECT_EQ(results[i].verified, r.verified) << "claim " << i;
+  }
+}
+
+TEST_F(ObligationCheckAllTest, FailingConjunctsAreIdentified) {
+
+  auto target = make_cfg("incq %rax");
+  auto rewrite = make_cfg("addq $0x1, %rax");
+  CfgPath p = {1};
+
+  std::vector<Variable> rbx_is_seven;
+  rbx_is_seven.push_back(Variable(x64asm::rbx, true));
+
+  auto prove = std::make_shared<ConjunctionInvariant>();
+  prove->add_invariants(claims());
+  prove->add_invariant(std::make_shared<EqualityInvariant>(rbx_is_seven, 7));
+  prove->add_invariant(std::make_shared<StateEqualityInvariant>(x64asm::RegSet::empty() + x64asm::rax + x64asm::rbx));
+
+  auto failing = checker_.failing_conjuncts(target, rewrite, 2, 2, p, p, assume(), prove, {}, false);
+  EXPECT_EQ(std::vector<size_t>({1, 3}), failing);
+}
+
+TEST_F(ObligationCheckAllTest, CounterexamplePathsCompileOnce) {
+
+  auto target = make_cfg("incq %rax");
+  auto rewrite = make_cfg("addq $0x1, %rax");
+  CfgPath p = {1};
+
+  std::vector<Variable> rax_is_five;
+  rax_is_five.push_back(Variable(x64asm::rax, false));
+  auto claim = std::make_shared<EqualityInvariant>(rax_is_five, 5);
+
+  for (size_t i = 0; i < 3; ++i) {
+    auto r = checker_.check_wait(target, rewrite, 2, 2, p, p, assume(), claim, {}, false);
+    ASSERT_FALSE(r.verified);
+    ASSERT_TRUE(r.has_ceg);
+  }
+
+  // One compilation for the target path, one for the rewrite path
+  EXPECT_EQ(2ul, checker_.get_counterexample_sandbox().get_compilations());
+}
+
+TEST_F(ObligationCheckAllTest, TestcasesRefuteWithoutSolver) {
+
+  auto target = make_cfg("incq %rax");
+  auto rewrite = make_cfg("addq $0x1, %rax");
+  CfgPath p = {1};
+
+  CpuState tc;
+  tc.stack.resize(0x700000000, 1024);
+  tc.gp[x64asm::rsp].get_fixed_quad(0) = 0x700000000 + 512;
+  tc.gp[x64asm::rax].get_fixed_quad(0) = 3;
+  tc.gp[x64asm::rbx].get_fixed_quad(0) = 7;
+
+  std::vector<ObligationChecker::Result> results(3);
+  ObligationChecker::Callback callback = [&] (ObligationChecker::Result& r, void* optional) {
+    results[(size_t)optional] = r;
+  };
+
+  checker_.check_all(target, rewrite, 2, 2, p, p, assume(), claims(), {{tc, tc}}, callback, false,
+  {(void*)0, (void*)1, (void*)2});
+
+  // rax comes out as 4, not 5, and the testcase shows it
+  EXPECT_FALSE(results[1].verified);
+  EXPECT_TRUE(results[1].has_ceg);
+  EXPECT_EQ("Refuted by testcase", results[1].comments);
+  EXPECT_EQ(0ul, results[1].smt_time_microseconds);
+  EXPECT_EQ(4ul, results[1].target_final_ceg.gp[x64asm::rax].get_fixed_quad(0));
+
+  // The others still go to the solver
+  EXPECT_TRUE(results[0].verified);
+  EXPECT_TRUE(results[2].verified);
+  EXPECT_NE("Refuted by testcase", results[0].comments);
+}
+
+} //namespace stoke
@@ -0,0 +1,120 @@
+// Copyright 2013-2019 Stanford University
+//
+// Licensed under the Apache License, Version 2.0 (the License);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an AS IS BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/validator/implication_engine.h"
+#include "src/validator/invariants/equality.h"
+#include "src/validator/invariants/inequality.h"
+#include "src/validator/invariants/mod_2n.h"
+#include "src/validator/invariants/nonzero.h"
+#include "src/validator/invariants/range.h"
+#include "src/validator/invariants/sign.h"
+
+namespace stoke {
+
+class ImplicationEngineTest : public ::testing::Test {
+
+protected:
+
+  Variable var(const x64asm::R64& r, long coefficient = 1) {
+    Variable v(r, false);
+    v.coefficient = coefficient;
+    return v;
+  }
+
+  std::shared_ptr<Invariant> equality(std::vector<Variable> terms, long constant) {
+    return std::make_shared<EqualityInvariant>(terms, constant);
+  }
+};
+
+TEST_F(ImplicationEngineTest, ScaledEqualities) {
+
+  // rax - rbx = 3 and 3rax - 3rbx = 9
+  auto a = equality({var(x64asm::rax), var(x64asm::rbx, -1)}, 3);
+  auto b = equality({var(x64asm::rax, 3), var(x64asm::rbx, -3)}, 9);
+  auto c = equality({var(x64asm::rax), var(x64asm::rbx, -1)}, 4);
+  auto d = equality({var(x64asm::rax, 2), var(x64asm::rbx, -2)}, 3);
+
+  EXPECT_EQ(ImplicationEngine::YES, ImplicationEngine::implies(a, b));
+  EXPECT_EQ(ImplicationEngine::YES, ImplicationEngine::implies(b, a));
+  EXPECT_EQ(ImplicationEngine::NO, ImplicationEngine::implies(a, c));
+
+  // With even coefficients, the equality is checked as rax - rbx = 3 modulo 2^63
+  EXPECT_EQ(ImplicationEngine::YES, ImplicationEngine::implies(a, d));
+  EXPECT_EQ(ImplicationEngine::NO, ImplicationEngine::implies(d, a));
+}
+
+TEST_F(ImplicationEngineTest, SeveralEqualitiesTogether) {
+
+  auto a = equality({var(x64asm::rax), var(x64asm::rbx, -1)}, 1);
+  auto b = equality({var(x64asm::rbx), var(x64asm::rcx, -1)}, 2);
+  auto c = equality({var(x64asm::rax), var(x64asm::rcx, -1)}, 3);
+  auto d = equality({var(x64asm::rax), var(x64asm::rcx, -1)}, 4);
+
+  EXPECT_EQ(ImplicationEngine::NO, ImplicationEngine::implies(a, c));
+  EXPECT_EQ(ImplicationEngine::NO, ImplicationEngine::implies(b, c));
+
+  ImplicationEngine::LinearSystem system;
+  EXPECT_TRUE(system.add(a));
+  EXPECT_TRUE(system.add(b));
+
+  std::vector<std::shared_ptr<Invariant>> sources;
+  ASSERT_TRUE(system.implies(c, &sources));
+  EXPECT_EQ(2ul, sources.size());
+  EXPECT_FALSE(system.implies(d));
+
+  EXPECT_FALSE(system.add(c));
+  EXPECT_EQ(2ul, system.size());
+}
+
+TEST_F(ImplicationEngineTest, SingleVariableFacts) {
+
+  auto small = std::make_shared<RangeInvariant>(var(x64asm::rax), 4, 8);
+  auto large = std::make_shared<RangeInvariant>(var(x64asm::rax), 0, 16);
+  auto nonzero = std::make_shared<NonzeroInvariant>(var(x64asm::rax));
+  auto positive = std::make_shared<SignInvariant>(var(x64asm::rax), true);
+  auto aligned = std::make_shared<Mod2NInvariant>(var(x64asm::rax), 3);
+  auto even = std::make_shared<Mod2NInvariant>(var(x64asm::rax), 1);
+  auto is_eight = equality({var(x64asm::rax)}, 8);
+
+  EXPECT_EQ(ImplicationEngine::YES, ImplicationEngine::implies(small, large));
+  EXPECT_EQ(ImplicationEngine::NO, ImplicationEngine::implies(large, small));
+  EXPECT_EQ(ImplicationEngine::YES, ImplicationEngine::implies(small, nonzero));
+  EXPECT_EQ(ImplicationEngine::NO, ImplicationEngine::implies(large, nonzero));
+  EXPECT_EQ(ImplicationEngine::YES, ImplicationEngine::implies(small, positive));
+  EXPECT_EQ(ImplicationEngine::YES, ImplicationEngine::implies(aligned, even));
+  EXPECT_EQ(ImplicationEngine::NO, ImplicationEngine::implies(even, aligned));
+  EXPECT_EQ(ImplicationEngine::NO, ImplicationEngine::implies(small, aligned));
+  EXPECT_EQ(ImplicationEngine::YES, ImplicationEngine::implies(is_eight, aligned));
+  EXPECT_EQ(ImplicationEngine::YES, ImplicationEngine::implies(is_eight, small));
+
+  // Nothing about rax says anything about rbx
+  auto other = std::make_shared<NonzeroInvariant>(var(x64asm::rbx));
+  EXPECT_EQ(ImplicationEngine::NO, ImplicationEngine::implies(small, other));
+}
+
+TEST_F(ImplicationEngineTest, Inequalities) {
+
+  auto lt = std::make_shared<InequalityInvariant>(var(x64asm::rax), var(x64asm::rbx), true);
+  auto le = std::make_shared<InequalityInvariant>(var(x64asm::rax), var(x64asm::rbx), false);
+  auto ge = std::make_shared<InequalityInvariant>(var(x64asm::rbx), var(x64asm::rax), false);
+  auto eq = equality({var(x64asm::rax), var(x64asm::rbx, -1)}, 0);
+
+  EXPECT_EQ(ImplicationEngine::YES, ImplicationEngine::implies(lt, le));
+  EXPECT_EQ(ImplicationEngine::NO, ImplicationEngine::implies(le, lt));
+  EXPECT_EQ(ImplicationEngine::YES, ImplicationEngine::implies(eq, le));
+  EXPECT_EQ(ImplicationEngine::YES, ImplicationEngine::implies(eq, ge));
+  EXPECT_EQ(ImplicationEngine::NO, ImplicationEngine::implies(eq, lt));
+}
+
+} //namespace stoke
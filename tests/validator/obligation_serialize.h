@@ -0,0 +1,164 @@
+// Copyright 2013-2019 Stanford University
+//
+// Licensed under the Apache License, Version 2.0 (the License);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an AS IS BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "src/serialize/hash64.h"
+#include "src/validator/invariants/equality.h"
+#include "src/validator/invariants/true.h"
+#include "src/validator/obligation_checker.h"
+#include "src/validator/obligation_corpus.h"
+
+namespace stoke {
+
+class ObligationSerializationTest : public ::testing::Test {
+
+protected:
+  ObligationChecker::Obligation make_obligation(size_t testcases) {
+    std::stringstream ss;
+    ss << ".foo:" << std::endl;
+    ss << "incq %rax" << std::endl;
+    ss << "cmpq $0x10, %rax" << std::endl;
+    ss << "jne .foo" << std::endl;
+    ss << "retq" << std::endl;
+    x64asm::Code c;
+    ss >> c;
+    Cfg cfg(c, x64asm::RegSet::universe(), x64asm::RegSet::universe());
+
+    ObligationChecker::Obligation obligation;
+    obligation.target = cfg;
+    obligation.rewrite = cfg;
+    obligation.target_block = cfg.get_entry();
+    obligation.rewrite_block = cfg.get_entry();
+    obligation.P = {1, 1};
+    obligation.Q = {1};
+    obligation.assume = std::make_shared<TrueInvariant>();
+    std::vector<Variable> vars;
+    vars.push_back(Variable(x64asm::rax, false));
+    vars.push_back(Variable(x64asm::rax, true));
+    obligation.prove = std::make_shared<EqualityInvariant>(vars, 0);
+    obligation.separate_stack = true;
+
+    CpuState tc;
+    tc.stack.resize(0x700000000, 1024);
+    for (size_t i = 0; i < testcases; ++i) {
+      tc.gp[x64asm::rax].get_fixed_quad(0) = i;
+      obligation.testcases.push_back({tc, tc});
+    }
+    return obligation;
+  }
+
+  std::string text(const ObligationChecker::Obligation& o) {
+    std::stringstream ss;
+    o.write_text(ss);
+    return ss.str();
+  }
+};
+
+TEST_F(ObligationSerializationTest, BinaryRoundTrip) {
+  auto o = make_obligation(5);
+
+  std::string bin;
+  o.write_bin(bin);
+  ASSERT_TRUE(ObligationChecker::Obligation::is_bin(bin.data(), bin.size()));
+
+  ObligationChecker::Obligation copy;
+  ASSERT_TRUE(copy.read_bin(bin.data(), bin.size()));
+  EXPECT_EQ(text(o), text(copy));
+}
+
+TEST_F(ObligationSerializationTest, BinaryIsSmallerThanText) {
+  auto o = make_obligation(5);
+
+  std::string bin;
+  o.write_bin(bin);
+  EXPECT_LT(4*bin.size(), text(o).size());
+}
+
+TEST_F(ObligationSerializationTest, HashIgnoresCompression) {
+  auto o = make_obligation(5);
+
+  std::string bin1;
+  uint64_t h1;
+  o.write_bin(bin1, &h1);
+
+  std::string bin2;
+  uint64_t h2;
+  o.write_bin(bin2, &h2);
+  EXPECT_EQ(h1, h2);
+  EXPECT_EQ(16ul, hash64_hex(h1).size());
+
+  // Any change to the obligation changes the hash
+  o.separate_stack = false;
+  uint64_t h3;
+  o.write_bin(bin2, &h3);
+  EXPECT_NE(h1, h3);
+}
+
+TEST_F(ObligationSerializationTest, MalformedDataIsRejected) {
+  auto o = make_obligation(2);
+
+  std::string bin;
+  o.write_bin(bin);
+
+  ObligationChecker::Obligation copy;
+  EXPECT_FALSE(copy.read_bin(bin.data(), bin.size()/2));
+
+  auto bad_version = bin;
+  bad_version[4]++;
+  EXPECT_FALSE(copy.read_bin(bad_version.data(), bad_version.size()));
+
+  auto t = text(o);
+  EXPECT_FALSE(ObligationChecker::Obligation::is_bin(t.data(), t.size()));
+}
+
+TEST_F(ObligationSerializationTest, CorpusRoundTrip) {
+  std::stringstream ss;
+  ObligationCorpus corpus(ss);
+  for (size_t i = 0; i < 3; ++i)
+    corpus.append(make_obligation(i));
+  EXPECT_EQ(3ul, corpus.size());
+
+  std::vector<std::vector<ObligationChecker::Obligation>> read;
+  ASSERT_TRUE(ObligationCorpus::read_all(ss, read));
+  ASSERT_EQ(3ul, read.size());
+  for (size_t i = 0; i < 3; ++i) {
+    ASSERT_EQ(1ul, read[i].size());
+    EXPECT_EQ(text(make_obligation(i)), text(read[i][0]));
+  }
+
+  // A corpus cut off mid-record is malformed
+  auto data = ss.str();
+  std::stringstream truncated(data.substr(0, data.size() - 10));
+  read.clear();
+  EXPECT_FALSE(ObligationCorpus::read_all(truncated, read));
+  EXPECT_EQ(2ul, read.size());
+}
+
+TEST_F(ObligationSerializationTest, CorpusKeepsBatches) {
+  std::stringstream ss;
+  ObligationCorpus corpus(ss);
+  corpus.append(make_obligation(0));
+  corpus.append_batch({ make_obligation(1), make_obligation(2) });
+  EXPECT_EQ(3ul, corpus.size());
+
+  std::vector<std::vector<ObligationChecker::Obligation>> read;
+  ASSERT_TRUE(ObligationCorpus::read_all(ss, read));
+  ASSERT_EQ(2ul, read.size());
+  ASSERT_EQ(1ul, read[0].size());
+  ASSERT_EQ(2ul, read[1].size());
+  EXPECT_EQ(text(make_obligation(0)), text(read[0][0]));
+  EXPECT_EQ(text(make_obligation(1)), text(read[1][0]));
+  EXPECT_EQ(text(make_obligation(2)), text(read[1][1]));
+}
+
+} //namespace stoke
@@ -0,0 +1,116 @@
+// Copyright 2013-2019 Stanford University
+//
+// Licensed under the Apache License, Version 2.0 (the License);
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an AS IS BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <chrono>
+#include <thread>
+#include <unistd.h>
+
+#include "src/serialize/hash64.h"
+#include "src/solver/z3solver.h"
+#include "src/validator/filters/default.h"
+#include "src/validator/handlers/combo_handler.h"
+#include "src/validator/invariants/true.h"
+#include "src/validator/postgres_obligation_checker.h"
+#include "src/validator/smt_obligation_checker.h"
+
+namespace stoke {
+
+/** Plays the part of a worker: waits for the problem to show up, then records
+  a result for it and announces it the same way stoke_worker does. */
+void postgres_fake_worker(std::string connection_string, std::string hash) {
+  pqxx::connection c(connection_string.c_str());
+  for (size_t i = 0; i < 50; ++i) {
+    pqxx::nontransaction tx(c);
+    auto h = tx.esc(hash);
+    auto r = tx.exec("SELECT hash FROM ProofObligation WHERE hash='" + h + "'");
+    if (r.size() == 0) {
+      tx.commit();
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      continue;
+    }
+
+    tx.exec("INSERT INTO ProofObligationResult "
+            "  (hash, solver, strategy, verified, gen_time, smt_time, version) "
+            "VALUES ('" + h + "', 'z3', 'flat', TRUE, 0, 0, 'test')");
+    tx.exec("DELETE FROM ProofObligationQueue WHERE hash='" + h + "'");
+    tx.exec("NOTIFY stoke_result, '" + h + "'");
+    tx.commit();
+    return;
+  }
+}
+
+/** Needs a database to talk to; set TEST_VALIDATOR_POSTGRES to a connection
+  string (e.g. "dbname=stoke_test") to run it. */
+TEST(PostgresObligationCheckerTest, ResultNotificationWakesChecker) {
+
+  const char* connection_string = getenv("TEST_VALIDATOR_POSTGRES");
+  if (connection_string == NULL)
+    return;
+
+  Z3Solver solver;
+  ComboHandler handler;
+  DefaultFilter filter(handler);
+  SmtObligationChecker smt(solver, filter);
+  PostgresObligationChecker checker(connection_string, smt);
+
+  std::stringstream ss;
+  ss << ".foo:" << std::endl;
+  ss << "incq %rax" << std::endl;
+  ss << "retq" << std::endl;
+  x64asm::Code c;
+  ss >> c;
+  Cfg cfg(c, x64asm::RegSet::universe(), x64asm::RegSet::universe());
+
+  // Make the problem unique so that no earlier run has already answered it
+  CpuState tc;
+  tc.gp[x64asm::rax].get_fixed_quad(0) = ((uint64_t)time(NULL) << 32) | getpid();
+
+  ObligationChecker::Obligation obligation;
+  obligation.target = cfg;
+  obligation.rewrite = cfg;
+  obligation.target_block = cfg.get_entry();
+  obligation.rewrite_block = cfg.get_entry();
+  obligation.assume = std::make_shared<TrueInvariant>();
+  obligation.prove = std::make_shared<TrueInvariant>();
+  obligation.testcases.push_back({tc, tc});
+  obligation.separate_stack = false;
+
+  std::string payload;
+  uint64_t hash;
+  obligation.write_bin(payload, &hash);
+
+  bool called = false;
+  bool verified = false;
+  ObligationChecker::Callback callback = [&] (ObligationChecker::Result& result, void*) {
+    called = true;
+    verified = result.verified;
+  };
+  checker.check(obligation, callback);
+  // Send the problem to the database
+  checker.check_for_callbacks();
+  EXPECT_FALSE(called);
+
+  std::thread worker(postgres_fake_worker, std::string(connection_string), hash64_hex(hash));
+  auto start = std::chrono::steady_clock::now();
+  checker.block_until_complete();
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  worker.join();
+
+  EXPECT_TRUE(called);
+  EXPECT_TRUE(verified);
+  // Falling back to polling would take a full minute
+  EXPECT_GT(std::chrono::seconds(30), elapsed);
+}
+
+} //namespace stoke
@@ -0,0 +1,181 @@
+// Copyright 2013-2019 Stanford University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+
+#include "src/ext/cpputil/include/command_line/command_line.h"
+#include "src/ext/cpputil/include/io/console.h"
+#include "src/ext/cpputil/include/signal/debug_handler.h"
+#include "src/telemetry/telemetry.h"
+#include "src/validator/forking_obligation_checker.h"
+#include "src/validator/obligation_corpus.h"
+
+#include "tools/args/replay.inc"
+#include "tools/gadgets/obligation_checker.h"
+#include "tools/gadgets/telemetry.h"
+
+using namespace cpputil;
+using namespace std;
+using namespace std::chrono;
+using namespace stoke;
+
+namespace {
+
+uint64_t quantile(const vector<uint64_t>& sorted, double q) {
+  if (sorted.empty())
+    return 0;
+  size_t i = (size_t)(q * (sorted.size() - 1) + 0.5);
+  return sorted[min(i, sorted.size() - 1)];
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  CommandLineConfig::strict_with_convenience(argc, argv);
+  DebugHandler::install_sigsegv();
+  DebugHandler::install_sigill();
+  TelemetryGadget telemetry;
+
+  if (corpus_arg.value() == "")
+    Console::error(1) << "No corpus given; record one with --record_obligations." << endl;
+
+  vector<vector<ObligationChecker::Obligation>> corpus;
+  ifstream ifs(corpus_arg.value(), ios::binary);
+  if (!ifs.good())
+    Console::error(1) << "Unable to open corpus \"" << corpus_arg.value() << "\"" << endl;
+  if (!ObligationCorpus::read_all(ifs, corpus))
+    Console::error(1) << "Corpus is malformed after " << corpus.size() << " batches" << endl;
+
+  size_t obligations = 0;
+  for (const auto& batch : corpus)
+    obligations += batch.size();
+  if (obligations == 0)
+    Console::error(1) << "Corpus is empty" << endl;
+
+  ObligationCheckerGadget gadget;
+  ObligationChecker* checker = &gadget;
+  unique_ptr<ForkingObligationChecker> forking;
+  if (process_count_arg.value() > 1) {
+    vector<ObligationChecker*> children = { &gadget };
+    forking.reset(new ForkingObligationChecker(children, process_count_arg.value()));
+    checker = forking.get();
+  }
+
+  Console::msg() << "Replaying " << obligations << " obligations in " << corpus.size() << " batches "
+                 << replay_passes_arg.value() << " time(s)..." << endl;
+
+  // Only what the replay does goes in the report
+  Telemetry::reset();
+
+  size_t total = obligations * replay_passes_arg.value();
+  vector<uint64_t> starts(total, 0);
+  vector<uint64_t> latencies(total, 0);
+  size_t verified = 0;
+  size_t refuted = 0;
+  size_t errors = 0;
+
+  ObligationChecker::Callback callback = [&] (ObligationChecker::Result& result, void* optional) {
+    auto i = (size_t)optional;
+    latencies[i] = Telemetry::now() - starts[i];
+    if (result.has_error)
+      errors++;
+    else if (result.verified)
+      verified++;
+    else
+      refuted++;
+  };
+
+  const auto start = steady_clock::now();
+  size_t i = 0;
+  for (size_t pass = 0; pass < replay_passes_arg.value(); ++pass) {
+    for (const auto& batch : corpus) {
+      if (batch.empty())
+        continue;
+
+      // Replay each batch the way it was dispatched, so shared work is timed once
+      if (batch.size() == 1) {
+        const auto& o = batch[0];
+        starts[i] = Telemetry::now();
+        checker->check(o.target, o.rewrite, o.target_block, o.rewrite_block, o.P, o.Q,
+                       o.assume, o.prove, o.testcases, callback, o.separate_stack, (void*)i);
+        i++;
+        continue;
+      }
+
+      vector<shared_ptr<Invariant>> proves;
+      vector<void*> optionals;
+      const auto now = Telemetry::now();
+      for (const auto& o : batch) {
+        proves.push_back(o.prove);
+        optionals.push_back((void*)i);
+        starts[i++] = now;
+      }
+      const auto& o = batch[0];
+      checker->check_all(o.target, o.rewrite, o.target_block, o.rewrite_block, o.P, o.Q,
+                         o.assume, proves, o.testcases, callback, o.separate_stack, optionals);
+    }
+  }
+  checker->block_until_complete();
+  const auto dur = duration_cast<duration<double>>(steady_clock::now() - start);
+
+  auto sorted = latencies;
+  sort(sorted.begin(), sorted.end());
+  uint64_t sum = 0;
+  for (auto l : sorted)
+    sum += l;
+
+  ofstream ofs;
+  if (replay_report_arg.value() != "") {
+    ofs.open(replay_report_arg.value());
+    if (!ofs.good())
+      Console::error(1) << "Unable to write report to \"" << replay_report_arg.value() << "\"" << endl;
+  }
+  ostream& os = replay_report_arg.value() != "" ? ofs : Console::msg();
+
+  os << fixed;
+  os << "{" << endl;
+  os << "  \"corpus\": \"" << corpus_arg.value() << "\"," << endl;
+  os << "  \"obligation_checker\": \"" << obligation_checker_arg.value() << "\"," << endl;
+  os << "  \"solver\": \"";
+  SolverWriter()(os, solver_arg.value());
+  os << "\"," << endl;
+  os << "  \"alias_strategy\": \"" << alias_strategy_arg.value() << "\"," << endl;
+  os << "  \"process_count\": " << process_count_arg.value() << "," << endl;
+  os << "  \"obligations\": " << obligations << "," << endl;
+  os << "  \"batches\": " << corpus.size() << "," << endl;
+  os << "  \"passes\": " << replay_passes_arg.value() << "," << endl;
+  os << "  \"checks\": " << total << "," << endl;
+  os << "  \"verified\": " << verified << "," << endl;
+  os << "  \"refuted\": " << refuted << "," << endl;
+  os << "  \"errors\": " << errors << "," << endl;
+  os << "  \"runtime_s\": " << dur.count() << "," << endl;
+  os << "  \"throughput_per_s\": " << total / dur.count() << "," << endl;
+  os << "  \"latency_ns\": {"
+     << "\"mean\": " << sum / total
+     << ", \"min\": " << sorted.front()
+     << ", \"p50\": " << quantile(sorted, 0.5)
+     << ", \"p90\": " << quantile(sorted, 0.9)
+     << ", \"p99\": " << quantile(sorted, 0.99)
+     << ", \"max\": " << sorted.back()
+     << "}," << endl;
+  os << "  \"phases\": ";
+  Telemetry::snapshot().write_json(os);
+  os << "}" << endl;
+
+  return 0;
+}
@@ -70,6 +70,10 @@ int main(int argc, char** argv) {
 
   Console::msg() << "Correct: " << (res.first ? "yes" : "no") << endl;
   Console::msg() << "Cost: " << res.second << endl;
+  if (cost_function_arg.value().find("cycles") != string::npos) {
+    Console::msg() << "Cycles (median): " << fxn.get_cycles().get_median() << endl;
+    Console::msg() << "Cycles (IQR): " << fxn.get_cycles().get_iqr() << endl;
+  }
   Console::msg() << endl;
 
   return 0;
@@ -34,6 +34,7 @@
 #include "tools/gadgets/seed.h"
 #include "tools/gadgets/solver.h"
 #include "tools/gadgets/target.h"
+#include "tools/gadgets/telemetry.h"
 #include "tools/gadgets/testcases.h"
 #include "tools/gadgets/verifier.h"
 #include "tools/io/state_diff.h"
@@ -86,7 +87,7 @@ int main(int argc, char** argv) {
   CommandLineConfig::strict_with_convenience(argc, argv);
   DebugHandler::install_sigsegv();
   DebugHandler::install_sigill();
-
+  TelemetryGadget telemetry;
 
   FunctionsGadget aux_fxns;
   TargetGadget target(aux_fxns, false);
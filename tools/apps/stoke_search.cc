@@ -15,6 +15,7 @@
 #include <chrono>
 #include <iostream>
 #include <sys/time.h>
+#include <thread>
 
 #include "src/ext/cpputil/include/command_line/command_line.h"
 #include "src/ext/cpputil/include/io/column.h"
@@ -26,8 +27,10 @@
 #include "src/expr/expr.h"
 #include "src/expr/expr_parser.h"
 #include "src/tunit/tunit.h"
+#include "src/search/candidate_board.h"
 #include "src/search/progress_callback.h"
 #include "src/search/new_best_correct_callback.h"
+#include "src/search/refresh_callback.h"
 #include "src/search/statistics_callback.h"
 #include "src/search/failed_verification_action.h"
 #include "src/search/postprocessing.h"
@@ -45,6 +48,7 @@
 #include "tools/gadgets/seed.h"
 #include "tools/gadgets/solver.h"
 #include "tools/gadgets/target.h"
+#include "tools/gadgets/telemetry.h"
 #include "tools/gadgets/testcases.h"
 #include "tools/gadgets/transform_pools.h"
 #include "tools/gadgets/verifier.h"
@@ -110,6 +114,12 @@ auto& cycle_timeout_arg =
   .description("The timeout (as number of iterations) per cycle.  Can be a comma-separated list, where the first element is used for the first cycle, and so on.  Can also be an expression involving the variable 'i' that refers to the current cycle (starting at 1); expressions include integer constants, the variable 'i', and binary operators: +, -, *, /, ** (exponentiation), >>, << (shifts), ==, !=, <=, <, >, >= (comparisons), % (modulo), |, & (binary and/or).  The last expression in the list is used for all following cycles.")
   .default_val("10000, 10000, 10000, 10000, 10000, 2**i * 1000");
 
+auto& refresh_interval_arg =
+  cpputil::ValueArg<size_t>::create("refresh_interval")
+  .usage("<int>")
+  .description("Number of iterations between checks for counterexamples from the verifier, which runs concurrently with search (0 to never check)")
+  .default_val(1000);
+
 auto& postprocessing_arg =
   ValueArg<Postprocessing, PostprocessingReader, PostprocessingWriter>::create("postprocessing")
   .usage("(none|simple|full)")
@@ -302,18 +312,42 @@ void show_final_update(const StatisticsCallbackData& stats, SearchState& state,
   }
 }
 
+void save_result(const Cfg& res) {
+  // next name for result file
+  static int last_result_id = 0;
+  string name = "";
+  bool done = false;
+  do {
+    name = results_arg.value() + "/result-" + to_string(last_result_id) + ".s";
+    last_result_id += 1;
+    ifstream f(name.c_str());
+    done = !f.good();
+  } while (!done);
+
+  // write output
+  ofstream outfile;
+  outfile.open(name);
+  outfile << res.get_function();
+  outfile.close();
+}
+
+/** Search publishes its candidates here; verification happens on another thread. */
+struct Boards {
+  Boards() : cycles(1), results(1) { }
+
+  /** Best correct rewrites from the end of each cycle; the first one to verify ends search. */
+  CandidateBoard cycles;
+  /** Improved rewrites discovered during a cycle; these are only saved to --results. */
+  CandidateBoard results;
+};
+
 void new_best_correct_callback(const NewBestCorrectCallbackData& data, void* arg) {
 
   if (results_arg.has_been_provided()) {
-    Console::msg() << "Verifying improved rewrite..." << endl;
-
-    auto state = data.state;
-    auto data = (pair<VerifierGadget&, TargetGadget&>*)arg;
-    auto verifier = data->first;
-    auto target = data->second;
+    auto& boards = *((Boards*)arg);
 
     // perform the postprocessing
-    Cfg res(state.current);
+    Cfg res(data.state.current);
     if (postprocessing_arg == Postprocessing::FULL) {
       CfgTransforms::remove_redundant(res);
       CfgTransforms::remove_unreachable(res);
@@ -325,46 +359,88 @@ void new_best_correct_callback(const NewBestCorrectCallbackData& data, void* arg
       // Do nothing.
     }
 
-    // verify the new best correct rewrite
-    const auto verified = verifier.verify(target, res);
+    // hand it off to the verifier; this supersedes any improvement it hasn't gotten to yet
+    boards.results.publish(0, res, data.state.best_correct_cost);
+
+  } else {
+    cout << "No action on new best correct" << endl;
+
+  }
+
+}
+
+void verify_loop(Boards& boards, VerifierGadget& verifier, TargetGadget& target) {
+  while (!boards.cycles.is_closed()) {
+    // End-of-cycle candidates take priority; they're the ones that can end search
+    auto c = boards.cycles.take();
+    const auto from_cycle = c != nullptr;
+    if (!from_cycle) {
+      c = boards.results.take();
+    }
+    if (c == nullptr) {
+      this_thread::sleep_for(milliseconds(10));
+      continue;
+    }
+
+    const auto verified = verifier.verify(target, c->rewrite);
 
     if (verifier.has_error()) {
-      Console::msg() << "The verifier encountered an error: " << verifier.error() << endl << endl;
+      Console::msg() << "The verifier encountered an error:" << endl;
+      Console::msg() << verifier.error() << endl;
     }
 
-    // save to file if verified
     if (verified) {
-      Console::msg() << "Verified!  Saving result..." << endl << endl;
-      // next name for result file
-      string name = "";
-      bool done = false;
-      do {
-        name = results_arg.value() + "/result-" + to_string(state.last_result_id) + ".s";
-        state.last_result_id += 1;
-        ifstream f(name.c_str());
-        done = !f.good();
-      } while (!done);
-
-      // write output
-      ofstream outfile;
-      outfile.open(name);
-      outfile << res.get_function();
-      outfile.close();
-    } else {
-      Console::msg() << "Verification failed."  << endl << endl;
-      if (verifier.counter_examples_available()) {
-        Console::msg() << "Counterexample: " << endl;
-        for (auto it : verifier.get_counter_examples()) {
-          Console::msg() << it << endl;
-        }
+      if (results_arg.has_been_provided()) {
+        save_result(c->rewrite);
+      }
+      if (from_cycle) {
+        boards.cycles.set_verified(*c);
+      }
+    } else if (from_cycle) {
+      Console::msg() << "Unable to verify new rewrite..." << endl << endl;
+      if (verifier.counter_examples_available() && failed_verification_action.value() == FailedVerificationAction::ADD_COUNTEREXAMPLE) {
+        boards.cycles.add_counterexample(verifier.get_counter_examples()[0]);
       }
     }
 
-  } else {
-    cout << "No action on new best correct" << endl;
+    (from_cycle ? boards.cycles : boards.results).finish(c);
+  }
+}
 
+/** Adds any new counterexamples from the verifier to the training set.  Returns true if there were any. */
+bool add_counterexamples(CandidateBoard& board, Sandbox& training_sb) {
+  vector<CpuState> cexs;
+  if (board.drain_counterexamples(0, cexs) == 0) {
+    return false;
   }
+  for (const auto& cex : cexs) {
+    Console::msg() << "Adding new testcase (counterexample from verifier):" << endl << endl;
+    Console::msg() << cex << endl << endl;
+    training_sb.insert_input(cex);
+  }
+  return true;
+}
+
+struct RefreshArg {
+  CandidateBoard* board;
+  Sandbox* training_sb;
+  CostFunctionGadget* fxn;
+  Search* search;
+};
+
+bool refresh_callback(const RefreshCallbackData& data, void* arg) {
+  auto& ra = *((RefreshArg*)arg);
 
+  // There's nothing left to find if the verifier has already accepted a rewrite
+  if (ra.board->get_verified() != nullptr) {
+    ra.search->stop();
+    return false;
+  }
+  if (!add_counterexamples(*ra.board, *ra.training_sb)) {
+    return false;
+  }
+  ra.fxn->refresh();
+  return true;
 }
 
 vector<string>& split(string& s, const string& delim, vector<string>& result) {
@@ -384,6 +460,7 @@ int main(int argc, char** argv) {
   CommandLineConfig::strict_with_convenience(argc, argv);
   DebugHandler::install_sigsegv();
   DebugHandler::install_sigill();
+  TelemetryGadget telemetry;
 
   // create results dir if necessary
   if (results_arg.has_been_provided()) {
@@ -420,8 +497,19 @@ int main(int argc, char** argv) {
   if (!no_progress_update_arg.value()) {
     search.set_progress_callback(pcb, &Console::msg());
   }
-  auto nbcc_data = pair<VerifierGadget&, TargetGadget&>(verifier, target);
-  search.set_new_best_correct_callback(new_best_correct_callback, &nbcc_data);
+  Boards boards;
+  search.set_new_best_correct_callback(new_best_correct_callback, &boards);
+
+  // Verification runs alongside search rather than in between cycles
+  thread verifier_thread(verify_loop, ref(boards), ref(verifier), ref(target));
+  // Used on the way out; the verifier works with locals of this function, so
+  // it has to finish whatever it's verifying before they go away
+  const auto stop_verifier = [&boards, &verifier_thread]() {
+    boards.cycles.close();
+    verifier_thread.join();
+  };
+
+  RefreshArg refresh_arg {&boards.cycles, &training_sb, nullptr, &search};
 
   size_t total_iterations = 0;
   size_t total_restarts = 0;
@@ -446,7 +534,10 @@ int main(int argc, char** argv) {
   string final_msg;
   SearchStateGadget state(target, aux_fxns);
   for (size_t i = 0; ; ++i) {
+    add_counterexamples(boards.cycles, training_sb);
     CostFunctionGadget fxn(target, &training_sb, &perf_sb);
+    refresh_arg.fxn = &fxn;
+    search.set_refresh_callback(refresh_callback, &refresh_arg, refresh_interval_arg.value());
 
     // determine iteration timeout
     Expr<size_t>* timeout_expr = i >= cycle_timeouts.size() ? cycle_timeouts[cycle_timeouts.size()-1] : cycle_timeouts[i];
@@ -463,6 +554,7 @@ int main(int argc, char** argv) {
     if (timeout_seconds_arg.value() != 0) {
       auto time_remaining = duration_cast<duration<double>>(steady_clock::now() - start) + duration<double>(timeout_seconds_arg.value());
       if (time_remaining <= steady_clock::duration::zero()) {
+        stop_verifier();
         show_final_update(search.get_statistics(), state, total_restarts, total_iterations, start, search_elapsed, false, true);
         Console::error(1) << "Search terminated unsuccessfully; unable to discover a new rewrite!" << endl;
       }
@@ -493,25 +585,34 @@ int main(int argc, char** argv) {
     total_iterations += search.get_statistics().iterations;
     total_restarts++;
 
-    if (state.interrupted) {
+    // The refresh callback stops search early once the verifier accepts a rewrite
+    if (state.interrupted && boards.cycles.get_verified() == nullptr) {
+      stop_verifier();
       Console::msg() << endl;
       show_final_update(search.get_statistics(), state, total_restarts, total_iterations, start, search_elapsed, false, false);
       Console::msg() << "Search interrupted!" << endl;
       exit(1);
     }
 
-    const auto verified = verifier.verify(target, state.best_correct);
+    // Hand the result to the verifier and move straight on to the next cycle
+    if (state.success && boards.cycles.get_verified() == nullptr) {
+      boards.cycles.publish(0, state.best_correct, state.best_correct_cost);
+    }
 
-    if (verifier.has_error()) {
-      Console::msg() << "The verifier encountered an error:" << endl;
-      Console::msg() << verifier.error() << endl;
+    // If search is out of budget, all that's left to do is wait for pending verifications
+    const auto out_of_budget = timeout_iterations_arg.value() && total_iterations >= timeout_iterations_arg.value();
+    if (out_of_budget) {
+      while (boards.cycles.pending() > 0 && boards.cycles.get_verified() == nullptr) {
+        this_thread::sleep_for(milliseconds(10));
+      }
     }
 
-    if (!state.success) {
-      Console::msg() << "Unable to discover a new correct rewrite before timing out... " << endl << endl;
-    } else if (!verified) {
-      Console::msg() << "Unable to verify new rewrite..." << endl << endl;
-    } else {
+    const auto verified = boards.cycles.get_verified();
+    if (verified != nullptr) {
+      state.best_correct = verified->rewrite;
+      state.best_correct_cost = verified->cost;
+      state.success = true;
+      state.interrupted = false;
       if (strategy_arg.value() == "none") {
         final_msg = "Search terminated successfully (but no verification was performed)!";
       } else {
@@ -520,23 +621,26 @@ int main(int argc, char** argv) {
       break;
     }
 
+    if (!state.success) {
+      Console::msg() << "Unable to discover a new correct rewrite before timing out... " << endl << endl;
+    }
+
     sep(Console::msg());
 
 
-    if (timeout_iterations_arg.value() && total_iterations >= timeout_iterations_arg.value()) {
-      show_final_update(search.get_statistics(), state, total_restarts, total_iterations, start, search_elapsed, verified, true);
+    if (out_of_budget) {
+      stop_verifier();
+      show_final_update(search.get_statistics(), state, total_restarts, total_iterations, start, search_elapsed, false, true);
       Console::error(1) << "Search terminated unsuccessfully; unable to discover a new rewrite!" << endl;
     }
 
-    if (!verified && verifier.counter_examples_available() && failed_verification_action.value() == FailedVerificationAction::ADD_COUNTEREXAMPLE) {
-      Console::msg() << "Restarting search using new testcase (counterexample from verifier):" << endl << endl;
-      Console::msg() << verifier.get_counter_examples()[0] << endl << endl;
-      training_sb.insert_input(verifier.get_counter_examples()[0]);
-    } else {
-      Console::msg() << "Restarting search" << endl;
-    }
+    Console::msg() << "Restarting search" << endl;
   }
 
+  // The verifier has at most one candidate in hand at this point
+  boards.cycles.close();
+  verifier_thread.join();
+
   if (postprocessing_arg == Postprocessing::FULL) {
     CfgTransforms::remove_redundant(state.best_correct);
     CfgTransforms::remove_unreachable(state.best_correct);
@@ -12,7 +12,10 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <deque>
 #include <iostream>
+#include <memory>
+#include <thread>
 
 #include "src/cfg/cfg.h"
 #include "src/cfg/paths.h"
@@ -73,6 +76,14 @@ auto& stop_at = ValueArg<size_t>::create("max_tcs")
 auto& randomize_order_arg = FlagArg::create("randomize_order")
                             .description("Output test cases in random order");
 
+auto& threads_arg = ValueArg<size_t>::create("threads")
+                    .usage("<int>")
+                    .description("Number of threads used to generate mutants (0 for one per core)")
+                    .default_val(0);
+
+auto& no_concolic_arg = FlagArg::create("no_concolic")
+                        .description("Query the solver for every path, shortest first, without following the paths testcases take");
+
 typedef struct {
   unsigned long size,resident,share,text,lib,data,dt;
 } statm_t;
@@ -115,15 +126,16 @@ vector<Memory*> get_segments(CpuState& cs) {
   return segments;
 }
 
-/** Make sure that a testcase is valid for the program */
-bool check_testcase(CpuState cs, Sandbox& sb) {
+/** Make sure that a testcase is valid for the program; on failure, the
+  output state is copied into bad_output if it's given. */
+bool check_testcase(const CpuState& cs, Sandbox& sb, CpuState* bad_output = NULL) {
 
   sb.clear_inputs();
   sb.insert_input(cs);
   sb.run(0);
   auto code = sb.get_output(0)->code;
-  if (code != ErrorCode::NORMAL) {
-    debug_bad_output = *sb.get_output(0);
+  if (code != ErrorCode::NORMAL && bad_output) {
+    *bad_output = *sb.get_output(0);
   }
 
   return code == ErrorCode::NORMAL;
@@ -167,6 +179,156 @@ CpuState mutate(CpuState cs, size_t iterations,
   return cs;
 }
 
+/** Make mutants_arg mutants of a testcase, spread over one thread per
+  sandbox.  Each mutant gets its own generator, seeded in order from gen, so
+  the results don't depend on how many threads there are. */
+vector<CpuState> make_mutants(const CpuState& tc, vector<unique_ptr<Sandbox>>& sandboxes,
+                              default_random_engine& gen) {
+
+  const auto n = mutants_arg.value();
+  vector<default_random_engine::result_type> seeds;
+  for (size_t i = 0; i < n; ++i) {
+    seeds.push_back(gen());
+  }
+
+  vector<CpuState> mutants(n);
+  auto work = [&](size_t t) {
+    for (size_t i = t; i < n; i += sandboxes.size()) {
+      default_random_engine local(seeds[i]);
+      mutants[i] = mutate(tc, iterations_arg.value(), *sandboxes[t], local);
+    }
+  };
+
+  vector<thread> workers;
+  for (size_t t = 1; t < sandboxes.size() && t < n; ++t) {
+    workers.emplace_back(work, t);
+  }
+  work(0);
+  for (auto& w : workers) {
+    w.join();
+  }
+
+  return mutants;
+}
+
+/** Chooses which path to ask the solver about next, concolically.  Every
+  testcase is run to record the path it takes.  At each branch along that
+  path, the shortest enumerated path that agrees with it up to the branch and
+  then goes the other way is queued, so the solver is asked to negate one
+  branch condition at a time.  Paths that a testcase already took are never
+  queried; once the queue runs dry, the remaining paths go shortest first. */
+class PathFrontier {
+public:
+  PathFrontier(const Cfg& target, const Sandbox& sb, const vector<CfgPath>& paths) :
+    target_(target), paths_(paths), done_(paths.size(), false), num_covered_(0) {
+
+    // The same settings CfgPaths uses for its own sandbox; testcases only
+    // need to run far enough to show which way they branch
+    auto learner_sb = new Sandbox(sb);
+    learner_sb->set_abi_check(false);
+    learner_sb->set_max_jumps(4096);
+    learner_.set_sandbox(learner_sb);
+
+    for (const auto& p : paths_) {
+      blocks_.push_back(strip_empty(p));
+    }
+  }
+
+  /** Run a testcase, mark the path it takes as covered, and queue the
+    negation of each branch along it. */
+  void learn(const CpuState& tc) {
+    CfgPath trace;
+    if (!learner_.learn_path(trace, target_, tc)) {
+      return;
+    }
+    trace = strip_empty(trace);
+
+    // negated[k] is set once some path leaving the trace after k blocks is queued
+    vector<bool> negated(trace.size() + 1, false);
+    for (size_t i = 0, ie = paths_.size(); i < ie; ++i) {
+      if (done_[i]) {
+        continue;
+      }
+      const auto& p = blocks_[i];
+      if (p == trace) {
+        done_[i] = true;
+        num_covered_++;
+        continue;
+      }
+
+      size_t k = 0;
+      while (k < p.size() && k < trace.size() && p[k] == trace[k]) {
+        k++;
+      }
+      if (!negated[k]) {
+        negated[k] = true;
+        queue_.push_back(i);
+      }
+    }
+  }
+
+  /** Get the next path to query; returns false once every path is done. */
+  bool next(CfgPath& p) {
+    while (!queue_.empty()) {
+      const auto i = queue_.front();
+      queue_.pop_front();
+      if (!done_[i]) {
+        return take(i, p);
+      }
+    }
+    for (size_t i = 0, ie = paths_.size(); i < ie; ++i) {
+      if (!done_[i]) {
+        return take(i, p);
+      }
+    }
+    return false;
+  }
+
+  /** Returns the number of paths skipped because a testcase took them. */
+  size_t num_covered() const {
+    return num_covered_;
+  }
+
+private:
+  const Cfg& target_;
+  CfgPaths learner_;
+
+  /** The enumerated paths, shortest first. */
+  vector<CfgPath> paths_;
+  /** The same paths without empty blocks, as traces record them. */
+  vector<CfgPath> blocks_;
+  /** Has each path been queried or covered? */
+  vector<bool> done_;
+  /** Paths that negate a branch of some trace, to query before the rest. */
+  deque<size_t> queue_;
+  size_t num_covered_;
+
+  bool take(size_t i, CfgPath& p) {
+    done_[i] = true;
+    p = paths_[i];
+    return true;
+  }
+
+  /** Traces only record blocks with instructions in them. */
+  CfgPath strip_empty(const CfgPath& p) const {
+    CfgPath res;
+    for (auto b : p) {
+      if (target_.num_instrs(b)) {
+        res.push_back(b);
+      }
+    }
+    return res;
+  }
+};
+
+/** Add a testcase to the output, and let the frontier see its path. */
+void emit(vector<CpuState>& outputs, const CpuState& tc, PathFrontier* frontier) {
+  outputs.push_back(tc);
+  if (frontier) {
+    frontier->learn(tc);
+  }
+}
+
 void make_tc_different_memory(
   SmtObligationChecker& checker,
   const Cfg& target,
@@ -174,7 +336,8 @@ void make_tc_different_memory(
   vector<CpuState>& outputs, CpuState tc,
   CfgPath p,
   CfgPath rewrite_path,
-  Sandbox& sb,
+  vector<unique_ptr<Sandbox>>& sandboxes,
+  PathFrontier* frontier,
   default_random_engine& gen) {
 // Now, lets find another testcase that touches *different* memory.
   ComboHandler handler;
@@ -209,15 +372,14 @@ void make_tc_different_memory(
     if (result.has_ceg) {
       auto tc2 = result.target_ceg;
 
-      if (!check_testcase(tc2, sb)) {
+      if (!check_testcase(tc2, *sandboxes[0])) {
         cerr << "Warning: skipping over invalid testcase." << endl;
         return;
       }
 
-      outputs.push_back(tc2);
-      for (size_t i = 0; i < mutants_arg.value(); ++i) {
-        auto mutated = mutate(tc2, iterations_arg.value(), sb, gen);
-        outputs.push_back(mutated);
+      emit(outputs, tc2, frontier);
+      for (auto& mutated : make_mutants(tc2, sandboxes, gen)) {
+        emit(outputs, mutated, frontier);
       }
     }
   }
@@ -264,6 +426,16 @@ int main(int argc, char** argv) {
   default_random_engine gen;
   gen.seed((default_random_engine::result_type)seed);
 
+  // One sandbox per thread for mutants; the first is the one used everywhere else
+  size_t threads = threads_arg.value();
+  if (threads == 0) {
+    threads = max(thread::hardware_concurrency(), 1u);
+  }
+  vector<unique_ptr<Sandbox>> sandboxes;
+  for (size_t i = 0; i < threads; ++i) {
+    sandboxes.emplace_back(new Sandbox(sb));
+  }
+
   SolverGadget solver;
   ComboHandler handler;
   DefaultFilter filter(handler);
@@ -276,7 +448,7 @@ int main(int argc, char** argv) {
   vector<CfgPath> paths;
   paths = CfgPaths::enumerate_paths(target, bound_arg.value());
 
-  // Handle the shorter paths first
+  // Handle the shorter paths first, unless a testcase leads elsewhere
   auto by_length = [](const CfgPath& lhs, const CfgPath& rhs) {
     return lhs.size() < rhs.size();
   };
@@ -302,8 +474,13 @@ int main(int argc, char** argv) {
 
   size_t found = 0;
 
+  // Without learning, the frontier just hands out paths shortest first
+  PathFrontier frontier(target, sb, paths);
+  PathFrontier* learning = no_concolic_arg.value() ? NULL : &frontier;
+
   CpuStates outputs;
-  for (auto p : paths) {
+  CfgPath p;
+  while (frontier.next(p)) {
 
     cout << "Working on path " << p << endl;
     DEBUG(cout << "Output argument: " << output_arg.value() << endl;)
@@ -324,7 +501,7 @@ int main(int argc, char** argv) {
     if (result.has_ceg) {
       auto tc = result.target_ceg;
 
-      if (!check_testcase(tc, sb)) {
+      if (!check_testcase(tc, *sandboxes[0], &debug_bad_output)) {
         cerr << "Warning: skipping over invalid (original) testcase" << endl;
         cerr << tc << endl;
         cerr << "Output state" << endl;
@@ -332,19 +509,18 @@ int main(int argc, char** argv) {
         continue;
       }
 
-      outputs.push_back(tc);
+      emit(outputs, tc, learning);
       if (debug_arg.value()) {
         cerr << " * Found testcase" << endl;
       }
 
       /** Change some register values. */
-      for (size_t i = 0; i < mutants_arg.value(); ++i) {
-        auto mutated = mutate(tc, iterations_arg.value(), sb, gen);
-        outputs.push_back(mutated);
+      for (auto& mutated : make_mutants(tc, sandboxes, gen)) {
+        emit(outputs, mutated, learning);
       }
 
       /** Use SMT Solver to make yet another testcase with different memory. */
-      make_tc_different_memory(checker, target, rewrite, outputs, tc, p, rewrite_path, sb, gen);
+      make_tc_different_memory(checker, target, rewrite, outputs, tc, p, rewrite_path, sandboxes, learning, gen);
 
     } else {
       if (debug_arg.value())
@@ -352,6 +528,9 @@ int main(int argc, char** argv) {
     }
   }
 
+  if (debug_arg.value())
+    cerr << "Paths skipped because a testcase already took them: " << frontier.num_covered() << endl;
+
   // Go through final testcases and mark memory locations in the same cache line
   // (e.g. 16-byte chunk) as valid.
   for (auto& tc : outputs) {
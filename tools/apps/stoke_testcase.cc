@@ -17,6 +17,7 @@
 #include <iostream>
 #include <random>
 #include <string>
+#include <thread>
 #include <vector>
 #include <sstream>
 
@@ -113,6 +114,12 @@ auto& register_max_arg = ValueArg<string>::create("register_max")
 auto& register_mask_arg = ValueArg<string>::create("register_mask")
                           .usage("<string>")
                           .description("Set mask values for registers.  E.g. \"rax=0x10,rdx=0x20\"");
+auto& threads_arg = ValueArg<size_t>::create("threads")
+                    .usage("<int>")
+                    .description("Number of threads to generate testcases on (0 for one per core)")
+                    .default_val(1);
+auto& no_static_layout_arg = FlagArg::create("no_static_layout")
+                             .description("Only allocate memory for accesses after they fault in the sandbox");
 
 
 
@@ -229,6 +236,7 @@ int auto_gen() {
   sg.set_max_attempts(max_attempts.value())
   .set_max_memory(max_stack.value())
   .set_allow_unaligned(allow_unaligned_arg)
+  .set_static_layout(!no_static_layout_arg.value())
   .set_seed(seed);
 
 
@@ -249,13 +257,12 @@ int auto_gen() {
 
 
   // generate testcases
-  CpuStates tcs;
-  for (size_t i = 0, ie = max_tc.value(); i < ie; ++i) {
-    CpuState tc;
-    if (sg.get(tc, target)) {
-      tcs.push_back(tc);
-    }
+  size_t threads = threads_arg.value();
+  if (threads == 0) {
+    threads = max(thread::hardware_concurrency(), 1u);
   }
+  CpuStates tcs;
+  sg.get(tcs, max_tc.value(), target, threads);
 
   if (tcs.empty()) {
     Console::warn() << "Last reported error from StateGen: " << endl;
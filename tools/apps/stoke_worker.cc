@@ -106,11 +106,32 @@ struct ObligationQueueEntry {
   char solver[8];
   char strategy[8];
   char text[1024*1024*10]; // 10 megabytes
+  size_t text_size;
 
   bool operator==(const ObligationQueueEntry& other) {
     return id == other.id;
   }
 
+  /** Copy the problem out of a row with problem and payload columns; newer
+    obligations only have the binary payload.  Returns false if the problem
+    doesn't fit. */
+  template <typename Row>
+  bool set_problem(const Row& row) {
+    if (!row["payload"].is_null()) {
+      binarystring payload(row["payload"]);
+      if (payload.size() > sizeof(text)) {
+        text_size = 0;
+        return false;
+      }
+      text_size = payload.size();
+      memcpy(text, payload.data(), text_size);
+    } else {
+      strncpy(text, row["problem"].c_str(), sizeof(text)-1);
+      text_size = strlen(text);
+    }
+    return true;
+  }
+
   static string queue_tablename() {
     return "ProofObligationQueue";
   }
@@ -123,6 +144,7 @@ struct ObligationQueueEntry {
     solver[sizeof(solver)-1] = '\0';
     strategy[sizeof(strategy)-1] = '\0';
     text[sizeof(text)-1] = '\0';
+    text_size = 0;
   }
 
 };
@@ -363,8 +385,11 @@ string generate_random_hash(default_random_engine& gen) {
   return hash;
 }
 
+void report_timeout(connection& c, ObligationQueueEntry& qe, uint64_t time_taken_s, string error = "TIMEOUT");
+
 /** Pick one or more jobs from the database whose expiration is NULL or passed.
-  Fetch problem text while we're at it.
+  Jobs are taken in order of priority, and then by how quickly their solver
+  and strategy are predicted to finish.  Fetch problem text while we're at it.
   Will return immediately if none are available */
 size_t select_job(connection& c, vector<ObligationQueueEntry*>& output, size_t max) {
   cout << "Entry" << endl;
@@ -372,29 +397,18 @@ size_t select_job(connection& c, vector<ObligationQueueEntry*>& output, size_t m
   size_t count = 0;
   uint64_t id;
 
-  nontransaction count_tx(c);
-  auto r = count_tx.exec("select count(*) from proofobligationqueue");
-  count_tx.commit();
-  double total_rows = r[0][0].as<double>();
-  if (total_rows == 0)
-    return 0;
-
-  double ratio = 1.1*100*(double)max/(double)total_rows;
-  if (ratio > 100)
-    ratio = 100;
-  if (ratio < 0.001)
-    ratio = 0.001;
-
   work tx_pick(c);
 
+  // Rows another worker is in the middle of claiming are skipped rather than waited on
   stringstream sql;
   sql << "WITH tmp AS ("
-      << "  SELECT id FROM ProofObligationQueue TABLESAMPLE BERNOULLI("
-      <<      std::fixed << std::setprecision(5) << ratio << ")"
+      << "  SELECT id FROM ProofObligationQueue "
       << "  WHERE ("
       << "    expiration IS NULL "
       << "    OR expiration < NOW()) "
+      << "  ORDER BY priority DESC, predicted_time ASC, id ASC "
       << "  LIMIT " << max
+      << "  FOR UPDATE SKIP LOCKED"
       << ") "
       << "UPDATE ProofObligationQueue SET "
       << "  expiration = NOW() + interval '10 seconds', "
@@ -403,7 +417,9 @@ size_t select_job(connection& c, vector<ObligationQueueEntry*>& output, size_t m
       << "WHERE tmp.id = ProofObligationQueue.id "
       << "RETURNING *, "
       << "  (SELECT problem FROM ProofObligation "
-      << "   WHERE ProofObligation.hash = ProofObligationQueue.hash) as problem";
+      << "   WHERE ProofObligation.hash = ProofObligationQueue.hash) as problem, "
+      << "  (SELECT payload FROM ProofObligation "
+      << "   WHERE ProofObligation.hash = ProofObligationQueue.hash) as payload";
 
   string sql_str = sql.str();
   try {
@@ -430,7 +446,12 @@ size_t select_job(connection& c, vector<ObligationQueueEntry*>& output, size_t m
         strncpy(qe->hash, row["hash"].c_str(), sizeof(qe->hash)-1);
         strncpy(qe->solver, row["solver"].c_str(), sizeof(qe->solver)-1);
         strncpy(qe->strategy, row["strategy"].c_str(), sizeof(qe->strategy)-1);
-        strncpy(qe->text, row["problem"].c_str(), sizeof(qe->text)-1);
+        if (!qe->set_problem(row)) {
+          cout << "Problem with hash " << qe->hash << " is too big for the queue; dropping it." << endl;
+          report_timeout(c, *qe, 0, "PROBLEM TOO LARGE");
+          delete qe;
+          continue;
+        }
 
         count++;
         output.push_back(qe);
@@ -451,7 +472,7 @@ size_t select_job(connection& c, vector<ObligationQueueEntry*>& output, size_t m
 
 
 
-void report_timeout(connection& c, ObligationQueueEntry& qe, uint64_t time_taken_s, string error = "TIMEOUT") {
+void report_timeout(connection& c, ObligationQueueEntry& qe, uint64_t time_taken_s, string error) {
 
   nontransaction tx(c);
   std::stringstream sql_add_result;
@@ -474,6 +495,9 @@ void report_timeout(connection& c, ObligationQueueEntry& qe, uint64_t time_taken
   stringstream sql_remove;
   sql_remove << "DELETE FROM ProofObligationQueue WHERE id=" << qe.id;
   tx.exec(sql_remove.str().c_str());
+
+  // Let whoever is waiting on this hash know
+  tx.exec("NOTIFY stoke_result, '" + tx.esc(qe.hash) + "'");
   tx.commit();
 
 }
@@ -529,25 +553,36 @@ void report_result(connection& c, ObligationQueueEntry& qe, ObligationChecker::R
   stringstream sql_remove;
   sql_remove << "DELETE FROM ProofObligationQueue WHERE id=" << qe.id;
   tx.exec(sql_remove.str().c_str());
+
+  // Let whoever is waiting on this hash know
+  tx.exec("NOTIFY stoke_result, '" + tx.esc(qe.hash) + "'");
   tx.commit();
 
 }
 
 void discharge_problem(const ObligationQueueEntry& qe, ObligationChecker::Callback& callback, bool debug_problem = false) {
 
-  if (verbose_arg.value()) {
-    cout << "Problem text is: " << endl << qe.text << endl << endl;
-  }
-
   // Parse the problem
-  stringstream ss(qe.text);
   ObligationChecker::Obligation oblig;
-  oblig.read_text(ss);
-  if (ss.bad() || ss.fail()) {
-    cout << __FILE__ << ":" << __LINE__
-         << ": stringstream in bad state when parsing problem with hash "
-         << qe.hash << endl;
-    exit(1);
+  if (ObligationChecker::Obligation::is_bin(qe.text, qe.text_size)) {
+    if (!oblig.read_bin(qe.text, qe.text_size)) {
+      cout << __FILE__ << ":" << __LINE__
+           << ": unable to decode problem with hash " << qe.hash << endl;
+      exit(1);
+    }
+  } else {
+    stringstream ss(string(qe.text, qe.text_size));
+    oblig.read_text(ss);
+    if (ss.bad() || ss.fail()) {
+      cout << __FILE__ << ":" << __LINE__
+           << ": stringstream in bad state when parsing problem with hash "
+           << qe.hash << endl;
+      exit(1);
+    }
+  }
+
+  if (verbose_arg.value()) {
+    cout << "Problem text is: " << endl << oblig << endl << endl;
   }
 
   cout << "Testcases in obligation: " << oblig.testcases.size() << endl;
@@ -753,15 +788,23 @@ ConditionQueue<T>* make_queue(size_t n, string name) {
   return new (buffer) ConditionQueue<T>(n, name);
 }
 
+/** Listens for announcements of newly queued jobs; waking up is all that matters. */
+class JobReceiver : public notification_receiver {
+public:
+  JobReceiver(connection_base& c) : notification_receiver(c, "stoke_job") { }
+
+  void operator()(const string& payload, int backend_pid) override { }
+};
+
 template <typename T>
 pid_t spawn_producer(ConditionQueue<T>& queue) {
 
-  int sleep_time = 1;
   pid_t pid = fork();
   if (!pid) {
     vector<T*> entries;
     entries.reserve(queue.space());
     connection c(postgres_arg.value());
+    JobReceiver receiver(c);
 
     size_t count = 0;
     while (true) {
@@ -776,9 +819,10 @@ pid_t spawn_producer(ConditionQueue<T>& queue) {
       }
 
       cout << getpid() << ": " << queue.get_name() << ": we have " << space << " much space.. querying."  << endl;
+      // Drop announcements that this query is about to account for
+      c.get_notifs();
       size_t n = select_job(c, entries, space);
       if (n > 0) {
-        sleep_time = 1;
         cout << getpid() << ": adding " << n << " jobs to queue." << endl;
         queue.insert_jobs(entries);
         for (auto it : entries)
@@ -786,10 +830,10 @@ pid_t spawn_producer(ConditionQueue<T>& queue) {
         entries.clear();
       } else {
         cout << getpid() << ": no jobs in database ready." << endl;
+        // Wait for new jobs; wake up at least as often as leases expire, since
+        // abandoned jobs become available again without any announcement
+        c.await_notification(10, 0);
       }
-      sleep(sleep_time);
-      if (sleep_time < 128)
-        sleep_time *= 2;
     }
   }
 
@@ -890,7 +934,7 @@ bool debug_hash_obligation(string hash) {
   work tx(c);
 
   stringstream sql;
-  sql << "SELECT hash, problem FROM ProofObligation WHERE hash='" << tx.esc(hash) << "'";
+  sql << "SELECT hash, problem, payload FROM ProofObligation WHERE hash='" << tx.esc(hash) << "'";
 
   result r = tx.exec(sql.str().c_str());
   tx.commit();
@@ -908,7 +952,11 @@ bool debug_hash_obligation(string hash) {
   for (auto row : r) {
     qe->id = 0;
     strncpy(qe->hash, row["hash"].c_str(), sizeof(qe->hash)-1);
-    strncpy(qe->text, row["problem"].c_str(), sizeof(qe->text)-1);
+    if (!qe->set_problem(row)) {
+      cout << "Problem with hash " << hash << " is too big to load." << endl;
+      delete qe;
+      return false;
+    }
   }
 
   /** Do some parsing */
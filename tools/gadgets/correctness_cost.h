@@ -35,6 +35,7 @@ public:
     set_penalty(misalign_penalty_arg, sig_penalty_arg);
     set_min_ulp(min_ulp_arg);
     set_reduction(reduction_arg);
+    set_fused(fused_correctness_arg);
   }
 };
 
@@ -25,14 +25,34 @@
 #include "src/cost/nongoal.h"
 #include "tools/args/cost.inc"
 #include "tools/gadgets/correctness_cost.h"
+#include "tools/gadgets/cycles_cost.h"
 #include "tools/gadgets/latency_cost.h"
 #include "tools/gadgets/nongoal_cost.h"
+#include "tools/gadgets/pipeline_cost.h"
 
 namespace stoke {
 
 class CostFunctionGadget : public CostFunction {
 public:
-  CostFunctionGadget(const Cfg& target, Sandbox* test_sb, Sandbox* perf_sb) : CostFunction(), fxn_(build_fxn(target, test_sb, perf_sb)) {
+  CostFunctionGadget(const Cfg& target, Sandbox* test_sb, Sandbox* perf_sb) : CostFunction(),
+    target_(target), test_sb_(test_sb), perf_sb_(perf_sb),
+    cycles_(new CyclesCostGadget()) {
+    fxn_ = build_fxn();
+  }
+  CostFunctionGadget(const CostFunctionGadget&) = delete;
+  CostFunctionGadget& operator=(const CostFunctionGadget&) = delete;
+
+  ~CostFunctionGadget() {
+    clear();
+    delete cycles_;
+  }
+
+  /** Rebuilds the cost function from the current contents of the sandboxes.
+    Call this after adding testcases so that the target's outputs are recomputed. */
+  CostFunctionGadget& refresh() {
+    clear();
+    fxn_ = build_fxn();
+    return *this;
   }
 
   result_type operator()(const Cfg& cfg, Cost max) {
@@ -43,23 +63,69 @@ public:
     return (*fxn_)(cfg);
   }
 
+  /** Search orders and limits testcases through these; they all belong to fxn_. */
+  bool fuses_test_sandbox() {
+    return fxn_->fuses_test_sandbox();
+  }
+  size_t num_testcases() const {
+    return fxn_->num_testcases();
+  }
+  CostFunctionGadget& set_testcase_order(const std::vector<size_t>& order) {
+    fxn_->set_testcase_order(order);
+    return *this;
+  }
+  CostFunctionGadget& set_testcase_limit(size_t n) {
+    fxn_->set_testcase_limit(n);
+    return *this;
+  }
+  long get_failing_testcase() const {
+    return fxn_->get_failing_testcase();
+  }
+
+  /** Returns the "cycles" term, for reporting its statistics. */
+  const CyclesCost& get_cycles() const {
+    return *cycles_;
+  }
+
 private:
 
+  Cfg target_;
+  Sandbox* test_sb_;
+  Sandbox* perf_sb_;
+
+  /** Kept across rebuilds so that its statistics cover the whole run. */
+  CyclesCost* cycles_;
   CostFunction* fxn_;
+  /** Everything the last build allocated: the leaves and both expression trees. */
+  std::vector<CostFunction*> owned_;
 
-  static CostFunction* build_fxn(const Cfg& target, Sandbox* test_sb, Sandbox* perf_sb) {
+  void clear() {
+    for (auto f : owned_) {
+      delete f;
+    }
+    owned_.clear();
+    fxn_ = NULL;
+  }
+
+  CostFunction* build_fxn() {
 
     CostParser::SymbolTable st;
     st["binsize"] =      new BinSizeCost();
-    st["correctness"] =  new CorrectnessCostGadget(target, test_sb);
+    st["correctness"] =  new CorrectnessCostGadget(target_, test_sb_);
     st["latency"] =      new LatencyCostGadget();
     st["measured"] =     new MeasuredCost();
+    st["pipeline"] =     new PipelineCostGadget();
     st["size"] =         new SizeCost();
     st["sseavx"] =       new SseAvxCost();
-    st["nongoal"] =      new NonGoalCostGadget(target);
+    st["nongoal"] =      new NonGoalCostGadget(target_);
+    for (const auto& it : st) {
+      owned_.push_back(it.second);
+    }
+    st["cycles"] =       cycles_;
 
     CostParser cost_p(cost_function_arg.value(), st);
     auto cost_fxn = cost_p.run();
+    owned_.push_back(cost_fxn);
     if (cost_p.get_error().size()) {
       cpputil::Console::error(1) << "Error parsing cost function: " << cost_p.get_error() << std::endl;
     }
@@ -69,6 +135,7 @@ private:
 
     CostParser correct_p(correctness_arg.value(), st);
     auto correctness_fxn = correct_p.run();
+    owned_.push_back(correctness_fxn);
     if (correct_p.get_error().size()) {
       cpputil::Console::error(1) << "Error parsing correctness function: " << correct_p.get_error()
                                  << std::endl;
@@ -78,8 +145,8 @@ private:
     }
 
     (*cost_fxn).set_correctness(correctness_fxn)
-    .setup_test_sandbox(test_sb)
-    .setup_perf_sandbox(perf_sb);
+    .setup_test_sandbox(test_sb_)
+    .setup_perf_sandbox(perf_sb_);
     return cost_fxn;
   }
 
@@ -15,6 +15,7 @@
 #ifndef STOKE_TOOLS_GADGETS_OBLIGATION_CHECKER_H
 #define STOKE_TOOLS_GADGETS_OBLIGATION_CHECKER_H
 
+#include <fstream>
 #include <functional>
 #include <iostream>
 #include <ostream>
@@ -29,6 +30,7 @@
 #include "src/solver/smtsolver.h"
 #include "src/validator/demo_obligation_checker.h"
 #include "src/validator/obligation_checker.h"
+#include "src/validator/obligation_corpus.h"
 #include "src/validator/smt_obligation_checker.h"
 #include "src/validator/postgres_obligation_checker.h"
 #include "src/validator/filters/bound_away.h"
@@ -44,7 +46,8 @@ class ObligationCheckerGadget : public ObligationChecker {
 
 public:
 
-  ObligationCheckerGadget() : solver_(NULL), child_(NULL), handler_(NULL), filter_(NULL)
+  ObligationCheckerGadget() : solver_(NULL), child_(NULL), handler_(NULL), filter_(NULL),
+    record_file_(NULL), record_(NULL)
   {
     auto oc_type = obligation_checker_arg.value();
     if (oc_type == "smt" || oc_type == "postgres") {
@@ -84,9 +87,22 @@ public:
       set_nacl(true);
     if (fixpoint_up_arg.value())
       set_fixpoint_up(true);
+
+    if (record_obligations_arg.value() != "") {
+      record_file_ = new std::ofstream(record_obligations_arg.value(), std::ios::binary | std::ios::app);
+      if (!record_file_->good()) {
+        std::cerr << "Unable to open \"" << record_obligations_arg.value() << "\" for recording" << std::endl;
+        exit(1);
+      }
+      record_ = new ObligationCorpus(*record_file_);
+    }
   }
 
   ~ObligationCheckerGadget() {
+    if (record_)
+      delete record_;
+    if (record_file_)
+      delete record_file_;
     if (child_)
       delete child_;
     if (handler_)
@@ -127,6 +143,11 @@ public:
     return *this;
   }
 
+  ObligationChecker& set_priority(int priority) override {
+    child_->set_priority(priority);
+    return *this;
+  }
+
   /** Check.  This performs the requested obligation check, and depending on the implementation may
     choose to either:
       (1) block, call the callback (in the same thread/process), and then return; or
@@ -140,9 +161,28 @@ public:
                      Callback& callback,
                      bool override_separate_stack,
                      void* optional = NULL) override {
+    if (record_)
+      record_->append(target, rewrite, target_block, rewrite_block, p, q, assume, prove,
+                      testcases, override_separate_stack || !stack_out_arg.value());
     child_->check(target, rewrite, target_block, rewrite_block, p, q, assume, prove, testcases, callback, override_separate_stack, optional);
   }
 
+  /** Checks every claim for one edge in a single batch, recording them as one. */
+  virtual void check_all(const Cfg& target, const Cfg& rewrite,
+                         Cfg::id_type target_block, Cfg::id_type rewrite_block,
+                         const CfgPath& p, const CfgPath& q,
+                         std::shared_ptr<Invariant> assume,
+                         const std::vector<std::shared_ptr<Invariant>>& proves,
+                         const std::vector<std::pair<CpuState, CpuState>>& testcases,
+                         Callback& callback,
+                         bool override_separate_stack,
+                         const std::vector<void*>& optionals) override {
+    if (record_)
+      record_->append_all(target, rewrite, target_block, rewrite_block, p, q, assume, proves,
+                          testcases, override_separate_stack || !stack_out_arg.value());
+    child_->check_all(target, rewrite, target_block, rewrite_block, p, q, assume, proves, testcases, callback, override_separate_stack, optionals);
+  }
+
   /** Blocks until all the checking has done and the callbacks have been called. */
   virtual void block_until_complete() override {
     child_->block_until_complete();
@@ -186,6 +226,10 @@ private:
   Handler* handler_;
   Filter* filter_;
 
+  /** Where obligations are recorded, if anywhere. */
+  std::ofstream* record_file_;
+  ObligationCorpus* record_;
+
 };
 
 } //namespace stoke
@@ -29,6 +29,9 @@ public:
     Search(transform) {
     set_seed(seed);
     set_beta(beta_arg);
+    set_adapt_interval(adapt_interval_arg);
+    set_reorder_interval(reorder_interval_arg);
+    set_testcase_subset(testcase_subset_arg);
   }
 };
 
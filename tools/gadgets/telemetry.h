@@ -0,0 +1,58 @@
+// Copyright 2013-2019 Stanford University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef STOKE_TOOLS_GADGETS_TELEMETRY_H
+#define STOKE_TOOLS_GADGETS_TELEMETRY_H
+
+#include <fstream>
+
+#include "src/ext/cpputil/include/io/console.h"
+#include "src/telemetry/telemetry.h"
+#include "tools/args/telemetry.inc"
+
+namespace stoke {
+
+/** Writes out whatever telemetry was asked for when it goes out of scope. */
+class TelemetryGadget {
+public:
+  TelemetryGadget() {
+    if (telemetry_trace_arg.value() != "")
+      Telemetry::set_tracing(true);
+  }
+
+  ~TelemetryGadget() {
+    if (telemetry_arg.value() == "" && telemetry_trace_arg.value() == "")
+      return;
+
+    auto snapshot = Telemetry::snapshot();
+    if (telemetry_arg.value() != "") {
+      std::ofstream ofs(telemetry_arg.value());
+      if (ofs.good())
+        snapshot.write_json(ofs);
+      else
+        cpputil::Console::warn() << "Unable to write telemetry to " << telemetry_arg.value() << std::endl;
+    }
+    if (telemetry_trace_arg.value() != "") {
+      std::ofstream ofs(telemetry_trace_arg.value());
+      if (ofs.good())
+        snapshot.write_chrome_trace(ofs);
+      else
+        cpputil::Console::warn() << "Unable to write telemetry trace to " << telemetry_trace_arg.value() << std::endl;
+    }
+  }
+};
+
+} // namespace stoke
+
+#endif
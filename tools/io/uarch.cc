@@ -0,0 +1,55 @@
+// Copyright 2013-2019 Stanford University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <array>
+#include <string>
+#include <utility>
+
+#include "src/ext/cpputil/include/io/fail.h"
+#include "tools/io/generic.h"
+#include "tools/io/uarch.h"
+
+using namespace cpputil;
+using namespace std;
+using namespace stoke;
+
+namespace {
+
+array<pair<string, Uarch>, 4> us {{
+    {"native", Uarch::NATIVE},
+    {"nehalem", Uarch::NEHALEM},
+    {"sandybridge", Uarch::SANDYBRIDGE},
+    {"haswell", Uarch::HASWELL}
+  }
+};
+
+} // namespace
+
+namespace stoke {
+
+void UarchReader::operator()(std::istream& is, Uarch& u) {
+  string s;
+  is >> s;
+  if (!generic_read(us, s, u)) {
+    fail(is) << "Unrecognized microarchitecture \"" << s << "\"";
+  }
+}
+
+void UarchWriter::operator()(std::ostream& os, const Uarch u) {
+  string s;
+  generic_write(us, s, u);
+  os << s;
+}
+
+} // namespace stoke